@@ -14,6 +14,7 @@
 #include "word.h"
 #include "file.h"
 #include "pagedir.h"
+#include "htmlscan.h"
 #include "hashtable.h"
 #include "counters.h"
 
@@ -23,7 +24,14 @@ typedef struct index {
   int num_slots; 
 } index_t;
 
+// what index_page passes through webpage_scan to index_word
+typedef struct indexing {
+  index_t *index;
+  int docID;
+} indexing_t;
+
 // ************* Local Functions *************  //
+static void index_word(void *arg, const char *word, const size_t len);
 
 /**************** index_add() ****************/
 /* see index.h for description */
@@ -174,38 +182,57 @@ void index_build(const char* pageDir,index_t *index)
 {
     if (pageDir != NULL && index != NULL && page_validate(pageDir) ){
 
-        // open the crawler file to read
-        FILE *fp;
+        // view each saved page in turn, whatever the format, and scan
+        // its words where they lie, without copying the page
+        pageview_t *view = assertp(pageview_new(), "index_build");
         int ID= 1;
-        char crawlerFile[100];
-        sprintf(crawlerFile,"%s/%i", pageDir, ID);
-        fp = fopen(crawlerFile,"r");
-        while (fp != NULL){    
-            char *result;
-            int pos = 0;
-            // create webpage
-            webpage_t *page = page_load(pageDir, ID);
-            while ((result = webpage_getNextWord(page, &pos)) != NULL){
-                
-                // if word is larger than 3 characters
-                if(strlen(result) >=3 ){
-                    index_add(index, normalize_word(result), ID);
-                }
-                count_free(result);
-            }
+        while (page_view(pageDir, ID, view)){    
+            size_t length;
+            const char *html = pageview_html(view, &length);
+            indexing_t indexing = { index, ID };
+            htmlscan(html, length, &indexing, NULL, index_word);
             
-            // go to the next crawler file
-            webpage_delete(page);
-            fclose(fp);
+            // go to the next saved page
             ID++;
-            sprintf(crawlerFile,"%s/%i", pageDir, ID);
-            fp = fopen(crawlerFile,"r");
         }
+        pageview_delete(view);
 
         
     }
 }
 
+//adds the words of one page to the index
+void index_page(index_t *index, webpage_t *page, const int docID)
+{
+    if (index != NULL && page != NULL && webpage_getHTML(page) != NULL){
+        // add each of its words, found in one pass over the page
+        indexing_t indexing = { index, docID };
+        webpage_scan(page, &indexing, NULL, index_word);
+    }
+}
+
+//adds one word of a page being built into the index
+static void index_word(void *arg, const char *word, const size_t len)
+{
+    indexing_t *indexing = arg;
+
+    // if word is at least 3 characters
+    if (len >= 3){
+        // copy it to be normalized; most words fit on the stack
+        char buffer[64];
+        char *copy = (len < sizeof(buffer)) ? buffer 
+                                             : count_malloc(len + 1);
+        if (copy != NULL){
+            memcpy(copy, word, len);
+            copy[len] = '\0';
+            index_add(indexing->index, normalize_word(copy), indexing->docID);
+            if (copy != buffer){
+                count_free(copy);
+            }
+        }
+    }
+}
+
 //deletes
 void index_delete(index_t *index)
 {
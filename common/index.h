@@ -13,6 +13,7 @@
 #include <stdbool.h>
 #include "hashtable.h"
 #include "counters.h"
+#include "webpage.h"
 
 /**************** global types ****************/
 typedef struct index index_t;   // opaque to users of the module
@@ -141,6 +142,23 @@ index_t *index_load(char* indexFilename, index_t *index);
  */
 void index_build(const char* pageDir,index_t *index);
 
+/************* index_page **********************/
+/* Adds the words of one page to the index, as index_build does
+ * for each page it loads.
+ *
+ * Caller provides:
+ *   valid pointer to an index, a page with its html, and the
+ *   document ID under which to count its words.
+ * We do:
+ *   if index == NULL or the page has no html, do nothing
+ *   otherwise, add each word of at least 3 letters, normalized,
+ *   to the index under docID. The page is not changed.
+ * Notes:
+ *   The crawler calls this to index pages as it saves them,
+ *   rather than have the indexer load them again.
+ */
+void index_page(index_t *index, webpage_t *page, const int docID);
+
 /************* index_delete **********************/
 /* Delete index, calling helper function.
  *
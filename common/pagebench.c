@@ -0,0 +1,164 @@
+/*
+ * pagebench.c - benchmark for the formats of a pageDirectory
+ *
+ * usage: pagebench pageDirectory scratchDirectory [rounds]
+ *
+ * Copy the pages of pageDirectory (in any format) into three new
+ * directories under scratchDirectory, one in each format -- a file per
+ * page, segments, and compressed segments -- and for each print the
+ * bytes the pages take on disk, the best rates at which page_load reads
+ * them all back, and page_view goes through them all, over the given
+ * number of rounds (default 3), and the rate at which index_build
+ * indexes them, as the indexer does.  The
+ * pages are read from the page cache, so this measures the cost of
+ * reading, copying and decompressing, not of the disk.
+ *
+ * Antony Guzman, 2020
+ */
+
+#define _GNU_SOURCE       // clock_gettime
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "pagedir.h"
+#include "index.h"
+#include "webpage.h"
+
+/**************** local types ****************/
+static const char *formatName[] = { "files", "segments", "compressed" };
+
+/**************** local functions ****************/
+static long long dir_bytes(const char *dir);
+static double now_sec(void);
+
+/**************** main ****************/
+int
+main(int argc, char *argv[])
+{
+  int rounds = 3;
+  if (argc < 3 || argc > 4
+      || (argc > 3 && sscanf(argv[3], "%d", &rounds) != 1)
+      || rounds < 1) {
+    fprintf(stderr, "usage: %s pageDirectory scratchDirectory [rounds]\n",
+            argv[0]);
+    exit(1);
+  }
+  const char *source = argv[1];
+  int pages = pagedir_count(source);
+  if (pages == 0) {
+    fprintf(stderr, "%s: no pages in '%s'\n", argv[0], source);
+    exit(2);
+  }
+  long long html = 0;
+  for (int id = 1; id <= pages; id++) {
+    webpage_t *page = page_load(source, id);
+    html += strlen(webpage_getHTML(page));
+    webpage_delete(page);
+  }
+  printf("%d pages, %lld bytes of HTML, from %s\n", pages, html, source);
+  printf("%-10s %12s %9s %12s %12s %12s\n", "format", "bytes", "ratio",
+         "load pages/s", "view pages/s", "index pages/s");
+
+  for (pagedir_format_t format = PAGEDIR_FILES;
+       format <= PAGEDIR_COMPRESSED; format++) {
+    char dir[1024];
+    snprintf(dir, sizeof(dir), "%s/%s", argv[2], formatName[format]);
+    mkdir(dir, 0755);
+    if (!pagedir_init(dir) || !pagedir_create(dir, format)) {
+      fprintf(stderr, "%s: cannot write '%s'\n", argv[0], dir);
+      exit(3);
+    }
+    for (int id = 1; id <= pages; id++) {
+      webpage_t *page = page_load(source, id);
+      page_save(page, dir, id);
+      webpage_delete(page);
+    }
+    pagedir_close(dir);
+    long long bytes = dir_bytes(dir);
+
+    // each reader goes over the HTML once, as the least a user of it
+    // would, so the view's pages are read in as the load's are
+    double best = 0;
+    long long loaded = 0, viewed = 0;
+    for (int round = 0; round < rounds; round++) {
+      double start = now_sec();
+      for (int id = 1; id <= pages; id++) {
+        webpage_t *page = page_load(dir, id);
+        loaded += strlen(webpage_getHTML(page));
+        webpage_delete(page);
+      }
+      double elapsed = now_sec() - start;
+      if (round == 0 || elapsed < best) {
+        best = elapsed;
+      }
+    }
+
+    double bestView = 0;
+    pageview_t *view = pageview_new();
+    for (int round = 0; round < rounds; round++) {
+      double start = now_sec();
+      for (int id = 1; page_view(dir, id, view); id++) {
+        size_t length;
+        const char *html = pageview_html(view, &length);
+        const char *nul = memchr(html, '\0', length);
+        viewed += nul != NULL ? nul - html : length;
+      }
+      double elapsed = now_sec() - start;
+      if (round == 0 || elapsed < bestView) {
+        bestView = elapsed;
+      }
+    }
+    pageview_delete(view);
+    if (viewed != loaded) {
+      fprintf(stderr, "%s: page_view saw %lld bytes of HTML, page_load %lld\n",
+              argv[0], viewed, loaded);
+    }
+
+    double start = now_sec();
+    index_t *index = index_new(300);
+    index_build(dir, index);
+    index_delete(index);
+    double indexing = now_sec() - start;
+
+    printf("%-10s %12lld %8.1f%% %12.0f %12.0f %12.0f\n", formatName[format],
+           bytes, 100.0 * bytes / html, pages / best, pages / bestView,
+           pages / indexing);
+  }
+  return 0;
+}
+
+/**************** dir_bytes ****************/
+/* Return the total size of the files in dir, other than hidden ones. */
+static long long
+dir_bytes(const char *dir)
+{
+  DIR *d = opendir(dir);
+  if (d == NULL) {
+    return 0;
+  }
+  long long bytes = 0;
+  struct dirent *entry;
+  while ( (entry = readdir(d)) != NULL) {
+    char path[2048];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    if (entry->d_name[0] != '.' && stat(path, &st) == 0) {
+      bytes += st.st_size;
+    }
+  }
+  closedir(d);
+  return bytes;
+}
+
+/**************** now_sec ****************/
+static double
+now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
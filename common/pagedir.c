@@ -2,20 +2,196 @@
  * pagedir.c
  * Antony Guzman, Feb 2020
  * Provides functions that will be useful to crawler, indexer, and querier
+ *
+ * In PAGEDIR_SEGMENTS each page is stored just as a page file would be
+ * ("URL\ndepth\nhtml\n"), as one record in a data file.  Records are
+ * placed at 'global' offsets: the record at offset g is in the file
+ * 'segment.<g / SEGMENT>' at offset g % SEGMENT, and a record is not
+ * begun in one segment if it would run into the next (unless it begins
+ * a segment, in which case that file holds all of it).  The index is an
+ * array of fixed-size entries -- a record's global offset, length, and
+ * checksum -- where entry i is that of document i, with length 0 for
+ * none; entry 0 instead holds a magic string and the offset at which
+ * the next record goes.  Entries are written in this machine's byte
+ * order.  A page is appended, and its entry then overwritten, so a page
+ * saved again (by a recrawl) leaves its old record behind, unused.
+ *
+ * In PAGEDIR_COMPRESSED the records are gathered into blocks of about
+ * BLOCK bytes, and each block is compressed (see lz.h) and stored as
+ * one record would be.  A block begins with the number of records in it
+ * and their total length, then the start, length and checksum of each
+ * within the decompressed block, and then the compressed records.  The
+ * entry of a page gives the offset and length of its block, and the
+ * checksum of its record, by which it is found in the block; so loading
+ * one page decompresses only its own block.  The store keeps the last
+ * block it decompressed, so that loading the pages in order decompresses
+ * each block once.
+ *
+ * Several processes may save pages at once, as shards (pagedir_shard):
+ * shard n places its records from global offset n * SHARDSEGS * SEGMENT
+ * on, in segments no other shard writes, and only shard 0 writes the
+ * header.  Their entries, at different document IDs, are in different
+ * places in the index.
+ *
+ * Each pageDirectory in use has a 'store', holding its open files and
+ * the batch of records and entries not yet written; the stores are kept
+ * in a list, so that page_save and page_load can find them by name.
+ *
+ * Pages are read through views (page_view): a page file is mapped on
+ * its own, and a segment is mapped whole, SEGMENT bytes of address
+ * space, the first time a page in it is viewed, and stays mapped until
+ * the store is closed; so a record is read where it lies, in the page
+ * cache, and a mapping never moves under a view, however the file has
+ * grown since.  Only a record that is past what the segment held when
+ * last looked at is checked against the file's size again.  A view
+ * that goes from one page to the next asks the kernel to read READAHEAD
+ * bytes ahead of it.  A compressed record is decompressed into a buffer
+ * of the view's own.
  */
 
+#define _GNU_SOURCE       // pread, pwrite, madvise
+
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "pagedir.h"
 #include "webpage.h"
 #include "memory.h"
 #include "file.h"
+#include "lz.h"
 #include <string.h>
 
 /**************** file-local global variables ****************/
 static const char crawlerfile[] = ".crawler";
+static const char indexfile[] = "segment.index";
+static const char segmentprefix[] = "segment.";
+static const char magic[8] = { 't', 's', 'e', 's', 'e', 'g', 's', '1' };
+static const char magicz[8] = { 't', 's', 'e', 's', 'e', 'g', 'z', '1' };
+static const uint64_t SEGMENT = 1ULL << 30;   // bytes per data file
+static const size_t BATCH = 262144;           // bytes of records per write
+static const size_t BLOCK = 65536;            // bytes of records per block
+static const int SHARDSEGS = 1024;            // segments for each shard
+static const uint64_t READAHEAD = 1ULL << 21; // bytes to read ahead of a view
+
+/**************** file-local types ****************/
+typedef struct entry {
+  uint64_t offset;            // global offset of the record (or block)
+  uint32_t length;            // its length, or 0 if no such page
+  uint32_t check;             // FNV-1a hash of the record
+} entry_t;
+
+typedef struct header {
+  char magic[8];              // as above
+  uint64_t end;               // where the next record goes
+} header_t;
+
+typedef struct blockrec {
+  uint32_t start;             // where a record is in the block
+  uint32_t length;            // its length
+  uint32_t check;             // FNV-1a hash of it
+} blockrec_t;
+
+typedef struct blockhead {
+  uint32_t count;             // records in the block
+  uint32_t length;            // their total length
+} blockhead_t;
+
+typedef struct pending {
+  int id;                     // a document ID
+  entry_t entry;              // its new entry, not yet written
+} pending_t;
+
+typedef struct segmap {
+  char *data;                 // a segment, mapped whole, or NULL
+  uint64_t size;              // the size of its file, when last looked at
+} segmap_t;
+
+typedef struct store {
+  char *pageDirectory;
+  pagedir_format_t format;
+  pthread_mutex_t lock;       // guards the fields below
+  int indexfd;                // the index, or -1 for PAGEDIR_FILES
+  bool writable;              // was it opened for writing?
+  int *segfds;                // the data files opened so far, or -1
+  int nsegfds;
+  segmap_t *segmaps;          // ... and those mapped so far, for views
+  int nsegmaps;
+  uint64_t end;               // where the next record goes
+  int shard;                  // see pagedir_shard; 0 if not sharded
+  char *buf;                  // records not yet written, beginning...
+  uint64_t bufstart;          // ... at this global offset
+  size_t buflen, bufcap;
+  pending_t *pending;         // entries not yet written, the last of
+  int npending, pendingcap;   // which are those of the open block
+  char *block;                // the records of the open block
+  size_t blocklen, blockcap;
+  blockrec_t *recs;           // where they are in it
+  int nrecs, reccap;
+  bool cached;                // is there a block decompressed below?
+  uint64_t cacheoffset;       // the offset of that block
+  char *cache;                // its records
+  size_t cachelen, cachecap;
+  blockrec_t *cacherecs;      // where they are in it
+  uint32_t ncacherecs, cachereccap;
+  struct store *next;         // the next store in the list
+} store_t;
+
+/**************** global types ****************/
+typedef struct pageview {
+  const char *url;            // the spans of the page viewed
+  size_t urlLength;
+  int depth;
+  const char *html;
+  size_t htmlLength;
+  void *map;                  // its page file, mapped, or NULL
+  size_t mapLength;
+  char *copy;                 // its record, read or decompressed, or NULL
+  int lastID;                 // the page viewed last, or 0
+  uint64_t ahead;             // how far ahead of it we have read
+} pageview_t;
+
+static store_t *stores = NULL;                  // the stores in use
+static pthread_mutex_t storesLock = PTHREAD_MUTEX_INITIALIZER;
 
 /**************** file-local function prototypes ****************/
-/* none */
+static store_t *store_get(const char *pageDirectory);
+static store_t *store_open(const char *pageDirectory);
+static void store_close(store_t *s);
+static bool store_flush(store_t *s);
+static bool store_entry(store_t *s, const int id, entry_t *entry);
+static char *store_read(store_t *s, const int id, uint32_t *length);
+static int store_segment(store_t *s, const uint64_t offset);
+static void store_append(store_t *s, const int id, const webpage_t *page);
+static char *store_place(store_t *s, const size_t length, uint64_t *offset);
+static void store_seal(store_t *s);
+static bool store_write(store_t *s);
+static bool block_load(store_t *s, const int fd, const entry_t *entry);
+static char *block_find(store_t *s, const entry_t *entry,
+                        uint32_t *recordLength);
+static const char *store_map(store_t *s, const uint64_t offset,
+                             const uint32_t length);
+static void store_readahead(store_t *s, pageview_t *view,
+                            const uint64_t offset);
+static const char *file_map(const char *pageDir, const int ID,
+                            pageview_t *view, const bool sequential,
+                            size_t *length);
+static bool view_parse(pageview_t *view, const char *record,
+                       const size_t length);
+static void view_release(pageview_t *view);
+static bool remove_segments(const char *pageDirectory);
+static bool docname(const char *name, int *id, bool *temporary);
+static uint32_t fnv32(const char *data, const size_t length);
+static bool read_all(int fd, void *data, size_t n, off_t at);
+static bool write_all(int fd, const void *data, size_t n, off_t at);
 
 /**************** pagedir_init ****************/
 /* see pagedir.h for documentation */
@@ -58,11 +234,25 @@ page_save(const webpage_t *page, const char *pageDirectory, const int documentID
   assertp(webpage_getURL(page), "pagedir_save gets NULL url");
   assertp(webpage_getHTML(page), "pagedir_save gets NULL html");
 
+  store_t *s = store_get(pageDirectory);
+  if (s->format != PAGEDIR_FILES) {
+    pthread_mutex_lock(&s->lock);
+    if (!s->writable) {
+      assertp(NULL, "pagedir_save cannot write index");
+    }
+    store_append(s, documentID, page);
+    pthread_mutex_unlock(&s->lock);
+    return;
+  }
+
   // create filename string from page directory and document ID
   char *filename = assertp(malloc(strlen(pageDirectory)+12), "pagedir_save");
   sprintf(filename, "%s/%d", pageDirectory, documentID);
+  // write it under a temporary name, so it appears whole or not at all
+  char *tempname = assertp(malloc(strlen(filename)+2), "pagedir_save");
+  sprintf(tempname, "%s~", filename);
 
-  FILE *fp = fopen(filename, "w");
+  FILE *fp = fopen(tempname, "w");
   assertp(fp, "pagedir_save cannot open file for writing");
   
   fprintf(fp, "%s\n%d\n%s\n", 
@@ -70,7 +260,10 @@ page_save(const webpage_t *page, const char *pageDirectory, const int documentID
           webpage_getDepth(page), 
           webpage_getHTML(page));
 
-  fclose(fp);
+  if (fclose(fp) != 0 || rename(tempname, filename) != 0) {
+    assertp(NULL, "pagedir_save cannot write file");
+  }
+  free(tempname);
   free(filename);
 }
 
@@ -102,35 +295,1099 @@ bool page_validate(const char* pageDir)
 /*see pagedir.h for description */
 webpage_t* page_load(const char *pageDir, const int ID)
 {
-  FILE *fp;
-  char filename[100];
-  sprintf(filename,"%s/%i", pageDir, ID);
-  
-  if ((fp = fopen(filename, "r")) == NULL){
+  // copy the page out of a view, once, for the webpage to own
+  pageview_t view;
+  memset(&view, 0, sizeof(view));
+  webpage_t *page = NULL;
+  if (page_view(pageDir, ID, &view)) {
+    char *url = assertp(malloc(view.urlLength + 1), "page_load");
+    memcpy(url, view.url, view.urlLength);
+    url[view.urlLength] = '\0';
+    char *html = assertp(malloc(view.htmlLength + 1), "page_load");
+    memcpy(html, view.html, view.htmlLength);
+    html[view.htmlLength] = '\0';
+    page = webpage_new(url, view.depth, html);
+  }
+  view_release(&view);
+  return page;
+}
+
+/**************** page_loadURL() ****************/
+/* see pagedir.h for description */
+char *
+page_loadURL(const char *pageDir, const int ID)
+{
+  pageview_t view;
+  memset(&view, 0, sizeof(view));
+  char *url = NULL;
+  if (page_view(pageDir, ID, &view)) {
+    url = assertp(malloc(view.urlLength + 1), "page_loadURL");
+    memcpy(url, view.url, view.urlLength);
+    url[view.urlLength] = '\0';
+  }
+  view_release(&view);
+  return url;
+}
+
+/**************** pageview_new() ****************/
+/* see pagedir.h for description */
+pageview_t *
+pageview_new(void)
+{
+  return count_calloc(1, sizeof(pageview_t));
+}
+
+/**************** page_view() ****************/
+/* see pagedir.h for description */
+bool
+page_view(const char *pageDir, const int ID, pageview_t *view)
+{
+  if (pageDir == NULL || view == NULL) {
+    return false;
+  }
+  view_release(view);
+  bool sequential = (ID == view->lastID + 1);
+  view->lastID = ID;
+  store_t *s = store_get(pageDir);
+  if (s->format == PAGEDIR_FILES) {
+    size_t length;
+    const char *record = file_map(pageDir, ID, view, sequential, &length);
+    return record != NULL && view_parse(view, record, length);
+  }
+
+  // a record in a mapped segment is checked where it lies; any other is
+  // read (or decompressed), and checked, by store_read
+  pthread_mutex_lock(&s->lock);
+  entry_t entry;
+  const char *record = NULL;
+  uint32_t length = 0;
+  if (s->format == PAGEDIR_SEGMENTS && store_entry(s, ID, &entry)
+      && (record = store_map(s, entry.offset, entry.length)) != NULL) {
+    length = entry.length;
+    if (sequential) {
+      store_readahead(s, view, entry.offset);
+    }
+  } else if ( (view->copy = store_read(s, ID, &length)) != NULL) {
+    record = view->copy;
+  }
+  pthread_mutex_unlock(&s->lock);
+  if (record == NULL
+      || (view->copy == NULL && fnv32(record, length) != entry.check)) {
+    return false;
+  }
+  return view_parse(view, record, length);
+}
+
+/**************** pageview_url() ****************/
+/* see pagedir.h for description */
+const char *
+pageview_url(pageview_t *view, size_t *length)
+{
+  if (view == NULL || view->url == NULL) {
+    return NULL;
+  }
+  if (length != NULL) {
+    *length = view->urlLength;
+  }
+  return view->url;
+}
+
+/**************** pageview_depth() ****************/
+/* see pagedir.h for description */
+int
+pageview_depth(pageview_t *view)
+{
+  return view == NULL ? 0 : view->depth;
+}
+
+/**************** pageview_html() ****************/
+/* see pagedir.h for description */
+const char *
+pageview_html(pageview_t *view, size_t *length)
+{
+  if (view == NULL || view->html == NULL) {
+    return NULL;
+  }
+  if (length != NULL) {
+    *length = view->htmlLength;
+  }
+  return view->html;
+}
+
+/**************** pageview_delete() ****************/
+/* see pagedir.h for description */
+void
+pageview_delete(pageview_t *view)
+{
+  if (view != NULL) {
+    view_release(view);
+    count_free(view);
+  }
+}
+
+/**************** pagedir_create() ****************/
+/* see pagedir.h for description */
+bool
+pagedir_create(const char *pageDirectory, const pagedir_format_t format)
+{
+  if (pageDirectory == NULL) {
+    return false;
+  }
+  // forget the old store, and the old segments
+  pthread_mutex_lock(&storesLock);
+  for (store_t **sp = &stores; *sp != NULL; sp = &(*sp)->next) {
+    if (strcmp((*sp)->pageDirectory, pageDirectory) == 0) {
+      store_t *old = *sp;
+      *sp = old->next;
+      store_close(old);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&storesLock);
+  if (!remove_segments(pageDirectory)) {
+    return false;
+  }
+  if (format == PAGEDIR_FILES) {
+    return true;
+  }
+
+  char *filename = pagedir_pathname(pageDirectory, indexfile);
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  free(filename);
+  if (fd < 0) {
+    return false;
+  }
+  header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, format == PAGEDIR_COMPRESSED ? magicz : magic,
+         sizeof(header.magic));
+  header.end = 0;
+  bool ok = write_all(fd, &header, sizeof(header), 0);
+  return (close(fd) == 0) && ok;
+}
+
+/**************** pagedir_format() ****************/
+/* see pagedir.h for description */
+pagedir_format_t
+pagedir_format(const char *pageDirectory)
+{
+  return pageDirectory == NULL ? PAGEDIR_FILES
+                               : store_get(pageDirectory)->format;
+}
+
+/**************** pagedir_count() ****************/
+/* see pagedir.h for description */
+int
+pagedir_count(const char *pageDirectory)
+{
+  if (pageDirectory == NULL) {
+    return 0;
+  }
+  store_t *s = store_get(pageDirectory);
+  int count = 0;
+  if (s->format == PAGEDIR_FILES) {
+    char filename[100];
+    do {
+      snprintf(filename, sizeof(filename), "%s/%i", pageDirectory, ++count);
+    } while (access(filename, R_OK) == 0);
+  } else {
+    entry_t entry;
+    pthread_mutex_lock(&s->lock);
+    while (store_entry(s, ++count, &entry)) {
+    }
+    pthread_mutex_unlock(&s->lock);
+  }
+  return count - 1;
+}
+
+/**************** pagedir_recover() ****************/
+/* see pagedir.h for description */
+int
+pagedir_recover(const char *pageDirectory)
+{
+  if (pageDirectory == NULL) {
+    return -1;
+  }
+  store_t *s = store_get(pageDirectory);
+  if (s->format != PAGEDIR_FILES) {
+    // a page is in the index only once it has been written whole
+    pthread_mutex_lock(&s->lock);
+    struct stat st;
+    int max = -1;
+    if (store_flush(s) && fstat(s->indexfd, &st) == 0) {
+      max = st.st_size / sizeof(entry_t) - 1;
+      if (max < 0) {
+        max = 0;
+      }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return max;
+  }
+
+  DIR *dir = opendir(pageDirectory);
+  if (dir == NULL) {
+    return -1;
+  }
+  int max = 0;
+  struct dirent *entry;
+  while ( (entry = readdir(dir)) != NULL) {
+    int id;
+    bool temporary;
+    if (!docname(entry->d_name, &id, &temporary)) {
+      continue;
+    } else if (temporary) {
+      char *filename = pagedir_pathname(pageDirectory, entry->d_name);
+      unlink(filename);
+      free(filename);
+    } else if (id > max) {
+      max = id;
+    }
+  }
+  closedir(dir);
+  return max;
+}
+
+/**************** pagedir_move() ****************/
+/* see pagedir.h for description */
+bool
+pagedir_move(const char *pageDirectory, const int from, const int to)
+{
+  if (pageDirectory == NULL || from < 1 || to < 1) {
+    return false;
+  }
+  store_t *s = store_get(pageDirectory);
+  if (s->format == PAGEDIR_FILES) {
+    char fromname[100], toname[100];
+    snprintf(fromname, sizeof(fromname), "%s/%d", pageDirectory, from);
+    snprintf(toname, sizeof(toname), "%s/%d", pageDirectory, to);
+    return rename(fromname, toname) == 0;
+  }
+
+  pthread_mutex_lock(&s->lock);
+  entry_t entry, none;
+  memset(&none, 0, sizeof(none));
+  bool ok = s->writable && store_entry(s, from, &entry)
+    && write_all(s->indexfd, &entry, sizeof(entry), to * sizeof(entry_t))
+    && write_all(s->indexfd, &none, sizeof(none), from * sizeof(entry_t));
+  pthread_mutex_unlock(&s->lock);
+  return ok;
+}
+
+/**************** pagedir_shard() ****************/
+/* see pagedir.h for description */
+void
+pagedir_shard(const char *pageDirectory, const int shard)
+{
+  if (pageDirectory == NULL || shard < 0) {
+    return;
+  }
+  store_t *s = store_get(pageDirectory);
+  pthread_mutex_lock(&s->lock);
+  if (s->format != PAGEDIR_FILES && shard > 0) {
+    s->shard = shard;
+    s->end = (uint64_t)shard * SHARDSEGS * SEGMENT;
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+/**************** pagedir_compact() ****************/
+/* see pagedir.h for description */
+int
+pagedir_compact(const char *pageDirectory, const int maxID, int *newID)
+{
+  if (pageDirectory == NULL || maxID < 0) {
+    return -1;
+  }
+  store_t *s = store_get(pageDirectory);
+  bool *there = assertp(count_calloc(maxID + 2, sizeof(bool)),
+                        "pagedir_compact");
+  for (int id = 1; id <= maxID; id++) {
+    if (s->format == PAGEDIR_FILES) {
+      char filename[100];
+      snprintf(filename, sizeof(filename), "%s/%d", pageDirectory, id);
+      there[id] = access(filename, F_OK) == 0;
+    } else {
+      entry_t entry;
+      pthread_mutex_lock(&s->lock);
+      there[id] = store_entry(s, id, &entry);
+      pthread_mutex_unlock(&s->lock);
+    }
+    if (newID != NULL) {
+      newID[id] = there[id] ? id : 0;
+    }
+  }
+
+  // fill the lowest gap with the highest page, until they meet
+  int low = 1, high = maxID;
+  for (;;) {
+    while (low <= maxID && there[low]) {
+      low++;
+    }
+    while (high > 0 && !there[high]) {
+      high--;
+    }
+    if (low > high) {
+      break;
+    }
+    if (!pagedir_move(pageDirectory, high, low)) {
+      count_free(there);
+      return -1;
+    }
+    there[low] = true;
+    there[high] = false;
+    if (newID != NULL) {
+      newID[high] = low;
+    }
+  }
+  count_free(there);
+  return low - 1;
+}
+
+/**************** pagedir_flush() ****************/
+/* see pagedir.h for description */
+bool
+pagedir_flush(const char *pageDirectory)
+{
+  if (pageDirectory == NULL) {
+    return false;
+  }
+  store_t *s = store_get(pageDirectory);
+  pthread_mutex_lock(&s->lock);
+  bool ok = store_flush(s);
+  pthread_mutex_unlock(&s->lock);
+  return ok;
+}
+
+/**************** pagedir_close() ****************/
+/* see pagedir.h for description */
+bool
+pagedir_close(const char *pageDirectory)
+{
+  if (pageDirectory == NULL) {
+    return false;
+  }
+  store_t *s = NULL;
+  pthread_mutex_lock(&storesLock);
+  for (store_t **sp = &stores; *sp != NULL; sp = &(*sp)->next) {
+    if (strcmp((*sp)->pageDirectory, pageDirectory) == 0) {
+      s = *sp;
+      *sp = s->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&storesLock);
+  if (s == NULL) {
+    return true;
+  }
+  bool ok = store_flush(s);
+  store_close(s);
+  return ok;
+}
+
+/**************** store_get ****************/
+/* Return the store for pageDirectory, opening it if need be.  The store
+ * stays in the list, so the pointer is good until pagedir_close.
+ */
+static store_t *
+store_get(const char *pageDirectory)
+{
+  pthread_mutex_lock(&storesLock);
+  store_t *s;
+  for (s = stores; s != NULL; s = s->next) {
+    if (strcmp(s->pageDirectory, pageDirectory) == 0) {
+      break;
+    }
+  }
+  if (s == NULL) {
+    s = store_open(pageDirectory);
+    s->next = stores;
+    stores = s;
+  }
+  pthread_mutex_unlock(&storesLock);
+  return s;
+}
+
+/**************** store_open ****************/
+/* Make a store for pageDirectory: PAGEDIR_SEGMENTS or PAGEDIR_COMPRESSED
+ * if it has an index we can open, and PAGEDIR_FILES otherwise.
+ */
+static store_t *
+store_open(const char *pageDirectory)
+{
+  store_t *s = assertp(count_calloc(1, sizeof(store_t)), "store_open");
+  s->pageDirectory = assertp(count_malloc(strlen(pageDirectory) + 1),
+                             "store_open");
+  strcpy(s->pageDirectory, pageDirectory);
+  pthread_mutex_init(&s->lock, NULL);
+  s->format = PAGEDIR_FILES;
+  s->indexfd = -1;
+
+  char *filename = pagedir_pathname(pageDirectory, indexfile);
+  s->writable = true;
+  int fd = open(filename, O_RDWR);
+  if (fd < 0 && errno == EACCES) {
+    s->writable = false;
+    fd = open(filename, O_RDONLY);
+  }
+  free(filename);
+  header_t header;
+  if (fd >= 0 && read_all(fd, &header, sizeof(header), 0)
+      && (memcmp(header.magic, magic, sizeof(magic)) == 0
+          || memcmp(header.magic, magicz, sizeof(magicz)) == 0)) {
+    s->format = memcmp(header.magic, magic, sizeof(magic)) == 0
+      ? PAGEDIR_SEGMENTS : PAGEDIR_COMPRESSED;
+    s->indexfd = fd;
+    s->end = header.end;
+  } else if (fd >= 0) {
+    close(fd);
+  }
+  return s;
+}
+
+/**************** store_close ****************/
+/* Close the store's files and free it, dropping anything not written. */
+static void
+store_close(store_t *s)
+{
+  if (s->indexfd >= 0) {
+    close(s->indexfd);
+  }
+  for (int i = 0; i < s->nsegfds; i++) {
+    if (s->segfds[i] >= 0) {
+      close(s->segfds[i]);
+    }
+  }
+  for (int i = 0; i < s->nsegmaps; i++) {
+    if (s->segmaps[i].data != NULL) {
+      munmap(s->segmaps[i].data, SEGMENT);
+    }
+  }
+  pthread_mutex_destroy(&s->lock);
+  free(s->segfds);
+  free(s->segmaps);
+  free(s->buf);
+  free(s->pending);
+  free(s->block);
+  free(s->recs);
+  free(s->cache);
+  free(s->cacherecs);
+  count_free(s->pageDirectory);
+  count_free(s);
+}
+
+/**************** store_append ****************/
+/* Add page, as document id, to the batch of records to be written (or,
+ * in PAGEDIR_COMPRESSED, to the open block, sealing the block if it is
+ * now big enough), writing out the batch if it is now big enough.
+ * Caller holds s->lock.
+ */
+static void
+store_append(store_t *s, const int id, const webpage_t *page)
+{
+  const char *url = webpage_getURL(page);
+  const char *html = webpage_getHTML(page);
+  char depth[16];
+  int depthlen = sprintf(depth, "%d\n", webpage_getDepth(page));
+  size_t urllen = strlen(url), htmllen = strlen(html);
+  size_t length = urllen + 1 + depthlen + htmllen + 1;
+  if (length >= SEGMENT / 2) {
+    assertp(NULL, "pagedir_save gets page too big");
+  }
+
+  char *record;
+  uint64_t offset = 0;
+  if (s->format == PAGEDIR_COMPRESSED) {
+    if (s->blocklen + length > s->blockcap) {
+      s->blockcap = s->blocklen + length > 2 * BLOCK ? s->blocklen + length
+                                                     : 2 * BLOCK;
+      s->block = assertp(realloc(s->block, s->blockcap), "pagedir_save block");
+    }
+    record = s->block + s->blocklen;
+  } else {
+    record = store_place(s, length, &offset);
+  }
+  memcpy(record, url, urllen);
+  record[urllen] = '\n';
+  memcpy(record + urllen + 1, depth, depthlen);
+  memcpy(record + urllen + 1 + depthlen, html, htmllen);
+  record[length - 1] = '\n';
+
+  if (s->npending == s->pendingcap) {
+    s->pendingcap = s->pendingcap > 0 ? 2 * s->pendingcap : 64;
+    s->pending = assertp(realloc(s->pending, s->pendingcap * sizeof(pending_t)),
+                         "pagedir_save pending");
+  }
+  pending_t *p = &s->pending[s->npending++];
+  p->id = id;
+  p->entry.offset = offset;
+  p->entry.length = length;
+  p->entry.check = fnv32(record, length);
+
+  if (s->format == PAGEDIR_COMPRESSED) {
+    // the block's offset and length go in the entry when it is sealed
+    if (s->nrecs == s->reccap) {
+      s->reccap = s->reccap > 0 ? 2 * s->reccap : 64;
+      s->recs = assertp(realloc(s->recs, s->reccap * sizeof(blockrec_t)),
+                        "pagedir_save recs");
+    }
+    blockrec_t *r = &s->recs[s->nrecs++];
+    r->start = s->blocklen;
+    r->length = length;
+    r->check = p->entry.check;
+    s->blocklen += length;
+    if (s->blocklen >= BLOCK) {
+      store_seal(s);
+    }
+  }
+
+  if (s->buflen >= BATCH && !store_flush(s)) {
+    assertp(NULL, "pagedir_save cannot write segment");
+  }
+}
+
+/**************** store_place ****************/
+/* Make room in the batch for a record of 'length' bytes, writing out the
+ * batch's records first if the record can't follow on in it; set
+ * *offset to the global offset of the record, and return where in the
+ * batch to put it.  Caller holds s->lock.
+ */
+static char *
+store_place(store_t *s, const size_t length, uint64_t *offset)
+{
+  // a record lies all in one segment
+  *offset = s->end;
+  if (*offset % SEGMENT != 0 && *offset % SEGMENT + length > SEGMENT) {
+    *offset += SEGMENT - *offset % SEGMENT;
+  }
+  if (s->buflen > 0 && (*offset != s->bufstart + s->buflen
+                        || *offset / SEGMENT != s->bufstart / SEGMENT
+                        || s->buflen + length > BATCH)
+      && !store_write(s)) {
+    assertp(NULL, "pagedir_save cannot write segment");
+  }
+  if (s->buflen == 0) {
+    s->bufstart = *offset;
+  }
+
+  if (s->buflen + length > s->bufcap) {
+    s->bufcap = s->buflen + length > BATCH ? s->buflen + length : BATCH;
+    s->buf = assertp(realloc(s->buf, s->bufcap), "pagedir_save buffer");
+  }
+  char *record = s->buf + s->buflen;
+  s->buflen += length;
+  s->end = *offset + length;
+  return record;
+}
+
+/**************** store_seal ****************/
+/* Compress the open block into the batch, and give its offset and
+ * length to the entries of its records.  Caller holds s->lock.
+ */
+static void
+store_seal(store_t *s)
+{
+  if (s->nrecs == 0) {
+    return;
+  }
+  blockhead_t head = { s->nrecs, s->blocklen };
+  size_t headlen = sizeof(head) + s->nrecs * sizeof(blockrec_t);
+  size_t bound = headlen + lz_bound(s->blocklen);
+  uint64_t offset;
+  char *block = store_place(s, bound, &offset);
+  memcpy(block, &head, sizeof(head));
+  memcpy(block + sizeof(head), s->recs, s->nrecs * sizeof(blockrec_t));
+  size_t length = headlen + lz_compress(s->block, s->blocklen,
+                                        block + headlen, bound - headlen);
+  // give back what the compression saved
+  s->buflen -= bound - length;
+  s->end -= bound - length;
+
+  for (int i = s->npending - s->nrecs; i < s->npending; i++) {
+    s->pending[i].entry.offset = offset;
+    s->pending[i].entry.length = length;
+  }
+  s->blocklen = 0;
+  s->nrecs = 0;
+}
+
+/**************** store_flush ****************/
+/* Write out the batch: first the records (sealing any open block), then
+ * the header (unless we are a shard > 0), then the entries, a run of
+ * consecutive IDs at a time, so that the index never points at a record
+ * not yet written, nor the header before a record already in use.
+ * Return false if any write fails.  Caller holds s->lock.
+ */
+static bool
+store_flush(store_t *s)
+{
+  if (s->format == PAGEDIR_FILES || s->npending == 0) {
+    return true;
+  }
+  store_seal(s);
+  bool ok = store_write(s);
+  header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, s->format == PAGEDIR_COMPRESSED ? magicz : magic,
+         sizeof(header.magic));
+  header.end = s->end;
+  if (s->shard == 0) {
+    ok = ok && write_all(s->indexfd, &header, sizeof(header), 0);
+  }
+
+  entry_t *entries = assertp(count_malloc(s->npending * sizeof(entry_t)),
+                             "store_flush");
+  for (int i = 0; ok && i < s->npending; ) {
+    int n = 0;
+    do {
+      entries[n] = s->pending[i + n].entry;
+      n++;
+    } while (i + n < s->npending
+             && s->pending[i + n].id == s->pending[i].id + n);
+    ok = write_all(s->indexfd, entries, n * sizeof(entry_t),
+                   (off_t)s->pending[i].id * sizeof(entry_t));
+    i += n;
+  }
+  count_free(entries);
+
+  s->npending = 0;
+  return ok;
+}
+
+/**************** store_write ****************/
+/* Write out the records in the batch, with one write.  Return false if
+ * it fails.  Caller holds s->lock.
+ */
+static bool
+store_write(store_t *s)
+{
+  if (s->buflen == 0) {
+    return true;
+  }
+  int fd = store_segment(s, s->bufstart);
+  bool ok = fd >= 0
+    && write_all(fd, s->buf, s->buflen, s->bufstart % SEGMENT);
+  s->buflen = 0;
+  return ok;
+}
+
+/**************** store_entry ****************/
+/* Set *entry to that of page id, writing out the batch first if the
+ * page is in it.  Return false if there is no such page.  Caller holds
+ * s->lock.
+ */
+static bool
+store_entry(store_t *s, const int id, entry_t *entry)
+{
+  if (id < 1) {
+    return false;
+  }
+  for (int i = s->npending - 1; i >= 0; i--) {
+    if (s->pending[i].id == id) {
+      if (!store_flush(s)) {
+        return false;
+      }
+      break;
+    }
+  }
+  return read_all(s->indexfd, entry, sizeof(entry_t),
+                  (off_t)id * sizeof(entry_t))
+    && entry->length > 0;
+}
+
+/**************** store_read ****************/
+/* Read the record of page id, with one read of its entry and one of the
+ * record (or of its block, which is then decompressed), and return it in
+ * a new string (ending in an extra '\0') after checking it against its
+ * entry; set *length to its length.  Return NULL if there is no such
+ * page, or it can't be read whole.  Caller holds s->lock.
+ */
+static char *
+store_read(store_t *s, const int id, uint32_t *length)
+{
+  entry_t entry;
+  if (!store_entry(s, id, &entry)) {
+    return NULL;
+  }
+  int fd = store_segment(s, entry.offset);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (s->format == PAGEDIR_COMPRESSED) {
+    if (!(s->cached && s->cacheoffset == entry.offset)
+        && !block_load(s, fd, &entry)) {
       return NULL;
+    }
+    return block_find(s, &entry, length);
+  }
+  char *record = assertp(count_malloc(entry.length + 1), "store_read");
+  if (!read_all(fd, record, entry.length, entry.offset % SEGMENT)) {
+    count_free(record);
+    return NULL;
   }
+  if (fnv32(record, entry.length) != entry.check) {
+    count_free(record);
+    return NULL;
+  }
+  record[entry.length] = '\0';
+  *length = entry.length;
+  return record;
+}
 
-  // first line should be the URL	
-  char *url = freadlinep(fp);
-  char *copyURL = malloc(strlen(url) +1);
-  strcpy(copyURL,url);
+/**************** block_load ****************/
+/* Read the block that entry points into, from fd, and decompress it into
+ * the store's cache.  Return false if it can't be read, or is damaged.
+ * Caller holds s->lock.
+ */
+static bool
+block_load(store_t *s, const int fd, const entry_t *entry)
+{
+  s->cached = false;
+  blockhead_t head;
+  if (entry->length < sizeof(head)) {
+    return false;
+  }
+  char *block = assertp(count_malloc(entry->length), "block_load");
+  if (!read_all(fd, block, entry->length, entry->offset % SEGMENT)) {
+    count_free(block);
+    return false;
+  }
+  memcpy(&head, block, sizeof(head));
+  if (head.count == 0 || head.count > (entry->length - sizeof(head))
+                                      / sizeof(blockrec_t)) {
+    count_free(block);
+    return false;
+  }
+  size_t headlen = sizeof(head) + head.count * sizeof(blockrec_t);
 
-  // second line is depth
-  char *second_line = freadlinep(fp);
+  if (head.count > s->cachereccap) {
+    s->cachereccap = head.count;
+    s->cacherecs = assertp(realloc(s->cacherecs,
+                                   head.count * sizeof(blockrec_t)),
+                           "block_load");
+  }
+  memcpy(s->cacherecs, block + sizeof(head), head.count * sizeof(blockrec_t));
+  s->ncacherecs = head.count;
+  if (head.length + 1 > s->cachecap) {
+    s->cachecap = head.length + 1;
+    s->cache = assertp(realloc(s->cache, s->cachecap), "block_load");
+  }
+  s->cached = lz_decompress(block + headlen, entry->length - headlen,
+                            s->cache, head.length);
+  s->cachelen = head.length;
+  s->cacheoffset = entry->offset;
+  count_free(block);
+  return s->cached;
+}
 
-  int depth = atoi(second_line);
-  //everthing else is HMTL
-  char *html = freadfilep(fp);
-  char *copy = malloc(strlen(html) +1);
-  strcpy(copy,html);
-  webpage_t *page = webpage_new(copyURL, depth, copy);
-  
-  //clean up
-  count_free(url);
-  count_free(second_line);
-  count_free(html);
-  fclose(fp);
+/**************** block_find ****************/
+/* Return a copy of the record in the cached block with the checksum in
+ * 'entry', as store_read does; NULL if it is not there.  Caller holds
+ * s->lock.
+ */
+static char *
+block_find(store_t *s, const entry_t *entry, uint32_t *recordLength)
+{
+  for (uint32_t i = 0; i < s->ncacherecs; i++) {
+    blockrec_t *r = &s->cacherecs[i];
+    if (r->check == entry->check && r->start <= s->cachelen
+        && r->length <= s->cachelen - r->start
+        && fnv32(s->cache + r->start, r->length) == r->check) {
+      char *record = assertp(count_malloc(r->length + 1), "block_find");
+      memcpy(record, s->cache + r->start, r->length);
+      record[r->length] = '\0';
+      *recordLength = r->length;
+      return record;
+    }
+  }
+  return NULL;
+}
 
- return page;
-}	
+/**************** store_segment ****************/
+/* Return a descriptor of the data file holding global offset 'offset',
+ * opening (or, for writing, creating) it if need be; -1 on error.
+ * Caller holds s->lock.
+ */
+static int
+store_segment(store_t *s, const uint64_t offset)
+{
+  int n = offset / SEGMENT;
+  if (n >= s->nsegfds) {
+    s->segfds = assertp(realloc(s->segfds, (n + 1) * sizeof(int)),
+                        "store_segment");
+    for (int i = s->nsegfds; i <= n; i++) {
+      s->segfds[i] = -1;
+    }
+    s->nsegfds = n + 1;
+  }
+  if (s->segfds[n] < 0) {
+    char name[32];
+    sprintf(name, "%s%d", segmentprefix, n);
+    char *filename = pagedir_pathname(s->pageDirectory, name);
+    s->segfds[n] = s->writable ? open(filename, O_RDWR | O_CREAT, 0644)
+                               : open(filename, O_RDONLY);
+    free(filename);
+  }
+  return s->segfds[n];
+}
 
+/**************** store_map ****************/
+/* Return where the 'length' bytes at global offset 'offset' are, in the
+ * mapping of their segment, mapping it first if need be; NULL if they
+ * are not all in the file, or it can't be mapped.  Caller holds s->lock.
+ */
+static const char *
+store_map(store_t *s, const uint64_t offset, const uint32_t length)
+{
+  uint64_t end = offset % SEGMENT + length;
+  int fd = store_segment(s, offset);
+  if (fd < 0 || end > SEGMENT) {
+    return NULL;              // a record too big for a mapping; read it
+  }
+  int n = offset / SEGMENT;
+  if (n >= s->nsegmaps) {
+    s->segmaps = assertp(realloc(s->segmaps, (n + 1) * sizeof(segmap_t)),
+                         "store_map");
+    memset(&s->segmaps[s->nsegmaps], 0,
+           (n + 1 - s->nsegmaps) * sizeof(segmap_t));
+    s->nsegmaps = n + 1;
+  }
+  segmap_t *map = &s->segmaps[n];
+  if (end > map->size) {
+    // past the end of the file, as it was: touching it would be fatal
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < end) {
+      return NULL;
+    }
+    map->size = st.st_size;
+  }
+  if (map->data == NULL) {
+    void *data = mmap(NULL, SEGMENT, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      return NULL;
+    }
+    map->data = data;
+  }
+  return map->data + offset % SEGMENT;
+}
+
+/**************** store_readahead ****************/
+/* A view has come to the record at global offset 'offset', from the page
+ * before it: unless that is more than half of READAHEAD short of where
+ * it last asked the kernel to read to, ask it to read the next READAHEAD
+ * bytes (or to the end of the segment) from there.  Caller holds
+ * s->lock, and has just mapped that segment.
+ */
+static void
+store_readahead(store_t *s, pageview_t *view, const uint64_t offset)
+{
+  if (offset < view->ahead && view->ahead - offset > READAHEAD / 2) {
+    return;                   // far enough ahead already
+  }
+  uint64_t page = sysconf(_SC_PAGESIZE);
+  uint64_t start = offset % SEGMENT / page * page;
+  uint64_t length = start + READAHEAD > SEGMENT ? SEGMENT - start
+                                                : READAHEAD;
+  madvise(s->segmaps[offset / SEGMENT].data + start, length, MADV_WILLNEED);
+  view->ahead = offset - offset % SEGMENT + start + length;
+}
+
+/**************** file_map ****************/
+/* Map page ID's own file in pageDir into the view, and return it, with
+ * its length in *length; NULL if there is none, or it is empty.  If the
+ * view has come from the page before, have the kernel read it all now.
+ */
+static const char *
+file_map(const char *pageDir, const int ID, pageview_t *view,
+         const bool sequential, size_t *length)
+{
+  char filename[100];
+  snprintf(filename, sizeof(filename), "%s/%i", pageDir, ID);
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  if (sequential) {
+    madvise(map, st.st_size, MADV_WILLNEED);
+  }
+  view->map = map;
+  view->mapLength = *length = st.st_size;
+  return map;
+}
+
+/**************** view_parse ****************/
+/* Point the view at the URL, depth and HTML of a record, laid out as by
+ * page_save; false if it is not one.  The HTML keeps the newline after
+ * it, as page_load always has.  The record need not be null-terminated.
+ */
+static bool
+view_parse(pageview_t *view, const char *record, const size_t length)
+{
+  const char *end = record + length;
+  const char *urlend = memchr(record, '\n', length);
+  if (urlend == NULL) {
+    return false;
+  }
+  const char *p = urlend + 1;
+  int depth = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    depth = 10 * depth + (*p++ - '0');
+  }
+  const char *html = memchr(p, '\n', end - p);
+  if (html == NULL) {
+    return false;
+  }
+  html++;
+
+  view->url = record;
+  view->urlLength = urlend - record;
+  view->depth = depth;
+  view->html = html;
+  view->htmlLength = end - html;
+  return true;
+}
+
+/**************** view_release ****************/
+/* Let go of the page the view holds, if any, leaving it empty. */
+static void
+view_release(pageview_t *view)
+{
+  if (view->map != NULL) {
+    munmap(view->map, view->mapLength);
+  }
+  if (view->copy != NULL) {
+    count_free(view->copy);
+  }
+  view->map = NULL;
+  view->mapLength = 0;
+  view->copy = NULL;
+  view->url = view->html = NULL;
+  view->urlLength = view->htmlLength = 0;
+  view->depth = 0;
+}
+
+/**************** remove_segments ****************/
+/* Remove the index and data files from pageDirectory; false on error. */
+static bool
+remove_segments(const char *pageDirectory)
+{
+  DIR *dir = opendir(pageDirectory);
+  if (dir == NULL) {
+    return false;
+  }
+  bool ok = true;
+  size_t prefixlen = strlen(segmentprefix);
+  struct dirent *entry;
+  while ( (entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, segmentprefix, prefixlen) == 0) {
+      char *filename = pagedir_pathname(pageDirectory, entry->d_name);
+      if (unlink(filename) != 0 && errno != ENOENT) {
+        ok = false;
+      }
+      free(filename);
+    }
+  }
+  closedir(dir);
+  return ok;
+}
+
+/**************** docname ****************/
+/* If name is that of a saved page -- a document ID, with no leading
+ * zeros -- or of one being saved -- the same with a '~' after it --
+ * set *id and *temporary accordingly and return true.
+ */
+static bool
+docname(const char *name, int *id, bool *temporary)
+{
+  if (name[0] < '1' || name[0] > '9') {
+    return false;
+  }
+  long value = 0;
+  const char *p;
+  for (p = name; *p >= '0' && *p <= '9'; p++) {
+    value = value * 10 + (*p - '0');
+    if (value > 1000000000L) {
+      return false;
+    }
+  }
+  if (*p == '~' && p[1] == '\0') {
+    *temporary = true;
+  } else if (*p == '\0') {
+    *temporary = false;
+  } else {
+    return false;
+  }
+  *id = value;
+  return true;
+}
+
+/**************** pagedir_pathname ****************/
+/* see pagedir.h for documentation */
+char *
+pagedir_pathname(const char *pageDirectory, const char *name)
+{
+  char *path = assertp(malloc(strlen(pageDirectory) + strlen(name) + 2),
+                       "pagedir pathname");
+  sprintf(path, "%s/%s", pageDirectory, name);
+  return path;
+}
+
+/**************** fnv32 ****************/
+/* The 32-bit FNV-1a hash of data. */
+static uint32_t
+fnv32(const char *data, const size_t length)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+/**************** read_all ****************/
+/* Read n bytes at offset 'at' of fd; false if they aren't all there. */
+static bool
+read_all(int fd, void *data, size_t n, off_t at)
+{
+  char *p = data;
+  while (n > 0) {
+    ssize_t got = pread(fd, p, n, at);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    } else if (got <= 0) {
+      return false;
+    }
+    p += got;
+    n -= got;
+    at += got;
+  }
+  return true;
+}
+
+/**************** write_all ****************/
+/* Write n bytes at offset 'at' of fd; false on error. */
+static bool
+write_all(int fd, const void *data, size_t n, off_t at)
+{
+  const char *p = data;
+  while (n > 0) {
+    ssize_t put = pwrite(fd, p, n, at);
+    if (put < 0 && errno == EINTR) {
+      continue;
+    } else if (put < 0) {
+      return false;
+    }
+    p += put;
+    n -= put;
+    at += put;
+  }
+  return true;
+}
@@ -2,12 +2,38 @@
  * pagedir.h
  * Antony Guzman, Feb 2020
  * A header file for pagedir.c, listing the functions for use in TSE
+ *
+ * A pageDirectory holds the pages the crawler saved, numbered by
+ * document ID 1, 2, 3, ..., in one of two formats:
+ *   PAGEDIR_FILES     one file per page, named by its document ID (the
+ *                     original layout, still read and written);
+ *   PAGEDIR_SEGMENTS  the pages appended to a few large data files,
+ *                     'segment.0', 'segment.1', ..., with the file
+ *                     'segment.index' giving each page's place in them;
+ *   PAGEDIR_COMPRESSED  the same, but with the pages compressed in
+ *                     blocks of about 64KB, so that loading a page
+ *                     decompresses only the block it is in.
+ * The functions below read and write any of them, choosing by whether
+ * 'segment.index' is present, and what it says.  With segments,
+ * page_save gathers pages in memory and writes them in batches;
+ * pagedir_flush or pagedir_close writes out the last batch.  Pages may be saved and
+ * loaded by several threads at once.
  */
 
+#ifndef __PAGEDIR_H
+#define __PAGEDIR_H
 
 #include <stdio.h>
+#include <stdbool.h>
 #include "webpage.h"
 
+/**************** global types ****************/
+typedef enum {
+  PAGEDIR_FILES, PAGEDIR_SEGMENTS, PAGEDIR_COMPRESSED
+} pagedir_format_t;
+
+typedef struct pageview pageview_t;  // opaque; see page_view
+
 /**************** Functions ****************/
 /**************** pagedir_init ****************/
 /* pagedir_init - set up the pageDirectory.
@@ -28,7 +54,9 @@ bool pagedir_init(const char *pageDirectory);
  *   otherwise, save the URL of a page as the first line of the file
  *   the depth of the page as the second line
  *   and the rest is the HMTL of the webpage
- *   the filename will be the ID configured by crawler
+ *   the filename will be the ID configured by crawler;
+ *   the file is written as 'ID~' and then renamed, so that a crawl
+ *   killed part way through never leaves a partly written page.
  *    
  */
 void 
@@ -57,10 +85,128 @@ bool page_validate(const char* pageDir);
  * , valid integer.
  * We do:
  *   if pageDir is NULL, return false
- *   otherwise, open the file and retrieve the URL, 
- *   depth, and HTML and put them as the parameters for a new
- *   webapge. 
+ *   otherwise, view the page (see page_view) and copy the URL,
+ *   depth, and HTML, once, into a new webpage.
  *   Clean up afterwards
  *    
  */
 webpage_t* page_load(const char *pageDir, const int ID);
+
+/**************** page_loadURL ****************/
+/* Return just the URL of page ID in pageDir, in a new string the caller
+ * must free, or NULL if there is no such page.
+ */
+char *page_loadURL(const char *pageDir, const int ID);
+
+/**************** pageview_new ****************/
+/* Return a new, empty view of a page, for page_view; NULL if error.
+ * Caller is responsible for later calling pageview_delete.
+ */
+pageview_t *pageview_new(void);
+
+/**************** page_view ****************/
+/* Let 'view' see page ID in pageDir where it lies, with nothing copied:
+ * its URL, depth and HTML, read-only, and not null-terminated, good
+ * until the view is given another page or deleted (or pageDir closed).
+ * Reuse one view to go through the pages in order, and the pages ahead
+ * are read before they are wanted.
+ *
+ * Caller provides:
+ *   valid pageDir, ID, and a view from pageview_new.
+ * We return:
+ *   true if the view now holds page ID; false, and the view empty, if
+ *   there is no such page, or it can't be read.
+ */
+bool page_view(const char *pageDir, const int ID, pageview_t *view);
+
+/**************** pageview_url ****************/
+/* Return the URL of the page viewed, setting *length (if not NULL) to
+ * its length; NULL if none.
+ */
+const char *pageview_url(pageview_t *view, size_t *length);
+
+/**************** pageview_depth ****************/
+/* Return the depth of the page viewed. */
+int pageview_depth(pageview_t *view);
+
+/**************** pageview_html ****************/
+/* Return the HTML of the page viewed, setting *length (if not NULL) to
+ * its length; NULL if none.
+ */
+const char *pageview_html(pageview_t *view, size_t *length);
+
+/**************** pageview_delete ****************/
+/* Let go of any page the view holds, and free it.  Ignores NULL. */
+void pageview_delete(pageview_t *view);
+
+/**************** pagedir_create ****************/
+/* Start a new, empty set of pages in pageDirectory, in the given format.
+ * Any segments and index there are removed.  (Files of pages are left,
+ * to be overwritten by page_save as before; but with PAGEDIR_SEGMENTS
+ * they are no longer read.)
+ * Returns false if the segment index can't be created.
+ */
+bool pagedir_create(const char *pageDirectory, const pagedir_format_t format);
+
+/**************** pagedir_format ****************/
+/* Return the format of the pages in pageDirectory. */
+pagedir_format_t pagedir_format(const char *pageDirectory);
+
+/**************** pagedir_count ****************/
+/* Return the number of pages numbered 1, 2, 3, ... in pageDirectory,
+ * up to the first missing.
+ */
+int pagedir_count(const char *pageDirectory);
+
+/**************** pagedir_recover ****************/
+/* Tidy up pageDirectory after a crawler was killed: remove any page
+ * left half-written.  Return the highest document ID that might have
+ * a page (there may be gaps below it), or -1 if pageDirectory can't be
+ * read.
+ */
+int pagedir_recover(const char *pageDirectory);
+
+/**************** pagedir_move ****************/
+/* Renumber page 'from' as 'to', which must not exist.
+ * Returns false if that fails.
+ */
+bool pagedir_move(const char *pageDirectory, const int from, const int to);
+
+/**************** pagedir_shard ****************/
+/* Let this process save pages in pageDirectory while other processes
+ * do too, as shard 'shard' (>= 0) of a crawl split among processes,
+ * each saving under document IDs of its own.  With segments, shard 0
+ * writes segments as usual, and shard n > 0 writes segments of its
+ * own, numbered from n * 1024, leaving the header of the index to
+ * shard 0.  Call before this process saves any page, in a
+ * pageDirectory set up by pagedir_create.  No effect on PAGEDIR_FILES.
+ */
+void pagedir_shard(const char *pageDirectory, const int shard);
+
+/**************** pagedir_compact ****************/
+/* Close the gaps among the pages in pageDirectory, numbered from 1 up
+ * to at most maxID, by moving the highest into the lowest gaps, so that
+ * they are numbered 1, 2, 3, ... as index_build expects.
+ * If newID is not NULL (an array of maxID + 1), we set newID[id] to the
+ * new ID of each page id, and to 0 where there is no page.
+ * Returns the number of pages, or -1 if one can't be moved.
+ */
+int pagedir_compact(const char *pageDirectory, const int maxID, int *newID);
+
+/**************** pagedir_flush ****************/
+/* Write out any pages page_save has not yet written to pageDirectory.
+ * Returns false if they could not be written.
+ */
+bool pagedir_flush(const char *pageDirectory);
+
+/**************** pagedir_close ****************/
+/* As pagedir_flush, and then close pageDirectory's files, which are
+ * reopened if it is used again.
+ */
+bool pagedir_close(const char *pageDirectory);
+
+/**************** pagedir_pathname ****************/
+/* Return "pageDirectory/name", in a new string the caller must free. */
+char *pagedir_pathname(const char *pageDirectory, const char *name);
+
+#endif // __PAGEDIR_H
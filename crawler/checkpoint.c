@@ -0,0 +1,342 @@
+/*
+ * checkpoint.c - the crawler's 'checkpoint' module
+ *
+ * see checkpoint.h for more information.
+ *
+ * The checkpoint is a text file, one item per line:
+ *   the line "tse checkpoint 2";
+ *   the seed URL; maxDepth; the last document ID handed out;
+ *   the number of URLs seen, then their fingerprints (see seenset.h),
+ *   in hexadecimal;
+ *   the number of URLs waiting, then each as its depth, a space, and
+ *   the URL;
+ *   the line "end".
+ * A checkpoint of version 1, which lists the URLs seen themselves, can
+ * still be resumed.
+ *
+ * Antony Guzman, 2020
+ */
+
+#define _GNU_SOURCE       // syncfs
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "checkpoint.h"
+#include "hashtable.h"
+#include "seenset.h"
+#include "frontier.h"
+#include "politeness.h"
+#include "webpage.h"
+#include "pagedir.h"
+#include "bag.h"
+#include "file.h"
+#include "memory.h"
+
+/**************** file-local global variables ****************/
+static const char checkpointFile[] = ".checkpoint";
+static const char magic[] = "tse checkpoint 2";
+static const char magic1[] = "tse checkpoint 1";   // URLs, not fingerprints
+static const int DONE_SLOTS = 200;        // hashtable slots for replayed URLs
+
+/**************** local types ****************/
+/* What replay passes through webpage_scan to replay_link. */
+typedef struct replayed {
+  seenset_t *seen;            // URLs seen
+  bag_t *found;               // pages for those first seen here
+  int depth;                  // their depth
+} replayed_t;
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static void save_seen(void *arg, const uint64_t fingerprint);
+static void save_page(void *arg, webpage_t *page);
+static void save_url(void *arg, const char *url, const int depth);
+static int replay(const char *pageDirectory, const int after,
+                  const int maxDepth, seenset_t *seen, hashtable_t *done,
+                  bag_t *found);
+static void replay_link(void *arg, char *url);
+static bool read_int(FILE *fp, int *value);
+static bool read_long(FILE *fp, long *value);
+
+/**************** checkpoint_save() ****************/
+/* see checkpoint.h for description */
+bool
+checkpoint_save(const char *pageDirectory, const char *seedURL,
+                const int maxDepth, const int documentID,
+                seenset_t *seen, frontier_t *frontier, politeness_t *sched)
+{
+  if (pageDirectory == NULL || seedURL == NULL || seen == NULL) {
+    return false;
+  }
+  int dirfd = open(pageDirectory, O_RDONLY | O_DIRECTORY);
+  if (dirfd < 0) {
+    return false;
+  }
+  // the pages the checkpoint counts as saved must be on disk before it
+  if (!pagedir_flush(pageDirectory)) {
+    close(dirfd);
+    return false;
+  }
+  syncfs(dirfd);
+
+  char *filename = pagedir_pathname(pageDirectory, checkpointFile);
+  char *newname = assertp(malloc(strlen(filename) + 2), "checkpoint_save");
+  sprintf(newname, "%s~", filename);
+  FILE *fp = fopen(newname, "w");
+  bool ok = (fp != NULL);
+  if (ok) {
+    fprintf(fp, "%s\n%s\n%d\n%d\n%ld\n",
+            magic, seedURL, maxDepth, documentID, seenset_size(seen));
+    ok = seenset_iterate(seen, fp, save_seen);
+    fprintf(fp, "%ld\n", frontier_size(frontier) + politeness_size(sched));
+    politeness_iterate(sched, fp, save_page);
+    ok = frontier_iterate(frontier, fp, save_url) && ok;
+    fprintf(fp, "end\n");
+    ok = ok && fflush(fp) == 0 && !ferror(fp) && fsync(fileno(fp)) == 0;
+    ok = (fclose(fp) == 0) && ok;
+  }
+  // replace the old checkpoint only once the new one is complete
+  if (ok && rename(newname, filename) == 0) {
+    fsync(dirfd);
+  } else {
+    unlink(newname);
+    ok = false;
+  }
+
+  close(dirfd);
+  free(newname);
+  free(filename);
+  return ok;
+}
+
+/**************** checkpoint_resume() ****************/
+/* see checkpoint.h for description */
+int
+checkpoint_resume(const char *pageDirectory, const char *seedURL,
+                  const int maxDepth, seenset_t *seen,
+                  frontier_t *frontier, int (*priority)(const char *url))
+{
+  if (pageDirectory == NULL || seedURL == NULL || seen == NULL
+      || frontier == NULL || priority == NULL) {
+    return -1;
+  }
+  char *filename = pagedir_pathname(pageDirectory, checkpointFile);
+  FILE *fp = fopen(filename, "r");
+  int documentID = 0;
+  bool ok = true;
+
+  if (fp == NULL) {
+    if (errno != ENOENT) {
+      fprintf(stderr, "%s: cannot read checkpoint\n", filename);
+      free(filename);
+      return -1;
+    }
+    // no checkpoint yet: the crawl begins with the seed
+    seenset_insert(seen, seedURL);
+  } else {
+    // check that it is a checkpoint of this crawl, then read the seen set
+    char *line = freadlinep(fp);
+    bool urls = (line != NULL && strcmp(line, magic1) == 0);
+    ok = (line != NULL && (urls || strcmp(line, magic) == 0));
+    if (line != NULL) free(line);
+    char *seed = ok ? freadlinep(fp) : NULL;
+    int depth;
+    long nseen = 0;
+    ok = ok && seed != NULL && read_int(fp, &depth)
+      && read_int(fp, &documentID) && read_long(fp, &nseen);
+    if (ok && (strcmp(seed, seedURL) != 0 || depth != maxDepth)) {
+      fprintf(stderr, "%s: checkpoint is of a crawl from '%s' to depth %d\n",
+              filename, seed, depth);
+      free(seed);
+      fclose(fp);
+      free(filename);
+      return -1;
+    }
+    if (seed != NULL) free(seed);
+    for (long i = 0; ok && i < nseen; i++) {
+      ok = (line = freadlinep(fp)) != NULL;
+      if (ok) {
+        uint64_t fingerprint;
+        char excess;
+        if (urls) {
+          seenset_insert(seen, line);
+        } else if (sscanf(line, "%" SCNx64 "%c", &fingerprint, &excess) == 1) {
+          seenset_add(seen, fingerprint);
+        } else {
+          ok = false;
+        }
+        free(line);
+      }
+    }
+  }
+
+  // find the links in the pages saved since, noting those pages as done
+  hashtable_t *done = assertp(hashtable_new(DONE_SLOTS), "checkpoint done");
+  bag_t *found = assertp(bag_new(), "checkpoint found");
+  int last = ok ? replay(pageDirectory, documentID, maxDepth,
+                         seen, done, found) : -1;
+  ok = ok && last >= 0;
+
+  // what was waiting at the checkpoint, less what has been done since
+  if (fp == NULL) {
+    if (ok && hashtable_find(done, seedURL) == NULL) {
+      frontier_insert(frontier, seedURL, 0, (*priority)(seedURL));
+    }
+  } else {
+    long npending = 0;
+    ok = ok && read_long(fp, &npending);
+    for (long i = 0; ok && i < npending; i++) {
+      char *line = freadlinep(fp);
+      int depth, offset;
+      ok = (line != NULL && sscanf(line, "%d %n", &depth, &offset) == 1);
+      if (ok && hashtable_find(done, line + offset) == NULL) {
+        frontier_insert(frontier, line + offset, depth,
+                        (*priority)(line + offset));
+      }
+      if (line != NULL) free(line);
+    }
+    char *line = ok ? freadlinep(fp) : NULL;
+    ok = ok && line != NULL && strcmp(line, "end") == 0;
+    if (line != NULL) free(line);
+    fclose(fp);
+  }
+
+  // ... plus what those pages link to
+  webpage_t *page;
+  while ( (page = bag_extract(found)) != NULL) {
+    const char *url = webpage_getURL(page);
+    if (ok && hashtable_find(done, url) == NULL) {
+      frontier_insert(frontier, url, webpage_getDepth(page),
+                      (*priority)(url));
+    }
+    webpage_delete(page);
+  }
+
+  if (!ok) {
+    fprintf(stderr, "%s: checkpoint or saved pages unreadable\n", filename);
+  }
+  bag_delete(found, NULL);
+  hashtable_delete(done, NULL);
+  free(filename);
+  return ok ? last : -1;
+}
+
+/**************** checkpoint_remove() ****************/
+/* see checkpoint.h for description */
+void
+checkpoint_remove(const char *pageDirectory)
+{
+  if (pageDirectory != NULL) {
+    char *filename = pagedir_pathname(pageDirectory, checkpointFile);
+    unlink(filename);
+    free(filename);
+  }
+}
+
+/**************** replay ****************/
+/* Go through the pages saved with IDs after 'after', in order, closing
+ * any gaps in their numbering.  Add each page's URL to 'done' (and
+ * 'seen'); if the page is shallower than maxDepth, add each internal
+ * link not yet seen to 'seen', and a page for it, one level deeper, to
+ * 'found'.  Also remove any page left half-saved.  Return the last
+ * document ID in use, or -1 on error.
+ */
+static int
+replay(const char *pageDirectory, const int after, const int maxDepth,
+       seenset_t *seen, hashtable_t *done, bag_t *found)
+{
+  int max = pagedir_recover(pageDirectory);
+  if (max < 0) {
+    return -1;
+  }
+
+  int last = after;
+  for (int id = after + 1; id <= max; id++) {
+    webpage_t *page = page_load(pageDirectory, id);
+    if (page == NULL) {
+      continue;
+    }
+    last++;
+    if (id != last && !pagedir_move(pageDirectory, id, last)) {
+      // a page was lost, and this one can't be moved down to keep the
+      // IDs dense
+      webpage_delete(page);
+      last = -1;
+      break;
+    }
+    hashtable_insert(done, webpage_getURL(page), "done");
+    seenset_insert(seen, webpage_getURL(page));
+    if (webpage_getDepth(page) < maxDepth) {
+      replayed_t replayed = { seen, found, webpage_getDepth(page) + 1 };
+      webpage_scan(page, &replayed, replay_link, NULL);
+    }
+    webpage_delete(page);
+  }
+  return last;
+}
+
+/**************** replay_link ****************/
+/* Add a page for url to the pages found by replay, if it is internal
+ * and not yet seen.
+ */
+static void
+replay_link(void *arg, char *url)
+{
+  replayed_t *replayed = arg;
+  if (IsInternalURL(url) && seenset_insert(replayed->seen, url)) {
+    webpage_t *link = webpage_newCopy(url, replayed->depth);
+    bag_insert(replayed->found, assertp(link, "replay link"));
+  }
+}
+
+/**************** save_seen ****************/
+static void
+save_seen(void *arg, const uint64_t fingerprint)
+{
+  fprintf(arg, "%016" PRIx64 "\n", fingerprint);
+}
+
+/**************** save_page ****************/
+static void
+save_page(void *arg, webpage_t *page)
+{
+  save_url(arg, webpage_getURL(page), webpage_getDepth(page));
+}
+
+/**************** save_url ****************/
+static void
+save_url(void *arg, const char *url, const int depth)
+{
+  fprintf(arg, "%d %s\n", depth, url);
+}
+
+/**************** read_int ****************/
+/* Read a line holding just an integer. */
+static bool
+read_int(FILE *fp, int *value)
+{
+  long v;
+  if (!read_long(fp, &v) || v < -2147483647L || v > 2147483647L) {
+    return false;
+  }
+  *value = v;
+  return true;
+}
+
+/**************** read_long ****************/
+static bool
+read_long(FILE *fp, long *value)
+{
+  char *line = freadlinep(fp);
+  char excess;
+  bool ok = (line != NULL && sscanf(line, "%ld%c", value, &excess) == 1);
+  if (line != NULL) {
+    free(line);
+  }
+  return ok;
+}
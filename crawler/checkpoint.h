@@ -0,0 +1,77 @@
+/*
+ * checkpoint.h - header file for the crawler's 'checkpoint' module
+ *
+ * A checkpoint records a crawl in progress, in the file '.checkpoint'
+ * in the pageDirectory, next to the '.crawler' marker: the seed URL and
+ * maxDepth, the last document ID handed out, the fingerprint of every
+ * URL seen, and every URL (with its depth) still waiting to be crawled.  The crawler writes
+ * one only when no page is being fetched, so those agree with the pages
+ * saved so far.  Each checkpoint is written to a new file, flushed to
+ * disk with the pages saved before it, and then renamed over the old
+ * one, so a crawl killed at any moment leaves either the old checkpoint
+ * or the new one, never a mix of the two.
+ *
+ * Resuming reads the checkpoint back and then 'replays' the pages saved
+ * after it: they are not fetched again, but their links are found as if
+ * they had just been crawled.
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __CHECKPOINT_H
+#define __CHECKPOINT_H
+
+#include <stdbool.h>
+#include "seenset.h"
+#include "frontier.h"
+#include "politeness.h"
+
+/**************** functions ****************/
+
+/**************** checkpoint_save ****************/
+/* Write a checkpoint of the crawl to pageDirectory/.checkpoint.
+ *
+ * Caller provides:
+ *   the crawl's pageDirectory, seedURL and maxDepth; the last document
+ *   ID handed out; the set of URLs seen; and the pages waiting to
+ *   be crawled, in the frontier and in the politeness scheduler.
+ *   No page may be in the middle of being crawled.
+ * We return:
+ *   true if the checkpoint was written; false, leaving the previous
+ *   checkpoint (if any) in place, if not.
+ */
+bool checkpoint_save(const char *pageDirectory, const char *seedURL,
+                     const int maxDepth, const int documentID,
+                     seenset_t *seen, frontier_t *frontier,
+                     politeness_t *sched);
+
+/**************** checkpoint_resume ****************/
+/* Restore a crawl from pageDirectory/.checkpoint, if there is one, or
+ * from the seed alone if not; then replay the pages saved since.
+ *
+ * Caller provides:
+ *   the crawl's pageDirectory, seedURL and maxDepth, which must match
+ *   the checkpoint's; an empty set of URLs seen and an empty
+ *   frontier, which we fill; and the function that gives a URL its
+ *   priority in the frontier.
+ * We return:
+ *   the last document ID used by a saved page, so the crawl can carry
+ *   on from the next; or -1, with a message on stderr, if the
+ *   checkpoint cannot be read or is for another crawl.
+ * Notes:
+ *   A page saved after the checkpoint is not put back in the frontier,
+ *   but the links in it are.  If some pages were lost, so that the
+ *   saved documents are not numbered 1, 2, 3, ..., we renumber the
+ *   ones that follow to close the gap.
+ */
+int checkpoint_resume(const char *pageDirectory, const char *seedURL,
+                      const int maxDepth, seenset_t *seen,
+                      frontier_t *frontier, int (*priority)(const char *url));
+
+/**************** checkpoint_remove ****************/
+/* Remove pageDirectory/.checkpoint, if any, so that a later resume
+ * starts over from the seed.
+ */
+void checkpoint_remove(const char *pageDirectory);
+
+#endif // __CHECKPOINT_H
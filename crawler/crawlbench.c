@@ -0,0 +1,252 @@
+/*
+ * crawlbench.c - benchmark for the crawler, against a local sitesrv
+ *
+ * usage: crawlbench [-p PORT] [-n PAGES] [-f FANOUT] [-s BYTES] [-l MS]
+ *                   [-e PCT] pageDirectory maxDepth [crawler option ...]
+ *
+ * Start ./sitesrv on 127.0.0.1:PORT (default 8050) with the site options
+ * given (see sitesrv.c), then run ./crawler, with the crawler options
+ * given, to crawl the site from its page 0 into pageDirectory, to
+ * maxDepth.  The crawler is given a hosts file (-H) that sends
+ * old-www.cs.dartmouth.edu to the server, and a file for its metrics
+ * (-F).  When it exits, stop the server and print the pages the crawler
+ * fetched and how fast, and the CPU time and peak memory the crawler
+ * used, as the kernel counts them for the crawler's process alone (the
+ * server's are not included).  For a crawl split among shards (-K),
+ * the pages are summed over the shards, and the CPU time too, but the
+ * peak memory is that of the largest process.
+ *
+ * Antony Guzman, 2020
+ */
+
+#define _GNU_SOURCE       // clock_gettime, wait4
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/**************** file-local global variables ****************/
+#define MAXSHARDS 64      // as the crawler's -K
+
+/**************** local functions ****************/
+static bool server_up(const int port);
+static long metric(const char *line, const char *name);
+static double now_sec(void);
+
+/**************** main ****************/
+int
+main(int argc, char *argv[])
+{
+  // the server's arguments: ours, less the page directory and depth
+  char *server[2 * 6 + 2] = { "./sitesrv" };
+  int nserver = 1;
+  int port = 8050;
+  bool portGiven = false;
+  char excess;
+  int opt;
+  while ((opt = getopt(argc, argv, "+p:n:f:s:l:e:")) != -1) {
+    if (opt == '?' || (opt == 'p' && (sscanf(optarg, "%d%c", &port, &excess)
+                                      != 1 || port < 1 || port > 65535))) {
+      nserver = 0;
+      break;
+    }
+    portGiven = portGiven || opt == 'p';
+    server[nserver++] = opt == 'p' ? "-p" : opt == 'n' ? "-n"
+                        : opt == 'f' ? "-f" : opt == 's' ? "-s"
+                        : opt == 'l' ? "-l" : "-e";
+    server[nserver++] = optarg;
+    if (nserver > 2 * 6) {
+      nserver = 0;              // an option given more than once
+      break;
+    }
+  }
+  if (nserver == 0 || argc - optind < 2) {
+    fprintf(stderr, "usage: %s [-p PORT] [-n PAGES] [-f FANOUT] [-s BYTES] "
+            "[-l MS] [-e PCT] pageDirectory maxDepth [crawler option ...]\n",
+            argv[0]);
+    exit(1);
+  }
+  char portString[16];
+  sprintf(portString, "%d", port);
+  if (!portGiven) {
+    server[nserver++] = "-p";
+    server[nserver++] = portString;
+  }
+  server[nserver] = NULL;
+  char *pageDirectory = argv[optind];
+  char *maxDepth = argv[optind + 1];
+  int ncrawlerOpts = argc - optind - 2;
+
+  // a hosts file pointing the crawler at the server, and a metrics file
+  char hosts[] = "/tmp/crawlbench.hosts.XXXXXX";
+  char metrics[] = "/tmp/crawlbench.metrics.XXXXXX";
+  int hostsfd = mkstemp(hosts);
+  int metricsfd = mkstemp(metrics);
+  const char *line = "127.0.0.1 old-www.cs.dartmouth.edu\n";
+  if (hostsfd < 0 || metricsfd < 0
+      || write(hostsfd, line, strlen(line)) != (ssize_t)strlen(line)) {
+    fprintf(stderr, "%s: cannot write temporary files\n", argv[0]);
+    exit(2);
+  }
+  close(hostsfd);
+  close(metricsfd);
+
+  if (server_up(port)) {
+    fprintf(stderr, "%s: something is already serving port %d\n",
+            argv[0], port);
+    unlink(hosts);
+    unlink(metrics);
+    exit(3);
+  }
+  pid_t serverPid = fork();
+  if (serverPid == 0) {
+    execv(server[0], server);
+    fprintf(stderr, "%s: cannot run %s\n", argv[0], server[0]);
+    _exit(127);
+  }
+  bool up = false;
+  for (int i = 0; i < 200 && serverPid > 0 && !up; i++) {
+    struct timespec wait = { 0, 25000000 };
+    nanosleep(&wait, NULL);
+    if (waitpid(serverPid, NULL, WNOHANG) != 0) {
+      serverPid = -1;           // it has exited
+    } else {
+      up = server_up(port);
+    }
+  }
+  if (!up) {
+    fprintf(stderr, "%s: sitesrv did not start\n", argv[0]);
+    if (serverPid > 0) {
+      kill(serverPid, SIGTERM);
+      waitpid(serverPid, NULL, 0);
+    }
+    unlink(hosts);
+    unlink(metrics);
+    exit(4);
+  }
+
+  // ./crawler -H hosts -F metrics [options] seed pageDirectory maxDepth
+  char seed[128];
+  sprintf(seed, "http://old-www.cs.dartmouth.edu:%d/bench/0.html", port);
+  char **crawler = calloc(ncrawlerOpts + 9, sizeof(char *));
+  int ncrawler = 0;
+  crawler[ncrawler++] = "./crawler";
+  crawler[ncrawler++] = "-H";
+  crawler[ncrawler++] = hosts;
+  crawler[ncrawler++] = "-F";
+  crawler[ncrawler++] = metrics;
+  for (int i = 0; i < ncrawlerOpts; i++) {
+    crawler[ncrawler++] = argv[optind + 2 + i];
+  }
+  crawler[ncrawler++] = seed;
+  crawler[ncrawler++] = pageDirectory;
+  crawler[ncrawler++] = maxDepth;
+  crawler[ncrawler] = NULL;
+
+  double start = now_sec();
+  pid_t crawlerPid = fork();
+  if (crawlerPid == 0) {
+    execv(crawler[0], crawler);
+    fprintf(stderr, "%s: cannot run %s\n", argv[0], crawler[0]);
+    _exit(127);
+  }
+  int status = -1;
+  struct rusage usage;
+  memset(&usage, 0, sizeof(usage));
+  if (crawlerPid > 0) {
+    wait4(crawlerPid, &status, 0, &usage);
+  }
+  double seconds = now_sec() - start;
+  kill(serverPid, SIGTERM);
+  waitpid(serverPid, NULL, 0);
+  free(crawler);
+
+  // the last line of the metrics holds the totals; of each shard's,
+  // with shards, which label their lines
+  static char last[MAXSHARDS + 1][4096];
+  char buf[4096];
+  FILE *fp = fopen(metrics, "r");
+  while (fp != NULL && fgets(buf, sizeof(buf), fp) != NULL) {
+    long shard = metric(buf, "shard");
+    if (shard >= 0 && shard < MAXSHARDS) {
+      strcpy(last[strstr(buf, "\"shard\":") != NULL ? shard + 1 : 0], buf);
+    }
+  }
+  if (fp != NULL) {
+    fclose(fp);
+  }
+  unlink(hosts);
+  unlink(metrics);
+  if (crawlerPid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s: the crawler failed\n", argv[0]);
+    exit(5);
+  }
+
+  long fetched = 0, failed = 0, bytes = 0;
+  for (int i = 0; i <= MAXSHARDS; i++) {
+    fetched += metric(last[i], "fetched");
+    failed += metric(last[i], "failed");
+    bytes += metric(last[i], "bytes");
+  }
+  double user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+  double sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+  printf("crawlbench: %ld pages fetched (%ld failed), %.1f MB, in %.2fs: "
+         "%.1f pages/s\n", fetched, failed, bytes / 1e6, seconds,
+         seconds > 0 ? fetched / seconds : 0.0);
+  printf("crawlbench: cpu %.2fs user + %.2fs system, %.0f%% of one core; "
+         "peak memory %.1f MB\n", user, sys,
+         seconds > 0 ? 100 * (user + sys) / seconds : 0.0,
+         usage.ru_maxrss / 1024.0);
+  exit(0);
+}
+
+/**************** server_up ****************/
+/* Return true if something accepts connections on 127.0.0.1:port. */
+static bool
+server_up(const int port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bool up = fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+  if (fd >= 0) {
+    close(fd);
+  }
+  return up;
+}
+
+/**************** metric ****************/
+/* The value of the named counter in a line of the crawler's metrics,
+ * or 0 if it is not there.
+ */
+static long
+metric(const char *line, const char *name)
+{
+  char key[64];
+  snprintf(key, sizeof(key), "\"%s\":", name);
+  const char *p = strstr(line, key);
+  return p != NULL ? atol(p + strlen(key)) : 0;
+}
+
+/**************** now_sec ****************/
+/* The time now, in seconds, on a clock that only goes forward. */
+static double
+now_sec(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
@@ -10,7 +10,71 @@
  * Arg 2: The directory that you want to put the output file in. It must have already been created and must be writeable.
  * Arg 3: The depth that you wish to crawl to. This depth must non-negative
  *
- * Command line options: None
+ * Command line options:
+ *   -j N, --jobs=N   crawl with a pool of N worker threads (default 1).
+ *   -a N, --async=N  crawl from one thread with up to N fetches in flight.
+ *   -k, --keepalive  reuse HTTP connections between fetches from one host.
+ *   -P N, --pipeline=N  send up to N requests at once on a kept-alive 
+ *                    connection (implies -k).
+ *   -d MS, --delay=MS  wait at least MS milliseconds between requests to
+ *                    any one host (default 1000).
+ *   -b N, --burst=N  let a host that has been idle take up to N requests
+ *                    without waiting (default 1).
+ *   -H FILE, --hosts=FILE  resolve hostnames listed in FILE (in /etc/hosts
+ *                    format) without asking the system resolver.
+ *   -p, --prefetch   resolve the hosts of newly found URLs in the
+ *                    background, before they are fetched.
+ *   -o ORDER, --order=ORDER  crawl in 'bfs' (default), 'dfs', or 
+ *                    'priority' (fewest path segments first) order.
+ *   -m MB, --memory=MB  keep at most MB megabytes of URLs waiting to be
+ *                    crawled in memory, spilling the rest to disk.
+ *   -s MB, --seen=MB  keep at most MB megabytes of the set of URLs seen
+ *                    in memory, spilling the rest to disk.
+ *   -c SEC, --checkpoint=SEC  checkpoint the crawl every SEC seconds
+ *                    (default 60; 0 for never).
+ *   -r, --resume     carry on a crawl from its last checkpoint, without
+ *                    fetching again the pages already saved.
+ *   -R, --recrawl    crawl again into a pageDirectory that holds an
+ *                    earlier crawl, fetching and rewriting only the pages
+ *                    that have changed.
+ *   -D MODE, --dedup=MODE  do not save a page that is a copy of one
+ *                    already saved: 'exact' copies only, or 'near'
+ *                    copies too.
+ *   -L, --legacy     save each page in a file of its own, rather than
+ *                    appending them to segments (a resumed or repeated
+ *                    crawl keeps the format it began with).
+ *   -z, --compress   compress the segments, in blocks of pages.
+ *   -S N, --stages=N  save pages, and scan them for links, in threads of
+ *                    their own, while the fetchers carry on; at most N
+ *                    pages wait for each of those stages.
+ *   -M SEC, --metrics=SEC  write the crawl's counters, gauges and timings,
+ *                    as a line of JSON, every SEC seconds and at the end.
+ *   -F FILE, --metrics-file=FILE  append those lines to FILE rather than
+ *                    writing them to stderr (every 10 seconds, without -M).
+ *   -I FILE, --index=FILE  index the pages as they are saved, in a thread
+ *                    of its own, and write the index to FILE at the end,
+ *                    as the indexer would (not with -R).
+ *   -K N, --shards=N  split the crawl among N processes, each crawling
+ *                    the URLs whose hash falls to it, with the delay
+ *                    between requests to a host multiplied by N; the
+ *                    pages are numbered 1, 2, 3, ... at the end, and
+ *                    any index built then.  No checkpoints; not with
+ *                    -r, -R or -D.
+ *   -A FILE, --archive=FILE  append every fetch, with its response and
+ *                    timing, to the archive FILE.
+ *   -Y FILE, --replay=FILE  take every fetch from the archive FILE
+ *                    rather than the network, each taking as long as it
+ *                    did when recorded.
+ *   -f, --fast       with -Y, take no time over the fetches at all.
+ *   -T C,I,T, --timeouts=C,I,T  give up on a connect after C milliseconds,
+ *                    on a server that sends nothing for I, and on a
+ *                    fetch after T in all (default 10000,30000,60000;
+ *                    0 for no limit).  A host that fails to answer
+ *                    several times in a row is given a rest.
+ *   -B KB, --max-page=KB  read no page longer than KB kilobytes
+ *                    (default 16384; 0 for no limit), nor any that is
+ *                    not HTML; such pages are refused as soon as their
+ *                    headers, or too many of their bytes, arrive.
  *
  * Output: This program outputs file to the provided directory. These files, labeled 1,2,3,etc, contain the url of
  * the page crawled, the depth at which it was crawled, and the html curled from that url.
@@ -19,24 +83,171 @@
  * be opened, or if memory is not allocated properly.
  */
 
+#define _GNU_SOURCE       // getopt_long
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
 #include "webpage.h"
+#include "http.h"
 #include "pagedir.h"
-#include "bag.h"
-#include "hashtable.h"
 #include "memory.h"
+#include "fetchq.h"
+#include "connpool.h"
+#include "politeness.h"
+#include "dnscache.h"
+#include "frontier.h"
+#include "seenset.h"
+#include "checkpoint.h"
+#include "recrawl.h"
+#include "dedup.h"
+#include "stageq.h"
+#include "metrics.h"
+#include "index.h"
+#include "shard.h"
+#include "archive.h"
+
 /**************** file-local global variables ****************/
 static const int maxMaxDepth = 10;
+static const int maxJobs = 64;
+static const int maxShards = 64;
+static const int maxInflight = 4096;
+static const int maxPipeline = 64;
+static const int maxDelay = 60000;
+static const int maxTimeout = 3600000;      // ms
+static const int maxPage = 1048576;         // KB
+static const int maxBurst = 1000;
+static const int maxMemory = 65536;         // MB
+static const int maxCheckpoint = 86400;     // seconds
+static const int maxStageq = 4096;
+static const int stagePoll = 10;            // ms; see crawl_async
+static const int maxMetrics = 86400;        // seconds
+static const int defaultMetrics = 10;       // seconds
+static const int indexQueue = 64;           // pages waiting to be indexed
+static const int indexSlots = 300;          // as the indexer's index
+static const int extraWindow = 256;         // see crawl_next
+
+/**************** local types ****************/
+/* The state shared by all crawler workers.  Everything below the
+ * 'lock' comment is guarded by the mutex.  A worker that finds no page
+ * ready to crawl waits on 'more' until another worker inserts a page,
+ * the last busy worker finishes (at which point the crawl is over), or
+ * the next host becomes ready.  A page taken to crawl stays 'active'
+ * until it has been saved and scanned, which with stages is done by
+ * other threads than the one that fetched it.  In a shard, a worker
+ * that finds the crawl over tells the coordinator it is idle, and
+ * waits on 'more' for URLs from other shards, or to be told to stop.
+ */
+typedef struct crawl {
+  char *seedURL;              // where the crawl began
+  char *pageDirectory;        // where page_save puts the pages
+  int maxDepth;               // do not scan pages at this depth
+  int checkpoint;             // seconds between checkpoints, or 0
+  connpool_t *pool;           // kept-alive connections, or NULL
+  int pipeline;               // pages a worker fetches at once
+  bool prefetch;              // prefetch hostnames of new pages?
+  recrawl_t *recrawl;         // validators and pages of earlier crawls
+  dedup_t *dedup;             // fingerprints of the pages saved, or NULL
+  stageq_t *saveq;            // fetched pages waiting to be saved, or NULL
+  stageq_t *scanq;            // saved pages waiting to be scanned
+  metrics_t *metrics;         // counters and timings, or NULL
+  stageq_t *indexq;           // copies of pages to index, or NULL
+  index_t *index;             // the index they go into
+  shard_t *shard;             // this process's shard, or NULL
+  int idStep;                 // between the document IDs handed out
+  pthread_mutex_t lock;       // guards the fields below
+  pthread_cond_t more;        // signalled when pages added or a worker idles
+  frontier_t *frontier;       // URLs not yet crawled, in crawl order
+  politeness_t *pages_to_crawl; // the next few of them, by host
+  int window;                 // how many to keep in pages_to_crawl
+  seenset_t *pages_seen;      // URLs already queued to crawl
+  int documentID;             // last document ID handed out
+  int active;                 // pages taken and not yet done with
+  long received;              // URLs taken in from other shards
+  bool idle;                  // have we said we are idle, since?
+  bool stopped;               // has the coordinator said stop?
+  time_t lastCheckpoint;      // when the last checkpoint was written
+} crawl_t;
+
+/* The command-line options, beyond the three required arguments. */
+typedef struct options {
+  int jobs;                   // worker threads
+  int inflight;               // async fetches in flight, or 0
+  int pipeline;               // requests per kept-alive connection, or 0
+  int delay;                  // ms between requests to one host
+  int burst;                  // requests a host may save up
+  char *hosts;                // hosts file for the dnscache, or NULL
+  bool prefetch;              // prefetch hostnames of new pages?
+  frontier_order_t order;     // crawl order
+  int memory;                 // MB of frontier to keep in memory, or 0
+  int seen;                   // MB of seen set to keep in memory, or 0
+  int checkpoint;             // seconds between checkpoints, or 0
+  bool resume;                // carry on from the last checkpoint?
+  bool recrawl;               // reuse the pages of an earlier crawl?
+  bool dedup;                 // skip copies of pages already saved?
+  dedup_mode_t dedupMode;     // which copies
+  bool legacy;                // one file per page, not segments?
+  bool compress;              // compressed segments?
+  int stages;                 // pages queued for each stage, or 0
+  int metrics;                // seconds between metrics lines, or 0
+  char *metricsFile;          // where to append them, or NULL for stderr
+  char *indexFile;            // where to write the index, or NULL
+  int shards;                 // processes to split the crawl among, or 0
+  char *archive;              // archive to record to, or NULL
+  char *replay;               // archive to replay from, or NULL
+  bool fast;                  // replay without the recorded timing?
+} options_t;
+
+/* A copy of a page saved, waiting for stage_index to index it. */
+typedef struct indexed {
+  webpage_t *page;            // the copy
+  int documentID;             // under which it was saved
+} indexed_t;
+
+/* What page_scan passes through webpage_scan to scan_link. */
+typedef struct scan {
+  crawl_t *crawl;             // the crawl
+  int depth;                  // depth of the pages linked to
+} scan_t;
 
 /**************** local function prototypes ****************/
 /* not visible outside this file */
 static void parse_args(const int argc, char *argv[], 
-                       char **seedURL, char **pageDirectory, int *maxDepth);
-static void crawler(char *seed, char *pageDirectory, int maxDepth);
-static void page_scan(webpage_t *page, bag_t *to_crawl, hashtable_t *seen);
+                       char **seedURL, char **pageDirectory, int *maxDepth,
+                       options_t *opts);
+static void crawler(char *seed, char *pageDirectory, int maxDepth, 
+                    options_t *opts, shard_t *shard);
+static void crawl_shards(char *seedURL, char *pageDirectory,
+                         const int maxDepth, options_t *opts);
+static void *crawl_receive(void *arg);
+static bool crawl_over(crawl_t *crawl);
+static void crawl_wait(crawl_t *crawl, const long wait);
+static void sleep_ms(const long ms);
+static void page_prefetch(const char *url);
+static webpage_t *crawl_next(crawl_t *crawl, long *wait);
+static int url_priority(const char *url);
+static void *crawl_worker(void *arg);
+static void crawl_async(crawl_t *crawl, const int inflight);
+static void page_fetched(webpage_t *page, const bool fetched, crawl_t *crawl);
+static bool page_store(webpage_t *page, crawl_t *crawl);
+static void *stage_save(void *arg);
+static void *stage_scan(void *arg);
+static void crawl_gauges(void *arg, metrics_t *metrics);
+static void page_index(webpage_t *page, const int documentID, crawl_t *crawl);
+static void *stage_index(void *arg);
+static int crawl_take(crawl_t *crawl, webpage_t *pages[], const int max);
+static void crawl_release(crawl_t *crawl, const int n);
+static int crawl_nextID(void *arg);
+static bool crawl_checkpointDue(crawl_t *crawl);
+static void crawl_checkpoint(crawl_t *crawl);
+static void page_scan(webpage_t *page, crawl_t *crawl);
+static void scan_link(void *arg, char *url);
 
 // log one word (1-9 chars) about a given url
 inline static void logr(const char *word, const int depth, const char *url)
@@ -53,17 +264,261 @@ inline static void logr(const char *word, const int depth, const char *url)
  */
 static void
 parse_args(const int argc, char *argv[], 
-           char **seedURL, char **pageDirectory, int *maxDepth)
+           char **seedURL, char **pageDirectory, int *maxDepth,
+           options_t *opts)
 {
-  /**** usage ****/
+  /**** options ****/
   char *program = argv[0];
-  if (argc != 4) {
-    fprintf(stderr, "usage: %s: seedURL pageDirectory maxDepth\n", program);
+  static const struct option longopts[] = {
+    { "jobs", required_argument, NULL, 'j' },
+    { "async", required_argument, NULL, 'a' },
+    { "keepalive", no_argument, NULL, 'k' },
+    { "pipeline", required_argument, NULL, 'P' },
+    { "delay", required_argument, NULL, 'd' },
+    { "burst", required_argument, NULL, 'b' },
+    { "hosts", required_argument, NULL, 'H' },
+    { "prefetch", no_argument, NULL, 'p' },
+    { "order", required_argument, NULL, 'o' },
+    { "memory", required_argument, NULL, 'm' },
+    { "seen", required_argument, NULL, 's' },
+    { "checkpoint", required_argument, NULL, 'c' },
+    { "resume", no_argument, NULL, 'r' },
+    { "recrawl", no_argument, NULL, 'R' },
+    { "dedup", required_argument, NULL, 'D' },
+    { "legacy", no_argument, NULL, 'L' },
+    { "compress", no_argument, NULL, 'z' },
+    { "stages", required_argument, NULL, 'S' },
+    { "metrics", required_argument, NULL, 'M' },
+    { "metrics-file", required_argument, NULL, 'F' },
+    { "index", required_argument, NULL, 'I' },
+    { "shards", required_argument, NULL, 'K' },
+    { "archive", required_argument, NULL, 'A' },
+    { "replay", required_argument, NULL, 'Y' },
+    { "fast", no_argument, NULL, 'f' },
+    { "timeouts", required_argument, NULL, 'T' },
+    { "max-page", required_argument, NULL, 'B' },
+    { NULL, 0, NULL, 0 }
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "j:a:kP:d:b:H:po:m:s:c:rRD:LzS:M:F:I:K:A:Y:fT:B:", longopts, NULL)) != -1) {
+    char excess; // any characters seen after an integer
+    switch (opt) {
+    case 'j':
+      if (sscanf(optarg, "%d%c", &opts->jobs, &excess) != 1
+          || opts->jobs < 1 || opts->jobs > maxJobs) {
+        fprintf(stderr, "usage: %s: jobs '%s' must be in range [1:%d]\n",
+                program, optarg, maxJobs);
+        exit (1);
+      }
+      break;
+    case 'a':
+      if (sscanf(optarg, "%d%c", &opts->inflight, &excess) != 1
+          || opts->inflight < 1 || opts->inflight > maxInflight) {
+        fprintf(stderr, "usage: %s: async '%s' must be in range [1:%d]\n",
+                program, optarg, maxInflight);
+        exit (1);
+      }
+      break;
+    case 'k':
+      if (opts->pipeline == 0) {
+        opts->pipeline = 1;
+      }
+      break;
+    case 'P':
+      if (sscanf(optarg, "%d%c", &opts->pipeline, &excess) != 1
+          || opts->pipeline < 1 || opts->pipeline > maxPipeline) {
+        fprintf(stderr, "usage: %s: pipeline '%s' must be in range [1:%d]\n",
+                program, optarg, maxPipeline);
+        exit (1);
+      }
+      break;
+    case 'd':
+      if (sscanf(optarg, "%d%c", &opts->delay, &excess) != 1
+          || opts->delay < 0 || opts->delay > maxDelay) {
+        fprintf(stderr, "usage: %s: delay '%s' must be in range [0:%d]\n",
+                program, optarg, maxDelay);
+        exit (1);
+      }
+      break;
+    case 'b':
+      if (sscanf(optarg, "%d%c", &opts->burst, &excess) != 1
+          || opts->burst < 1 || opts->burst > maxBurst) {
+        fprintf(stderr, "usage: %s: burst '%s' must be in range [1:%d]\n",
+                program, optarg, maxBurst);
+        exit (1);
+      }
+      break;
+    case 'H':
+      if (dnscache_loadHosts(optarg) < 0) {
+        fprintf(stderr, "usage: %s: cannot read hosts file '%s'\n",
+                program, optarg);
+        exit (1);
+      }
+      opts->hosts = optarg;
+      break;
+    case 'p':
+      opts->prefetch = true;
+      break;
+    case 'o':
+      if (!frontier_parseOrder(optarg, &opts->order)) {
+        fprintf(stderr, "usage: %s: order '%s' must be bfs, dfs, or priority\n",
+                program, optarg);
+        exit (1);
+      }
+      break;
+    case 'm':
+      if (sscanf(optarg, "%d%c", &opts->memory, &excess) != 1
+          || opts->memory < 1 || opts->memory > maxMemory) {
+        fprintf(stderr, "usage: %s: memory '%s' must be in range [1:%d]\n",
+                program, optarg, maxMemory);
+        exit (1);
+      }
+      break;
+    case 's':
+      if (sscanf(optarg, "%d%c", &opts->seen, &excess) != 1
+          || opts->seen < 1 || opts->seen > maxMemory) {
+        fprintf(stderr, "usage: %s: seen '%s' must be in range [1:%d]\n",
+                program, optarg, maxMemory);
+        exit (1);
+      }
+      break;
+    case 'c':
+      if (sscanf(optarg, "%d%c", &opts->checkpoint, &excess) != 1
+          || opts->checkpoint < 0 || opts->checkpoint > maxCheckpoint) {
+        fprintf(stderr, "usage: %s: checkpoint '%s' must be in range [0:%d]\n",
+                program, optarg, maxCheckpoint);
+        exit (1);
+      }
+      break;
+    case 'r':
+      opts->resume = true;
+      break;
+    case 'R':
+      opts->recrawl = true;
+      break;
+    case 'D':
+      if (!dedup_parseMode(optarg, &opts->dedupMode)) {
+        fprintf(stderr, "usage: %s: dedup '%s' must be exact or near\n",
+                program, optarg);
+        exit (1);
+      }
+      opts->dedup = true;
+      break;
+    case 'L':
+      opts->legacy = true;
+      break;
+    case 'z':
+      opts->compress = true;
+      break;
+    case 'S':
+      if (sscanf(optarg, "%d%c", &opts->stages, &excess) != 1
+          || opts->stages < 1 || opts->stages > maxStageq) {
+        fprintf(stderr, "usage: %s: stages '%s' must be in range [1:%d]\n",
+                program, optarg, maxStageq);
+        exit (1);
+      }
+      break;
+    case 'M':
+      if (sscanf(optarg, "%d%c", &opts->metrics, &excess) != 1
+          || opts->metrics < 1 || opts->metrics > maxMetrics) {
+        fprintf(stderr, "usage: %s: metrics '%s' must be in range [1:%d]\n",
+                program, optarg, maxMetrics);
+        exit (1);
+      }
+      break;
+    case 'F':
+      opts->metricsFile = optarg;
+      break;
+    case 'I':
+      opts->indexFile = optarg;
+      break;
+    case 'K':
+      if (sscanf(optarg, "%d%c", &opts->shards, &excess) != 1
+          || opts->shards < 1 || opts->shards > maxShards) {
+        fprintf(stderr, "usage: %s: shards '%s' must be in range [1:%d]\n",
+                program, optarg, maxShards);
+        exit (1);
+      }
+      break;
+    case 'A':
+      opts->archive = optarg;
+      break;
+    case 'Y':
+      opts->replay = optarg;
+      break;
+    case 'f':
+      opts->fast = true;
+      break;
+    case 'T': {
+      int connect, idle, total;
+      if (sscanf(optarg, "%d,%d,%d%c", &connect, &idle, &total, &excess) != 3
+          || connect < 0 || connect > maxTimeout
+          || idle < 0 || idle > maxTimeout
+          || total < 0 || total > maxTimeout) {
+        fprintf(stderr, "usage: %s: timeouts '%s' must be three "
+                "milliseconds in range [0:%d], as CONNECT,IDLE,TOTAL\n",
+                program, optarg, maxTimeout);
+        exit (1);
+      }
+      http_setTimeouts(connect, idle, total);
+      break;
+    }
+    case 'B': {
+      int kb;
+      if (sscanf(optarg, "%d%c", &kb, &excess) != 1
+          || kb < 0 || kb > maxPage) {
+        fprintf(stderr, "usage: %s: max-page '%s' must be in range [0:%d]\n",
+                program, optarg, maxPage);
+        exit (1);
+      }
+      http_setLimits(kb * 1024L, true);
+      break;
+    }
+    default:
+      fprintf(stderr, "usage: %s: [-j N [-k] [-P N] | -a N] [-d MS] [-b N] "
+              "[-H FILE] [-p] [-o ORDER] [-m MB] [-s MB] [-c SEC] [-r | -R] "
+              "[-D MODE] [-L | -z] [-S N] [-M SEC] [-F FILE] [-I FILE] [-K N] "
+              "[-A FILE | -Y FILE [-f]] [-T C,I,T] [-B KB] "
+              "seedURL pageDirectory maxDepth\n", program);
+      exit (1);
+    }
+  }
+
+  /**** usage ****/
+  if (argc - optind != 3 
+      || (opts->inflight > 0 && (opts->jobs > 1 || opts->pipeline > 0))
+      || (opts->resume && opts->recrawl)
+      || (opts->legacy && opts->compress)
+      || (opts->recrawl && opts->indexFile != NULL)
+      || (opts->shards > 0 && (opts->resume || opts->recrawl || opts->dedup))
+      || (opts->archive != NULL && opts->replay != NULL)
+      || (opts->fast && opts->replay == NULL)) {
+    fprintf(stderr, "usage: %s: [-j N [-k] [-P N] | -a N] [-d MS] [-b N] "
+            "[-H FILE] [-p] [-o ORDER] [-m MB] [-s MB] [-c SEC] [-r | -R] "
+            "[-D MODE] [-L | -z] [-S N] [-M SEC] [-F FILE] [-I FILE] [-K N] "
+            "[-A FILE | -Y FILE [-f]] [-T C,I,T] [-B KB] "
+            "seedURL pageDirectory maxDepth\n", program);
+    exit (1);
+  }
+  argv += optind;
+
+  /**** archive ****/
+  if (opts->archive != NULL
+      && !archive_start(opts->archive, ARCHIVE_RECORD)) {
+    fprintf(stderr, "usage: %s: cannot append to archive '%s'\n",
+            program, opts->archive);
+    exit (1);
+  }
+  if (opts->replay != NULL
+      && !archive_start(opts->replay, opts->fast ? ARCHIVE_REPLAY_FAST
+                                                 : ARCHIVE_REPLAY)) {
+    fprintf(stderr, "usage: %s: cannot read archive '%s'\n",
+            program, opts->replay);
     exit (1);
   }
 
   /**** seedURL ****/
-  *seedURL = argv[1];
+  *seedURL = argv[0];
   if (!NormalizeURL(*seedURL)) {
     fprintf(stderr, "usage: %s: un-normalizable seedURL '%s'\n", 
             program, *seedURL);
@@ -76,7 +531,7 @@ parse_args(const int argc, char *argv[],
   }
   
   /**** pageDirectory ****/ 
-  *pageDirectory = argv[2];
+  *pageDirectory = argv[1];
   if (!pagedir_init(*pageDirectory)) {
     fprintf(stderr, "usage: %s: invalid or unwritable directory '%s'\n", 
             program, *pageDirectory);
@@ -84,7 +539,7 @@ parse_args(const int argc, char *argv[],
   }
 
   /**** maxDepth ****/
-  char *maxDepthString = argv[3];
+  char *maxDepthString = argv[2];
   char excess; // any characters seen after an integer
   if (sscanf(maxDepthString, "%d%c", maxDepth, &excess) != 1) {
     fprintf(stderr, "usage: %s: invalid maxDepth '%s'\n", 
@@ -108,61 +563,339 @@ int main(int argc, char* argv[])
    char *seedURL = NULL;
    char *dir_name = NULL;
    int maxDepth = 0;
+   options_t opts = { .jobs = 1, .inflight = 0, .pipeline = 0, 
+                      .delay = 1000, .burst = 1, 
+                      .hosts = NULL, .prefetch = false,
+                      .order = FRONTIER_BFS, .memory = 0, .seen = 0,
+                      .checkpoint = 60, .resume = false, .recrawl = false,
+                      .dedup = false, .dedupMode = DEDUP_EXACT,
+                      .legacy = false, .compress = false, .stages = 0,
+                      .metrics = 0, .metricsFile = NULL,
+                      .indexFile = NULL, .shards = 0,
+                      .archive = NULL, .replay = NULL, .fast = false };
 
-   parse_args(argc, argv, &seedURL, &dir_name, &maxDepth);
+   parse_args(argc, argv, &seedURL, &dir_name, &maxDepth, &opts);
    
-   // pass the parameters to the crawler
-   crawler(seedURL, dir_name, maxDepth);
+   // pass the parameters to the crawler, or to the shards
+   if (opts.shards > 0) {
+      crawl_shards(seedURL, dir_name, maxDepth, &opts);
+   } else {
+      crawler(seedURL, dir_name, maxDepth, &opts, NULL);
+   }
+   archive_stop();
 
    //exit success
    return 0;
 
 }
 
-//uses a bag to track pages to explore, and hashtable to track pages seen;
-// when it explores a page it gives the page URL to the pagefetcher, then the 
-// result to page_sav, then to the pagescanner
-void crawler(char *seedURL, char *pageDirectory, int maxDepth)
+//uses a frontier to track pages to explore, and a seenset to track pages
+// seen; when it explores a page it gives the page URL to the pagefetcher,
+// then the result to page_sav, then to the pagescanner.
+// The next few pages out of the frontier wait in a politeness scheduler,
+// which only hands out a page when its host is due another request; 
+// that replaces the fixed pause inside webpage_fetch.
+// With jobs > 1 that loop runs in a pool of worker threads sharing the
+// scheduler and seenset; with jobs == 1 it runs in the calling thread.
+// With inflight > 0 the calling thread instead keeps up to that many
+// fetches going at once through a fetchq.
+// With pipeline > 0 the workers fetch through a pool of kept-alive 
+// connections, each worker taking up to 'pipeline' pages at a time.
+// Every so often, when no page is being fetched, the crawl is saved to
+// a checkpoint; with resume, it carries on from the last one.
+// With recrawl, pages saved by an earlier crawl are fetched only if
+// they have changed, and keep their document IDs; there are no
+// checkpoints, since the document IDs are no longer handed out in order.
+// With dedup, a page that is a copy of one already saved is not saved,
+// though its links are still followed.
+// A new crawl appends its pages to segments, compressed with compress,
+// or with legacy writes each to a file of its own; resume and recrawl
+// keep the format there.
+// With stages, fetched pages are saved by one thread and then scanned
+// by another, through bounded queues, while the fetchers carry on.
+// With metrics, a thread writes the crawl's metrics every so often.
+// With indexFile, a thread indexes each page saved, and the index is
+// written at the end, so there is no need to run the indexer.
+// With shard, this is one of several processes crawling into the same
+// pageDirectory (see crawl_shards): it crawls only the URLs it owns,
+// sends the others on, and takes in those sent to it, by a thread of
+// its own; it hands out every shard_count'th document ID, and writes
+// its pages, validators and spill files apart from the others'.
+void crawler(char *seedURL, char *pageDirectory, int maxDepth, 
+             options_t *opts, shard_t *shard)
 {
+   crawl_t crawl;
+   crawl.seedURL = seedURL;
+   crawl.pageDirectory = pageDirectory;
+   crawl.maxDepth = maxDepth;
+   crawl.checkpoint = opts->recrawl || shard != NULL ? 0 : opts->checkpoint;
+   crawl.pool = NULL;
+   crawl.pipeline = 1;
+   crawl.prefetch = opts->prefetch && opts->replay == NULL;  // no names
+   if (opts->pipeline > 0) {
+      crawl.pool = assertp(connpool_new(opts->jobs, opts->pipeline), 
+                           "connpool");
+      crawl.pipeline = opts->pipeline;
+   }
+   pagedir_format_t format = opts->legacy ? PAGEDIR_FILES
+                           : opts->compress ? PAGEDIR_COMPRESSED
+                           : PAGEDIR_SEGMENTS;
+   crawl.shard = shard;
+   int id = shard != NULL ? shard_id(shard) : -1;
+   int shards = shard != NULL ? shard_count(shard) : 1;
+   if (shard != NULL) {
+      // the coordinator has created the segments; ours go past the others'
+      pagedir_shard(pageDirectory, id);
+      crawl.recrawl = recrawl_newShard(pageDirectory, id);
+   } else {
+      if (!opts->resume && !opts->recrawl
+          && !pagedir_create(pageDirectory, format)) {
+         fprintf(stderr, "crawler: cannot create segments in '%s'\n",
+                 pageDirectory);
+         exit (10);
+      }
+      crawl.recrawl = recrawl_new(pageDirectory,
+                                  !opts->resume && !opts->recrawl,
+                                  opts->recrawl);
+   }
+   if (crawl.recrawl == NULL) {
+      fprintf(stderr, "crawler: cannot write validators in '%s'\n",
+              pageDirectory);
+      exit (8);
+   }
+   pthread_mutex_init(&crawl.lock, NULL);
+   pthread_cond_init(&crawl.more, NULL);
 
-   // allocate data structures
-   bag_t *pages_to_crawl = bag_new();
-   assertp(pages_to_crawl, "pages_to_crawl");
-   const int TableSize = 200;
-   hashtable_t *pages_seen = hashtable_new(TableSize);
-   assertp(pages_seen, "pages_seen");
+   // the scheduler paces each host; no need to pause after every fetch
+   webpage_setFetchDelay(0);
 
-   // malloc a copy of the seedURL to store in the webpage_t below
-   char *seedcopy = malloc(strlen(seedURL)+1);
-   strcpy(seedcopy, seedURL);
+   // allocate data structures; spilled URLs go next to the pages
+   char *spillFile = assertp(malloc(strlen(pageDirectory) + 24), "spill");
+   sprintf(spillFile, shard != NULL ? "%s/.frontier.%d" : "%s/.frontier",
+           pageDirectory, id);
+   size_t memory = (opts->memory > 0 ? opts->memory : maxMemory) * 1048576L;
+   crawl.frontier = frontier_new(opts->order, memory, spillFile);
+   assertp(crawl.frontier, "frontier");
+   free(spillFile);
+   // each host sees, from all the shards, no more than from one crawler
+   crawl.pages_to_crawl = politeness_new(opts->delay * shards, opts->burst);
+   assertp(crawl.pages_to_crawl, "pages_to_crawl");
+   // enough pages to keep every fetcher busy
+   crawl.window = opts->inflight > 0 ? opts->inflight 
+                                     : opts->jobs * crawl.pipeline;
+   char *seenFile = assertp(malloc(strlen(pageDirectory) + 20), "seen");
+   sprintf(seenFile, shard != NULL ? "%s/.seen.%d" : "%s/.seen",
+           pageDirectory, id);
+   memory = (opts->seen > 0 ? opts->seen : maxMemory) * 1048576L;
+   crawl.pages_seen = seenset_new(memory, seenFile);
+   assertp(crawl.pages_seen, "pages_seen");
+   free(seenFile);
 
-   // initialize a WebPage representing the seed URL at depth 0, and add to bag
-   bag_insert(pages_to_crawl, webpage_new(seedcopy, 0, NULL));
-   // insert seedURL to hashtable; the 'item' value is unused. 
-   hashtable_insert(pages_seen, seedURL, "seed"); 
+   if (opts->resume) {
+      // pick up the pages seen, the pages to crawl and the document IDs
+      crawl.documentID = checkpoint_resume(pageDirectory, seedURL, maxDepth,
+                                           crawl.pages_seen, crawl.frontier,
+                                           url_priority);
+      if (crawl.documentID < 0) {
+         exit (7);
+      }
+   } else if (shard != NULL) {
+      // the seed comes from the coordinator, to whichever shard owns it;
+      // shard i hands out document IDs i+1, i+1+shards, ...
+      crawl.documentID = id + 1 - shards;
+   } else {
+      // the seed URL, at depth 0, is the first page to crawl
+      frontier_insert(crawl.frontier, seedURL, 0, url_priority(seedURL));
+      // the seed URL has been seen
+      seenset_insert(crawl.pages_seen, seedURL);
+
+      // initialize our document ID series, after any pages we have
+      crawl.documentID = recrawl_lastID(crawl.recrawl);
+      // any older checkpoint is not of this crawl
+      checkpoint_remove(pageDirectory);
+   }
+   crawl.dedup = NULL;
+   if (opts->dedup) {
+      // compare new pages with those already saved, if any
+      crawl.dedup = dedup_new(pageDirectory, opts->dedupMode,
+                              !opts->resume && !opts->recrawl);
+      if (crawl.dedup == NULL) {
+         fprintf(stderr, "crawler: cannot write duplicates in '%s'\n",
+                 pageDirectory);
+         exit (9);
+      }
+      dedup_load(crawl.dedup, crawl.documentID);
+   }
+   crawl.idStep = shards;
+   crawl.active = 0;
+   crawl.received = 0;
+   crawl.idle = crawl.stopped = false;
+   crawl.lastCheckpoint = time(NULL);
+
+   // start writing metrics, if asked
+   crawl.metrics = NULL;
+   FILE *metricsFile = stderr;
+   if (opts->metrics > 0 || opts->metricsFile != NULL) {
+      if (opts->metricsFile != NULL
+          && (metricsFile = fopen(opts->metricsFile, "a")) == NULL) {
+         fprintf(stderr, "crawler: cannot write metrics to '%s'\n",
+                 opts->metricsFile);
+         exit (11);
+      }
+      crawl.metrics = assertp(metrics_new(), "metrics");
+      if (shard != NULL) {
+         metrics_setShard(crawl.metrics, id);
+      }
+      if (!metrics_start(crawl.metrics, opts->metrics > 0 ? opts->metrics
+                                                          : defaultMetrics,
+                         metricsFile, &crawl, crawl_gauges)) {
+         assertp(NULL, "metrics_start");
+      }
+   }
+
+   // start indexing, after the pages already saved, if asked
+   crawl.indexq = NULL;
+   crawl.index = NULL;
+   pthread_t indexer;
+   if (opts->indexFile != NULL) {
+      FILE *fp = fopen(opts->indexFile, "w");
+      if (fp == NULL) {
+         fprintf(stderr, "crawler: cannot write index to '%s'\n",
+                 opts->indexFile);
+         exit (12);
+      }
+      fclose(fp);
+      crawl.index = assertp(index_new(indexSlots), "index");
+      if (opts->resume) {
+         index_build(pageDirectory, crawl.index);
+      }
+      crawl.indexq = assertp(stageq_new(indexQueue), "indexq");
+      if (pthread_create(&indexer, NULL, stage_index, &crawl) != 0) {
+         assertp(NULL, "pthread_create");
+      }
+   }
+
+   // start the stages after fetching, if they are to run on their own
+   crawl.saveq = crawl.scanq = NULL;
+   pthread_t saver, scanner;
+   if (opts->stages > 0) {
+      crawl.saveq = assertp(stageq_new(opts->stages), "saveq");
+      crawl.scanq = assertp(stageq_new(opts->stages), "scanq");
+      if (pthread_create(&saver, NULL, stage_save, &crawl) != 0
+          || pthread_create(&scanner, NULL, stage_scan, &crawl) != 0) {
+         assertp(NULL, "pthread_create");
+      }
+   }
+
+   // take in the URLs other shards send
+   pthread_t receiver;
+   if (shard != NULL
+       && pthread_create(&receiver, NULL, crawl_receive, &crawl) != 0) {
+      assertp(NULL, "pthread_create");
+   }
 
-   // initialize our document ID series
-   int documentID = 0;
    // start crawling!
-   webpage_t *page;
-   while ( (page = bag_extract(pages_to_crawl)) != NULL) {
-      // fetch the page, filling in page's html
-      if (webpage_fetch(page)) {
-         // save the fetched page to a file
-         page_save(page, pageDirectory, ++documentID);
-      
-      //    // if we should explore another level, ...
-         if (webpage_getDepth(page) < maxDepth) {
-            // scan the page to extract URLs and put them in the bag
-            page_scan(page, pages_to_crawl, pages_seen);
+   if (opts->inflight > 0) {
+      crawl_async(&crawl, opts->inflight);
+   } else if (opts->jobs == 1) {
+      crawl_worker(&crawl);
+   } else {
+      int jobs = opts->jobs;
+      pthread_t *workers = assertp(malloc(jobs * sizeof(pthread_t)), "workers");
+      for (int i = 0; i < jobs; i++) {
+         if (pthread_create(&workers[i], NULL, crawl_worker, &crawl) != 0) {
+            assertp(NULL, "pthread_create");
          }
-      } 
-      // // finished with this web page
-      webpage_delete(page);
+      }
+      for (int i = 0; i < jobs; i++) {
+         pthread_join(workers[i], NULL);
+      }
+      free(workers);
    }
+
+  // the coordinator has said stop, so the receiver is done
+  if (shard != NULL) {
+    pthread_join(receiver, NULL);
+  }
+
+  // the last line of metrics has the totals
+  if (crawl.metrics != NULL) {
+    metrics_delete(crawl.metrics);
+    if (metricsFile != stderr) {
+      fclose(metricsFile);
+    }
+  }
+
+  // every page is done with, so the stages have nothing left to do
+  if (crawl.saveq != NULL) {
+    stageq_close(crawl.saveq);
+    stageq_close(crawl.scanq);
+    pthread_join(saver, NULL);
+    pthread_join(scanner, NULL);
+    stageq_report(crawl.saveq, stderr, "crawler save queue");
+    stageq_report(crawl.scanq, stderr, "crawler scan queue");
+    stageq_delete(crawl.saveq, webpage_delete);
+    stageq_delete(crawl.scanq, webpage_delete);
+  }
+
+  // every page saved has been queued to index; finish, and write it
+  if (crawl.indexq != NULL) {
+    stageq_close(crawl.indexq);
+    pthread_join(indexer, NULL);
+    if (crawl.saveq != NULL) {
+      stageq_report(crawl.indexq, stderr, "crawler index queue");
+    }
+    stageq_delete(crawl.indexq, NULL);
+    if (!index_save(opts->indexFile, crawl.index)) {
+      fprintf(stderr, "crawler: cannot write index to '%s'\n",
+              opts->indexFile);
+    }
+    index_delete(crawl.index);
+  }
+
+  // a final checkpoint, so that resuming a finished crawl does nothing
+  if (crawl.checkpoint > 0) {
+    crawl_checkpoint(&crawl);
+  }
+
   // clean up
-  hashtable_delete(pages_seen, NULL);
-  bag_delete(pages_to_crawl, webpage_delete);
+  if (crawl.pool != NULL) {
+    connpool_report(crawl.pool, stderr, "crawler connections");
+    connpool_delete(crawl.pool);
+  }
+  if (crawl.prefetch) {
+    dnscache_report(stderr, "crawler names");
+  }
+  archive_report(stderr, "crawler archive");
+  if (opts->memory > 0) {
+    frontier_report(crawl.frontier, stderr, "crawler frontier");
+  }
+  if (opts->seen > 0) {
+    seenset_report(crawl.pages_seen, stderr, "crawler seen");
+  }
+  if (opts->recrawl) {
+    recrawl_report(crawl.recrawl, stderr, "crawler recrawl");
+  }
+  if (crawl.dedup != NULL) {
+    dedup_report(crawl.dedup, stderr, "crawler dedup");
+    if (!dedup_delete(crawl.dedup)) {
+      fprintf(stderr, "crawler: cannot write duplicates in '%s'\n",
+              pageDirectory);
+    }
+  }
+  if (!pagedir_close(pageDirectory)) {
+    fprintf(stderr, "crawler: cannot write pages in '%s'\n", pageDirectory);
+  }
+  if (!recrawl_delete(crawl.recrawl)) {
+    fprintf(stderr, "crawler: cannot write changed list in '%s'\n",
+            pageDirectory);
+  }
+  dnscache_clear();
+  seenset_delete(crawl.pages_seen);
+  politeness_delete(crawl.pages_to_crawl, webpage_delete);
+  frontier_delete(crawl.frontier);
+  pthread_cond_destroy(&crawl.more);
+  pthread_mutex_destroy(&crawl.lock);
   #ifdef MEMTEST
   // report on our own memory use
   count_report(stdout, "crawler");
@@ -170,41 +903,666 @@ void crawler(char *seedURL, char *pageDirectory, int maxDepth)
 
 }
 
+/**************** crawl_shards ****************/
+/* Crawl with opts->shards processes, each running crawler as one shard,
+ * while this one, the coordinator, passes URLs between them (see
+ * shard.h).  Each shard saves its own pages into the pageDirectory the
+ * coordinator has created, under its own document IDs; once they are
+ * done, the coordinator fills the gaps among those IDs so that the pages
+ * are numbered 1, 2, 3, ... as for any crawl, gathers the shards'
+ * validators, and builds any index from the pages saved.  Exits 13 if a
+ * shard fails or the pages can't be renumbered.
+ */
+static void
+crawl_shards(char *seedURL, char *pageDirectory, const int maxDepth,
+             options_t *opts)
+{
+   pagedir_format_t format = opts->legacy ? PAGEDIR_FILES
+                           : opts->compress ? PAGEDIR_COMPRESSED
+                           : PAGEDIR_SEGMENTS;
+   // closed again, so that the shards and we reopen it as they left it
+   if (!pagedir_create(pageDirectory, format)
+       || !pagedir_close(pageDirectory)) {
+      fprintf(stderr, "crawler: cannot create segments in '%s'\n",
+              pageDirectory);
+      exit (10);
+   }
+   checkpoint_remove(pageDirectory);
+   if (opts->indexFile != NULL) {
+      FILE *fp = fopen(opts->indexFile, "w");
+      if (fp == NULL) {
+         fprintf(stderr, "crawler: cannot write index to '%s'\n",
+                 opts->indexFile);
+         exit (12);
+      }
+      fclose(fp);
+   }
+
+   shard_t *shard = shard_start(opts->shards);
+   if (shard == NULL) {
+      fprintf(stderr, "crawler: cannot start %d shards\n", opts->shards);
+      exit (13);
+   }
+   if (shard_id(shard) >= 0) {
+      // a shard: crawl, leaving the index to the coordinator
+      options_t shardOpts = *opts;
+      shardOpts.indexFile = NULL;
+      crawler(seedURL, pageDirectory, maxDepth, &shardOpts, shard);
+      shard_delete(shard);
+      exit (0);
+   }
+
+   int failed = shard_route(shard, seedURL);
+   shard_report(shard, stderr, "crawler shards");
+   shard_delete(shard);
+
+   // number the pages 1, 2, 3, ...
+   int maxID = pagedir_recover(pageDirectory);
+   int *newID = assertp(malloc((maxID + 2) * sizeof(int)), "newID");
+   int pages = maxID < 0 ? -1 : pagedir_compact(pageDirectory, maxID, newID);
+   if (pages < 0 || !pagedir_close(pageDirectory)
+       || !recrawl_merge(pageDirectory, opts->shards, newID, maxID)) {
+      fprintf(stderr, "crawler: cannot renumber pages in '%s'\n",
+              pageDirectory);
+      free(newID);
+      exit (13);
+   }
+   free(newID);
+
+   if (opts->indexFile != NULL) {
+      index_t *index = assertp(index_new(indexSlots), "index");
+      index_build(pageDirectory, index);
+      if (!index_save(opts->indexFile, index)) {
+         fprintf(stderr, "crawler: cannot write index to '%s'\n",
+                 opts->indexFile);
+      }
+      index_delete(index);
+      pagedir_close(pageDirectory);
+   }
+   if (failed > 0) {
+      fprintf(stderr, "crawler: %d of %d shards failed\n",
+              failed, opts->shards);
+      exit (13);
+   }
+}
+
+/**************** crawl_worker ****************/
+/* Fetch, save, and scan pages until the crawl runs dry; or, with
+ * stages, fetch pages and hand them on to be saved and scanned.
+ * Only the scheduler, the seenset and the document ID are shared;
+ * the fetch, the save and the link extraction run unlocked.
+ */
+static void *
+crawl_worker(void *arg)
+{
+  crawl_t *crawl = arg;
+  webpage_t *pages[maxPipeline];
+  bool fetched[maxPipeline];
+  int n;
+
+  while ( (n = crawl_take(crawl, pages, crawl->pipeline)) > 0) {
+    // fetch the pages, filling in each page's html
+    if (crawl->pool != NULL) {
+      connpool_fetch(crawl->pool, pages, n, fetched);
+    } else {
+      fetched[0] = webpage_fetch(pages[0]);
+    }
+    for (int i = 0; i < n; i++) {
+      page_fetched(pages[i], fetched[i], crawl);
+    }
+  }
+  return NULL;
+}
+
+/**************** crawl_async ****************/
+/* Crawl from the calling thread, keeping up to 'inflight' fetches
+ * going at once, and handling each page as its fetch completes.
+ * While no host is ready, wait for a fetch to complete, but no longer
+ * than until the next host is ready.  The crawl is over when no page
+ * is waiting and none is active: being fetched, or, with stages,
+ * waiting to be saved or scanned.  Those stages add pages as they scan,
+ * without waking fetchq_next; so while they hold pages, wait for a
+ * fetch no more than stagePoll milliseconds at a time.
+ */
+static void
+crawl_async(crawl_t *crawl, const int inflight)
+{
+  fetchq_t *fq = assertp(fetchq_new(inflight), "fetchq");
+  webpage_t *page;
+  bool fetched;
+
+  for (;;) {
+    pthread_mutex_lock(&crawl->lock);
+    // a checkpoint waits for the pages active, and holds up new ones
+    bool checkpoint = crawl_checkpointDue(crawl);
+    if (checkpoint && crawl->active == 0) {
+      crawl_checkpoint(crawl);
+      checkpoint = false;
+    }
+
+    // top up the fetches in flight with pages whose hosts are ready
+    long wait = -1;
+    while (!checkpoint && fetchq_pending(fq) < inflight
+           && (page = crawl_next(crawl, &wait)) != NULL) {
+      fetchq_submit(fq, page);
+      crawl->active++;
+    }
+    if (checkpoint || fetchq_pending(fq) >= inflight) {
+      wait = -1;        // no room for another fetch anyway
+    }
+    if (fetchq_pending(fq) == 0 && crawl->active > 0) {
+      // only the stages are busy; wait for them, or for a host
+      crawl_wait(crawl, wait);
+      pthread_mutex_unlock(&crawl->lock);
+      continue;
+    }
+    if (fetchq_pending(fq) == 0 && wait < 0) {
+      // nothing waiting, nothing active: done, unless another shard
+      // may yet send us pages
+      bool over = crawl_over(crawl);
+      if (!over) {
+        crawl_wait(crawl, -1);
+      }
+      pthread_mutex_unlock(&crawl->lock);
+      if (over) {
+        break;
+      }
+      continue;
+    }
+    bool staged = crawl->active > fetchq_pending(fq);
+    pthread_mutex_unlock(&crawl->lock);
+
+    if (fetchq_pending(fq) > 0) {
+      if (staged && (wait < 0 || wait > stagePoll)) {
+        wait = stagePoll;
+      }
+      // handle whichever page comes back next
+      if ( (page = fetchq_next(fq, &fetched, wait)) != NULL) {
+        page_fetched(page, fetched, crawl);
+      }
+    } else {
+      sleep_ms(wait);   // nothing to do until a host is ready
+    }
+  }
+
+  fetchq_delete(fq, webpage_delete);
+}
+
+/**************** page_fetched ****************/
+/* Handle a page whose fetch is over: tell the scheduler whether its
+ * host answered; then if it was fetched (or has not changed since an
+ * earlier crawl), save and scan it, or, with stages, queue it to be
+ * saved, waiting while that queue is full; otherwise we are done with it.
+ */
+static void
+page_fetched(webpage_t *page, const bool fetched, crawl_t *crawl)
+{
+  // no answer at all counts against the host (see politeness.h)
+  pthread_mutex_lock(&crawl->lock);
+  politeness_answered(crawl->pages_to_crawl, page,
+                      webpage_getStatus(page) != 0);
+  pthread_mutex_unlock(&crawl->lock);
+
+  if (crawl->metrics != NULL) {
+    long connect, firstByte, total;
+    webpage_getTimes(page, &connect, &firstByte, &total);
+    metrics_time(crawl->metrics, METRIC_CONNECT, connect);
+    metrics_time(crawl->metrics, METRIC_FIRSTBYTE, firstByte);
+    metrics_time(crawl->metrics, METRIC_FETCH, total);
+    long avoided;
+    bool refused = webpage_getRefused(page, &avoided);
+    metrics_count(crawl->metrics, fetched ? METRIC_FETCHED
+                  : webpage_getStatus(page) == 304 ? METRIC_NOTMODIFIED
+                  : refused && webpage_getStatus(page) == 200 ? METRIC_REFUSED
+                  : METRIC_FAILED, 1);
+    metrics_count(crawl->metrics, METRIC_BYTES, webpage_getHTMLLength(page));
+    metrics_count(crawl->metrics, METRIC_AVOIDED, avoided);
+  }
+  if (fetched || webpage_getStatus(page) == 304) {
+    if (crawl->saveq != NULL) {
+      if (stageq_put(crawl->saveq, page)) {
+        return;         // stage_save takes it from here
+      }
+    } else if (page_store(page, crawl)
+               && webpage_getDepth(page) < crawl->maxDepth) {
+      // scan the page to extract URLs and queue them to crawl
+      page_scan(page, crawl);
+    }
+  }
+  // finished with this web page
+  webpage_delete(page);
+  crawl_release(crawl, 1);
+}
+
+/**************** page_store ****************/
+/* Save a freshly fetched page.  A page saved by an earlier crawl keeps
+ * its document ID; if the server says it has not changed since (304),
+ * its saved copy is loaded instead.  A new page that dedup finds is a
+ * copy of one already saved is not saved.
+ * Returns false if the page has no html to scan (a page we had, but
+ * can no longer get).
+ */
+static bool
+page_store(webpage_t *page, crawl_t *crawl)
+{
+  long long start = http_clock();
+  int documentID = recrawl_update(crawl->recrawl, page);
+  if (documentID < 0 || webpage_getHTML(page) == NULL) {
+    return false;
+  }
+  if (documentID == 0 
+      && (documentID = dedup_page(crawl->dedup, page, crawl_nextID, crawl)) 
+         > 0) {
+    // save the fetched page to a file
+    page_save(page, crawl->pageDirectory, documentID);
+    recrawl_saved(crawl->recrawl, documentID, page);
+    metrics_count(crawl->metrics, METRIC_SAVED, 1);
+    if (crawl->indexq != NULL) {
+      page_index(page, documentID, crawl);
+    }
+  }
+  metrics_time(crawl->metrics, METRIC_SAVE, http_clock() - start);
+  return true;
+}
+
+/**************** stage_save ****************/
+/* The thread that saves the pages in crawl->saveq, and queues those
+ * we should explore further in crawl->scanq, until saveq is closed.
+ */
+static void *
+stage_save(void *arg)
+{
+  crawl_t *crawl = arg;
+  webpage_t *page;
+
+  while ( (page = stageq_get(crawl->saveq)) != NULL) {
+    if (!page_store(page, crawl)
+        || webpage_getDepth(page) >= crawl->maxDepth
+        || !stageq_put(crawl->scanq, page)) {
+      webpage_delete(page);
+      crawl_release(crawl, 1);
+    }
+  }
+  return NULL;
+}
+
+/**************** stage_scan ****************/
+/* The thread that scans the pages in crawl->scanq for links, until
+ * scanq is closed.
+ */
+static void *
+stage_scan(void *arg)
+{
+  crawl_t *crawl = arg;
+  webpage_t *page;
+
+  while ( (page = stageq_get(crawl->scanq)) != NULL) {
+    page_scan(page, crawl);
+    webpage_delete(page);
+    crawl_release(crawl, 1);
+  }
+  return NULL;
+}
+
+/**************** crawl_take ****************/
+/* Extract up to max pages to crawl, waiting while no host is ready
+ * or no page is waiting but other workers may still add some.
+ * When a checkpoint is due, wait for the other workers to finish their
+ * pages, and then write it, before taking any.
+ * Returns the number of pages taken; 0 once no page is waiting and 
+ * no worker is busy, i.e., the crawl is complete.
+ */
+static int
+crawl_take(crawl_t *crawl, webpage_t *pages[], const int max)
+{
+  pthread_mutex_lock(&crawl->lock);
+  int n = 0;
+  long wait;
+  for (;;) {
+    if (crawl_checkpointDue(crawl)) {
+      if (crawl->active > 0) {
+        crawl_wait(crawl, -1);    // crawl_release wakes us at 0
+        continue;
+      }
+      crawl_checkpoint(crawl);
+    }
+    if ( (pages[n] = crawl_next(crawl, &wait)) != NULL
+         || (wait < 0 && crawl->active == 0 && crawl_over(crawl))) {
+      break;
+    }
+    crawl_wait(crawl, wait);
+  }
+  if (pages[n] != NULL) {
+    // got one; take more if they are ready for the taking
+    for (n = 1; n < max && (pages[n] = crawl_next(crawl, &wait)) != NULL; 
+         n++) {
+      ;
+    }
+    crawl->active += n;
+  } else {
+    // nothing left and nobody busy: wake any other waiters so they quit too
+    pthread_cond_broadcast(&crawl->more);
+  }
+  pthread_mutex_unlock(&crawl->lock);
+  return n;
+}
+
+/**************** crawl_over ****************/
+/* With nothing left to crawl and nobody busy, return true if the crawl
+ * is over: always, unless this is a shard the coordinator has not yet
+ * told to stop; then say we are idle, if not already since taking in
+ * the last URL, and return false.  Caller holds crawl->lock.
+ */
+static bool
+crawl_over(crawl_t *crawl)
+{
+  if (crawl->shard == NULL || crawl->stopped) {
+    return true;
+  }
+  if (!crawl->idle) {
+    shard_idle(crawl->shard, crawl->received);
+    crawl->idle = true;
+  }
+  return false;
+}
+
+/**************** crawl_receive ****************/
+/* In a shard, take in the URLs the coordinator passes on from other
+ * shards, adding those not seen before to the pages to crawl, until it
+ * says stop; then wake every worker waiting, to find the crawl over.
+ */
+static void *
+crawl_receive(void *arg)
+{
+  crawl_t *crawl = arg;
+  char *url;
+  int depth;
+  while ( (url = shard_receive(crawl->shard, &depth)) != NULL) {
+    pthread_mutex_lock(&crawl->lock);
+    if (seenset_insert(crawl->pages_seen, url)) {
+      if (!frontier_insert(crawl->frontier, url, depth, url_priority(url))) {
+        fprintf(stderr, "crawler: cannot queue '%s'\n", url);
+      }
+      metrics_count(crawl->metrics, METRIC_LINKS, 1);
+      if (crawl->prefetch) {
+        page_prefetch(url);
+      }
+    }
+    // either way, we are no longer idle as the coordinator knows it
+    crawl->received++;
+    crawl->idle = false;
+    pthread_cond_signal(&crawl->more);
+    pthread_mutex_unlock(&crawl->lock);
+  }
+  pthread_mutex_lock(&crawl->lock);
+  crawl->stopped = true;
+  pthread_cond_broadcast(&crawl->more);
+  pthread_mutex_unlock(&crawl->lock);
+  return NULL;
+}
+
+/**************** crawl_release ****************/
+/* Note that n pages taken have been fetched, saved and scanned. */
+static void
+crawl_release(crawl_t *crawl, const int n)
+{
+  pthread_mutex_lock(&crawl->lock);
+  crawl->active -= n;
+  if (crawl->active == 0) {
+    pthread_cond_broadcast(&crawl->more);
+  }
+  pthread_mutex_unlock(&crawl->lock);
+}
+
+/**************** crawl_next ****************/
+/* Return the next page to crawl whose host is ready, as
+ * politeness_extract does, after moving pages from the frontier to the
+ * politeness scheduler until it holds crawl->window of them.  The
+ * frontier decides the crawl order; the scheduler holds only enough
+ * pages to keep the fetchers busy, so the order is kept.  But if none
+ * of its hosts is ready, take up to extraWindow more pages from the
+ * frontier in search of one that is, rather than sit idle.
+ * Caller holds crawl->lock (or there is only one thread).
+ */
+static webpage_t *
+crawl_next(crawl_t *crawl, long *wait)
+{
+  webpage_t *page;
+  while (politeness_size(crawl->pages_to_crawl) < crawl->window
+         && (page = frontier_extract(crawl->frontier)) != NULL) {
+    recrawl_prepare(crawl->recrawl, page);
+    politeness_insert(crawl->pages_to_crawl, page);
+  }
+  while ( (page = politeness_extract(crawl->pages_to_crawl, wait)) == NULL
+          && *wait > 0
+          && politeness_size(crawl->pages_to_crawl) 
+             < crawl->window + extraWindow
+          && (page = frontier_extract(crawl->frontier)) != NULL) {
+    recrawl_prepare(crawl->recrawl, page);
+    politeness_insert(crawl->pages_to_crawl, page);
+  }
+  return page;
+}
+
+/**************** crawl_wait ****************/
+/* Wait on crawl->more, with crawl->lock held, for at most 'wait' 
+ * milliseconds, or indefinitely if wait < 0.
+ */
+static void
+crawl_wait(crawl_t *crawl, const long wait)
+{
+  if (wait < 0) {
+    pthread_cond_wait(&crawl->more, &crawl->lock);
+  } else {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += wait / 1000;
+    until.tv_nsec += (wait % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&crawl->more, &crawl->lock, &until);
+  }
+}
+
+/**************** sleep_ms ****************/
+static void
+sleep_ms(const long ms)
+{
+  struct timespec delay = { ms / 1000, (ms % 1000) * 1000000L };
+  while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+    ;   // interrupted; sleep for the remainder
+  }
+}
+
+/**************** crawl_nextID ****************/
+/* Hand out the next document ID, for the crawl_t arg.  IDs are only
+ * assigned to pages that are saved, so they remain dense (1, 2, 3, ...)
+ * as index_build expects.
+ */
+static int
+crawl_nextID(void *arg)
+{
+  crawl_t *crawl = arg;
+  pthread_mutex_lock(&crawl->lock);
+  int documentID = crawl->documentID += crawl->idStep;
+  pthread_mutex_unlock(&crawl->lock);
+  return documentID;
+}
+
+/**************** crawl_checkpointDue ****************/
+/* Is it time for another checkpoint?
+ * Caller holds crawl->lock (or there is only one thread).
+ */
+static bool
+crawl_checkpointDue(crawl_t *crawl)
+{
+  return crawl->checkpoint > 0
+    && time(NULL) - crawl->lastCheckpoint >= crawl->checkpoint;
+}
+
+/**************** crawl_checkpoint ****************/
+/* Write a checkpoint of the crawl, which no page may be part way
+ * through.  If it fails, say so, and keep crawling; there will be
+ * another chance later.
+ * Caller holds crawl->lock (or there is only one thread).
+ */
+static void
+crawl_checkpoint(crawl_t *crawl)
+{
+  if (!checkpoint_save(crawl->pageDirectory, crawl->seedURL, crawl->maxDepth,
+                       crawl->documentID, crawl->pages_seen, crawl->frontier,
+                       crawl->pages_to_crawl)) {
+    fprintf(stderr, "crawler: cannot write checkpoint in '%s'\n",
+            crawl->pageDirectory);
+  }
+  crawl->lastCheckpoint = time(NULL);
+}
+
 /**************** page_scan ****************/
 /* Scan the given page to extract any links (URLs); for any not 
- * already seen before, add them to the bag of pages yet to crawl.
+ * already seen before, add them to the pages yet to crawl.
  */
 static void
-page_scan(webpage_t *page, bag_t *pages_to_crawl, hashtable_t *pages_seen)
+page_scan(webpage_t *page, crawl_t *crawl)
 {
   assertp(page, "page_scan page==NULL");
-  assertp(pages_to_crawl, "page_scan pages_to_crawl==NULL");
-  assertp(pages_seen, "page_scan pages_seen==NULL");
+  assertp(crawl, "page_scan crawl==NULL");
 
 
   // extract URLs from the page, and consider each in turn
-  char *url = NULL;        // will be filled with pointer to a new url
-  int pos = 0;                // start at beginning of page
-
-  while ((url = webpage_getNextURL(page, &pos)) != NULL) {
-    // check whether it is internal to crawl domain
-    if (IsInternalURL(url)) { // side effect: URL normalized
-      if (hashtable_insert(pages_seen, url, "seen")) {
-        // never seen it before: add it bag to to be crawled
-        webpage_t *new = webpage_new(url, webpage_getDepth(page)+1, NULL);
-        assertp(new, "webpage_new in page_scan");
-        bag_insert(pages_to_crawl, new);
-	// do not free(url) because it is saved in the webpage_t
-      } 
-      else {
-        // ignore it, we've seen it before
-	      free(url);
-      }
+  long long start = http_clock();
+  scan_t scan = { crawl, webpage_getDepth(page) + 1 };
+  webpage_scan(page, &scan, scan_link, NULL);
+  metrics_count(crawl->metrics, METRIC_SCANNED, 1);
+  metrics_time(crawl->metrics, METRIC_SCAN, http_clock() - start);
+}
+
+/**************** scan_link ****************/
+/* Consider one URL found by page_scan: if it is internal to the crawl
+ * domain and not seen before, add it to the pages yet to crawl.
+ */
+static void
+scan_link(void *arg, char *url)
+{
+  scan_t *scan = arg;
+  crawl_t *crawl = scan->crawl;
+
+  // check whether it is internal to crawl domain
+  if (IsInternalURL(url)) { // side effect: URL normalized
+    bool foreign = false;
+    pthread_mutex_lock(&crawl->lock);
+    if (!seenset_insert(crawl->pages_seen, url)) {
+      ;   // ignore it, we've seen it before
+    } else if (crawl->shard != NULL
+               && shard_owner(crawl->shard, url) != shard_id(crawl->shard)) {
+      foreign = true;   // another shard's: send it on, once, below
     } else {
-      free(url);
+      // never seen it before: add it to the pages to be crawled
+      if (!frontier_insert(crawl->frontier, url, scan->depth,
+                           url_priority(url))) {
+        fprintf(stderr, "crawler: cannot queue '%s'\n", url);
+      }
+      pthread_cond_signal(&crawl->more);
+      metrics_count(crawl->metrics, METRIC_LINKS, 1);
+      if (crawl->prefetch) {
+        page_prefetch(url);
+      }
+    }
+    pthread_mutex_unlock(&crawl->lock);
+    if (foreign && !shard_send(crawl->shard, url, scan->depth)) {
+      fprintf(stderr, "crawler: cannot send on '%s'\n", url);
     }
   }
 }
 
+/**************** page_index ****************/
+/* Queue a copy of a page just saved, to be indexed by stage_index,
+ * waiting while the queue is full.  The copy leaves the page itself
+ * free to be scanned meanwhile.
+ */
+static void
+page_index(webpage_t *page, const int documentID, crawl_t *crawl)
+{
+  size_t len = webpage_getHTMLLength(page);
+  char *html = assertp(malloc(len + 1), "index html");
+  memcpy(html, webpage_getHTML(page), len + 1);
+  indexed_t *item = assertp(count_malloc(sizeof(indexed_t)), "indexed");
+  item->page = assertp(webpage_newCopy(webpage_getURL(page),
+                                       webpage_getDepth(page)), "index page");
+  webpage_setHTML(item->page, html);
+  item->documentID = documentID;
+  stageq_put(crawl->indexq, item);
+}
+
+/**************** stage_index ****************/
+/* The thread that adds the pages in crawl->indexq to crawl->index,
+ * until indexq is closed; only it touches the index meanwhile.
+ */
+static void *
+stage_index(void *arg)
+{
+  crawl_t *crawl = arg;
+  indexed_t *item;
+
+  while ( (item = stageq_get(crawl->indexq)) != NULL) {
+    index_page(crawl->index, item->page, item->documentID);
+    webpage_delete(item->page);
+    count_free(item);
+  }
+  return NULL;
+}
+
+/**************** crawl_gauges ****************/
+/* Bring the metrics' gauges up to date, for metrics_start's thread. */
+static void
+crawl_gauges(void *arg, metrics_t *metrics)
+{
+  crawl_t *crawl = arg;
+  pthread_mutex_lock(&crawl->lock);
+  metrics_gauge(metrics, METRIC_FRONTIER, frontier_size(crawl->frontier)
+                + politeness_size(crawl->pages_to_crawl));
+  metrics_gauge(metrics, METRIC_ACTIVE, crawl->active);
+  pthread_mutex_unlock(&crawl->lock);
+  metrics_gauge(metrics, METRIC_SAVEQ, stageq_depth(crawl->saveq));
+  metrics_gauge(metrics, METRIC_SCANQ, stageq_depth(crawl->scanq));
+}
 
+/**************** page_prefetch ****************/
+/* Start resolving the hostname of url in the background, so that the
+ * name is in the dnscache by the time the page is fetched.
+ */
+static void
+page_prefetch(const char *url)
+{
+  // the hostname is between "//" and any port or path
+  const char *host = strstr(url, "//");
+  if (host == NULL) {
+    return;
+  }
+  host += 2;
+  size_t len = strcspn(host, ":/");
+  char hostname[256];
+  if (len > 0 && len < sizeof(hostname)) {
+    memcpy(hostname, host, len);
+    hostname[len] = '\0';
+    dnscache_prefetch(hostname);
+  }
+}
 
+/**************** url_priority ****************/
+/* The priority of a URL for the 'priority' crawl order: the number of
+ * segments in its path, so pages near the top of a site come first.
+ */
+static int
+url_priority(const char *url)
+{
+  const char *path = strstr(url, "//");
+  path = (path != NULL) ? strchr(path + 2, '/') : NULL;
+  int segments = 0;
+  for (; path != NULL; path = strchr(path + 1, '/')) {
+    segments++;
+  }
+  return segments;
+}
@@ -0,0 +1,547 @@
+/*
+ * dedup.c - the crawler's 'dedup' module
+ *
+ * see dedup.h for more information.
+ *
+ * Exact copies are found by a 64-bit FNV-1a hash of the html, kept with
+ * the html's length in an open-addressed table.  Near copies are found
+ * by a 64-bit SimHash: each run of SHINGLE consecutive words (a
+ * 'shingle', so that word order counts, not just which words are used)
+ * is hashed, and bit b of the SimHash is set if more shingle hashes
+ * have bit b set than not.  (Short shingles would make pages written
+ * from a small vocabulary, or from one template, all look alike.)
+ * Pages whose SimHashes differ in at most NEAR_BITS bits are near
+ * copies.  To find those without comparing every pair, each SimHash is
+ * filed under each of its four 16-bit blocks; two SimHashes that differ
+ * in at most three bits must agree in at least one block, so only those
+ * filed under one of the page's own blocks need be compared.
+ *
+ * Antony Guzman, 2020
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "dedup.h"
+#include "webpage.h"
+#include "htmlscan.h"
+#include "pagedir.h"
+#include "memory.h"
+
+/**************** file-local global variables ****************/
+static const char duplicatesFile[] = ".duplicates";
+static const int NEAR_BITS = 3;         // SimHash bits that may differ
+static const int MIN_SHINGLES = 8;      // fewer, and only exact copies count
+#define SHINGLE 8                       // words per shingle
+#define SHINGLE_BASE 0x100000001b3ULL   // multiplier of the rolling hash
+static const int MIN_WORD = 3;          // shorter words are not indexed
+#define BLOCKS 4                        // SimHash blocks, of BLOCK_BITS each
+#define BLOCK_BITS 16
+#define BLOCK_SLOTS (1 << BLOCK_BITS)
+
+/**************** local types ****************/
+typedef struct fingerprint {
+  uint64_t hash;              // FNV-1a hash of the whole html
+  size_t length;              // length of the html
+  uint64_t sim;               // SimHash of its shingles
+  int shingles;               // how many shingles that took
+} fingerprint_t;
+
+typedef struct exact {
+  uint64_t hash;              // as in fingerprint_t
+  size_t length;
+  int id;                     // the page saved, or 0 for an empty slot
+} exact_t;
+
+typedef struct print {
+  uint64_t sim;               // SimHash of the page saved
+  int id;                     // its document ID
+  int next[BLOCKS];           // next print filed under each block, or -1
+} print_t;
+
+typedef struct counter {
+  uint64_t hash;              // hash of a word, or 0 for an empty slot
+  int count;                  // times the word appears
+} counter_t;
+
+/* The state of fingerprint's scan of the words, for shingle_word. */
+typedef struct shingler {
+  uint32_t ones[64];          // shingle hashes with each bit set
+  uint64_t words[SHINGLE];    // hashes of the last SHINGLE words
+  uint64_t rolling;           // rolling hash of them
+  uint64_t drop;              // weight of a word SHINGLE words back
+  int nwords;                 // words so far
+  int shingles;               // shingles so far
+} shingler_t;
+
+/* The state of index_bytes's scan of the words, for count_word. */
+typedef struct wordcounts {
+  counter_t *counts;          // hash table of words
+  size_t slots;               // a power of two
+  size_t used;
+} wordcounts_t;
+
+/**************** global types ****************/
+typedef struct dedup {
+  char *pageDirectory;
+  dedup_mode_t mode;
+  FILE *duplicates;           // the record, open for appending
+  pthread_mutex_t lock;       // guards everything below
+  exact_t *exact;             // hash table of exact fingerprints
+  size_t exactSlots;          // a power of two
+  size_t nexact;
+  print_t *prints;            // SimHashes, in the order they were noted
+  int nprints, printcap;
+  int *heads;                 // [block][block value] -> first print, or -1
+  int lastID;                 // the highest document ID noted
+  long pages;                 // pages given to dedup_page
+  long exactCopies, nearCopies;
+  long diskBytes;             // bytes of page files not written
+  long indexBytes;            // bytes of index not written, roughly
+} dedup_t;
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static void fingerprint(const char *html, const bool near, fingerprint_t *fp);
+static void shingle_word(void *arg, const char *word, const size_t length);
+static void count_word(void *arg, const char *word, const size_t length);
+static uint64_t word_hash(const char *word, const size_t length);
+static int find_exact(dedup_t *d, const fingerprint_t *fp);
+static int find_near(dedup_t *d, const fingerprint_t *fp);
+static void note(dedup_t *d, const fingerprint_t *fp, const int documentID);
+static long index_bytes(const char *html, const int documentID);
+static int digits(long n);
+static uint64_t mix(uint64_t x);
+
+/**************** dedup_new() ****************/
+/* see dedup.h for description */
+dedup_t *
+dedup_new(const char *pageDirectory, const dedup_mode_t mode, const bool fresh)
+{
+  if (pageDirectory == NULL) {
+    return NULL;
+  }
+  dedup_t *d = assertp(count_calloc(1, sizeof(dedup_t)), "dedup_t");
+  d->pageDirectory = assertp(malloc(strlen(pageDirectory) + 1),
+                             "dedup pageDirectory");
+  strcpy(d->pageDirectory, pageDirectory);
+  d->mode = mode;
+  pthread_mutex_init(&d->lock, NULL);
+
+  d->exactSlots = 1024;
+  d->exact = assertp(calloc(d->exactSlots, sizeof(exact_t)), "dedup exact");
+  if (mode == DEDUP_NEAR) {
+    d->heads = assertp(malloc(BLOCKS * BLOCK_SLOTS * sizeof(int)),
+                       "dedup heads");
+    memset(d->heads, 0xff, BLOCKS * BLOCK_SLOTS * sizeof(int));  // all -1
+  }
+
+  char *filename = assertp(malloc(strlen(pageDirectory)
+                                  + sizeof(duplicatesFile) + 1),
+                           "dedup filename");
+  sprintf(filename, "%s/%s", pageDirectory, duplicatesFile);
+  d->duplicates = fopen(filename, fresh ? "w" : "a");
+  free(filename);
+  if (d->duplicates == NULL) {
+    dedup_delete(d);
+    return NULL;
+  }
+  return d;
+}
+
+/**************** dedup_parseMode() ****************/
+/* see dedup.h for description */
+bool
+dedup_parseMode(const char *name, dedup_mode_t *mode)
+{
+  if (name == NULL || mode == NULL) {
+    return false;
+  } else if (strcmp(name, "exact") == 0) {
+    *mode = DEDUP_EXACT;
+  } else if (strcmp(name, "near") == 0) {
+    *mode = DEDUP_NEAR;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**************** dedup_load() ****************/
+/* see dedup.h for description */
+int
+dedup_load(dedup_t *d, const int lastID)
+{
+  if (d == NULL) {
+    return 0;
+  }
+  int loaded = 0;
+  for (int id = 1; id <= lastID; id++) {
+    webpage_t *saved = page_load(d->pageDirectory, id);
+    if (saved == NULL) {
+      continue;
+    }
+    // page_save added a newline, which the fetched html did not have
+    char *html = webpage_getHTML(saved);
+    size_t len = strlen(html);
+    if (len > 0 && html[len-1] == '\n') {
+      html[len-1] = '\0';
+    }
+    fingerprint_t fp;
+    fingerprint(html, d->mode == DEDUP_NEAR, &fp);
+    pthread_mutex_lock(&d->lock);
+    note(d, &fp, id);
+    pthread_mutex_unlock(&d->lock);
+    webpage_delete(saved);
+    loaded++;
+  }
+  return loaded;
+}
+
+/**************** dedup_page() ****************/
+/* see dedup.h for description */
+int
+dedup_page(dedup_t *d, webpage_t *page, int (*newID)(void *arg), void *arg)
+{
+  if (d == NULL || page == NULL || webpage_getHTML(page) == NULL) {
+    return newID(arg);
+  }
+  const char *html = webpage_getHTML(page);
+  fingerprint_t fp;
+  fingerprint(html, d->mode == DEDUP_NEAR, &fp);
+
+  pthread_mutex_lock(&d->lock);
+  d->pages++;
+  bool near = false;
+  int canonical = find_exact(d, &fp);
+  if (canonical == 0 && d->mode == DEDUP_NEAR) {
+    canonical = find_near(d, &fp);
+    near = (canonical != 0);
+  }
+  if (canonical == 0) {
+    // a page we have not seen: it gets the next ID
+    int documentID = newID(arg);
+    note(d, &fp, documentID);
+    pthread_mutex_unlock(&d->lock);
+    return documentID;
+  }
+  const int lastID = d->lastID;
+  pthread_mutex_unlock(&d->lock);
+
+  // a copy: count what saving and indexing it would have cost
+  const char *url = webpage_getURL(page);
+  long disk = strlen(url) + digits(webpage_getDepth(page)) + fp.length + 3;
+  long index = index_bytes(html, lastID + 1);
+  pthread_mutex_lock(&d->lock);
+  if (near) {
+    d->nearCopies++;
+  } else {
+    d->exactCopies++;
+  }
+  d->diskBytes += disk;
+  d->indexBytes += index;
+  fprintf(d->duplicates, "%d %s %s\n", canonical, near ? "near" : "exact",
+          url);
+  pthread_mutex_unlock(&d->lock);
+  return 0;
+}
+
+/**************** dedup_report() ****************/
+/* see dedup.h for description */
+void
+dedup_report(dedup_t *d, FILE *fp, const char *message)
+{
+  if (d == NULL || fp == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&d->lock);
+  fprintf(fp, "%s: %ld pages, %ld exact and %ld near copies not saved, "
+          "%ld bytes of pages and about %ld bytes of index spared\n",
+          message, d->pages, d->exactCopies, d->nearCopies,
+          d->diskBytes, d->indexBytes);
+  pthread_mutex_unlock(&d->lock);
+}
+
+/**************** dedup_delete() ****************/
+/* see dedup.h for description */
+bool
+dedup_delete(dedup_t *d)
+{
+  if (d == NULL) {
+    return true;
+  }
+  bool ok = true;
+  if (d->duplicates != NULL) {
+    ok = (fclose(d->duplicates) == 0);
+  }
+  free(d->exact);
+  if (d->prints != NULL) {
+    free(d->prints);
+  }
+  if (d->heads != NULL) {
+    free(d->heads);
+  }
+  pthread_mutex_destroy(&d->lock);
+  free(d->pageDirectory);
+  count_free(d);
+  return ok;
+}
+
+/**************** fingerprint ****************/
+/* Fill in *fp for html: its hash and length, and, if near, its SimHash.
+ */
+static void
+fingerprint(const char *html, const bool near, fingerprint_t *fp)
+{
+  // FNV-1a, over every byte
+  uint64_t hash = 14695981039346656037ULL;
+  const char *p;
+  for (p = html; *p != '\0'; p++) {
+    hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+  }
+  fp->hash = hash;
+  fp->length = p - html;
+  fp->sim = 0;
+  fp->shingles = 0;
+  if (!near) {
+    return;
+  }
+
+  // SimHash, over the shingles: a rolling hash of the last SHINGLE words
+  // (words[] holds them) gives each shingle's hash, scrambled by mix
+  shingler_t shingler = { .rolling = 0, .drop = 1, .nwords = 0 };
+  for (int w = 0; w < SHINGLE; w++) {
+    shingler.drop *= SHINGLE_BASE;
+  }
+  htmlscan(html, fp->length, &shingler, NULL, shingle_word);
+  fp->shingles = shingler.shingles;
+  for (int b = 0; b < 64; b++) {
+    if (2 * shingler.ones[b] > (uint32_t)fp->shingles) {
+      fp->sim |= (uint64_t)1 << b;
+    }
+  }
+}
+
+/**************** shingle_word ****************/
+/* Add the next word of the page to the shingler_t arg: roll it into the
+ * rolling hash, and once there are SHINGLE words, count the bits of
+ * each shingle's hash.
+ */
+static void
+shingle_word(void *arg, const char *word, const size_t length)
+{
+  shingler_t *sh = arg;
+  uint64_t hash = word_hash(word, length);
+  sh->rolling = sh->rolling * SHINGLE_BASE + hash;
+  if (sh->nwords >= SHINGLE) {
+    sh->rolling -= sh->drop * sh->words[sh->nwords % SHINGLE];
+  }
+  sh->words[sh->nwords++ % SHINGLE] = hash;
+  if (sh->nwords < SHINGLE) {
+    return;
+  }
+  uint64_t shingle = mix(sh->rolling);
+  for (int b = 0; b < 64; b++) {
+    sh->ones[b] += (shingle >> b) & 1;
+  }
+  sh->shingles++;
+}
+
+/**************** word_hash ****************/
+/* Return the FNV-1a hash of the word in lower case. */
+static uint64_t
+word_hash(const char *word, const size_t length)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    h = (h ^ (unsigned char)tolower((unsigned char)word[i])) * 1099511628211ULL;
+  }
+  return h;
+}
+
+/**************** find_exact ****************/
+/* Return the ID of a page noted with the same hash and length, or 0.
+ * Caller holds d->lock.
+ */
+static int
+find_exact(dedup_t *d, const fingerprint_t *fp)
+{
+  size_t mask = d->exactSlots - 1;
+  for (size_t i = fp->hash & mask; d->exact[i].id != 0; i = (i + 1) & mask) {
+    if (d->exact[i].hash == fp->hash && d->exact[i].length == fp->length) {
+      return d->exact[i].id;
+    }
+  }
+  return 0;
+}
+
+/**************** find_near ****************/
+/* Return the ID of a page noted with a SimHash at most NEAR_BITS bits
+ * from fp's, or 0.  Pages with too few shingles have no such neighbours.
+ * Caller holds d->lock.
+ */
+static int
+find_near(dedup_t *d, const fingerprint_t *fp)
+{
+  if (fp->shingles < MIN_SHINGLES) {
+    return 0;
+  }
+  for (int k = 0; k < BLOCKS; k++) {
+    int block = (fp->sim >> (k * BLOCK_BITS)) & (BLOCK_SLOTS - 1);
+    for (int i = d->heads[k * BLOCK_SLOTS + block]; i >= 0;
+         i = d->prints[i].next[k]) {
+      if (__builtin_popcountll(d->prints[i].sim ^ fp->sim) <= NEAR_BITS) {
+        return d->prints[i].id;
+      }
+    }
+  }
+  return 0;
+}
+
+/**************** note ****************/
+/* Note fp as the fingerprint of the page saved as documentID.
+ * Caller holds d->lock.
+ */
+static void
+note(dedup_t *d, const fingerprint_t *fp, const int documentID)
+{
+  if (documentID > d->lastID) {
+    d->lastID = documentID;
+  }
+
+  // the exact table stays at most half full
+  if (2 * (d->nexact + 1) > d->exactSlots) {
+    exact_t *old = d->exact;
+    size_t oldSlots = d->exactSlots;
+    d->exactSlots *= 2;
+    d->exact = assertp(calloc(d->exactSlots, sizeof(exact_t)), "dedup exact");
+    for (size_t j = 0; j < oldSlots; j++) {
+      if (old[j].id != 0) {
+        size_t i = old[j].hash & (d->exactSlots - 1);
+        while (d->exact[i].id != 0) {
+          i = (i + 1) & (d->exactSlots - 1);
+        }
+        d->exact[i] = old[j];
+      }
+    }
+    free(old);
+  }
+  if (find_exact(d, fp) == 0) {
+    size_t i = fp->hash & (d->exactSlots - 1);
+    while (d->exact[i].id != 0) {
+      i = (i + 1) & (d->exactSlots - 1);
+    }
+    d->exact[i] = (exact_t){ fp->hash, fp->length, documentID };
+    d->nexact++;
+  }
+
+  if (d->heads == NULL || fp->shingles < MIN_SHINGLES) {
+    return;
+  }
+  if (d->nprints == d->printcap) {
+    d->printcap = d->printcap > 0 ? 2 * d->printcap : 1024;
+    d->prints = assertp(realloc(d->prints, d->printcap * sizeof(print_t)),
+                        "dedup prints");
+  }
+  print_t *print = &d->prints[d->nprints];
+  print->sim = fp->sim;
+  print->id = documentID;
+  for (int k = 0; k < BLOCKS; k++) {
+    int *head = &d->heads[k * BLOCK_SLOTS
+                          + ((fp->sim >> (k * BLOCK_BITS)) & (BLOCK_SLOTS - 1))];
+    print->next[k] = *head;
+    *head = d->nprints;
+  }
+  d->nprints++;
+}
+
+/**************** index_bytes ****************/
+/* Estimate the bytes the indexer would add to the index file for html
+ * saved as documentID: " documentID count" for each distinct word
+ * it would index.
+ */
+static long
+index_bytes(const char *html, const int documentID)
+{
+  wordcounts_t wc = { NULL, 256, 0 };
+  wc.counts = assertp(calloc(wc.slots, sizeof(counter_t)), "dedup counts");
+  htmlscan(html, strlen(html), &wc, NULL, count_word);
+
+  long bytes = 0;
+  for (size_t i = 0; i < wc.slots; i++) {
+    if (wc.counts[i].hash != 0) {
+      bytes += 2 + digits(documentID) + digits(wc.counts[i].count);
+    }
+  }
+  free(wc.counts);
+  return bytes;
+}
+
+/**************** count_word ****************/
+/* Count the next word of the page in the wordcounts_t arg, if the
+ * indexer would index it.
+ */
+static void
+count_word(void *arg, const char *word, const size_t length)
+{
+  wordcounts_t *wc = arg;
+  if (length < MIN_WORD) {
+    return;
+  }
+  uint64_t hash = word_hash(word, length) | 1;  // never 0, an empty slot
+  if (2 * (wc->used + 1) > wc->slots) {
+    // keep the table at most half full
+    counter_t *old = wc->counts;
+    size_t slots = 2 * wc->slots;
+    wc->counts = assertp(calloc(slots, sizeof(counter_t)), "dedup counts");
+    for (size_t j = 0; j < wc->slots; j++) {
+      if (old[j].hash != 0) {
+        size_t i = old[j].hash & (slots - 1);
+        while (wc->counts[i].hash != 0) {
+          i = (i + 1) & (slots - 1);
+        }
+        wc->counts[i] = old[j];
+      }
+    }
+    free(old);
+    wc->slots = slots;
+  }
+  size_t i = hash & (wc->slots - 1);
+  while (wc->counts[i].hash != 0 && wc->counts[i].hash != hash) {
+    i = (i + 1) & (wc->slots - 1);
+  }
+  if (wc->counts[i].hash == 0) {
+    wc->counts[i].hash = hash;
+    wc->used++;
+  }
+  wc->counts[i].count++;
+}
+
+/**************** digits ****************/
+/* The number of decimal digits in n >= 0. */
+static int
+digits(long n)
+{
+  int d = 1;
+  for (; n >= 10; n /= 10) {
+    d++;
+  }
+  return d;
+}
+
+/**************** mix ****************/
+/* Scramble the bits of x (the splitmix64 finalizer), so that every bit
+ * of the result depends on every bit of x.
+ */
+static uint64_t
+mix(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
@@ -0,0 +1,97 @@
+/*
+ * dedup.h - header file for the crawler's 'dedup' module
+ *
+ * The 'dedup' module keeps the crawler from saving the same page twice
+ * under different URLs.  It fingerprints each page it is given with a
+ * hash of its whole html, which catches exact copies, and, if asked to,
+ * with a SimHash of the words in its text (outside tags), which catches
+ * copies that differ in a few words.  A page whose fingerprint matches
+ * that of a page already saved is not saved; instead a line naming the
+ * page saved before, its 'canonical' document ID, is added to the file
+ * '.duplicates' in the pageDirectory:
+ *
+ *   canonicalID exact|near URL
+ *
+ * A dedup_t may be shared by several threads.
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __DEDUP_H
+#define __DEDUP_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "webpage.h"
+
+/**************** global types ****************/
+typedef struct dedup dedup_t;  // opaque to users of the module
+
+typedef enum {
+  DEDUP_EXACT, DEDUP_NEAR
+} dedup_mode_t;
+
+/**************** functions ****************/
+
+/**************** dedup_new ****************/
+/* Create a new dedup_t, with no pages in it.
+ *
+ * Caller provides:
+ *   the pageDirectory; the mode, DEDUP_EXACT for exact copies only or
+ *   DEDUP_NEAR for near copies as well; and fresh, if this is a new
+ *   crawl, whose '.duplicates' replaces any earlier one (otherwise we
+ *   add to it).
+ * We return:
+ *   pointer to a new dedup_t, or NULL if '.duplicates' can't be opened.
+ * Caller is responsible for:
+ *   later calling dedup_delete.
+ */
+dedup_t *dedup_new(const char *pageDirectory, const dedup_mode_t mode,
+                   const bool fresh);
+
+/**************** dedup_parseMode ****************/
+/* Set *mode from its name: "exact" or "near".
+ * Returns false if the name is not one of those.
+ */
+bool dedup_parseMode(const char *name, dedup_mode_t *mode);
+
+/**************** dedup_load ****************/
+/* Fingerprint the pages already saved in the pageDirectory, 1 to
+ * lastID, so that later pages are compared with them too.  Pages that
+ * can't be read are skipped.  Returns the number of pages read.
+ */
+int dedup_load(dedup_t *d, const int lastID);
+
+/**************** dedup_page ****************/
+/* Decide whether a fetched page should be saved.
+ *
+ * Caller provides:
+ *   a page with html; and newID(arg), which hands out the next document
+ *   ID, and which we call (with our own lock held) only if the page is
+ *   to be saved.
+ * We return:
+ *   the new document ID, under which the caller must save the page;
+ *   or 0 if the page is a copy of one saved before, in which case we
+ *   have recorded it in '.duplicates'.
+ * Notes:
+ *   The fingerprint is noted before we return, so of two copies of a
+ *   page fetched at once, only one is saved.
+ */
+int dedup_page(dedup_t *d, webpage_t *page,
+               int (*newID)(void *arg), void *arg);
+
+/**************** dedup_report ****************/
+/* Print the counters to fp on one line, prefixed by message: pages
+ * seen, exact and near copies not saved, and (for those) the bytes not
+ * written to the pageDirectory and the bytes, roughly, that the indexer
+ * would have added to the index file.
+ */
+void dedup_report(dedup_t *d, FILE *fp, const char *message);
+
+/**************** dedup_delete ****************/
+/* Close '.duplicates' and free d.  Returns false if '.duplicates'
+ * could not be written.  Ignores NULL.
+ */
+bool dedup_delete(dedup_t *d);
+
+#endif // __DEDUP_H
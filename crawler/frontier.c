@@ -0,0 +1,830 @@
+/*
+ * frontier.c - the crawler's 'frontier' module
+ *
+ * see frontier.h for more information.
+ *
+ * Every URL becomes an entry with a sort key: (depth, seq) for BFS,
+ * (-seq) for DFS, and (priority, depth, seq) for PRIORITY, where seq
+ * counts insertions.  In memory the entries live in a binary min-heap.
+ * When they outgrow the budget we sort the heap (a sorted array is a
+ * heap too), keep the better half, and write the worse half to the end
+ * of the spill file as one 'run'.  Each run keeps only a small read
+ * buffer and its next entry (its 'head') in memory; the next URL out
+ * of the frontier is the least of the heap's top and the runs' heads.
+ * If there come to be too many runs, they are merged into one.
+ *
+ * On disk each entry is a sequence of varints -- the key (zigzagged),
+ * seq, depth, the length of the prefix shared with the previous URL in
+ * the run, and the length of the rest -- then the rest of the URL.
+ *
+ * Entries are allocated by size from the slabs in memory.h, since the
+ * crawler makes and frees one for nearly every link it finds.
+ *
+ * Antony Guzman, 2020
+ */
+
+#define _GNU_SOURCE       // pread, pwrite
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "frontier.h"
+#include "webpage.h"
+#include "memory.h"
+
+/**************** file-local global variables ****************/
+static const size_t MIN_MEMORY = 65536;   // smallest budget we accept
+static const size_t RUNBUF = 4096;        // bytes of a run read at once
+static const size_t WRITEBUF = 65536;     // bytes of a run written at once
+static const int MAX_RUNS = 64;           // merge the runs beyond this
+static const int MIN_SPILL = 16;          // never spill fewer entries
+
+/**************** local types ****************/
+typedef struct entry {
+  long long key;              // sorts first
+  long long seq;              // then insertion order
+  int depth;                  // the page's depth
+  char url[];                 // the URL, null-terminated
+} entry_t;
+
+typedef struct run {
+  off_t pos, end;             // bytes of the run not yet read into buf
+  unsigned char *buf;         // bytes read but not yet decoded
+  size_t buflen, bufpos;
+  long remaining;             // entries not yet decoded
+  entry_t *head;              // the run's next entry, or NULL
+} run_t;
+
+/* An encoder builds a run in a buffer, writing it out when it fills. */
+typedef struct encoder {
+  int fd;                     // the file to write to
+  unsigned char *data;        // encoded bytes not yet written
+  size_t len, cap;
+  off_t offset;               // where in the file they go
+  char *prev;                 // the previous URL encoded
+  size_t prevcap;
+} encoder_t;
+
+/**************** global types ****************/
+typedef struct frontier {
+  frontier_order_t order;
+  size_t maxMemory;           // budget for entries, heap, and runs
+  char *spillName;            // pathname of the spill file
+  int fd;                     // the spill file, or -1 if not yet open
+  off_t fileEnd;              // where the next run goes
+  entry_t **heap;             // in-memory entries, min-heap by key
+  int nheap, heapcap;
+  run_t **runs;               // spilled runs with entries left
+  int nruns, runcap;
+  size_t heapMemory;          // bytes of the entries in the heap
+  long long seq;              // insertions so far
+  long size;                  // entries, in memory or on disk
+  long spilled;               // entries written to a run (not merges)
+  long long spillBytes;       // ... and the bytes that took
+  size_t peak;                // most memory used
+} frontier_t;
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static int entry_cmp(const entry_t *a, const entry_t *b);
+static int entry_qsort(const void *a, const void *b);
+static size_t entry_size(const entry_t *e);
+static entry_t *entry_new(const size_t len);
+static void entry_free(entry_t *e);
+static size_t memory_used(frontier_t *f);
+static void heap_push(frontier_t *f, entry_t *e);
+static entry_t *heap_pop(frontier_t *f);
+static bool spill(frontier_t *f);
+static bool merge(frontier_t *f);
+static bool run_add(frontier_t *f, off_t start, off_t end, long count);
+static void run_remove(frontier_t *f, int i);
+static bool run_advance(frontier_t *f, run_t *r);
+static bool run_byte(frontier_t *f, run_t *r, unsigned char *c);
+static bool run_varint(frontier_t *f, run_t *r, unsigned long long *v);
+static bool enc_put(encoder_t *enc, const entry_t *e);
+static bool enc_varint(encoder_t *enc, unsigned long long v);
+static bool enc_bytes(encoder_t *enc, const void *bytes, size_t n);
+static bool enc_flush(encoder_t *enc);
+static bool write_all(int fd, const unsigned char *data, size_t n, off_t at);
+
+/**************** frontier_new() ****************/
+/* see frontier.h for description */
+frontier_t *
+frontier_new(const frontier_order_t order, const size_t maxMemory,
+             const char *spillFile)
+{
+  if (maxMemory < MIN_MEMORY || spillFile == NULL) {
+    return NULL;
+  }
+  frontier_t *f = count_calloc(1, sizeof(frontier_t));
+  if (f == NULL) {
+    return NULL;
+  }
+  f->spillName = count_malloc(strlen(spillFile) + 1);
+  f->heapcap = 64;
+  f->heap = count_calloc(f->heapcap, sizeof(entry_t *));
+  f->runcap = 8;
+  f->runs = count_calloc(f->runcap, sizeof(run_t *));
+  if (f->spillName == NULL || f->heap == NULL || f->runs == NULL) {
+    if (f->spillName != NULL) count_free(f->spillName);
+    if (f->heap != NULL) count_free(f->heap);
+    if (f->runs != NULL) count_free(f->runs);
+    count_free(f);
+    return NULL;
+  }
+  strcpy(f->spillName, spillFile);
+  f->order = order;
+  f->maxMemory = maxMemory;
+  f->fd = -1;
+  return f;
+}
+
+/**************** frontier_parseOrder() ****************/
+/* see frontier.h for description */
+bool
+frontier_parseOrder(const char *name, frontier_order_t *order)
+{
+  if (name == NULL || order == NULL) {
+    return false;
+  } else if (strcmp(name, "bfs") == 0) {
+    *order = FRONTIER_BFS;
+  } else if (strcmp(name, "dfs") == 0) {
+    *order = FRONTIER_DFS;
+  } else if (strcmp(name, "priority") == 0) {
+    *order = FRONTIER_PRIORITY;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**************** frontier_insert() ****************/
+/* see frontier.h for description */
+bool
+frontier_insert(frontier_t *f, const char *url, const int depth,
+                const int priority)
+{
+  if (f == NULL || url == NULL || depth < 0) {
+    return false;
+  }
+  size_t len = strlen(url);
+  entry_t *e = entry_new(len);
+  if (e == NULL) {
+    return false;
+  }
+  e->seq = ++f->seq;
+  e->depth = depth;
+  memcpy(e->url, url, len + 1);
+  switch (f->order) {
+  case FRONTIER_BFS:      e->key = depth;                               break;
+  case FRONTIER_DFS:      e->key = -e->seq;                             break;
+  case FRONTIER_PRIORITY: e->key = (long long)priority * (1LL<<32) + depth;
+                          break;
+  }
+
+  heap_push(f, e);
+  f->size++;
+
+  // over budget? spill the worse half of the heap
+  while (memory_used(f) > f->maxMemory && f->nheap >= MIN_SPILL) {
+    if (!spill(f)) {
+      return false;
+    }
+  }
+  size_t used = memory_used(f);
+  f->peak = used > f->peak ? used : f->peak;
+  return true;
+}
+
+/**************** frontier_extract() ****************/
+/* see frontier.h for description */
+webpage_t *
+frontier_extract(frontier_t *f)
+{
+  if (f == NULL) {
+    return NULL;
+  }
+
+  // the least of the heap's top and the runs' heads
+  entry_t *best = (f->nheap > 0) ? f->heap[0] : NULL;
+  int from = -1;        // the run it came from, or -1 for the heap
+  for (int i = 0; i < f->nruns; i++) {
+    if (best == NULL || entry_cmp(f->runs[i]->head, best) < 0) {
+      best = f->runs[i]->head;
+      from = i;
+    }
+  }
+  if (best == NULL) {
+    return NULL;
+  }
+
+  if (from < 0) {
+    heap_pop(f);
+  } else {
+    // decode the run's next entry, which needs this one as its prefix
+    run_t *r = f->runs[from];
+    if (!run_advance(f, r) || r->head == NULL) {
+      run_remove(f, from);
+    }
+  }
+  f->size--;
+
+  // the last run is gone: start the spill file over
+  if (f->nruns == 0 && f->fileEnd > 0) {
+    if (ftruncate(f->fd, 0) == 0) {
+      f->fileEnd = 0;
+    }
+  }
+
+  webpage_t *page = webpage_newCopy(best->url, best->depth);
+  entry_free(best);
+  return page;
+}
+
+/**************** frontier_size() ****************/
+/* see frontier.h for description */
+long
+frontier_size(frontier_t *f)
+{
+  return f == NULL ? 0 : f->size;
+}
+
+/**************** frontier_iterate() ****************/
+/* see frontier.h for description */
+bool
+frontier_iterate(frontier_t *f, void *arg,
+                 void (*itemfunc)(void *arg, const char *url, const int depth))
+{
+  if (f == NULL || itemfunc == NULL) {
+    return false;
+  }
+  for (int i = 0; i < f->nheap; i++) {
+    (*itemfunc)(arg, f->heap[i]->url, f->heap[i]->depth);
+  }
+
+  // read each run through a copy of it, leaving the run where it was
+  bool ok = true;
+  unsigned char *buf = count_malloc(RUNBUF);
+  for (int i = 0; ok && buf != NULL && i < f->nruns; i++) {
+    run_t copy = *f->runs[i];
+    copy.buf = buf;
+    memcpy(buf, f->runs[i]->buf, copy.buflen);
+    size_t headsize = entry_size(copy.head);
+    if ( (copy.head = entry_new(strlen(copy.head->url))) == NULL) {
+      ok = false;
+      break;
+    }
+    memcpy(copy.head, f->runs[i]->head, headsize);
+    while (copy.head != NULL) {
+      entry_t *e = copy.head;
+      (*itemfunc)(arg, e->url, e->depth);
+      ok = run_advance(f, &copy);
+      entry_free(e);
+      if (!ok) {
+        break;
+      }
+    }
+    if (copy.head != NULL) entry_free(copy.head);
+  }
+  if (buf == NULL) {
+    return false;
+  }
+  count_free(buf);
+  return ok;
+}
+
+/**************** frontier_report() ****************/
+/* see frontier.h for description */
+void
+frontier_report(frontier_t *f, FILE *fp, const char *message)
+{
+  if (f == NULL || fp == NULL) {
+    return;
+  }
+  fprintf(fp, "%s: %lld URLs, %ld spilled in %lld bytes, "
+          "peak memory %zuKB\n",
+          message, f->seq, f->spilled, f->spillBytes, f->peak / 1024);
+}
+
+/**************** frontier_delete() ****************/
+/* see frontier.h for description */
+void
+frontier_delete(frontier_t *f)
+{
+  if (f != NULL) {
+    while (f->nheap > 0) {
+      entry_free(heap_pop(f));
+    }
+    while (f->nruns > 0) {
+      run_remove(f, f->nruns - 1);
+    }
+    if (f->fd >= 0) {
+      close(f->fd);
+      unlink(f->spillName);
+    }
+    count_free(f->heap);
+    count_free(f->runs);
+    count_free(f->spillName);
+    count_free(f);
+  }
+}
+
+/**************** entry_cmp ****************/
+/* Order two entries by key, then by seq. */
+static int
+entry_cmp(const entry_t *a, const entry_t *b)
+{
+  if (a->key != b->key) {
+    return a->key < b->key ? -1 : 1;
+  }
+  if (a->seq != b->seq) {
+    return a->seq < b->seq ? -1 : 1;
+  }
+  return 0;
+}
+
+/**************** entry_qsort ****************/
+/* entry_cmp, for qsort on an array of entry pointers */
+static int
+entry_qsort(const void *a, const void *b)
+{
+  return entry_cmp(*(entry_t * const *)a, *(entry_t * const *)b);
+}
+
+/**************** entry_size ****************/
+static size_t
+entry_size(const entry_t *e)
+{
+  return sizeof(entry_t) + strlen(e->url) + 1;
+}
+
+/**************** entry_new ****************/
+/* Allocate an entry for a URL of len characters, or return NULL. */
+static entry_t *
+entry_new(const size_t len)
+{
+  return slab_allocSize(sizeof(entry_t) + len + 1);
+}
+
+/**************** entry_free ****************/
+/* Free an entry, whose URL must be as long as it was made for. */
+static void
+entry_free(entry_t *e)
+{
+  slab_freeSize(e, entry_size(e));
+}
+
+/**************** memory_used ****************/
+/* What we hold in memory: the entries and the heap, and each run's
+ * buffer and head.
+ */
+static size_t
+memory_used(frontier_t *f)
+{
+  size_t used = f->heapMemory + f->heapcap * sizeof(entry_t *);
+  for (int i = 0; i < f->nruns; i++) {
+    used += sizeof(run_t) + RUNBUF + entry_size(f->runs[i]->head);
+  }
+  return used;
+}
+
+/**************** heap_push ****************/
+static void
+heap_push(frontier_t *f, entry_t *e)
+{
+  if (f->nheap == f->heapcap) {
+    f->heapcap *= 2;
+    f->heap = assertp(realloc(f->heap, f->heapcap * sizeof(entry_t *)),
+                      "frontier heap");
+  }
+  int i = f->nheap++;
+  while (i > 0 && entry_cmp(e, f->heap[(i-1)/2]) < 0) {
+    f->heap[i] = f->heap[(i-1)/2];
+    i = (i-1)/2;
+  }
+  f->heap[i] = e;
+  f->heapMemory += entry_size(e);
+}
+
+/**************** heap_pop ****************/
+/* Remove and return the least entry of the heap, which is not empty. */
+static entry_t *
+heap_pop(frontier_t *f)
+{
+  entry_t *top = f->heap[0];
+  entry_t *last = f->heap[--f->nheap];
+  int i = 0;
+  for (;;) {
+    int child = 2*i + 1;
+    if (child >= f->nheap) {
+      break;
+    }
+    if (child + 1 < f->nheap && entry_cmp(f->heap[child+1], f->heap[child]) < 0) {
+      child++;
+    }
+    if (entry_cmp(last, f->heap[child]) <= 0) {
+      break;
+    }
+    f->heap[i] = f->heap[child];
+    i = child;
+  }
+  if (f->nheap > 0) {
+    f->heap[i] = last;
+  }
+  f->heapMemory -= entry_size(top);
+  return top;
+}
+
+/**************** spill ****************/
+/* Write the worse half of the heap to a new run. */
+static bool
+spill(frontier_t *f)
+{
+  if (f->fd < 0) {
+    f->fd = open(f->spillName, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (f->fd < 0) {
+      return false;
+    }
+  }
+
+  // a sorted array is still a heap; the first half stays
+  qsort(f->heap, f->nheap, sizeof(entry_t *), entry_qsort);
+  int keep = f->nheap / 2;
+  long count = f->nheap - keep;
+
+  encoder_t enc = { .fd = f->fd, .offset = f->fileEnd };
+  off_t start = f->fileEnd;
+  bool ok = true;
+  for (int i = keep; ok && i < f->nheap; i++) {
+    ok = enc_put(&enc, f->heap[i]);
+  }
+  ok = ok && enc_flush(&enc);
+  if (enc.data != NULL) count_free(enc.data);
+  if (enc.prev != NULL) count_free(enc.prev);
+  if (!ok) {
+    return false;     // heap is intact; the partial run is ignored
+  }
+
+  for (int i = keep; i < f->nheap; i++) {
+    f->heapMemory -= entry_size(f->heap[i]);
+    entry_free(f->heap[i]);
+  }
+  f->nheap = keep;
+  f->fileEnd = enc.offset;
+  f->spilled += count;
+  f->spillBytes += f->fileEnd - start;
+
+  if (!run_add(f, start, f->fileEnd, count)) {
+    return false;
+  }
+  if (f->nruns > MAX_RUNS
+      || (size_t)f->nruns * RUNBUF > f->maxMemory / 4) {
+    return merge(f);
+  }
+  return true;
+}
+
+/**************** merge ****************/
+/* Merge all the runs into one, in a new spill file.  If that fails, the
+ * new file is removed, and the runs are left as they were, in the old.
+ */
+static bool
+merge(frontier_t *f)
+{
+  // where each run stands, to go back to if the merge fails
+  run_t *saved = count_calloc(f->nruns, sizeof(run_t));
+  char *newName = count_malloc(strlen(f->spillName) + 3);
+  bool ok = (saved != NULL && newName != NULL);
+  for (int i = 0; ok && i < f->nruns; i++) {
+    run_t *r = f->runs[i];
+    saved[i] = *r;
+    saved[i].pos = r->pos - (r->buflen - r->bufpos);
+    saved[i].head = entry_new(strlen(r->head->url));
+    if (saved[i].head == NULL) {
+      ok = false;
+    } else {
+      memcpy(saved[i].head, r->head, entry_size(r->head));
+    }
+  }
+  int fd = -1;
+  if (ok) {
+    sprintf(newName, "%s~", f->spillName);
+    fd = open(newName, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    ok = (fd >= 0);
+  }
+
+  // write to the new file, reading from the old; a run that runs out
+  // moves past the active ones, with its saved place
+  encoder_t enc = { .fd = fd, .offset = 0 };
+  long count = 0;
+  int active = ok ? f->nruns : 0;
+  while (ok && active > 0) {
+    int least = 0;
+    for (int i = 1; i < active; i++) {
+      if (entry_cmp(f->runs[i]->head, f->runs[least]->head) < 0) {
+        least = i;
+      }
+    }
+    run_t *r = f->runs[least];
+    entry_t *e = r->head;
+    ok = enc_put(&enc, e);
+    if (ok) {
+      ok = run_advance(f, r);       // e supplies the next one's prefix
+      entry_free(e);
+      count++;
+    }
+    if (ok && r->head == NULL) {
+      active--;
+      f->runs[least] = f->runs[active];
+      f->runs[active] = r;
+      run_t t = saved[least];
+      saved[least] = saved[active];
+      saved[active] = t;
+    }
+  }
+  ok = ok && enc_flush(&enc);
+  if (enc.data != NULL) count_free(enc.data);
+  if (enc.prev != NULL) count_free(enc.prev);
+  ok = ok && rename(newName, f->spillName) == 0;
+
+  if (!ok) {
+    // back to the old file, each run where it stood
+    if (fd >= 0) {
+      close(fd);
+      unlink(newName);
+    }
+    for (int i = 0; saved != NULL && i < f->nruns; i++) {
+      run_t *r = f->runs[i];
+      if (fd < 0) {
+        if (saved[i].head != NULL) entry_free(saved[i].head);
+        continue;                     // never began: nothing to undo
+      }
+      if (r->head != NULL) {
+        entry_free(r->head);
+      }
+      r->head = saved[i].head;
+      r->pos = saved[i].pos;
+      r->buflen = r->bufpos = 0;
+      r->remaining = saved[i].remaining;
+    }
+    if (saved != NULL) count_free(saved);
+    if (newName != NULL) count_free(newName);
+    return false;
+  }
+
+  for (int i = 0; i < f->nruns; i++) {
+    entry_free(saved[i].head);
+  }
+  while (f->nruns > 0) {
+    run_remove(f, f->nruns - 1);      // all spent
+  }
+  count_free(saved);
+  count_free(newName);
+  close(f->fd);
+  f->fd = fd;
+  f->fileEnd = enc.offset;
+  return run_add(f, 0, f->fileEnd, count);
+}
+
+/**************** run_add ****************/
+/* Add a run of count entries at [start, end) in the spill file. */
+static bool
+run_add(frontier_t *f, off_t start, off_t end, long count)
+{
+  run_t *r = count_calloc(1, sizeof(run_t));
+  if (r == NULL || (r->buf = count_malloc(RUNBUF)) == NULL) {
+    if (r != NULL) count_free(r);
+    return false;
+  }
+  r->pos = start;
+  r->end = end;
+  r->remaining = count;
+  if (f->nruns == f->runcap) {
+    f->runcap *= 2;
+    f->runs = assertp(realloc(f->runs, f->runcap * sizeof(run_t *)),
+                      "frontier runs");
+  }
+  f->runs[f->nruns++] = r;
+  if (!run_advance(f, r) || r->head == NULL) {
+    run_remove(f, f->nruns - 1);
+    return false;
+  }
+  return true;
+}
+
+/**************** run_remove ****************/
+/* Forget run i, and any entries it has left (which are lost). */
+static void
+run_remove(frontier_t *f, int i)
+{
+  run_t *r = f->runs[i];
+  f->size -= r->remaining;
+  if (r->head != NULL) {
+    entry_free(r->head);
+    f->size--;
+  }
+  count_free(r->buf);
+  count_free(r);
+  f->runs[i] = f->runs[--f->nruns];
+}
+
+/**************** run_advance ****************/
+/* Decode r's next entry into r->head, or set it NULL at the end of the
+ * run.  The previous head, which the caller must free, supplies the
+ * shared prefix.  Returns false on a read error.
+ */
+static bool
+run_advance(frontier_t *f, run_t *r)
+{
+  entry_t *prev = r->head;
+  r->head = NULL;
+  if (r->remaining == 0) {
+    return true;
+  }
+
+  unsigned long long key, seq, depth, shared, rest;
+  if (!run_varint(f, r, &key) || !run_varint(f, r, &seq)
+      || !run_varint(f, r, &depth) || !run_varint(f, r, &shared)
+      || !run_varint(f, r, &rest)
+      || shared > (prev == NULL ? 0 : strlen(prev->url))) {
+    return false;
+  }
+  entry_t *e = entry_new(shared + rest);
+  if (e == NULL) {
+    return false;
+  }
+  e->key = (long long)(key >> 1) ^ -(long long)(key & 1);
+  e->seq = seq;
+  e->depth = depth;
+  if (shared > 0) {
+    memcpy(e->url, prev->url, shared);
+  }
+  for (unsigned long long i = 0; i < rest; i++) {
+    unsigned char c;
+    if (!run_byte(f, r, &c)) {
+      slab_freeSize(e, sizeof(entry_t) + shared + rest + 1);
+      return false;
+    }
+    e->url[shared + i] = c;
+  }
+  e->url[shared + rest] = '\0';
+  r->head = e;
+  r->remaining--;
+  return true;
+}
+
+/**************** run_byte ****************/
+/* Return the next byte of run r in *c, reading more if need be. */
+static bool
+run_byte(frontier_t *f, run_t *r, unsigned char *c)
+{
+  if (r->bufpos == r->buflen) {
+    if (r->pos >= r->end) {
+      return false;
+    }
+    size_t want = (r->end - r->pos < (off_t)RUNBUF) ? r->end - r->pos : RUNBUF;
+    ssize_t n;
+    do {
+      n = pread(f->fd, r->buf, want, r->pos);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+      return false;
+    }
+    r->pos += n;
+    r->buflen = n;
+    r->bufpos = 0;
+  }
+  *c = r->buf[r->bufpos++];
+  return true;
+}
+
+/**************** run_varint ****************/
+static bool
+run_varint(frontier_t *f, run_t *r, unsigned long long *v)
+{
+  *v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    unsigned char c;
+    if (!run_byte(f, r, &c)) {
+      return false;
+    }
+    *v |= (unsigned long long)(c & 0x7f) << shift;
+    if ((c & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**************** enc_put ****************/
+/* Encode one entry, front-coded against the one before it. */
+static bool
+enc_put(encoder_t *enc, const entry_t *e)
+{
+  size_t len = strlen(e->url);
+  size_t shared = 0;
+  if (enc->prev != NULL) {
+    while (enc->prev[shared] != '\0' && enc->prev[shared] == e->url[shared]) {
+      shared++;
+    }
+  }
+  unsigned long long key = ((unsigned long long)e->key << 1)
+    ^ (unsigned long long)(e->key >> 63);   // zigzag
+  if (!enc_varint(enc, key) || !enc_varint(enc, e->seq)
+      || !enc_varint(enc, e->depth) || !enc_varint(enc, shared)
+      || !enc_varint(enc, len - shared)
+      || !enc_bytes(enc, e->url + shared, len - shared)) {
+    return false;
+  }
+
+  if (len + 1 > enc->prevcap) {
+    char *prev = count_malloc(2 * (len + 1));
+    if (prev == NULL) {
+      return false;
+    }
+    if (enc->prev != NULL) count_free(enc->prev);
+    enc->prev = prev;
+    enc->prevcap = 2 * (len + 1);
+  }
+  memcpy(enc->prev, e->url, len + 1);
+
+  return enc->len < WRITEBUF || enc_flush(enc);
+}
+
+/**************** enc_varint ****************/
+static bool
+enc_varint(encoder_t *enc, unsigned long long v)
+{
+  unsigned char bytes[10];
+  size_t n = 0;
+  do {
+    bytes[n] = v & 0x7f;
+    v >>= 7;
+    if (v != 0) {
+      bytes[n] |= 0x80;
+    }
+    n++;
+  } while (v != 0);
+  return enc_bytes(enc, bytes, n);
+}
+
+/**************** enc_bytes ****************/
+static bool
+enc_bytes(encoder_t *enc, const void *bytes, size_t n)
+{
+  if (enc->len + n > enc->cap) {
+    size_t cap = enc->cap > 0 ? enc->cap : 1024;
+    while (cap < enc->len + n) {
+      cap *= 2;
+    }
+    unsigned char *data = count_malloc(cap);
+    if (data == NULL) {
+      return false;
+    }
+    if (enc->data != NULL) {
+      memcpy(data, enc->data, enc->len);
+      count_free(enc->data);
+    }
+    enc->data = data;
+    enc->cap = cap;
+  }
+  memcpy(enc->data + enc->len, bytes, n);
+  enc->len += n;
+  return true;
+}
+
+/**************** enc_flush ****************/
+/* Write out the encoded bytes, at enc->offset in its file. */
+static bool
+enc_flush(encoder_t *enc)
+{
+  if (!write_all(enc->fd, enc->data, enc->len, enc->offset)) {
+    return false;
+  }
+  enc->offset += enc->len;
+  enc->len = 0;
+  return true;
+}
+
+/**************** write_all ****************/
+static bool
+write_all(int fd, const unsigned char *data, size_t n, off_t at)
+{
+  while (n > 0) {
+    ssize_t wrote = pwrite(fd, data, n, at);
+    if (wrote < 0 && errno == EINTR) {
+      continue;
+    }
+    if (wrote <= 0) {
+      return false;
+    }
+    data += wrote;
+    n -= wrote;
+    at += wrote;
+  }
+  return true;
+}
@@ -0,0 +1,111 @@
+/*
+ * frontier.h - header file for the crawler's 'frontier' module
+ *
+ * The 'frontier' holds the URLs found but not yet crawled, and decides
+ * the order in which they come out:
+ *   FRONTIER_BFS       shallowest first, in the order they were found;
+ *   FRONTIER_DFS       most recently found first;
+ *   FRONTIER_PRIORITY  lowest 'priority' value first, then as BFS.
+ * It keeps its URLs compactly in memory up to a given budget.  Beyond
+ * that it spills the URLs that would come out last to a file, as sorted
+ * runs in which each URL is stored as the length of the prefix it shares
+ * with the URL before it plus the remaining bytes.  It reads them back a
+ * few kilobytes at a time as they come due, merging the runs with what
+ * is in memory, so the order is exact however much was spilled.
+ *
+ * The frontier is not itself thread-safe; the crawler guards it.
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __FRONTIER_H
+#define __FRONTIER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "webpage.h"
+
+/**************** global types ****************/
+typedef struct frontier frontier_t;  // opaque to users of the module
+
+typedef enum {
+  FRONTIER_BFS, FRONTIER_DFS, FRONTIER_PRIORITY
+} frontier_order_t;
+
+/**************** functions ****************/
+
+/**************** frontier_new ****************/
+/* Create a new (empty) frontier.
+ *
+ * Caller provides:
+ *   the order in which to hand out URLs;
+ *   the most bytes of memory to use for URLs (at least 64KB);
+ *   the pathname of a file we may create for spilled URLs.
+ * We return:
+ *   pointer to a new frontier, or NULL if error.
+ * Caller is responsible for:
+ *   later calling frontier_delete, which removes the spill file.
+ */
+frontier_t *frontier_new(const frontier_order_t order, const size_t maxMemory,
+                         const char *spillFile);
+
+/**************** frontier_parseOrder ****************/
+/* Set *order from its name: "bfs", "dfs", or "priority".
+ * Returns false if the name is not one of those.
+ */
+bool frontier_parseOrder(const char *name, frontier_order_t *order);
+
+/**************** frontier_insert ****************/
+/* Add a URL, at the given depth, to the frontier.
+ *
+ * Caller provides:
+ *   valid frontier; URL, which we copy; depth >= 0; and a priority,
+ *   which matters only to FRONTIER_PRIORITY (lower comes out sooner).
+ * We return:
+ *   false if out of memory, in which case the URL is not added, or if
+ *   the spill file cannot be written, in which case it is added but
+ *   the frontier stays over its memory budget.
+ */
+bool frontier_insert(frontier_t *f, const char *url, const int depth,
+                     const int priority);
+
+/**************** frontier_extract ****************/
+/* Remove the next URL from the frontier.
+ * We return:
+ *   a new webpage_t for the URL, at its depth, with no HTML;
+ *   NULL if the frontier is empty.
+ * Caller is responsible for:
+ *   later calling webpage_delete.
+ */
+webpage_t *frontier_extract(frontier_t *f);
+
+/**************** frontier_size ****************/
+/* Return the number of URLs in the frontier, in memory or spilled. */
+long frontier_size(frontier_t *f);
+
+/**************** frontier_iterate ****************/
+/* Call itemfunc(arg, url, depth) on every URL in the frontier, in no
+ * particular order, reading spilled URLs back from the spill file
+ * without removing them.  The URL is ours; copy it to keep it.
+ * Returns false if the spill file could not be read, or memory ran out,
+ * in which case some URLs were missed.
+ */
+bool frontier_iterate(frontier_t *f, void *arg,
+                      void (*itemfunc)(void *arg, const char *url,
+                                       const int depth));
+
+/**************** frontier_report ****************/
+/* Print the frontier's counters to fp on one line, prefixed by message:
+ * URLs inserted, how many were ever spilled and the bytes that took,
+ * and the most memory used.
+ */
+void frontier_report(frontier_t *f, FILE *fp, const char *message);
+
+/**************** frontier_delete ****************/
+/* Delete the frontier and any URLs still in it, and remove the spill
+ * file.  Ignores NULL.
+ */
+void frontier_delete(frontier_t *f);
+
+#endif // __FRONTIER_H
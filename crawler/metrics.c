@@ -0,0 +1,337 @@
+/*
+ * metrics.c - the crawler's 'metrics' module
+ *
+ * see metrics.h for more information.
+ *
+ * Everything is guarded by one mutex; the crawler touches the metrics
+ * a few times per page, which is nothing beside fetching it.  A value
+ * v goes in bucket v if v < 4; otherwise, if its top bit is bit e, in
+ * bucket 4(e-1) plus the two bits below the top bit.  So each power of
+ * two is split into four buckets of equal width.
+ *
+ * Antony Guzman, 2020
+ */
+
+#define _GNU_SOURCE       // clock_gettime, open_memstream
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include "metrics.h"
+#include "http.h"
+#include "memory.h"
+
+/**************** file-local global variables ****************/
+#define BUCKETS 252       // enough for any long long; see bucket_of
+
+static const char *counterNames[METRIC_COUNTERS] = {
+  "fetched", "not_modified", "failed", "bytes", "refused", "avoided_bytes",
+  "saved", "scanned", "links"
+};
+static const char *gaugeNames[METRIC_GAUGES] = {
+  "frontier", "active", "save_queue", "scan_queue"
+};
+static const char *histogramNames[METRIC_HISTOGRAMS] = {
+  "connect_us", "first_byte_us", "fetch_us", "save_us", "scan_us"
+};
+
+/**************** local types ****************/
+typedef struct histogram {
+  long n;                     // values added
+  long long sum;              // their sum
+  long max;                   // the largest
+  long buckets[BUCKETS];      // how many fell in each bucket
+} histogram_t;
+
+/**************** global types ****************/
+typedef struct metrics {
+  pthread_mutex_t lock;       // guards everything below
+  long counters[METRIC_COUNTERS];
+  long gauges[METRIC_GAUGES];
+  histogram_t histograms[METRIC_HISTOGRAMS];
+  int shard;                  // labels each line, or -1
+  long long start;            // http_clock() when created
+  long long lastTime;         // ... when the last line was written
+  long lastPages;             // pages fetched by then
+  // the thread that writes them every so often
+  pthread_cond_t wake;        // signalled by metrics_stop
+  pthread_t writer;
+  bool writing;               // is there a writer thread?
+  bool stopping;              // should it stop?
+  int seconds;                // between lines
+  FILE *fp;                   // where to write them
+  void *arg;                  // for gaugefunc
+  void (*gaugefunc)(void *arg, metrics_t *m);
+} metrics_t;
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static int bucket_of(const long us);
+static long bucket_top(const int bucket);
+static long quantile(const histogram_t *h, const double q);
+static void *metrics_writer(void *arg);
+
+/**************** metrics_new() ****************/
+/* see metrics.h for description */
+metrics_t *
+metrics_new(void)
+{
+  metrics_t *m = count_calloc(1, sizeof(metrics_t));
+  if (m == NULL) {
+    return NULL;
+  }
+  pthread_mutex_init(&m->lock, NULL);
+  pthread_cond_init(&m->wake, NULL);
+  m->shard = -1;
+  m->start = m->lastTime = http_clock();
+  m->writing = m->stopping = false;
+  return m;
+}
+
+/**************** metrics_count() ****************/
+/* see metrics.h for description */
+void
+metrics_count(metrics_t *m, const metric_counter_t counter, const long n)
+{
+  if (m != NULL && counter >= 0 && counter < METRIC_COUNTERS) {
+    pthread_mutex_lock(&m->lock);
+    m->counters[counter] += n;
+    pthread_mutex_unlock(&m->lock);
+  }
+}
+
+/**************** metrics_gauge() ****************/
+/* see metrics.h for description */
+void
+metrics_gauge(metrics_t *m, const metric_gauge_t gauge, const long value)
+{
+  if (m != NULL && gauge >= 0 && gauge < METRIC_GAUGES) {
+    pthread_mutex_lock(&m->lock);
+    m->gauges[gauge] = value;
+    pthread_mutex_unlock(&m->lock);
+  }
+}
+
+/**************** metrics_time() ****************/
+/* see metrics.h for description */
+void
+metrics_time(metrics_t *m, const metric_histogram_t histogram, const long us)
+{
+  if (m != NULL && us >= 0 && histogram >= 0
+      && histogram < METRIC_HISTOGRAMS) {
+    pthread_mutex_lock(&m->lock);
+    histogram_t *h = &m->histograms[histogram];
+    h->n++;
+    h->sum += us;
+    if (us > h->max) {
+      h->max = us;
+    }
+    h->buckets[bucket_of(us)]++;
+    pthread_mutex_unlock(&m->lock);
+  }
+}
+
+/**************** metrics_write() ****************/
+/* see metrics.h for description */
+void
+metrics_write(metrics_t *m, FILE *fp)
+{
+  if (m == NULL || fp == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&m->lock);
+  long long now = http_clock();
+  long pages = m->counters[METRIC_FETCHED] + m->counters[METRIC_NOTMODIFIED];
+  double interval = (now - m->lastTime) / 1e6;
+
+  // build the line, so it goes out in one write, whole even when
+  // several processes append to one file
+  char *line = NULL;
+  size_t size = 0;
+  FILE *out = open_memstream(&line, &size);
+  if (out == NULL) {
+    pthread_mutex_unlock(&m->lock);
+    return;
+  }
+  fprintf(out, "{\"time\":%.3f", (now - m->start) / 1e6);
+  if (m->shard >= 0) {
+    fprintf(out, ",\"shard\":%d", m->shard);
+  }
+  for (int i = 0; i < METRIC_COUNTERS; i++) {
+    fprintf(out, ",\"%s\":%ld", counterNames[i], m->counters[i]);
+  }
+  fprintf(out, ",\"pages_per_sec\":%.1f",
+          interval > 0 ? (pages - m->lastPages) / interval : 0.0);
+  for (int i = 0; i < METRIC_GAUGES; i++) {
+    fprintf(out, ",\"%s\":%ld", gaugeNames[i], m->gauges[i]);
+  }
+  for (int i = 0; i < METRIC_HISTOGRAMS; i++) {
+    histogram_t *h = &m->histograms[i];
+    fprintf(out, ",\"%s\":{\"n\":%ld,\"mean\":%lld,\"p50\":%ld,"
+            "\"p90\":%ld,\"p99\":%ld,\"max\":%ld}", histogramNames[i],
+            h->n, h->n > 0 ? h->sum / h->n : 0, quantile(h, 0.50),
+            quantile(h, 0.90), quantile(h, 0.99), h->max);
+  }
+  fprintf(out, "}\n");
+  fclose(out);
+  if (line != NULL) {
+    fwrite(line, 1, size, fp);
+    fflush(fp);
+    free(line);
+  }
+
+  m->lastTime = now;
+  m->lastPages = pages;
+  pthread_mutex_unlock(&m->lock);
+}
+
+/**************** metrics_setShard() ****************/
+/* see metrics.h for description */
+void
+metrics_setShard(metrics_t *m, const int shard)
+{
+  if (m != NULL) {
+    pthread_mutex_lock(&m->lock);
+    m->shard = shard;
+    pthread_mutex_unlock(&m->lock);
+  }
+}
+
+/**************** metrics_start() ****************/
+/* see metrics.h for description */
+bool
+metrics_start(metrics_t *m, const int seconds, FILE *fp, void *arg,
+              void (*gaugefunc)(void *arg, metrics_t *m))
+{
+  if (m == NULL || fp == NULL || seconds < 1 || m->writing) {
+    return false;
+  }
+  m->seconds = seconds;
+  m->fp = fp;
+  m->arg = arg;
+  m->gaugefunc = gaugefunc;
+  m->stopping = false;
+  if (pthread_create(&m->writer, NULL, metrics_writer, m) != 0) {
+    return false;
+  }
+  m->writing = true;
+  return true;
+}
+
+/**************** metrics_stop() ****************/
+/* see metrics.h for description */
+void
+metrics_stop(metrics_t *m)
+{
+  if (m == NULL || !m->writing) {
+    return;
+  }
+  pthread_mutex_lock(&m->lock);
+  m->stopping = true;
+  pthread_cond_signal(&m->wake);
+  pthread_mutex_unlock(&m->lock);
+  pthread_join(m->writer, NULL);
+  m->writing = false;
+
+  if (m->gaugefunc != NULL) {
+    (*m->gaugefunc)(m->arg, m);
+  }
+  metrics_write(m, m->fp);
+}
+
+/**************** metrics_delete() ****************/
+/* see metrics.h for description */
+void
+metrics_delete(metrics_t *m)
+{
+  if (m != NULL) {
+    metrics_stop(m);
+    pthread_cond_destroy(&m->wake);
+    pthread_mutex_destroy(&m->lock);
+    count_free(m);
+  }
+}
+
+/**************** metrics_writer ****************/
+/* The thread metrics_start starts: every m->seconds, bring the gauges
+ * up to date and write a line, until metrics_stop.
+ */
+static void *
+metrics_writer(void *arg)
+{
+  metrics_t *m = arg;
+  struct timespec next;
+  clock_gettime(CLOCK_REALTIME, &next);
+
+  pthread_mutex_lock(&m->lock);
+  for (;;) {
+    next.tv_sec += m->seconds;
+    while (!m->stopping
+           && pthread_cond_timedwait(&m->wake, &m->lock, &next) == 0) {
+      ;   // woken early, but not to stop
+    }
+    if (m->stopping) {
+      break;
+    }
+    pthread_mutex_unlock(&m->lock);
+    if (m->gaugefunc != NULL) {
+      (*m->gaugefunc)(m->arg, m);
+    }
+    metrics_write(m, m->fp);
+    pthread_mutex_lock(&m->lock);
+  }
+  pthread_mutex_unlock(&m->lock);
+  return NULL;
+}
+
+/**************** bucket_of ****************/
+/* The bucket for a value >= 0; see the top of this file. */
+static int
+bucket_of(const long us)
+{
+  if (us < 4) {
+    return us;
+  }
+  int e = 63 - __builtin_clzll(us);         // its top bit; e >= 2
+  return 4 * (e - 1) + ((us >> (e - 2)) & 3);
+}
+
+/**************** bucket_top ****************/
+/* The largest value that falls in the given bucket. */
+static long
+bucket_top(const int bucket)
+{
+  if (bucket < 4) {
+    return bucket;
+  }
+  int e = bucket / 4 + 1;
+  long low = (long)(4 + bucket % 4) << (e - 2);
+  return low + (1L << (e - 2)) - 1;
+}
+
+/**************** quantile ****************/
+/* The q quantile of the values in h: the top of the bucket in which
+ * it falls, but no more than the largest value; 0 if h is empty.
+ */
+static long
+quantile(const histogram_t *h, const double q)
+{
+  if (h->n == 0) {
+    return 0;
+  }
+  long rank = (long)(q * h->n + 0.999999);  // the rank-th smallest value
+  if (rank < 1) {
+    rank = 1;
+  }
+  long seen = 0;
+  for (int b = 0; b < BUCKETS; b++) {
+    seen += h->buckets[b];
+    if (seen >= rank) {
+      long top = bucket_top(b);
+      return top < h->max ? top : h->max;
+    }
+  }
+  return h->max;
+}
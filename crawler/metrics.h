@@ -0,0 +1,125 @@
+/*
+ * metrics.h - header file for the crawler's 'metrics' module
+ *
+ * The 'metrics' of a crawl are counters (pages fetched, failed, bytes,
+ * ...), gauges (the pages waiting to be crawled, the depth of the
+ * stage queues, ...), and histograms of how long things took: to
+ * connect, to the first byte of a response, to fetch a whole page, to
+ * save it, and to scan it.  Each histogram keeps its values, in
+ * microseconds, in buckets four to each power of two, so any quantile
+ * it reports is within a quarter of the true value (and never below it).
+ *
+ * The metrics are written as one line of JSON, a single object, so a
+ * crawl can append one every few seconds to a file that tools read a
+ * line at a time:
+ *   {"time":5.001,"fetched":1200,...,"pages_per_sec":240.1,
+ *    "frontier":310,...,"connect_us":{"n":40,"mean":180,"p50":160,
+ *    "p90":320,"p99":448,"max":501},...}
+ * Counters and histograms are totals since the start; "pages_per_sec"
+ * is over the time since the line before.  Each line goes out in one
+ * write, so the shards of a crawl may append to the same file; their
+ * lines then carry "shard":N after "time".
+ *
+ * All the functions are thread-safe, and ignore a NULL metrics.
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/**************** global types ****************/
+typedef struct metrics metrics_t;  // opaque to users of the module
+
+typedef enum {
+  METRIC_FETCHED,             // pages fetched (status 200)
+  METRIC_NOTMODIFIED,         // pages not modified since (304)
+  METRIC_FAILED,              // pages that could not be fetched
+  METRIC_BYTES,               // bytes of html fetched
+  METRIC_REFUSED,             // pages not HTML, or too long, left unread
+  METRIC_AVOIDED,             // bytes of them not read, as far as known
+  METRIC_SAVED,               // pages saved
+  METRIC_SCANNED,             // pages scanned for links
+  METRIC_LINKS,               // new URLs those links added
+  METRIC_COUNTERS             // (how many counters there are)
+} metric_counter_t;
+
+typedef enum {
+  METRIC_FRONTIER,            // URLs waiting to be crawled
+  METRIC_ACTIVE,              // pages being fetched, saved or scanned
+  METRIC_SAVEQ,               // pages waiting to be saved
+  METRIC_SCANQ,               // pages waiting to be scanned
+  METRIC_GAUGES
+} metric_gauge_t;
+
+typedef enum {
+  METRIC_CONNECT,             // time to connect
+  METRIC_FIRSTBYTE,           // time to the first byte of the response
+  METRIC_FETCH,               // time to fetch the page in all
+  METRIC_SAVE,                // time to save it
+  METRIC_SCAN,                // time to scan it
+  METRIC_HISTOGRAMS
+} metric_histogram_t;
+
+/**************** functions ****************/
+
+/**************** metrics_new ****************/
+/* Create a new set of metrics, all zero; the clock for "time" and
+ * "pages_per_sec" starts now.
+ * We return:
+ *   pointer to the new metrics, or NULL if error.
+ * Caller is responsible for:
+ *   later calling metrics_delete.
+ */
+metrics_t *metrics_new(void);
+
+/**************** metrics_count ****************/
+/* Add n to the given counter. */
+void metrics_count(metrics_t *m, const metric_counter_t counter,
+                   const long n);
+
+/**************** metrics_gauge ****************/
+/* Set the given gauge to value. */
+void metrics_gauge(metrics_t *m, const metric_gauge_t gauge,
+                   const long value);
+
+/**************** metrics_time ****************/
+/* Add a time, in microseconds (the difference of two http_clock
+ * values, say), to the given histogram; a time < 0 (not known) is
+ * ignored.
+ */
+void metrics_time(metrics_t *m, const metric_histogram_t histogram,
+                  const long us);
+
+/**************** metrics_setShard ****************/
+/* Label every line written from now on with the given shard (>= 0). */
+void metrics_setShard(metrics_t *m, const int shard);
+
+/**************** metrics_write ****************/
+/* Write the metrics to fp, as one line of JSON, and flush it. */
+void metrics_write(metrics_t *m, FILE *fp);
+
+/**************** metrics_start ****************/
+/* Start a thread that writes the metrics to fp every 'seconds'
+ * seconds, until metrics_stop.  Before each line it calls
+ * gaugefunc(arg, m), if not NULL, to bring the gauges up to date.
+ * We return:
+ *   false if the thread could not be started.
+ */
+bool metrics_start(metrics_t *m, const int seconds, FILE *fp, void *arg,
+                   void (*gaugefunc)(void *arg, metrics_t *m));
+
+/**************** metrics_stop ****************/
+/* Stop the thread metrics_start started, if any, and write one last
+ * line, so the file ends with the totals for the whole crawl.
+ */
+void metrics_stop(metrics_t *m);
+
+/**************** metrics_delete ****************/
+/* Delete the metrics, stopping any thread first.  Ignores NULL. */
+void metrics_delete(metrics_t *m);
+
+#endif // __METRICS_H
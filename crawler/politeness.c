@@ -0,0 +1,421 @@
+/*
+ * politeness.c - the crawler's 'politeness' module
+ *
+ * see politeness.h for more information.
+ *
+ * Antony Guzman, 2020
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "politeness.h"
+#include "webpage.h"
+#include "hashtable.h"
+#include "http.h"
+#include "memory.h"
+
+/**************** file-local global variables ****************/
+static const int HOST_SLOTS = 101;    // hashtable slots for hosts
+static const int FAIL_GRACE = 3;      // failures in a row before backoff
+static const long BACKOFF_MIN = 1000; // ms; the first backoff
+static const long BACKOFF_MAX = 60000;  // ms; the longest
+static slab_t *nodeSlab = NULL;       // for every pagenode_t
+static pthread_once_t nodeSlabOnce = PTHREAD_ONCE_INIT;
+
+/**************** local types ****************/
+typedef struct pagenode {
+  webpage_t *page;
+  struct pagenode *next;
+} pagenode_t;
+
+typedef struct hostq {
+  pagenode_t *head, *tail;    // pages waiting for this host, in order
+  int npages;                 // how many
+  double tokens;              // tokens in the bucket as of 'last'
+  long long last;             // ms; when 'tokens' was brought up to date
+  long long ready;            // ms; when the host may next be fetched
+  int failures;               // fetches in a row it did not answer
+  int backoffs;               // times backed off since it last answered
+  long long answered;         // ms; when it last answered (or was new)
+  long long until;            // ms; backed off until then, or 0
+  int heapindex;              // position in the ready heap, or -1
+} hostq_t;
+
+/**************** global types ****************/
+typedef struct politeness {
+  hashtable_t *hosts;         // host -> hostq_t
+  hostq_t **heap;             // hosts with waiting pages, by 'ready'
+  int nheap;                  // hosts in the heap
+  int heapcap;                // slots allocated for the heap
+  int delay;                  // ms per token
+  int burst;                  // bucket capacity
+  long npages;                // pages waiting, over all hosts
+} politeness_t;
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static char *host_of(const char *url, size_t *size);
+static void hostq_refill(politeness_t *sched, hostq_t *h, long long now);
+static long long hostq_ready(politeness_t *sched, hostq_t *h);
+static void heap_push(politeness_t *sched, hostq_t *h);
+static void heap_pop(politeness_t *sched);
+static void heap_up(politeness_t *sched, int i);
+static void heap_down(politeness_t *sched, int i);
+static void heap_swap(politeness_t *sched, int i, int j);
+static void hostq_delete(void *item);
+static void pagenode_slab(void);
+
+/**************** politeness_new() ****************/
+/* see politeness.h for description */
+politeness_t *
+politeness_new(const int delay, const int burst)
+{
+  if (delay < 0 || burst < 1) {
+    return NULL;
+  }
+  politeness_t *sched = count_malloc(sizeof(politeness_t));
+  if (sched == NULL) {
+    return NULL;
+  }
+  sched->hosts = hashtable_new(HOST_SLOTS);
+  sched->heapcap = 16;
+  sched->heap = count_calloc(sched->heapcap, sizeof(hostq_t *));
+  if (sched->hosts == NULL || sched->heap == NULL) {
+    hashtable_delete(sched->hosts, NULL);
+    if (sched->heap != NULL) count_free(sched->heap);
+    count_free(sched);
+    return NULL;
+  }
+  sched->nheap = 0;
+  sched->npages = 0;
+  sched->delay = delay;
+  sched->burst = burst;
+  return sched;
+}
+
+/**************** politeness_insert() ****************/
+/* see politeness.h for description */
+void
+politeness_insert(politeness_t *sched, webpage_t *page)
+{
+  if (sched == NULL || page == NULL || webpage_getURL(page) == NULL) {
+    return;
+  }
+
+  size_t size;
+  char *host = host_of(webpage_getURL(page), &size);
+  hostq_t *h = hashtable_find(sched->hosts, host);
+  if (h == NULL) {
+    h = assertp(count_malloc(sizeof(hostq_t)), "hostq");
+    h->head = h->tail = NULL;
+    h->npages = 0;
+    h->tokens = sched->burst;     // a new host starts with a full bucket
+    h->last = http_clock() / 1000;
+    h->failures = h->backoffs = 0;
+    h->answered = h->last;
+    h->until = 0;
+    h->heapindex = -1;
+    hashtable_insert(sched->hosts, host, h);
+  }
+  slab_freeSize(host, size);
+
+  pthread_once(&nodeSlabOnce, pagenode_slab);
+  pagenode_t *node = assertp(slab_alloc(nodeSlab), "pagenode");
+  node->page = page;
+  node->next = NULL;
+  if (h->tail == NULL) {
+    h->head = node;
+  } else {
+    h->tail->next = node;
+  }
+  h->tail = node;
+  h->npages++;
+  sched->npages++;
+  if (h->heapindex < 0) {
+    // host had nothing waiting; it joins the heap
+    hostq_refill(sched, h, http_clock() / 1000);
+    h->ready = hostq_ready(sched, h);
+    heap_push(sched, h);
+  }
+}
+
+/**************** politeness_extract() ****************/
+/* see politeness.h for description */
+webpage_t *
+politeness_extract(politeness_t *sched, long *wait)
+{
+  if (sched == NULL || sched->nheap == 0) {
+    if (wait != NULL) *wait = -1;
+    return NULL;
+  }
+
+  hostq_t *h = sched->heap[0];
+  long long now = http_clock() / 1000;
+  if (h->ready > now) {
+    if (wait != NULL) *wait = h->ready - now;
+    return NULL;
+  }
+
+  // spend a token on this host's next page
+  hostq_refill(sched, h, now);
+  h->tokens -= 1;
+  pagenode_t *node = h->head;
+  webpage_t *page = node->page;
+  if ( (h->head = node->next) == NULL) {
+    h->tail = NULL;
+  }
+  slab_free(nodeSlab, node);
+  h->npages--;
+  sched->npages--;
+
+  if (h->npages > 0) {
+    h->ready = hostq_ready(sched, h);
+    heap_down(sched, 0);
+  } else {
+    heap_pop(sched);
+  }
+  if (wait != NULL) *wait = 0;
+  return page;
+}
+
+/**************** politeness_answered() ****************/
+/* see politeness.h for description */
+void
+politeness_answered(politeness_t *sched, webpage_t *page, const bool answered)
+{
+  if (sched == NULL || page == NULL || webpage_getURL(page) == NULL) {
+    return;
+  }
+  size_t size;
+  char *host = host_of(webpage_getURL(page), &size);
+  hostq_t *h = hashtable_find(sched->hosts, host);
+  slab_freeSize(host, size);
+  if (h == NULL) {
+    return;
+  }
+
+  long long now = http_clock() / 1000;
+  if (answered) {
+    h->answered = now;
+    if (h->failures == 0) {
+      return;                     // the usual case: nothing changes
+    }
+    h->failures = h->backoffs = 0;
+    h->until = 0;
+  } else if (++h->failures >= FAIL_GRACE && now >= h->until
+             && now - h->answered >= BACKOFF_MIN) {
+    // fetches that fail while it is backed off were sent before; only
+    // a failure after the rest doubles it, up to BACKOFF_MAX
+    long backoff = BACKOFF_MAX;
+    if (h->backoffs < 16 && (BACKOFF_MIN << h->backoffs) < BACKOFF_MAX) {
+      backoff = BACKOFF_MIN << h->backoffs;
+    }
+    h->backoffs++;
+    h->until = now + backoff;
+  } else {
+    return;
+  }
+
+  if (h->heapindex >= 0) {
+    h->ready = hostq_ready(sched, h);
+    heap_up(sched, h->heapindex);
+    heap_down(sched, h->heapindex);
+  }
+}
+
+/**************** politeness_isempty() ****************/
+/* see politeness.h for description */
+bool
+politeness_isempty(politeness_t *sched)
+{
+  return sched == NULL || sched->nheap == 0;
+}
+
+/**************** politeness_size() ****************/
+/* see politeness.h for description */
+long
+politeness_size(politeness_t *sched)
+{
+  return sched == NULL ? 0 : sched->npages;
+}
+
+/**************** politeness_iterate() ****************/
+/* see politeness.h for description */
+void
+politeness_iterate(politeness_t *sched, void *arg,
+                   void (*itemfunc)(void *arg, webpage_t *page))
+{
+  if (sched != NULL && itemfunc != NULL) {
+    // every host with pages waiting is in the heap
+    for (int i = 0; i < sched->nheap; i++) {
+      for (pagenode_t *node = sched->heap[i]->head; node != NULL;
+           node = node->next) {
+        (*itemfunc)(arg, node->page);
+      }
+    }
+  }
+}
+
+/**************** politeness_delete() ****************/
+/* see politeness.h for description */
+void
+politeness_delete(politeness_t *sched, void (*itemdelete)(void *item))
+{
+  if (sched != NULL) {
+    // every host with pages waiting is in the heap
+    for (int i = 0; i < sched->nheap; i++) {
+      hostq_t *h = sched->heap[i];
+      while (h->head != NULL) {
+        pagenode_t *node = h->head;
+        h->head = node->next;
+        if (itemdelete != NULL) {
+          (*itemdelete)(node->page);
+        }
+        slab_free(nodeSlab, node);
+      }
+      h->tail = NULL;
+    }
+    hashtable_delete(sched->hosts, hostq_delete);
+    count_free(sched->heap);
+    count_free(sched);
+  }
+}
+
+/**************** host_of ****************/
+/* Return the host of the URL, its authority (between "//" and the next
+ * '/'), as a string from a slab of *size bytes; the caller frees it
+ * with slab_freeSize.
+ */
+static char *
+host_of(const char *url, size_t *size)
+{
+  const char *start = strstr(url, "//");
+  start = (start != NULL) ? start + 2 : url;
+  size_t len = strcspn(start, "/");
+  char *host = assertp(slab_allocSize(len + 1), "politeness host");
+  memcpy(host, start, len);
+  host[len] = '\0';
+  *size = len + 1;
+  return host;
+}
+
+/**************** hostq_refill ****************/
+/* Add the tokens earned since h->last, up to the burst limit. */
+static void
+hostq_refill(politeness_t *sched, hostq_t *h, long long now)
+{
+  if (sched->delay == 0) {
+    h->tokens = sched->burst;
+  } else {
+    h->tokens += (double)(now - h->last) / sched->delay;
+    if (h->tokens > sched->burst) {
+      h->tokens = sched->burst;
+    }
+  }
+  h->last = now;
+}
+
+/**************** hostq_ready ****************/
+/* When will h next hold a whole token, and not be backed off? */
+static long long
+hostq_ready(politeness_t *sched, hostq_t *h)
+{
+  long long ready = h->last;
+  if (h->tokens < 1) {
+    ready += (long long)((1 - h->tokens) * sched->delay + 0.999);
+  }
+  return ready > h->until ? ready : h->until;
+}
+
+/**************** heap_push ****************/
+static void
+heap_push(politeness_t *sched, hostq_t *h)
+{
+  if (sched->nheap == sched->heapcap) {
+    sched->heapcap *= 2;
+    sched->heap = assertp(realloc(sched->heap,
+                                  sched->heapcap * sizeof(hostq_t *)),
+                          "politeness heap");
+  }
+  h->heapindex = sched->nheap;
+  sched->heap[sched->nheap++] = h;
+  heap_up(sched, h->heapindex);
+}
+
+/**************** heap_pop ****************/
+/* Remove the earliest-ready host from the heap. */
+static void
+heap_pop(politeness_t *sched)
+{
+  sched->heap[0]->heapindex = -1;
+  if (--sched->nheap > 0) {
+    sched->heap[0] = sched->heap[sched->nheap];
+    sched->heap[0]->heapindex = 0;
+    heap_down(sched, 0);
+  }
+}
+
+/**************** heap_up ****************/
+static void
+heap_up(politeness_t *sched, int i)
+{
+  while (i > 0 && sched->heap[(i-1)/2]->ready > sched->heap[i]->ready) {
+    heap_swap(sched, i, (i-1)/2);
+    i = (i-1)/2;
+  }
+}
+
+/**************** heap_down ****************/
+static void
+heap_down(politeness_t *sched, int i)
+{
+  for (;;) {
+    int least = i;
+    int left = 2*i + 1;
+    int right = 2*i + 2;
+    if (left < sched->nheap
+        && sched->heap[left]->ready < sched->heap[least]->ready) {
+      least = left;
+    }
+    if (right < sched->nheap
+        && sched->heap[right]->ready < sched->heap[least]->ready) {
+      least = right;
+    }
+    if (least == i) {
+      return;
+    }
+    heap_swap(sched, i, least);
+    i = least;
+  }
+}
+
+/**************** heap_swap ****************/
+static void
+heap_swap(politeness_t *sched, int i, int j)
+{
+  hostq_t *tmp = sched->heap[i];
+  sched->heap[i] = sched->heap[j];
+  sched->heap[j] = tmp;
+  sched->heap[i]->heapindex = i;
+  sched->heap[j]->heapindex = j;
+}
+
+/**************** hostq_delete ****************/
+/* for use by hashtable_delete; pages have already been dealt with */
+static void
+hostq_delete(void *item)
+{
+  if (item != NULL) {
+    count_free(item);
+  }
+}
+
+/**************** pagenode_slab ****************/
+/* Make the slab for pagenodes, once. */
+static void
+pagenode_slab(void)
+{
+  nodeSlab = slab_new("pagenode", sizeof(pagenode_t));
+}
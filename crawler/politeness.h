@@ -0,0 +1,109 @@
+/*
+ * politeness.h - header file for the crawler's 'politeness' module
+ *
+ * A 'politeness' scheduler holds the pages waiting to be crawled,
+ * queued per host in the order they were inserted, and hands out a
+ * page only when its host is ready for another request.  Each host
+ * gets a token bucket: one token per 'delay' milliseconds, holding at
+ * most 'burst' tokens, and each page handed out spends one.  With
+ * burst 1 that is simply a minimum delay between requests to the same
+ * host.  Hosts with waiting pages are kept in a heap ordered by the
+ * time they will next be ready, so finding the next page to crawl
+ * does not depend on the number of hosts.
+ *
+ * A host whose server stops answering is backed off: once it has
+ * failed to answer three fetches in a row, and answered none for a
+ * second, its pages wait a second, and twice as long each time a fetch
+ * sent after that fails too, up to a minute, until it answers again.
+ * Meanwhile the other hosts' pages go ahead, so a slow or dead server
+ * holds up only its own.  A server that answers most fetches, but lets
+ * some time out, is not backed off.
+ *
+ * The scheduler is not itself thread-safe; the crawler guards it.
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __POLITENESS_H
+#define __POLITENESS_H
+
+#include <stdbool.h>
+#include "webpage.h"
+
+/**************** global types ****************/
+typedef struct politeness politeness_t;  // opaque to users of the module
+
+/**************** functions ****************/
+
+/**************** politeness_new ****************/
+/* Create a new (empty) scheduler.
+ *
+ * Caller provides:
+ *   delay, milliseconds per token per host (>= 0; 0 means no limit),
+ *   burst, the most tokens a host may save up (>= 1).
+ * We return:
+ *   pointer to a new scheduler, or NULL if error.
+ * Caller is responsible for:
+ *   later calling politeness_delete.
+ */
+politeness_t *politeness_new(const int delay, const int burst);
+
+/**************** politeness_insert ****************/
+/* Add a page to the queue for its host.
+ *
+ * Caller provides:
+ *   valid scheduler and page (with URL).
+ * We guarantee:
+ *   a NULL scheduler or page is ignored.
+ * Caller is responsible for:
+ *   not free-ing the page while it is in the scheduler.
+ */
+void politeness_insert(politeness_t *sched, webpage_t *page);
+
+/**************** politeness_extract ****************/
+/* Return a page whose host is ready, and spend one of its tokens.
+ *
+ * Caller provides:
+ *   valid scheduler, and a place to put the wait time.
+ * We return:
+ *   a page, if some host with waiting pages is ready now;
+ *   otherwise NULL, with *wait set to the milliseconds until the
+ *   next host is ready, or to -1 if no pages are waiting at all.
+ */
+webpage_t *politeness_extract(politeness_t *sched, long *wait);
+
+/**************** politeness_answered ****************/
+/* Note whether the host of a page just fetched answered at all (with
+ * any status), or did not: it refused the connection, timed out, or
+ * dropped it.  Hosts that do not answer are backed off, as above.
+ *
+ * Caller provides:
+ *   valid scheduler and page (with URL), and whether it was answered.
+ * We guarantee:
+ *   a NULL scheduler or page, or a host never inserted, is ignored.
+ */
+void politeness_answered(politeness_t *sched, webpage_t *page,
+                         const bool answered);
+
+/**************** politeness_isempty ****************/
+/* Return true if no pages are waiting (or the scheduler is NULL). */
+bool politeness_isempty(politeness_t *sched);
+
+/**************** politeness_size ****************/
+/* Return the number of pages waiting, over all hosts. */
+long politeness_size(politeness_t *sched);
+
+/**************** politeness_iterate ****************/
+/* Call itemfunc(arg, page) on every page waiting, host by host, each
+ * host's pages in order.  The pages must not be changed or freed.
+ */
+void politeness_iterate(politeness_t *sched, void *arg,
+                        void (*itemfunc)(void *arg, webpage_t *page));
+
+/**************** politeness_delete ****************/
+/* Delete the scheduler, calling itemdelete (if not NULL) on each
+ * page still waiting.
+ */
+void politeness_delete(politeness_t *sched, void (*itemdelete)(void *item));
+
+#endif // __POLITENESS_H
@@ -0,0 +1,502 @@
+/*
+ * recrawl.c - the crawler's 'recrawl' module
+ *
+ * see recrawl.h for more information.
+ *
+ * The record of validators is a text file with one line per page
+ * saved: its document ID, its ETag, and its Last-Modified date (which
+ * holds spaces, so it comes last), with "-" for either if the server
+ * sent none.  Lines are only ever appended, so a page rewritten by a
+ * recrawl has more than one; the last one counts.
+ *
+ * A shard of a crawl split among processes keeps a record and a changed
+ * list of its own, '.validators.<shard>' and '.changed.<shard>', which
+ * recrawl_merge gathers into the usual two once every shard is done.
+ *
+ * Antony Guzman, 2020
+ */
+
+#define _GNU_SOURCE       // strdup
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "recrawl.h"
+#include "webpage.h"
+#include "hashtable.h"
+#include "http.h"
+#include "pagedir.h"
+#include "file.h"
+#include "memory.h"
+
+/**************** file-local global variables ****************/
+static const char validatorsFile[] = ".validators";
+static const char changedFile[] = ".changed";
+static const int DOC_SLOTS = 1009;      // hashtable slots for saved pages
+
+/**************** local types ****************/
+typedef struct olddoc {
+  int id;                     // its document ID
+  char *etag;                 // its validators, or NULL
+  char *lastModified;
+} olddoc_t;
+
+/**************** global types ****************/
+typedef struct recrawl {
+  char *pageDirectory;
+  int shard;                  // see recrawl_newShard, or -1
+  FILE *validators;           // the record, open for appending
+  hashtable_t *docs;          // URL -> olddoc_t, for pages saved before
+  int lastID;                 // the last of those
+  pthread_mutex_t lock;       // guards the fields below
+  int *changed;               // IDs of the pages saved by this run
+  int nchanged, changedcap;
+  long notModified;           // answered 304
+  long same;                  // fetched, but the same as before
+  long rewritten;             // fetched, and changed
+  long added;                 // new pages
+} recrawl_t;
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static recrawl_t *recrawl_open(const char *pageDirectory, const bool fresh,
+                               const bool previous, const int shard);
+static char *shardname(const char *pageDirectory, const char *name,
+                       const int shard);
+static bool merge_file(const char *pageDirectory, const char *name,
+                       const int shards, const int *newID, const int maxID);
+static int load_docs(recrawl_t *r, olddoc_t ***byID);
+static void load_validators(recrawl_t *r, olddoc_t **byID,
+                            const char *filename);
+static char *load_html(recrawl_t *r, const int documentID, int *depth);
+static void record(recrawl_t *r, const int documentID, webpage_t *page,
+                   const bool changed);
+static int id_cmp(const void *a, const void *b);
+static void olddoc_delete(void *item);
+
+/**************** recrawl_new() ****************/
+/* see recrawl.h for description */
+recrawl_t *
+recrawl_new(const char *pageDirectory, const bool fresh, const bool previous)
+{
+  return recrawl_open(pageDirectory, fresh, previous, -1);
+}
+
+/**************** recrawl_newShard() ****************/
+/* see recrawl.h for description */
+recrawl_t *
+recrawl_newShard(const char *pageDirectory, const int shard)
+{
+  return shard < 0 ? NULL : recrawl_open(pageDirectory, true, false, shard);
+}
+
+/**************** recrawl_merge() ****************/
+/* see recrawl.h for description */
+bool
+recrawl_merge(const char *pageDirectory, const int shards, const int *newID,
+              const int maxID)
+{
+  if (pageDirectory == NULL || shards < 1 || newID == NULL || maxID < 0) {
+    return false;
+  }
+  bool ok = merge_file(pageDirectory, validatorsFile, shards, newID, maxID);
+  return merge_file(pageDirectory, changedFile, shards, newID, maxID) && ok;
+}
+
+/**************** recrawl_open ****************/
+/* recrawl_new, or for shard >= 0, recrawl_newShard. */
+static recrawl_t *
+recrawl_open(const char *pageDirectory, const bool fresh, const bool previous,
+             const int shard)
+{
+  if (pageDirectory == NULL) {
+    return NULL;
+  }
+  recrawl_t *r = assertp(count_calloc(1, sizeof(recrawl_t)), "recrawl_t");
+  r->pageDirectory = assertp(malloc(strlen(pageDirectory) + 1),
+                             "recrawl pageDirectory");
+  strcpy(r->pageDirectory, pageDirectory);
+  r->shard = shard;
+  pthread_mutex_init(&r->lock, NULL);
+
+  char *filename = shardname(pageDirectory, validatorsFile, shard);
+  if (previous) {
+    olddoc_t **byID;
+    r->docs = assertp(hashtable_new(DOC_SLOTS), "recrawl docs");
+    r->lastID = load_docs(r, &byID);
+    load_validators(r, byID, filename);
+    free(byID);
+  }
+  r->validators = fopen(filename, fresh ? "w" : "a");
+  free(filename);
+  if (r->validators == NULL) {
+    recrawl_delete(r);
+    return NULL;
+  }
+  return r;
+}
+
+/**************** recrawl_lastID() ****************/
+/* see recrawl.h for description */
+int
+recrawl_lastID(recrawl_t *r)
+{
+  return r == NULL ? 0 : r->lastID;
+}
+
+/**************** recrawl_prepare() ****************/
+/* see recrawl.h for description */
+int
+recrawl_prepare(recrawl_t *r, webpage_t *page)
+{
+  if (r == NULL || r->docs == NULL || page == NULL) {
+    return 0;
+  }
+  olddoc_t *doc = hashtable_find(r->docs, webpage_getURL(page));
+  if (doc == NULL) {
+    return 0;
+  }
+  webpage_setValidators(page, doc->etag, doc->lastModified);
+  return doc->id;
+}
+
+/**************** recrawl_update() ****************/
+/* see recrawl.h for description */
+int
+recrawl_update(recrawl_t *r, webpage_t *page)
+{
+  if (r == NULL || r->docs == NULL || page == NULL) {
+    return 0;
+  }
+  olddoc_t *doc = hashtable_find(r->docs, webpage_getURL(page));
+  if (doc == NULL) {
+    return 0;
+  }
+
+  int depth;
+  char *saved = load_html(r, doc->id, &depth);
+  if (webpage_getHTML(page) == NULL) {
+    // not fetched: we can carry on only if it has not changed
+    if (webpage_getStatus(page) != 304 || saved == NULL
+        || !webpage_setHTML(page, saved)) {
+      if (saved != NULL) free(saved);
+      return -1;
+    }
+    if (depth == webpage_getDepth(page)) {
+      pthread_mutex_lock(&r->lock);
+      r->notModified++;
+      pthread_mutex_unlock(&r->lock);
+    } else {
+      // found at another depth this time: the file must say so
+      page_save(page, r->pageDirectory, doc->id);
+      record(r, doc->id, page, true);
+    }
+    return doc->id;
+  }
+
+  // fetched: rewrite the file only if the page has changed
+  bool same = (saved != NULL && depth == webpage_getDepth(page)
+               && strcmp(saved, webpage_getHTML(page)) == 0);
+  if (saved != NULL) {
+    free(saved);
+  }
+  if (!same) {
+    page_save(page, r->pageDirectory, doc->id);
+  }
+  record(r, doc->id, page, !same);
+  return doc->id;
+}
+
+/**************** recrawl_saved() ****************/
+/* see recrawl.h for description */
+void
+recrawl_saved(recrawl_t *r, const int documentID, webpage_t *page)
+{
+  if (r != NULL && page != NULL) {
+    pthread_mutex_lock(&r->lock);
+    r->added++;
+    pthread_mutex_unlock(&r->lock);
+    record(r, documentID, page, true);
+  }
+}
+
+/**************** recrawl_report() ****************/
+/* see recrawl.h for description */
+void
+recrawl_report(recrawl_t *r, FILE *fp, const char *message)
+{
+  if (r == NULL || fp == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&r->lock);
+  fprintf(fp, "%s: %ld not modified, %ld the same, %ld changed, %ld new\n",
+          message, r->notModified, r->same, r->rewritten, r->added);
+  pthread_mutex_unlock(&r->lock);
+}
+
+/**************** recrawl_delete() ****************/
+/* see recrawl.h for description */
+bool
+recrawl_delete(recrawl_t *r)
+{
+  if (r == NULL) {
+    return true;
+  }
+  bool ok = true;
+  if (r->validators != NULL) {
+    ok = (fclose(r->validators) == 0);
+
+    // the changed list, in order, replacing the last run's
+    char *filename = shardname(r->pageDirectory, changedFile, r->shard);
+    char *newname = assertp(malloc(strlen(filename) + 2), "recrawl_delete");
+    sprintf(newname, "%s~", filename);
+    FILE *fp = fopen(newname, "w");
+    if (fp != NULL) {
+      if (r->nchanged > 0) {
+        qsort(r->changed, r->nchanged, sizeof(int), id_cmp);
+      }
+      for (int i = 0; i < r->nchanged; i++) {
+        if (i == 0 || r->changed[i] != r->changed[i-1]) {
+          fprintf(fp, "%d\n", r->changed[i]);
+        }
+      }
+      ok = (fclose(fp) == 0) && rename(newname, filename) == 0 && ok;
+    } else {
+      ok = false;
+    }
+    free(newname);
+    free(filename);
+  }
+
+  hashtable_delete(r->docs, olddoc_delete);
+  if (r->changed != NULL) {
+    free(r->changed);
+  }
+  pthread_mutex_destroy(&r->lock);
+  free(r->pageDirectory);
+  count_free(r);
+  return ok;
+}
+
+/**************** load_docs ****************/
+/* Note the URL of each page saved, 1, 2, 3, ..., up to the first
+ * missing; return the number of pages, and in *byID a new array of
+ * them indexed by ID (NULL for a URL saved twice), which the caller
+ * must free.
+ */
+static int
+load_docs(recrawl_t *r, olddoc_t ***byID)
+{
+  int cap = 64;
+  *byID = assertp(calloc(cap, sizeof(olddoc_t *)), "recrawl byID");
+  int id;
+  for (id = 1; ; id++) {
+    char *url = page_loadURL(r->pageDirectory, id);
+    if (url == NULL) {
+      break;
+    }
+    if (id == cap) {
+      cap *= 2;
+      *byID = assertp(realloc(*byID, cap * sizeof(olddoc_t *)), 
+                      "recrawl byID");
+    }
+    olddoc_t *doc = assertp(count_calloc(1, sizeof(olddoc_t)), "olddoc");
+    doc->id = id;
+    if (hashtable_insert(r->docs, url, doc)) {
+      (*byID)[id] = doc;
+    } else {
+      count_free(doc);      // the same URL twice; keep the first
+      (*byID)[id] = NULL;
+    }
+    free(url);
+  }
+  return id - 1;
+}
+
+/**************** load_validators ****************/
+/* Read the record of validators into the pages saved before.  Lines
+ * for IDs we do not have, and malformed lines, are ignored.
+ */
+static void
+load_validators(recrawl_t *r, olddoc_t **byID, const char *filename)
+{
+  FILE *fp = fopen(filename, "r");
+  if (fp == NULL) {
+    return;
+  }
+  char *line;
+  while ( (line = freadlinep(fp)) != NULL) {
+    int id, offset;
+    char etag[HTTP_VALIDATOR];
+    if (sscanf(line, "%d %127s %n", &id, etag, &offset) == 2
+        && id >= 1 && id <= r->lastID && byID[id] != NULL) {
+      olddoc_t *doc = byID[id];
+      if (doc->etag != NULL) free(doc->etag);
+      if (doc->lastModified != NULL) free(doc->lastModified);
+      const char *date = line + offset;
+      doc->etag = strcmp(etag, "-") != 0 ? strdup(etag) : NULL;
+      doc->lastModified = strcmp(date, "-") != 0 ? strdup(date) : NULL;
+    }
+    free(line);
+  }
+  fclose(fp);
+}
+
+/**************** load_html ****************/
+/* Return the html saved as documentID, as it was before page_save
+ * added its final newline, and set *depth; or NULL if it can't be read.
+ */
+static char *
+load_html(recrawl_t *r, const int documentID, int *depth)
+{
+  webpage_t *saved = page_load(r->pageDirectory, documentID);
+  if (saved == NULL) {
+    return NULL;
+  }
+  char *html = strdup(webpage_getHTML(saved));
+  if (html != NULL) {
+    size_t len = strlen(html);
+    if (len > 0 && html[len-1] == '\n') {
+      html[len-1] = '\0';
+    }
+  }
+  *depth = webpage_getDepth(saved);
+  webpage_delete(saved);
+  return html;
+}
+
+/**************** record ****************/
+/* Append page's validators to the record, and count it as changed
+ * (adding it to the changed list) or as the same.
+ */
+static void
+record(recrawl_t *r, const int documentID, webpage_t *page, const bool changed)
+{
+  const char *etag = webpage_getETag(page);
+  const char *date = webpage_getLastModified(page);
+  pthread_mutex_lock(&r->lock);
+  fprintf(r->validators, "%d %s %s\n", documentID,
+          etag != NULL ? etag : "-", date != NULL ? date : "-");
+  if (changed) {
+    if (r->nchanged == r->changedcap) {
+      r->changedcap = r->changedcap > 0 ? 2 * r->changedcap : 64;
+      r->changed = assertp(realloc(r->changed, r->changedcap * sizeof(int)),
+                           "recrawl changed");
+    }
+    r->changed[r->nchanged++] = documentID;
+    if (r->docs != NULL && documentID <= r->lastID) {
+      r->rewritten++;
+    }
+  } else {
+    r->same++;
+  }
+  pthread_mutex_unlock(&r->lock);
+}
+
+/**************** shardname ****************/
+/* Return a new string "pageDirectory/name", or "pageDirectory/name.shard"
+ * if shard >= 0; caller must free it.
+ */
+static char *
+shardname(const char *pageDirectory, const char *name, const int shard)
+{
+  if (shard < 0) {
+    return pagedir_pathname(pageDirectory, name);
+  }
+  char *path = assertp(malloc(strlen(pageDirectory) + strlen(name) + 14),
+                       "recrawl shardname");
+  sprintf(path, "%s/%s.%d", pageDirectory, name, shard);
+  return path;
+}
+
+/**************** merge_file ****************/
+/* Gather the shards' copies of the file 'name' -- the record of
+ * validators or the changed list, lines that begin with a document ID
+ * -- into a new 'name', giving each line the ID newID says, and remove
+ * them once it is in place.  Lines of pages that are no more are
+ * dropped.  The changed list, unlike the record, must be in order, so
+ * we sort it.  If the merge fails, the shards' copies are left as they
+ * were, and no new 'name'.
+ */
+static bool
+merge_file(const char *pageDirectory, const char *name, const int shards,
+           const int *newID, const int maxID)
+{
+  char *filename = pagedir_pathname(pageDirectory, name);
+  char *newname = assertp(malloc(strlen(filename) + 2), "recrawl_merge");
+  sprintf(newname, "%s~", filename);
+  FILE *out = fopen(newname, "w");
+  bool ok = out != NULL;
+  int *ids = NULL;
+  int nids = 0, idcap = 0;
+  bool sorted = strcmp(name, changedFile) == 0;
+
+  for (int shard = 0; ok && shard < shards; shard++) {
+    char *shardfile = shardname(pageDirectory, name, shard);
+    FILE *in = fopen(shardfile, "r");
+    char *line;
+    while (in != NULL && (line = freadlinep(in)) != NULL) {
+      int id, offset;
+      if (sscanf(line, "%d%n", &id, &offset) == 1 && id >= 1 && id <= maxID
+          && newID[id] > 0) {
+        if (!sorted) {
+          ok = ok && fprintf(out, "%d%s\n", newID[id], line + offset) > 0;
+        } else {
+          if (nids == idcap) {
+            idcap = idcap > 0 ? 2 * idcap : 64;
+            ids = assertp(realloc(ids, idcap * sizeof(int)), "recrawl_merge");
+          }
+          ids[nids++] = newID[id];
+        }
+      }
+      free(line);
+    }
+    if (in != NULL) {
+      fclose(in);
+    }
+    free(shardfile);
+  }
+
+  if (nids > 0) {
+    qsort(ids, nids, sizeof(int), id_cmp);
+  }
+  for (int i = 0; ok && i < nids; i++) {
+    ok = fprintf(out, "%d\n", ids[i]) > 0;
+  }
+  free(ids);
+  ok = out != NULL && (fclose(out) == 0) && ok && rename(newname, filename) == 0;
+  if (ok) {
+    for (int shard = 0; shard < shards; shard++) {
+      char *shardfile = shardname(pageDirectory, name, shard);
+      unlink(shardfile);
+      free(shardfile);
+    }
+  } else if (out != NULL) {
+    unlink(newname);
+  }
+  free(newname);
+  free(filename);
+  return ok;
+}
+
+/**************** id_cmp ****************/
+static int
+id_cmp(const void *a, const void *b)
+{
+  int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+/**************** olddoc_delete ****************/
+static void
+olddoc_delete(void *item)
+{
+  olddoc_t *doc = item;
+  if (doc != NULL) {
+    if (doc->etag != NULL) free(doc->etag);
+    if (doc->lastModified != NULL) free(doc->lastModified);
+    count_free(doc);
+  }
+}
@@ -0,0 +1,117 @@
+/*
+ * recrawl.h - header file for the crawler's 'recrawl' module
+ *
+ * The 'recrawl' module lets a crawl reuse the pages an earlier crawl
+ * saved in the same pageDirectory.  Every crawl records, in the file
+ * '.validators', the validators (ETag and Last-Modified) the server
+ * sent with each page it saved.  A recrawl first reads the pages
+ * already saved (1, 2, 3, ...) and their validators; then, as it meets
+ * each of those URLs again, it asks the server for the page only if it
+ * has changed.  A page that has not changed keeps its file and its
+ * document ID; one that has is rewritten under the same ID; a page not
+ * seen before gets the next ID after the last one saved.
+ *
+ * At the end, the document IDs of the pages this run saved -- those
+ * changed and those new -- are written to the file '.changed', one per
+ * line in increasing order, so the indexer need only look at those.
+ *
+ * A recrawl_t may be shared by several threads.
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __RECRAWL_H
+#define __RECRAWL_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "webpage.h"
+
+/**************** global types ****************/
+typedef struct recrawl recrawl_t;  // opaque to users of the module
+
+/**************** functions ****************/
+
+/**************** recrawl_new ****************/
+/* Open the record of validators for pageDirectory.
+ *
+ * Caller provides:
+ *   the pageDirectory; fresh, if this is a new crawl, whose record
+ *   replaces any earlier one (otherwise we add to it); and previous,
+ *   if this is a recrawl, in which case we first read the pages saved
+ *   there and their validators.
+ * We return:
+ *   pointer to a new recrawl_t, or NULL if the record can't be opened.
+ * Caller is responsible for:
+ *   later calling recrawl_delete.
+ */
+recrawl_t *recrawl_new(const char *pageDirectory, const bool fresh,
+                       const bool previous);
+
+/**************** recrawl_newShard ****************/
+/* As recrawl_new for a new crawl, for shard 'shard' (>= 0) of a crawl
+ * split among processes: the shard keeps a record and a changed list
+ * of its own, for recrawl_merge to gather once every shard is done.
+ */
+recrawl_t *recrawl_newShard(const char *pageDirectory, const int shard);
+
+/**************** recrawl_merge ****************/
+/* Gather the records and changed lists of 'shards' shards, which must
+ * all have been deleted, into those of pageDirectory, replacing any
+ * earlier ones; page id (1 to maxID) is now page newID[id], or gone if
+ * newID[id] is 0.
+ * Returns false if they could not be written.
+ */
+bool recrawl_merge(const char *pageDirectory, const int shards,
+                   const int *newID, const int maxID);
+
+/**************** recrawl_lastID ****************/
+/* Return the number of pages saved before this recrawl (0 if this is
+ * not a recrawl); new pages are numbered after them.
+ */
+int recrawl_lastID(recrawl_t *r);
+
+/**************** recrawl_prepare ****************/
+/* If page's URL is that of a page saved before, give it the validators
+ * recorded for that page, so fetching it is conditional, and return
+ * its document ID; otherwise return 0.  Call before fetching the page.
+ */
+int recrawl_prepare(recrawl_t *r, webpage_t *page);
+
+/**************** recrawl_update ****************/
+/* Deal with a page after its fetch, if it was saved before.
+ *
+ * Caller provides:
+ *   a page passed to recrawl_prepare, and then fetched.
+ * We do:
+ *   if the page was saved before and the server said it was not
+ *   modified (304), load the saved html into the page; if it was
+ *   fetched, rewrite the saved file, unless it holds the same html
+ *   at the same depth, and record the page's new validators.
+ * We return:
+ *   the page's document ID, if it was saved before, in which case the
+ *   page now has html; 0 if it is a new page, which the caller should
+ *   save under a new ID and pass to recrawl_saved (if it was fetched);
+ *   -1 if it was saved before but neither fetched nor loaded.
+ */
+int recrawl_update(recrawl_t *r, webpage_t *page);
+
+/**************** recrawl_saved ****************/
+/* Note that the caller saved a new page under documentID: record its
+ * validators, and add it to the changed documents.
+ */
+void recrawl_saved(recrawl_t *r, const int documentID, webpage_t *page);
+
+/**************** recrawl_report ****************/
+/* Print the counters to fp on one line, prefixed by message: pages
+ * not modified (304), fetched but the same, changed, and new.
+ */
+void recrawl_report(recrawl_t *r, FILE *fp, const char *message);
+
+/**************** recrawl_delete ****************/
+/* Write the list of changed documents, close the record and free r.
+ * Returns false if the list could not be written.  Ignores NULL.
+ */
+bool recrawl_delete(recrawl_t *r);
+
+#endif // __RECRAWL_H
@@ -0,0 +1,511 @@
+/*
+ * seenset.c - the crawler's 'seenset' module
+ *
+ * see seenset.h for more information.
+ *
+ * A fingerprint is the FNV-1a hash of the URL, scrambled so that all
+ * its bits are useful, and never 0, which marks an empty slot.  The
+ * Bloom filter is an array of bits; a fingerprint sets BLOOM_HASHES of
+ * them, chosen by double hashing.  If any of those is clear, the
+ * fingerprint is certainly new.  Otherwise it is looked up in the hash
+ * table in memory (open addressing, at most half full) and then in the
+ * spill file.
+ *
+ * When the table has grown as large as the budget allows and is half
+ * full, its fingerprints are sorted and merged with those in the spill
+ * file into a new spill file, and the table is emptied.  The file is
+ * a sorted array of fingerprints, in blocks of BLOCK; the first
+ * fingerprint of each block is kept in memory, so that a lookup reads
+ * just the one block that could hold the fingerprint.
+ *
+ * Antony Guzman, 2020
+ */
+
+#define _GNU_SOURCE       // pread, pwrite
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "seenset.h"
+#include "memory.h"
+
+/**************** file-local global variables ****************/
+static const size_t MIN_MEMORY = 65536;   // smallest budget we accept
+static const size_t MAX_BLOOM = 16 << 20; // most bytes of Bloom filter
+static const int BLOOM_HASHES = 7;        // bits set per fingerprint
+static const size_t MIN_SLOTS = 1024;     // smallest hash table
+#define BLOCK 512                         // fingerprints per block on disk
+
+/**************** global types ****************/
+typedef struct seenset {
+  uint64_t *bloom;            // the Bloom filter
+  uint64_t bloomMask;         // its size in bits, less one
+  uint64_t *table;            // fingerprints in memory; 0 is empty
+  size_t slots, used;         // the table's size, and slots in use
+  size_t maxSlots;            // the most slots the budget allows
+  char *spillName;            // pathname of the spill file
+  int fd;                     // the spill file, or -1 if not yet open
+  long ondisk;                // fingerprints in it
+  uint64_t *index;            // first fingerprint of each block in it
+  size_t peak;                // most memory used
+  long bloomNew;              // URLs the filter knew were new
+  long falsePositives;        // URLs it said might not be, but were
+  int spills;                 // times the table was emptied to disk
+} seenset_t;
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static bool bloom_test(seenset_t *s, const uint64_t fp);
+static void bloom_set(seenset_t *s, const uint64_t fp);
+static bool table_find(seenset_t *s, const uint64_t fp);
+static void table_put(uint64_t *table, const size_t slots, const uint64_t fp);
+static void table_resize(seenset_t *s, const size_t slots);
+static bool disk_find(seenset_t *s, const uint64_t fp);
+static bool make_room(seenset_t *s);
+static bool spill(seenset_t *s);
+static bool read_all(int fd, uint64_t *data, size_t n, off_t at);
+static bool write_all(int fd, const uint64_t *data, size_t n, off_t at);
+static int fp_cmp(const void *a, const void *b);
+static size_t memory_used(seenset_t *s);
+static uint64_t mix(uint64_t x);
+
+/**************** seenset_new() ****************/
+/* see seenset.h for description */
+seenset_t *
+seenset_new(const size_t maxMemory, const char *spillFile)
+{
+  if (maxMemory < MIN_MEMORY || spillFile == NULL) {
+    return NULL;
+  }
+  seenset_t *s = count_calloc(1, sizeof(seenset_t));
+  if (s == NULL) {
+    return NULL;
+  }
+
+  // a power of two of each, the filter taking about a quarter
+  size_t bloomBytes = 8;
+  while (2 * bloomBytes <= maxMemory / 4 && 2 * bloomBytes <= MAX_BLOOM) {
+    bloomBytes *= 2;
+  }
+  s->maxSlots = MIN_SLOTS;
+  while (2 * s->maxSlots * sizeof(uint64_t) <= maxMemory - bloomBytes) {
+    s->maxSlots *= 2;
+  }
+  s->bloomMask = bloomBytes * 8 - 1;
+  s->bloom = count_calloc(bloomBytes, 1);
+  s->slots = MIN_SLOTS;
+  s->table = count_calloc(s->slots, sizeof(uint64_t));
+  s->spillName = count_malloc(strlen(spillFile) + 1);
+  if (s->bloom == NULL || s->table == NULL || s->spillName == NULL) {
+    if (s->bloom != NULL) count_free(s->bloom);
+    if (s->table != NULL) count_free(s->table);
+    if (s->spillName != NULL) count_free(s->spillName);
+    count_free(s);
+    return NULL;
+  }
+  strcpy(s->spillName, spillFile);
+  s->fd = -1;
+  s->peak = memory_used(s);
+  return s;
+}
+
+/**************** seenset_fingerprint() ****************/
+/* see seenset.h for description */
+uint64_t
+seenset_fingerprint(const char *url)
+{
+  uint64_t hash = 14695981039346656037ULL;     // FNV-1a
+  for (const char *p = url; *p != '\0'; p++) {
+    hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+  }
+  hash = mix(hash);
+  return hash != 0 ? hash : 1;
+}
+
+/**************** seenset_insert() ****************/
+/* see seenset.h for description */
+bool
+seenset_insert(seenset_t *s, const char *url)
+{
+  if (s == NULL || url == NULL) {
+    return false;
+  }
+  return seenset_add(s, seenset_fingerprint(url));
+}
+
+/**************** seenset_add() ****************/
+/* see seenset.h for description */
+bool
+seenset_add(seenset_t *s, const uint64_t fingerprint)
+{
+  if (s == NULL || fingerprint == 0) {
+    return false;
+  }
+  if (bloom_test(s, fingerprint)) {
+    // maybe seen: look for it
+    if (table_find(s, fingerprint) || disk_find(s, fingerprint)) {
+      return false;
+    }
+    s->falsePositives++;
+  } else {
+    s->bloomNew++;
+  }
+
+  if (!make_room(s)) {
+    fprintf(stderr, "seenset: cannot write '%s'\n", s->spillName);
+    return false;
+  }
+  table_put(s->table, s->slots, fingerprint);
+  s->used++;
+  bloom_set(s, fingerprint);
+  return true;
+}
+
+/**************** seenset_size() ****************/
+/* see seenset.h for description */
+long
+seenset_size(seenset_t *s)
+{
+  return s == NULL ? 0 : s->used + s->ondisk;
+}
+
+/**************** seenset_iterate() ****************/
+/* see seenset.h for description */
+bool
+seenset_iterate(seenset_t *s, void *arg,
+                void (*itemfunc)(void *arg, const uint64_t fingerprint))
+{
+  if (s == NULL || itemfunc == NULL) {
+    return false;
+  }
+  for (size_t i = 0; i < s->slots; i++) {
+    if (s->table[i] != 0) {
+      (*itemfunc)(arg, s->table[i]);
+    }
+  }
+  uint64_t block[BLOCK];
+  for (long at = 0; at < s->ondisk; at += BLOCK) {
+    size_t n = s->ondisk - at < BLOCK ? s->ondisk - at : BLOCK;
+    if (!read_all(s->fd, block, n, at * sizeof(uint64_t))) {
+      return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+      (*itemfunc)(arg, block[i]);
+    }
+  }
+  return true;
+}
+
+/**************** seenset_report() ****************/
+/* see seenset.h for description */
+void
+seenset_report(seenset_t *s, FILE *fp, const char *message)
+{
+  if (s == NULL || fp == NULL) {
+    return;
+  }
+  long maybe = s->bloomNew + s->falsePositives;
+  fprintf(fp, "%s: %ld URLs, %ld on disk after %d spills, "
+          "peak memory %zuKB, Bloom false positives %ld of %ld (%.2f%%)\n",
+          message, seenset_size(s), s->ondisk, s->spills, s->peak / 1024,
+          s->falsePositives, maybe,
+          maybe > 0 ? 100.0 * s->falsePositives / maybe : 0.0);
+}
+
+/**************** seenset_delete() ****************/
+/* see seenset.h for description */
+void
+seenset_delete(seenset_t *s)
+{
+  if (s != NULL) {
+    if (s->fd >= 0) {
+      close(s->fd);
+      unlink(s->spillName);
+    }
+    if (s->index != NULL) {
+      count_free(s->index);
+    }
+    count_free(s->bloom);
+    count_free(s->table);
+    count_free(s->spillName);
+    count_free(s);
+  }
+}
+
+/**************** bloom_test ****************/
+/* Are all of fp's bits set in the Bloom filter? */
+static bool
+bloom_test(seenset_t *s, const uint64_t fp)
+{
+  uint64_t step = mix(fp) | 1;
+  uint64_t bit = fp;
+  for (int i = 0; i < BLOOM_HASHES; i++, bit += step) {
+    uint64_t b = bit & s->bloomMask;
+    if ((s->bloom[b / 64] & ((uint64_t)1 << (b % 64))) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**************** bloom_set ****************/
+/* Set fp's bits in the Bloom filter. */
+static void
+bloom_set(seenset_t *s, const uint64_t fp)
+{
+  uint64_t step = mix(fp) | 1;
+  uint64_t bit = fp;
+  for (int i = 0; i < BLOOM_HASHES; i++, bit += step) {
+    uint64_t b = bit & s->bloomMask;
+    s->bloom[b / 64] |= (uint64_t)1 << (b % 64);
+  }
+}
+
+/**************** table_find ****************/
+static bool
+table_find(seenset_t *s, const uint64_t fp)
+{
+  size_t mask = s->slots - 1;
+  for (size_t i = fp & mask; s->table[i] != 0; i = (i + 1) & mask) {
+    if (s->table[i] == fp) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**************** table_put ****************/
+/* Put fp, which is not there, into the first free slot for it. */
+static void
+table_put(uint64_t *table, const size_t slots, const uint64_t fp)
+{
+  size_t i = fp & (slots - 1);
+  while (table[i] != 0) {
+    i = (i + 1) & (slots - 1);
+  }
+  table[i] = fp;
+}
+
+/**************** table_resize ****************/
+/* Move the table's fingerprints to a new table of the given size. */
+static void
+table_resize(seenset_t *s, const size_t slots)
+{
+  uint64_t *table = assertp(count_calloc(slots, sizeof(uint64_t)),
+                            "seenset table");
+  for (size_t i = 0; i < s->slots; i++) {
+    if (s->table[i] != 0) {
+      table_put(table, slots, s->table[i]);
+    }
+  }
+  count_free(s->table);
+  s->table = table;
+  s->slots = slots;
+}
+
+/**************** disk_find ****************/
+/* Is fp in the spill file?  If the file cannot be read we say not, so
+ * that at worst a URL is crawled twice, rather than not at all.
+ */
+static bool
+disk_find(seenset_t *s, const uint64_t fp)
+{
+  if (s->ondisk == 0 || fp < s->index[0]) {
+    return false;
+  }
+  // the last block starting at or before fp
+  long lo = 0, hi = (s->ondisk + BLOCK - 1) / BLOCK - 1;
+  while (lo < hi) {
+    long mid = (lo + hi + 1) / 2;
+    if (s->index[mid] <= fp) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  uint64_t block[BLOCK];
+  long at = lo * BLOCK;
+  size_t n = s->ondisk - at < BLOCK ? s->ondisk - at : BLOCK;
+  if (!read_all(s->fd, block, n, at * sizeof(uint64_t))) {
+    return false;
+  }
+  return bsearch(&fp, block, n, sizeof(uint64_t), fp_cmp) != NULL;
+}
+
+/**************** make_room ****************/
+/* Make sure the table has room for one more fingerprint, growing it
+ * while the budget allows, and then spilling it.
+ */
+static bool
+make_room(seenset_t *s)
+{
+  if (2 * (s->used + 1) <= s->slots) {
+    return true;
+  }
+  if (s->slots < s->maxSlots) {
+    table_resize(s, 2 * s->slots);
+  } else if (!spill(s)) {
+    return false;
+  }
+  size_t used = memory_used(s);
+  if (used > s->peak) {
+    s->peak = used;
+  }
+  return true;
+}
+
+/**************** spill ****************/
+/* Merge the table's fingerprints into the spill file, writing a new
+ * file and renaming it over the old one, and empty the table.  If that
+ * fails, the table and the old file are left as they were.
+ */
+static bool
+spill(seenset_t *s)
+{
+  // sort the table's fingerprints at its front
+  size_t n = 0;
+  for (size_t i = 0; i < s->slots; i++) {
+    if (s->table[i] != 0) {
+      s->table[n++] = s->table[i];
+    }
+  }
+  memset(s->table + n, 0, (s->slots - n) * sizeof(uint64_t));
+  qsort(s->table, n, sizeof(uint64_t), fp_cmp);
+
+  char *newName = assertp(count_malloc(strlen(s->spillName) + 2),
+                          "seenset spill");
+  sprintf(newName, "%s~", s->spillName);
+  long total = s->ondisk + n;
+  long nblocks = (total + BLOCK - 1) / BLOCK;
+  uint64_t *index = count_malloc(nblocks * sizeof(uint64_t));
+  int fd = open(newName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  bool ok = (fd >= 0 && index != NULL);
+
+  // merge, a block at a time from the old file, into blocks of the new
+  uint64_t in[BLOCK], out[BLOCK];
+  size_t inlen = 0, inpos = 0, outlen = 0;
+  long read = 0, written = 0;
+  size_t t = 0;
+  while (ok && written < total) {
+    if (inpos == inlen && read < s->ondisk) {
+      inlen = s->ondisk - read < BLOCK ? s->ondisk - read : BLOCK;
+      ok = read_all(s->fd, in, inlen, read * sizeof(uint64_t));
+      read += inlen;
+      inpos = 0;
+    }
+    if (t < n && (inpos == inlen || s->table[t] < in[inpos])) {
+      out[outlen++] = s->table[t++];
+    } else {
+      out[outlen++] = in[inpos++];
+    }
+    if (outlen == BLOCK || written + outlen == total) {
+      index[written / BLOCK] = out[0];
+      ok = ok && write_all(fd, out, outlen, written * sizeof(uint64_t));
+      written += outlen;
+      outlen = 0;
+    }
+  }
+  ok = ok && rename(newName, s->spillName) == 0;
+
+  if (ok) {
+    if (s->fd >= 0) {
+      close(s->fd);
+    }
+    if (s->index != NULL) {
+      count_free(s->index);
+    }
+    s->fd = fd;
+    s->index = index;
+    s->ondisk = total;
+    memset(s->table, 0, n * sizeof(uint64_t));
+    s->used = 0;
+    s->spills++;
+  } else {
+    if (fd >= 0) {
+      close(fd);
+      unlink(newName);
+    }
+    if (index != NULL) {
+      count_free(index);
+    }
+    table_resize(s, s->slots);      // put them back where they belong
+  }
+  count_free(newName);
+  return ok;
+}
+
+/**************** read_all ****************/
+static bool
+read_all(int fd, uint64_t *data, size_t n, off_t at)
+{
+  char *buf = (char *)data;
+  size_t want = n * sizeof(uint64_t);
+  while (want > 0) {
+    ssize_t got = pread(fd, buf, want, at);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return false;
+    }
+    buf += got;
+    want -= got;
+    at += got;
+  }
+  return true;
+}
+
+/**************** write_all ****************/
+static bool
+write_all(int fd, const uint64_t *data, size_t n, off_t at)
+{
+  const char *buf = (const char *)data;
+  size_t want = n * sizeof(uint64_t);
+  while (want > 0) {
+    ssize_t wrote = pwrite(fd, buf, want, at);
+    if (wrote < 0 && errno == EINTR) {
+      continue;
+    }
+    if (wrote <= 0) {
+      return false;
+    }
+    buf += wrote;
+    want -= wrote;
+    at += wrote;
+  }
+  return true;
+}
+
+/**************** fp_cmp ****************/
+static int
+fp_cmp(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/**************** memory_used ****************/
+/* The filter, the table, and the index of the spill file. */
+static size_t
+memory_used(seenset_t *s)
+{
+  return (s->bloomMask + 1) / 8 + s->slots * sizeof(uint64_t)
+    + (s->ondisk + BLOCK - 1) / BLOCK * sizeof(uint64_t);
+}
+
+/**************** mix ****************/
+/* Scramble the bits of x (the splitmix64 finalizer). */
+static uint64_t
+mix(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
@@ -0,0 +1,93 @@
+/*
+ * seenset.h - header file for the crawler's 'seenset' module
+ *
+ * The 'seenset' is the set of URLs the crawler has seen, kept in
+ * bounded memory.  It stores not the URLs but a 64-bit hash of each (its
+ * 'fingerprint'); two URLs with the same fingerprint would be taken for
+ * one, but among a hundred million URLs the odds of that are about one
+ * in four thousand.  The fingerprints are kept in a hash table in
+ * memory, up to a given budget; beyond that they are moved to a sorted
+ * file, with a small index in memory, so that looking one up there
+ * takes one read of a few kilobytes.  In front of both is a Bloom
+ * filter, which can tell at once, without looking, that most URLs not
+ * seen before are new.
+ *
+ * The seenset is not itself thread-safe; the crawler guards it.
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __SEENSET_H
+#define __SEENSET_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**************** global types ****************/
+typedef struct seenset seenset_t;  // opaque to users of the module
+
+/**************** functions ****************/
+
+/**************** seenset_new ****************/
+/* Create a new (empty) seenset.
+ *
+ * Caller provides:
+ *   the most bytes of memory to use (at least 64KB), a quarter of which
+ *   goes to the Bloom filter (but no more than 16MB);
+ *   the pathname of a file we may create for fingerprints moved out of
+ *   memory.
+ * We return:
+ *   pointer to a new seenset, or NULL if error.
+ * Caller is responsible for:
+ *   later calling seenset_delete, which removes the file.
+ */
+seenset_t *seenset_new(const size_t maxMemory, const char *spillFile);
+
+/**************** seenset_fingerprint ****************/
+/* Return the fingerprint of url, which is never 0. */
+uint64_t seenset_fingerprint(const char *url);
+
+/**************** seenset_insert ****************/
+/* Add url to the set.
+ * We return:
+ *   true if it was not there before; false if it was, or if it could
+ *   not be added (see seenset_add).
+ */
+bool seenset_insert(seenset_t *s, const char *url);
+
+/**************** seenset_add ****************/
+/* Add a fingerprint, as returned by seenset_fingerprint, to the set.
+ * We return:
+ *   true if it was not there before; false if it was, or if it could
+ *   not be added because the spill file could not be written (a
+ *   message is printed on stderr, and the set stays as it was).
+ */
+bool seenset_add(seenset_t *s, const uint64_t fingerprint);
+
+/**************** seenset_size ****************/
+/* Return the number of fingerprints in the set. */
+long seenset_size(seenset_t *s);
+
+/**************** seenset_iterate ****************/
+/* Call itemfunc(arg, fingerprint) on every fingerprint in the set, in
+ * no particular order.  Returns false if the spill file could not be
+ * read, in which case some were missed.
+ */
+bool seenset_iterate(seenset_t *s, void *arg,
+                     void (*itemfunc)(void *arg, const uint64_t fingerprint));
+
+/**************** seenset_report ****************/
+/* Print the seenset's counters to fp on one line, prefixed by message:
+ * fingerprints held, how many are on disk, memory used, and how often
+ * the Bloom filter said a new URL might have been seen before (its
+ * false-positive rate).
+ */
+void seenset_report(seenset_t *s, FILE *fp, const char *message);
+
+/**************** seenset_delete ****************/
+/* Delete the seenset and remove the spill file.  Ignores NULL. */
+void seenset_delete(seenset_t *s);
+
+#endif // __SEENSET_H
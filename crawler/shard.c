@@ -0,0 +1,477 @@
+/*
+ * shard.c - the crawler's 'shard' module
+ *
+ * see shard.h for more information.
+ *
+ * Each shard has two pipes: one up, which it writes and the coordinator
+ * reads, and one down, the other way.  The coordinator polls all the
+ * pipes up, and keeps what it has to write down each pipe in a buffer
+ * of its own, written as the pipe has room, with the pipes down set not
+ * to block.  It counts the URLs it has sent each shard; a shard is idle
+ * once it says so with that count.
+ *
+ * Antony Guzman, 2020
+ */
+
+#define _GNU_SOURCE       // pipe2
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "shard.h"
+#include "jhash.h"
+#include "memory.h"
+
+/**************** local types ****************/
+typedef struct buffer {
+  char *data;
+  size_t len, cap;
+} buffer_t;
+
+/* The coordinator's end of one shard. */
+typedef struct link {
+  pid_t pid;                  // the shard's process, or -1
+  int up;                     // we read what it sends, or -1 once closed
+  int down;                   // we write to it, or -1
+  buffer_t in;                // read, but not yet a whole line
+  buffer_t out;               // to write, when the pipe has room
+  long sent;                  // URLs sent it
+  bool idle;                  // idle, having taken in all of them?
+} link_t;
+
+/**************** global types ****************/
+typedef struct shard {
+  int id;                     // this shard, or -1 in the coordinator
+  int shards;                 // how many there are
+  // a shard's end
+  int up, down;               // its pipes
+  buffer_t in;                // read from down, lines from 'pos' on
+  size_t pos;
+  // the coordinator's end
+  link_t *links;              // one per shard
+  long routed;                // URLs passed between shards
+  size_t peak;                // the most bytes waiting to go to one
+} shard_t;
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static void route_line(shard_t *s, const int from, char *line);
+static void route_closed(shard_t *s, const int from);
+static bool all_idle(shard_t *s);
+static void buffer_add(buffer_t *b, const char *data, const size_t len);
+static bool write_line(const int fd, const char *line, const size_t len);
+
+/**************** shard_start() ****************/
+/* see shard.h for description */
+shard_t *
+shard_start(const int shards)
+{
+  if (shards < 1) {
+    return NULL;
+  }
+  shard_t *s = count_calloc(1, sizeof(shard_t));
+  int *fds = count_calloc(4 * shards, sizeof(int));
+  if (s == NULL || fds == NULL
+      || (s->links = count_calloc(shards, sizeof(link_t))) == NULL) {
+    count_free(fds);
+    shard_delete(s);
+    return NULL;
+  }
+  s->id = -1;
+  s->shards = shards;
+  s->up = s->down = -1;
+
+  // fds[4i], fds[4i+1] is shard i's pipe up; fds[4i+2], fds[4i+3] down
+  int made = 0;
+  while (made < 2 * shards && pipe2(&fds[2 * made], O_CLOEXEC) == 0) {
+    made++;
+  }
+  int started = 0;
+  fflush(NULL);
+  while (made == 2 * shards && started < shards) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      // the new shard keeps the write end up and the read end down
+      for (int i = 0; i < 4 * shards; i++) {
+        if (i != 4 * started + 1 && i != 4 * started + 2) {
+          close(fds[i]);
+        }
+      }
+      s->id = started;
+      s->up = fds[4 * started + 1];
+      s->down = fds[4 * started + 2];
+      count_free(s->links);
+      s->links = NULL;
+      count_free(fds);
+      return s;
+    } else if (pid < 0) {
+      break;
+    }
+    s->links[started++].pid = pid;
+  }
+
+  if (started < shards) {
+    for (int i = 0; i < started; i++) {
+      kill(s->links[i].pid, SIGKILL);
+      waitpid(s->links[i].pid, NULL, 0);
+    }
+    for (int i = 0; i < 2 * made; i++) {
+      close(fds[i]);
+    }
+    count_free(fds);
+    count_free(s->links);
+    count_free(s);
+    return NULL;
+  }
+
+  // the coordinator keeps the read end up and the write end down, and
+  // finds a shard gone by the error from write, not by dying of SIGPIPE
+  signal(SIGPIPE, SIG_IGN);
+  for (int i = 0; i < shards; i++) {
+    link_t *link = &s->links[i];
+    close(fds[4 * i + 1]);
+    close(fds[4 * i + 2]);
+    link->up = fds[4 * i];
+    link->down = fds[4 * i + 3];
+    fcntl(link->down, F_SETFL, fcntl(link->down, F_GETFL) | O_NONBLOCK);
+  }
+  count_free(fds);
+  return s;
+}
+
+/**************** shard_id() ****************/
+/* see shard.h for description */
+int
+shard_id(shard_t *s)
+{
+  return s == NULL ? -1 : s->id;
+}
+
+/**************** shard_count() ****************/
+/* see shard.h for description */
+int
+shard_count(shard_t *s)
+{
+  return s == NULL ? 0 : s->shards;
+}
+
+/**************** shard_owner() ****************/
+/* see shard.h for description */
+int
+shard_owner(shard_t *s, const char *url)
+{
+  if (s == NULL || url == NULL || s->shards < 2) {
+    return 0;
+  }
+  return JenkinsHash(url, s->shards);
+}
+
+/**************** shard_send() ****************/
+/* see shard.h for description */
+bool
+shard_send(shard_t *s, const char *url, const int depth)
+{
+  if (s == NULL || s->up < 0 || url == NULL) {
+    return false;
+  }
+  char line[PIPE_BUF];
+  int len = snprintf(line, sizeof(line), "U %d %s\n", depth, url);
+  return len > 0 && len < (int)sizeof(line) && write_line(s->up, line, len);
+}
+
+/**************** shard_receive() ****************/
+/* see shard.h for description */
+char *
+shard_receive(shard_t *s, int *depth)
+{
+  if (s == NULL || s->down < 0 || depth == NULL) {
+    return NULL;
+  }
+  for (;;) {
+    // a whole line?
+    char *start = s->in.data + s->pos;
+    char *end = s->in.len > s->pos ? memchr(start, '\n', s->in.len - s->pos)
+                                   : NULL;
+    if (end != NULL) {
+      *end = '\0';
+      s->pos = end + 1 - s->in.data;
+      int offset;
+      if (start[0] == 'U' && sscanf(start, "U %d %n", depth, &offset) == 1) {
+        return start + offset;
+      } else if (start[0] == 'S') {
+        return NULL;
+      }
+      continue;               // not a line we know; skip it
+    }
+
+    // no; keep the part line, and read more after it
+    if (s->pos > 0 && s->in.len > 0) {
+      memmove(s->in.data, s->in.data + s->pos, s->in.len - s->pos);
+      s->in.len -= s->pos;
+      s->pos = 0;
+    }
+    if (s->in.cap - s->in.len < PIPE_BUF) {
+      buffer_add(&s->in, NULL, PIPE_BUF);
+      s->in.len -= PIPE_BUF;
+    }
+    ssize_t n = read(s->down, s->in.data + s->in.len, s->in.cap - s->in.len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return NULL;            // the coordinator is gone
+    }
+    s->in.len += n;
+  }
+}
+
+/**************** shard_idle() ****************/
+/* see shard.h for description */
+void
+shard_idle(shard_t *s, const long received)
+{
+  if (s != NULL && s->up >= 0) {
+    char line[32];
+    int len = sprintf(line, "I %ld\n", received);
+    write_line(s->up, line, len);
+  }
+}
+
+/**************** shard_route() ****************/
+/* see shard.h for description */
+int
+shard_route(shard_t *s, const char *seedURL)
+{
+  if (s == NULL || s->links == NULL || seedURL == NULL) {
+    return -1;
+  }
+  char line[PIPE_BUF];
+  snprintf(line, sizeof(line), "U 0 %s", seedURL);
+  route_line(s, -1, line);
+
+  struct pollfd *fds = assertp(count_calloc(2 * s->shards,
+                                            sizeof(struct pollfd)),
+                               "shard_route");
+  char buf[65536];
+  while (!all_idle(s)) {
+    // read from every shard; write to those we have something for
+    int nfds = 0;
+    for (int i = 0; i < s->shards; i++) {
+      link_t *link = &s->links[i];
+      fds[2 * i].fd = link->up;
+      fds[2 * i].events = POLLIN;
+      fds[2 * i + 1].fd = link->out.len > 0 ? link->down : -1;
+      fds[2 * i + 1].events = POLLOUT;
+      nfds += (link->up >= 0) + (link->out.len > 0);
+    }
+    if (nfds == 0) {
+      break;                  // every shard is gone
+    }
+    if (poll(fds, 2 * s->shards, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    for (int i = 0; i < s->shards; i++) {
+      link_t *link = &s->links[i];
+      if (link->up >= 0 && fds[2 * i].revents != 0) {
+        ssize_t n = read(link->up, buf, sizeof(buf));
+        if (n > 0) {
+          buffer_add(&link->in, buf, n);
+          char *start = link->in.data, *end;
+          while ( (end = memchr(start, '\n',
+                                link->in.data + link->in.len - start))
+                  != NULL) {
+            *end = '\0';
+            route_line(s, i, start);
+            start = end + 1;
+          }
+          link->in.len -= start - link->in.data;
+          memmove(link->in.data, start, link->in.len);
+        } else if (n == 0 || errno != EINTR) {
+          route_closed(s, i);
+        }
+      }
+      if (link->out.len > 0 && link->down >= 0 && fds[2 * i + 1].revents != 0) {
+        ssize_t n = write(link->down, link->out.data, link->out.len);
+        if (n > 0) {
+          link->out.len -= n;
+          memmove(link->out.data, link->out.data + n, link->out.len);
+        } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+          route_closed(s, i);
+        }
+      }
+    }
+  }
+  count_free(fds);
+
+  // tell every shard to stop, and wait for it to
+  int failed = 0;
+  for (int i = 0; i < s->shards; i++) {
+    link_t *link = &s->links[i];
+    if (link->down >= 0) {
+      fcntl(link->down, F_SETFL, fcntl(link->down, F_GETFL) & ~O_NONBLOCK);
+      write_line(link->down, "S\n", 2);
+      close(link->down);
+      link->down = -1;
+    }
+  }
+  for (int i = 0; i < s->shards; i++) {
+    link_t *link = &s->links[i];
+    int status;
+    if (link->pid > 0 && (waitpid(link->pid, &status, 0) != link->pid
+                          || !WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+      failed++;
+    }
+    link->pid = -1;
+  }
+  return failed;
+}
+
+/**************** shard_report() ****************/
+/* see shard.h for description */
+void
+shard_report(shard_t *s, FILE *fp, const char *message)
+{
+  if (s != NULL && fp != NULL && s->links != NULL) {
+    fprintf(fp, "%s: %d shards, %ld URLs passed between them, "
+            "at most %zu bytes waiting for one\n",
+            message, s->shards, s->routed, s->peak);
+  }
+}
+
+/**************** shard_delete() ****************/
+/* see shard.h for description */
+void
+shard_delete(shard_t *s)
+{
+  if (s == NULL) {
+    return;
+  }
+  if (s->up >= 0) {
+    close(s->up);
+  }
+  if (s->down >= 0) {
+    close(s->down);
+  }
+  free(s->in.data);
+  if (s->links != NULL) {
+    for (int i = 0; i < s->shards; i++) {
+      link_t *link = &s->links[i];
+      if (link->up >= 0) {
+        close(link->up);
+      }
+      if (link->down >= 0) {
+        close(link->down);
+      }
+      free(link->in.data);
+      free(link->out.data);
+    }
+    count_free(s->links);
+  }
+  count_free(s);
+}
+
+/**************** route_line ****************/
+/* Act on a line from shard 'from' (or -1, for the seed): pass a URL on
+ * to its owner, or note that the shard is idle.
+ */
+static void
+route_line(shard_t *s, const int from, char *line)
+{
+  int depth, offset;
+  long received;
+  if (line[0] == 'U' && sscanf(line, "U %d %n", &depth, &offset) == 1) {
+    int to = shard_owner(s, line + offset);
+    link_t *link = &s->links[to];
+    if (link->down < 0) {
+      return;                 // that shard is gone
+    }
+    size_t len = strlen(line);
+    line[len] = '\n';
+    buffer_add(&link->out, line, len + 1);
+    line[len] = '\0';
+    link->sent++;
+    link->idle = false;
+    if (from >= 0) {
+      s->routed++;
+    }
+    if (link->out.len > s->peak) {
+      s->peak = link->out.len;
+    }
+  } else if (line[0] == 'I' && sscanf(line, "I %ld", &received) == 1
+             && from >= 0) {
+    s->links[from].idle = (received == s->links[from].sent);
+  }
+}
+
+/**************** route_closed ****************/
+/* Shard 'from' has closed its pipe, before it was told to stop: it has
+ * failed.  Say so, and count it as idle, with nothing more for it.
+ */
+static void
+route_closed(shard_t *s, const int from)
+{
+  link_t *link = &s->links[from];
+  fprintf(stderr, "crawler: shard %d quit before the crawl was over\n", from);
+  if (link->up >= 0) {
+    close(link->up);
+    link->up = -1;
+  }
+  if (link->down >= 0) {
+    close(link->down);
+    link->down = -1;
+  }
+  link->out.len = 0;
+  link->idle = true;
+}
+
+/**************** all_idle ****************/
+/* Is every shard idle, with nothing on its way to it? */
+static bool
+all_idle(shard_t *s)
+{
+  for (int i = 0; i < s->shards; i++) {
+    if (!s->links[i].idle) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**************** buffer_add ****************/
+/* Append len bytes to b, growing it as need be; if data is NULL, just
+ * make room for them, leaving them undefined.
+ */
+static void
+buffer_add(buffer_t *b, const char *data, const size_t len)
+{
+  if (b->len + len > b->cap) {
+    b->cap = b->len + len > 2 * b->cap ? b->len + len : 2 * b->cap;
+    b->data = assertp(realloc(b->data, b->cap), "shard buffer");
+  }
+  if (data != NULL) {
+    memcpy(b->data + b->len, data, len);
+  }
+  b->len += len;
+}
+
+/**************** write_line ****************/
+/* Write a line of at most PIPE_BUF bytes to a blocking pipe, whole. */
+static bool
+write_line(const int fd, const char *line, const size_t len)
+{
+  ssize_t n;
+  while ( (n = write(fd, line, len)) < 0 && errno == EINTR) {
+    ;   // interrupted before writing anything; try again
+  }
+  return n == (ssize_t)len;
+}
@@ -0,0 +1,115 @@
+/*
+ * shard.h - header file for the crawler's 'shard' module
+ *
+ * A crawl may be split among several processes, 'shards', each of
+ * which crawls only the URLs whose hash falls to it, and shares nothing
+ * with the others but the pageDirectory, where each saves its pages
+ * under document IDs of its own.  A shard that finds a URL belonging
+ * to another sends it to the process that started them all, the
+ * coordinator, which passes it on to that shard.
+ *
+ * The coordinator also decides when the crawl is over.  A shard with
+ * nothing to crawl and nothing being crawled says it is idle, and how
+ * many URLs it has taken in so far.  Every URL a shard sends reaches
+ * the coordinator before anything it sends later, so once every shard
+ * has said it is idle, having taken in all the URLs sent to it, no URL
+ * is anywhere in between, and no shard can find another: the
+ * coordinator tells them all to stop.
+ *
+ * They talk over pipes, in lines of text, each written with one
+ * write() of at most PIPE_BUF bytes, so that the threads of a shard
+ * can write at once without their lines mixing:
+ *   "U depth url"   a URL to crawl (either way)
+ *   "I count"       idle, having taken in count URLs (shard to coordinator)
+ *   "S"             stop (coordinator to shard)
+ * The coordinator never waits to write, so a shard never waits long
+ * for it.
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __SHARD_H
+#define __SHARD_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/**************** global types ****************/
+typedef struct shard shard_t;  // opaque to users of the module
+
+/**************** functions ****************/
+
+/**************** shard_start ****************/
+/* Fork 'shards' new processes, joined to this one by pipes.  Flush any
+ * output first, and call before starting any thread.
+ *
+ * Caller provides:
+ *   the number of shards (>= 1).
+ * We return:
+ *   in each new process, its end of the pipes, whose shard_id is 0, 1,
+ *   ..., shards-1; in this process, the coordinator's end, whose
+ *   shard_id is -1; NULL if the pipes or processes can't be made (any
+ *   processes already started are killed).
+ * Caller is responsible for:
+ *   later calling shard_delete, in each process.
+ */
+shard_t *shard_start(const int shards);
+
+/**************** shard_id ****************/
+/* Return which shard this is, or -1 in the coordinator. */
+int shard_id(shard_t *s);
+
+/**************** shard_count ****************/
+/* Return the number of shards. */
+int shard_count(shard_t *s);
+
+/**************** shard_owner ****************/
+/* Return the shard that crawls the given (normalized) URL. */
+int shard_owner(shard_t *s, const char *url);
+
+/**************** shard_send ****************/
+/* From a shard, send a URL found at the given depth, which belongs to
+ * another shard, to the coordinator.
+ * We return:
+ *   false if it can't be sent, or is too long to send.
+ */
+bool shard_send(shard_t *s, const char *url, const int depth);
+
+/**************** shard_receive ****************/
+/* In a shard, wait for the next URL from the coordinator.  Only one
+ * thread may call it.
+ * We return:
+ *   the URL, in a buffer of ours good until the next call, and its
+ *   depth in *depth; NULL once the coordinator says stop (or is gone).
+ */
+char *shard_receive(shard_t *s, int *depth);
+
+/**************** shard_idle ****************/
+/* From a shard, tell the coordinator we are idle, having taken in
+ * 'received' URLs from it in all -- counting only those already added
+ * to the pages to crawl (or found to be seen already).
+ */
+void shard_idle(shard_t *s, const long received);
+
+/**************** shard_route ****************/
+/* In the coordinator, send seedURL, at depth 0, to the shard that owns
+ * it, and then pass URLs between the shards until they are all idle;
+ * then tell them to stop, and wait for them to exit.  A shard that
+ * exits early is reported on stderr, and URLs for it are dropped.
+ * We return:
+ *   the number of shards that did not exit with status 0.
+ */
+int shard_route(shard_t *s, const char *seedURL);
+
+/**************** shard_report ****************/
+/* Print, from the coordinator, the URLs passed between shards, and the
+ * most that waited to be written to any one, to fp on one line,
+ * prefixed by message.
+ */
+void shard_report(shard_t *s, FILE *fp, const char *message);
+
+/**************** shard_delete ****************/
+/* Close this process's pipes and free s.  Ignores NULL. */
+void shard_delete(shard_t *s);
+
+#endif // __SHARD_H
@@ -0,0 +1,473 @@
+/*
+ * sitesrv.c - a local stand-in for the CS50 web server, for testing and
+ *   benchmarking the crawler without the network
+ *
+ * usage: sitesrv [-p PORT] [-n PAGES] [-f FANOUT] [-s BYTES] [-l MS]
+ *                [-e PCT] [-t PCT] [-x PCT] [-o | -c] [-w DIR]
+ *
+ * Serve a synthetic site of PAGES pages (default 1000), /bench/0.html
+ * to /bench/<PAGES-1>.html, on 127.0.0.1:PORT (default 8050).  Every
+ * page is made up from its number when it is asked for, so the site
+ * costs no disk and is the same on every run:
+ *   - page i links to FANOUT pages (default 8): pages i*FANOUT+1 to
+ *     i*FANOUT+FANOUT where they exist, others chosen at random, so
+ *     every page can be reached from page 0 in about log(PAGES)/
+ *     log(FANOUT) hops, and most pages are linked to more than once;
+ *     links are written in a few relative forms;
+ *   - its text is about BYTES bytes (default 8192; each page between
+ *     half and one and a half times that), of words drawn from a
+ *     vocabulary of 10000, the common ones far more often than the rare;
+ *   - each response waits MS milliseconds (default 0) before it is sent;
+ *   - PCT percent of the pages (default 0), picked by their number, fail
+ *     (never page 0): a third with 404, a third with 500, and a third by
+ *     closing the connection without an answer;
+ *   - with -t, PCT percent of the others (default 0) stall: they are
+ *     never answered, but the connection is held open until the client
+ *     gives up and closes it;
+ *   - with -x, PCT percent of the pages (default 0; never page 0) are
+ *     served as application/octet-stream rather than text/html, though
+ *     they are the same pages.
+ * Responses are HTTP/1.1, with Content-Length, kept alive unless the
+ * request says "Connection: close", and pipelined requests are answered
+ * in turn; or, with -o, HTTP/1.0, each on a connection of its own, closed
+ * after it.  With -c, bodies are sent chunked rather than with
+ * Content-Length, in chunks of 1000 bytes.  Each carries the same Last-Modified date; as the site never
+ * changes, any request with If-Modified-Since gets 304.  Each connection
+ * has a thread of its own.  To point the crawler at it, give it a
+ * hosts file (-H) that maps old-www.cs.dartmouth.edu to 127.0.0.1, and
+ * the seed http://old-www.cs.dartmouth.edu:PORT/bench/0.html.
+ *
+ * With -w DIR, write the pages to DIR/0.html, DIR/1.html, ... instead of
+ * serving them, for another server to serve as /bench/ (latency, errors
+ * and stalls do not apply).
+ *
+ * Antony Guzman, 2020
+ */
+
+#define _GNU_SOURCE       // memmem, strcasestr
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/**************** file-local global variables ****************/
+static const int vocabulary = 10000;    // distinct words in the site
+static const int requestMax = 16384;    // bytes of requests buffered
+static const char *lastModified = "Wed, 01 Jan 2020 00:00:00 GMT";
+
+/**************** local types ****************/
+typedef struct site {
+  long pages;                 // pages in the site
+  int fanout;                 // links on each page
+  int bytes;                  // mean bytes of text on a page
+  int latency;                // milliseconds to wait before each response
+  int errors;                 // percent of the pages that fail
+  int stalls;                 // percent of the others that stall
+  int binary;                 // percent of the pages not served as HTML
+  bool old;                   // answer in HTTP/1.0?
+  bool chunked;               // send bodies chunked?
+} site_t;
+
+typedef struct connection {
+  const site_t *site;
+  int fd;                     // the accepted socket
+} connection_t;
+
+/**************** local functions ****************/
+static void *serve(void *arg);
+static bool respond(const site_t *site, const int fd, char *request,
+                    char *page, const size_t pageMax);
+static size_t make_page(const site_t *site, const long n, char *buf);
+static int page_error(const site_t *site, const long n);
+static bool sendall(const int fd, const char *data, size_t len);
+static bool sendchunked(const int fd, const char *data, size_t len);
+static uint64_t mix(uint64_t x);
+
+/**************** main ****************/
+int
+main(int argc, char *argv[])
+{
+  site_t site = { .pages = 1000, .fanout = 8, .bytes = 8192,
+                  .latency = 0, .errors = 0, .stalls = 0, .binary = 0,
+                  .old = false, .chunked = false };
+  int port = 8050;
+  char *dir = NULL;
+  char excess;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:n:f:s:l:e:t:x:ocw:")) != -1) {
+    bool ok = true;
+    switch (opt) {
+    case 'p':
+      ok = sscanf(optarg, "%d%c", &port, &excess) == 1
+           && port >= 1 && port <= 65535;
+      break;
+    case 'n':
+      ok = sscanf(optarg, "%ld%c", &site.pages, &excess) == 1
+           && site.pages >= 1 && site.pages <= 100000000;
+      break;
+    case 'f':
+      ok = sscanf(optarg, "%d%c", &site.fanout, &excess) == 1
+           && site.fanout >= 1 && site.fanout <= 1000;
+      break;
+    case 's':
+      ok = sscanf(optarg, "%d%c", &site.bytes, &excess) == 1
+           && site.bytes >= 0 && site.bytes <= 100000000;
+      break;
+    case 'l':
+      ok = sscanf(optarg, "%d%c", &site.latency, &excess) == 1
+           && site.latency >= 0 && site.latency <= 60000;
+      break;
+    case 'e':
+      ok = sscanf(optarg, "%d%c", &site.errors, &excess) == 1
+           && site.errors >= 0 && site.errors <= 100;
+      break;
+    case 't':
+      ok = sscanf(optarg, "%d%c", &site.stalls, &excess) == 1
+           && site.stalls >= 0 && site.stalls <= 100;
+      break;
+    case 'x':
+      ok = sscanf(optarg, "%d%c", &site.binary, &excess) == 1
+           && site.binary >= 0 && site.binary <= 100;
+      break;
+    case 'o':
+      site.old = true;
+      break;
+    case 'c':
+      site.chunked = true;
+      break;
+    case 'w':
+      dir = optarg;
+      break;
+    default:
+      ok = false;
+    }
+    if (!ok) {
+      fprintf(stderr, "usage: %s [-p PORT] [-n PAGES] [-f FANOUT] "
+              "[-s BYTES] [-l MS] [-e PCT] [-t PCT] [-x PCT] [-o | -c] [-w DIR]\n", argv[0]);
+      exit(1);
+    }
+  }
+  if (optind != argc || (site.old && site.chunked)) {
+    fprintf(stderr, "usage: %s [-p PORT] [-n PAGES] [-f FANOUT] "
+            "[-s BYTES] [-l MS] [-e PCT] [-t PCT] [-x PCT] [-o | -c] [-w DIR]\n", argv[0]);
+    exit(1);
+  }
+
+  if (dir != NULL) {
+    // write the site rather than serve it
+    char *page = malloc(site.bytes * 3 / 2 + site.fanout * 64 + 256);
+    char *path = malloc(strlen(dir) + 32);
+    if (page == NULL || path == NULL) {
+      fprintf(stderr, "%s: out of memory\n", argv[0]);
+      exit(2);
+    }
+    for (long n = 0; n < site.pages; n++) {
+      sprintf(path, "%s/%ld.html", dir, n);
+      FILE *fp = fopen(path, "w");
+      size_t len = make_page(&site, n, page);
+      if (fp == NULL || fwrite(page, 1, len, fp) != len || fclose(fp) != 0) {
+        fprintf(stderr, "%s: cannot write '%s'\n", argv[0], path);
+        exit(3);
+      }
+    }
+    free(path);
+    free(page);
+    exit(0);
+  }
+
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int yes = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (listener < 0
+      || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0
+      || listen(listener, 1024) != 0) {
+    fprintf(stderr, "%s: cannot listen on port %d\n", argv[0], port);
+    exit(4);
+  }
+  signal(SIGPIPE, SIG_IGN);     // a crawler may hang up mid-response
+  printf("%s: %ld pages at http://old-www.cs.dartmouth.edu:%d/bench/0.html\n",
+         argv[0], site.pages, port);
+  fflush(stdout);
+
+  for (;;) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      continue;
+    }
+    connection_t *c = malloc(sizeof(connection_t));
+    pthread_t thread;
+    if (c == NULL) {
+      close(fd);
+      continue;
+    }
+    c->site = &site;
+    c->fd = fd;
+    if (pthread_create(&thread, NULL, serve, c) != 0) {
+      close(fd);
+      free(c);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+}
+
+/**************** serve ****************/
+/* The thread for one connection: read requests and answer them, in
+ * order, until the client closes the connection or asks us to, or we
+ * drop it to inject an error.
+ */
+static void *
+serve(void *arg)
+{
+  connection_t *c = arg;
+  const site_t *site = c->site;
+  int fd = c->fd;
+  free(c);
+
+  size_t pageMax = site->bytes * 3 / 2 + site->fanout * 64 + 512;
+  char *page = malloc(pageMax);
+  char *request = malloc(requestMax + 1);
+  size_t have = 0;              // bytes in request
+  if (page == NULL || request == NULL) {
+    free(page);
+    free(request);
+    close(fd);
+    return NULL;
+  }
+
+  for (;;) {
+    // read until there is a whole request in the buffer
+    char *end;
+    while ((end = memmem(request, have, "\r\n\r\n", 4)) == NULL) {
+      ssize_t n = have < requestMax
+                  ? read(fd, request + have, requestMax - have) : 0;
+      if (n <= 0) {
+        goto done;              // closed, failed, or request too long
+      }
+      have += n;
+    }
+    size_t len = end + 4 - request;
+    end[2] = '\0';              // keep the last header's \r\n
+    if (!respond(site, fd, request, page, pageMax)) {
+      break;
+    }
+    memmove(request, request + len, have - len);
+    have -= len;
+  }
+ done:
+  free(page);
+  free(request);
+  close(fd);
+  return NULL;
+}
+
+/**************** respond ****************/
+/* Answer the request, whose headers are in the string 'request', using
+ * 'page' to build the page.  Return false if the connection is to be
+ * closed.
+ */
+static bool
+respond(const site_t *site, const int fd, char *request, char *page,
+        const size_t pageMax)
+{
+  char path[1024];
+  char header[512];
+  int minor = 1;
+  if (sscanf(request, "GET %1023s HTTP/1.%d", path, &minor) != 2) {
+    const char *bad = "HTTP/1.1 400 Bad Request\r\n"
+                      "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    sendall(fd, bad, strlen(bad));
+    return false;
+  }
+  bool keep = minor >= 1 && !site->old
+              && strcasestr(request, "\nConnection: close") == NULL;
+
+  if (site->latency > 0) {
+    struct timespec wait = { site->latency / 1000,
+                             (site->latency % 1000) * 1000000L };
+    nanosleep(&wait, NULL);
+  }
+
+  long n;
+  char excess;
+  int status = 404;
+  if (sscanf(path, "/bench/%ld.htm%c%c", &n, &excess, &excess) == 2
+      && excess == 'l' && n >= 0 && n < site->pages) {
+    status = page_error(site, n);
+    if (status == 200 && strcasestr(request, "\nIf-Modified-Since:") != NULL) {
+      status = 304;
+    }
+  }
+
+  size_t len = 0;
+  const char *reason = "OK";
+  const char *type = "text/html";
+  switch (status) {
+  case -1:
+    while (read(fd, page, pageMax) > 0) {
+      ;                         // stall until the client hangs up
+    }
+    return false;
+  case 0:
+    return false;               // drop the connection, unanswered
+  case 200:
+    len = make_page(site, n, page);
+    if (n > 0 && (long)(mix(n ^ 0xb1a5ULL) % 100) < site->binary) {
+      type = "application/octet-stream";
+    }
+    break;
+  case 304:
+    reason = "Not Modified";
+    break;
+  case 404:
+    reason = "Not Found";
+    len = snprintf(page, pageMax, "<html><body>not found</body></html>\n");
+    break;
+  default:
+    reason = "Internal Server Error";
+    len = snprintf(page, pageMax, "<html><body>error</body></html>\n");
+  }
+  bool chunked = site->chunked && status != 304;
+  char length[64] = "Transfer-Encoding: chunked";
+  if (!chunked) {
+    snprintf(length, sizeof(length), "Content-Length: %zu", len);
+  }
+  int hlen = snprintf(header, sizeof(header),
+                      "HTTP/1.%d %d %s\r\nContent-Type: %s\r\n"
+                      "Last-Modified: %s\r\n%s\r\n%s\r\n",
+                      site->old ? 0 : 1, status, reason, type, lastModified,
+                      length,
+                      (keep || site->old) ? "" : "Connection: close\r\n");
+  return sendall(fd, header, hlen)
+    && (chunked ? sendchunked(fd, page, len) : sendall(fd, page, len))
+    && keep;
+}
+
+/**************** make_page ****************/
+/* Write page n of the site into buf, which holds at least
+ * bytes*3/2 + fanout*64 + 256 bytes; return its length.
+ */
+static size_t
+make_page(const site_t *site, const long n, char *buf)
+{
+  uint64_t state = mix(n + 1);
+  char *p = buf;
+  p += sprintf(p, "<html>\n<head><title>page %ld</title></head>\n<body>\n", n);
+
+  for (int k = 0; k < site->fanout; k++) {
+    long to = n * site->fanout + 1 + k;
+    if (to >= site->pages || to <= n) {         // past the end, or overflow
+      state = mix(state);
+      to = state % site->pages;
+    }
+    // a few of the forms a link can take, for the crawler to normalize
+    switch (k % 3) {
+    case 0:
+      p += sprintf(p, "<a href=\"%ld.html\">page %ld</a>\n", to, to);
+      break;
+    case 1:
+      p += sprintf(p, "<a href=\"./%ld.html\">page %ld</a>\n", to, to);
+      break;
+    default:
+      p += sprintf(p, "<a href=\"../bench/%ld.html\">page %ld</a>\n", to, to);
+    }
+  }
+
+  // text, of words more often common than rare
+  state = mix(state);
+  size_t text = site->bytes / 2 + (site->bytes > 0 ? state % (site->bytes + 1) : 0);
+  char *stop = p + text;
+  int column = 0;
+  while (p < stop) {
+    state = mix(state);
+    uint64_t a = state % vocabulary, b = (state >> 32) % vocabulary;
+    uint64_t w = mix(a * b / vocabulary + 1);
+    int wordLen = 3 + w % 8;
+    for (int i = 0; i < wordLen; i++) {
+      *p++ = 'a' + (w >> (8 + 5 * i)) % 26;
+    }
+    *p++ = (++column % 12 == 0) ? '\n' : ' ';
+  }
+  p += sprintf(p, "\n</body>\n</html>\n");
+  return p - buf;
+}
+
+/**************** page_error ****************/
+/* The status with which page n is to be answered: 200, or for the
+ * pages picked to fail, 404, 500, or 0 (drop the connection), or for
+ * those picked to stall, -1.  Page 0, the seed, never fails or stalls.
+ */
+static int
+page_error(const site_t *site, const long n)
+{
+  uint64_t h = mix(n ^ 0x5eedULL);
+  if (n == 0 || (long)(h % 100) >= site->errors) {
+    return (n > 0 && (long)(mix(n ^ 0x57a11ULL) % 100) < site->stalls)
+           ? -1 : 200;
+  }
+  static const int failures[] = { 404, 500, 0 };
+  return failures[(h >> 32) % 3];
+}
+
+/**************** sendchunked ****************/
+/* Write the len bytes of data to fd in chunks of 1000, then the last,
+ * empty, chunk; return false if that fails.
+ */
+static bool
+sendchunked(const int fd, const char *data, size_t len)
+{
+  char size[32];
+  while (len > 0) {
+    size_t n = len < 1000 ? len : 1000;
+    int slen = snprintf(size, sizeof(size), "%zx\r\n", n);
+    if (!sendall(fd, size, slen) || !sendall(fd, data, n)
+        || !sendall(fd, "\r\n", 2)) {
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return sendall(fd, "0\r\n\r\n", 5);
+}
+
+/**************** sendall ****************/
+/* Write all len bytes of data to fd; return false if that fails. */
+static bool
+sendall(const int fd, const char *data, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+/**************** mix ****************/
+/* A well-mixed 64-bit function of x (splitmix64's finalizer). */
+static uint64_t
+mix(uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
@@ -0,0 +1,199 @@
+/*
+ * stageq.c - the crawler's 'stageq' module
+ *
+ * see stageq.h for more information.
+ *
+ * The items are kept in a ring of 'capacity' slots, guarded by one
+ * mutex, with one condition variable for each side: 'room' for those
+ * putting items, 'items' for those taking them.
+ *
+ * Antony Guzman, 2020
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "stageq.h"
+#include "http.h"
+#include "memory.h"
+
+/**************** global types ****************/
+typedef struct stageq {
+  pthread_mutex_t lock;       // guards everything below
+  pthread_cond_t room;        // signalled when an item is taken
+  pthread_cond_t items;       // signalled when an item is put
+  void **ring;                // 'capacity' slots
+  int capacity;               // slots in the ring
+  int head;                   // slot of the next item to take
+  int depth;                  // items in the ring
+  bool closed;                // no more items may be put
+  long puts;                  // items ever put
+  long long depthSum;         // depth found by each put, summed
+  int peak;                   // the most items ever in the ring
+  long fullWaits;             // puts that found the ring full
+  double fullSeconds;         // time they spent waiting for room
+  double emptySeconds;        // time gets spent waiting for an item
+} stageq_t;
+
+/**************** local functions ****************/
+/* not visible outside this file */
+
+/**************** stageq_new() ****************/
+/* see stageq.h for description */
+stageq_t *
+stageq_new(const int capacity)
+{
+  if (capacity < 1) {
+    return NULL;
+  }
+  stageq_t *q = count_malloc(sizeof(stageq_t));
+  if (q == NULL) {
+    return NULL;
+  }
+  q->ring = count_calloc(capacity, sizeof(void *));
+  if (q->ring == NULL) {
+    count_free(q);
+    return NULL;
+  }
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->room, NULL);
+  pthread_cond_init(&q->items, NULL);
+  q->capacity = capacity;
+  q->head = 0;
+  q->depth = 0;
+  q->closed = false;
+  q->puts = 0;
+  q->depthSum = 0;
+  q->peak = 0;
+  q->fullWaits = 0;
+  q->fullSeconds = 0;
+  q->emptySeconds = 0;
+  return q;
+}
+
+/**************** stageq_put() ****************/
+/* see stageq.h for description */
+bool
+stageq_put(stageq_t *q, void *item)
+{
+  if (q == NULL || item == NULL) {
+    return false;
+  }
+  pthread_mutex_lock(&q->lock);
+  if (q->depth == q->capacity && !q->closed) {
+    // the next stage is behind; wait for it, timing how long
+    long long start = http_clock();
+    q->fullWaits++;
+    while (q->depth == q->capacity && !q->closed) {
+      pthread_cond_wait(&q->room, &q->lock);
+    }
+    q->fullSeconds += (http_clock() - start) / 1e6;
+  }
+  if (q->closed) {
+    pthread_mutex_unlock(&q->lock);
+    return false;
+  }
+  q->ring[(q->head + q->depth) % q->capacity] = item;
+  q->depthSum += q->depth;
+  q->depth++;
+  q->puts++;
+  if (q->depth > q->peak) {
+    q->peak = q->depth;
+  }
+  pthread_cond_signal(&q->items);
+  pthread_mutex_unlock(&q->lock);
+  return true;
+}
+
+/**************** stageq_get() ****************/
+/* see stageq.h for description */
+void *
+stageq_get(stageq_t *q)
+{
+  if (q == NULL) {
+    return NULL;
+  }
+  pthread_mutex_lock(&q->lock);
+  if (q->depth == 0 && !q->closed) {
+    // this stage is ahead; wait for the one before it
+    long long start = http_clock();
+    while (q->depth == 0 && !q->closed) {
+      pthread_cond_wait(&q->items, &q->lock);
+    }
+    q->emptySeconds += (http_clock() - start) / 1e6;
+  }
+  void *item = NULL;
+  if (q->depth > 0) {
+    item = q->ring[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->depth--;
+    pthread_cond_signal(&q->room);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return item;
+}
+
+/**************** stageq_close() ****************/
+/* see stageq.h for description */
+void
+stageq_close(stageq_t *q)
+{
+  if (q != NULL) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = true;
+    pthread_cond_broadcast(&q->room);
+    pthread_cond_broadcast(&q->items);
+    pthread_mutex_unlock(&q->lock);
+  }
+}
+
+/**************** stageq_depth() ****************/
+/* see stageq.h for description */
+int
+stageq_depth(stageq_t *q)
+{
+  if (q == NULL) {
+    return 0;
+  }
+  pthread_mutex_lock(&q->lock);
+  int depth = q->depth;
+  pthread_mutex_unlock(&q->lock);
+  return depth;
+}
+
+/**************** stageq_report() ****************/
+/* see stageq.h for description */
+void
+stageq_report(stageq_t *q, FILE *fp, const char *message)
+{
+  if (q == NULL || fp == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&q->lock);
+  fprintf(fp, "%s: %ld items, mean depth %.1f, peak %d of %d, "
+          "full %ld times for %.2fs, empty for %.2fs\n",
+          message, q->puts,
+          q->puts > 0 ? (double)q->depthSum / q->puts : 0.0,
+          q->peak, q->capacity, q->fullWaits, q->fullSeconds,
+          q->emptySeconds);
+  pthread_mutex_unlock(&q->lock);
+}
+
+/**************** stageq_delete() ****************/
+/* see stageq.h for description */
+void
+stageq_delete(stageq_t *q, void (*itemdelete)(void *item))
+{
+  if (q != NULL) {
+    for (int i = 0; i < q->depth; i++) {
+      if (itemdelete != NULL) {
+        (*itemdelete)(q->ring[(q->head + i) % q->capacity]);
+      }
+    }
+    pthread_cond_destroy(&q->items);
+    pthread_cond_destroy(&q->room);
+    pthread_mutex_destroy(&q->lock);
+    count_free(q->ring);
+    count_free(q);
+  }
+}
@@ -0,0 +1,90 @@
+/*
+ * stageq.h - header file for the crawler's 'stageq' module
+ *
+ * A 'stageq' is a bounded queue of items handed from one stage of the
+ * crawl to the next -- pages from the fetchers to the thread that saves
+ * them, and from that to the thread that scans them for links, and the
+ * pages saved to the thread that indexes them.  It holds at most a
+ * fixed number of items; a stage putting an item into a full queue
+ * waits until the next stage takes one, so a slow stage holds back the
+ * stages before it rather than letting items pile up in memory.  A
+ * stage taking an item from an empty queue waits for one.
+ *
+ * The queue counts how deep it was each time an item was put, and how
+ * long each side spent waiting for the other, so that the crawler can
+ * report which stage holds up the crawl.
+ *
+ * Unlike the frontier and the politeness scheduler, a stageq is
+ * thread-safe: it is the meeting point of threads.
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __STAGEQ_H
+#define __STAGEQ_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/**************** global types ****************/
+typedef struct stageq stageq_t;  // opaque to users of the module
+
+/**************** functions ****************/
+
+/**************** stageq_new ****************/
+/* Create a new (empty) queue.
+ *
+ * Caller provides:
+ *   the most items the queue may hold (>= 1).
+ * We return:
+ *   pointer to a new queue, or NULL if error.
+ * Caller is responsible for:
+ *   later calling stageq_delete.
+ */
+stageq_t *stageq_new(const int capacity);
+
+/**************** stageq_put ****************/
+/* Add an item at the tail of the queue, waiting while it is full.
+ *
+ * Caller provides:
+ *   valid queue and item (not NULL).
+ * We return:
+ *   true if the item was queued; false if the queue has been closed,
+ *   in which case the item is still the caller's.
+ */
+bool stageq_put(stageq_t *q, void *item);
+
+/**************** stageq_get ****************/
+/* Remove the item at the head of the queue, waiting while it is empty.
+ * We return:
+ *   the item, which is now the caller's;
+ *   NULL once the queue is closed and empty.
+ */
+void *stageq_get(stageq_t *q);
+
+/**************** stageq_close ****************/
+/* Close the queue: no more items may be put, and stageq_get returns
+ * NULL once the items already in it are taken.  Wakes every waiter.
+ */
+void stageq_close(stageq_t *q);
+
+/**************** stageq_depth ****************/
+/* Return the number of items in the queue now. */
+int stageq_depth(stageq_t *q);
+
+/**************** stageq_report ****************/
+/* Print the queue's counters to fp on one line, prefixed by message:
+ * items put, the mean and peak depth an item found on arrival, how
+ * often and for how long an item waited for room (the next stage was
+ * behind), and how long the next stage waited for an item (this one
+ * was behind).
+ */
+void stageq_report(stageq_t *q, FILE *fp, const char *message);
+
+/**************** stageq_delete ****************/
+/* Delete the queue, calling itemdelete (if not NULL) on each item
+ * still in it.  No thread may be waiting on it.  Ignores NULL.
+ */
+void stageq_delete(stageq_t *q, void (*itemdelete)(void *item));
+
+#endif // __STAGEQ_H
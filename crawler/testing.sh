@@ -39,6 +39,53 @@ mkdir data3
 # 4 arguments and nonexisting directory
 ./crawler $seedURL not_real 2
 
+# zero worker threads
+./crawler -j 0 $seedURL data1 2
+
+# negative politeness delay
+./crawler -d -1 $seedURL data1 2
+
+# unreadable hosts file
+./crawler -H no_such_file $seedURL data1 2
+
+# unknown crawl order
+./crawler -o sideways $seedURL data1 2
+
+# no memory for the URLs seen
+./crawler -s 0 $seedURL data1 2
+
+# resume with a different maxDepth from the checkpoint's
+mkdir data8
+./crawler -c 1 $seedURL data8 1
+./crawler -r $seedURL data8 2
+
+# resume and recrawl at once
+./crawler -r -R $seedURL data8 1
+
+# unknown dedup mode
+./crawler -D similar $seedURL data1 2
+
+# no room in the queues between stages
+./crawler -S 0 $seedURL data1 2
+
+# metrics written to a directory that does not exist
+./crawler -F no_such_dir/metrics $seedURL data1 2
+
+# index while recrawling
+./crawler -R -I data8.index $seedURL data8 1
+
+# shards while resuming
+./crawler -K 2 -r $seedURL data8 2
+
+# replaying an archive that does not exist
+./crawler -Y no_such.archive $seedURL data1 2
+
+# timeouts not three numbers
+./crawler -T 1000,1000 $seedURL data1 2
+
+# negative page limit
+./crawler -B -1 $seedURL data1 2
+
 ######################################
 ### These tests should pass ####
 
@@ -76,13 +123,154 @@ mkdir data3
 # at depth 1 with seed URL2
 ./crawler $seedURL2 data3 1
 
+# at depth 5 with four worker threads
+mkdir data4
+./crawler -j 4 $seedURL data4 5
 
+# at depth 5, one request per 200ms, bursts of up to 4
+mkdir data5
+./crawler -d 200 -b 4 $seedURL data5 5
 
+# at depth 2, names from a hosts file, prefetching
+echo "127.0.0.1 localhost" > hosts.test
+mkdir data6
+./crawler -H hosts.test -p $seedURL data6 2
+rm -f hosts.test
 
-
-
-
-
-
-
-
+
+
+
+
+
+
+
+
+
+
+
+# at depth 5, depth-first, frontier and seen set capped at 1MB each
+mkdir data7
+./crawler -o dfs -m 1 -s 1 $seedURL data7 5
+
+# at depth 5, killed part way through, then resumed
+mkdir data9
+timeout -s KILL 3 ./crawler -c 1 $seedURL data9 5
+./crawler -r $seedURL data9 5
+
+# at depth 5, again, fetching only the pages that changed
+./crawler -R $seedURL data9 5
+cat data9/.changed
+
+# at depth 5, not saving copies of pages already saved
+mkdir data10
+./crawler -D near $seedURL data10 5
+cat data10/.duplicates
+
+# at depth 5, one file per page, as before segments
+mkdir data11
+./crawler -L $seedURL data11 5
+ls data11
+
+# at depth 5, compressed segments
+mkdir data12
+./crawler -z $seedURL data12 5
+ls data12
+
+# at depth 5, fetching, saving and scanning in stages, queues of 2 pages
+mkdir data13
+./crawler -j 4 -S 2 $seedURL data13 5
+ls data13
+
+# at depth 5, with metrics every second
+mkdir data14
+./crawler -M 1 -F data14.metrics $seedURL data14 5
+tail -1 data14.metrics
+
+# at depth 5, indexing while crawling; the same as the indexer's index
+mkdir data15
+./crawler -I data15.index $seedURL data15 5
+../indexer/indexer data15 data15.index2
+sort data15.index | md5sum
+sort data15.index2 | md5sum
+
+# offline, against a local stand-in for the server: 300 pages, 10% failing
+echo "127.0.0.1 old-www.cs.dartmouth.edu" > data16.hosts
+./sitesrv -p 8051 -n 300 -e 10 &
+sleep 1
+mkdir data16
+./crawler -H data16.hosts -d 0 -j 4 http://old-www.cs.dartmouth.edu:8051/bench/0.html data16 10
+
+# offline, in 4 shards; the pages numbered 1, 2, 3, ... as for any crawl
+mkdir data17
+./crawler -H data16.hosts -d 0 -a 8 -K 4 -I data17.index http://old-www.cs.dartmouth.edu:8051/bench/0.html data17 10
+../indexer/indexer data17 data17.index2
+sort data17.index | md5sum
+sort data17.index2 | md5sum
+
+# record the fetches of an offline crawl; then, with the server gone,
+# replay them, at once, into the same pages
+mkdir data18
+./crawler -H data16.hosts -d 0 -A data18.archive -I data18.index http://old-www.cs.dartmouth.edu:8051/bench/0.html data18 10
+kill %1
+mkdir data19
+./crawler -d 0 -Y data18.archive -f -I data19.index http://old-www.cs.dartmouth.edu:8051/bench/0.html data19 10
+sort data18.index | md5sum
+sort data19.index | md5sum
+
+# a server that never answers a tenth of its pages: each fetch of one
+# times out, and the rest of the crawl goes on, as fetches in flight or
+# as threads fetching
+./sitesrv -p 8052 -n 300 -t 10 &
+sleep 1
+mkdir data20
+./crawler -H data16.hosts -d 0 -a 8 -T 300,300,1000 -F data20.metrics http://old-www.cs.dartmouth.edu:8052/bench/0.html data20 10
+mkdir data21
+./crawler -H data16.hosts -d 0 -j 4 -T 300,300,1000 -F data21.metrics http://old-www.cs.dartmouth.edu:8052/bench/0.html data21 10
+kill %1
+tail -1 data20.metrics | grep -o '"saved":[0-9]*'
+tail -1 data21.metrics | grep -o '"saved":[0-9]*'
+
+# a server that serves a tenth of its pages as other than HTML: those,
+# and any page over 8KB, are refused, unread, as fetches in flight or
+# as threads fetching
+./sitesrv -p 8053 -n 300 -x 10 &
+sleep 1
+mkdir data22
+./crawler -H data16.hosts -d 0 -a 8 -B 8 -F data22.metrics http://old-www.cs.dartmouth.edu:8053/bench/0.html data22 10
+mkdir data23
+./crawler -H data16.hosts -d 0 -j 4 -B 8 -F data23.metrics http://old-www.cs.dartmouth.edu:8053/bench/0.html data23 10
+kill %1
+tail -1 data22.metrics | grep -o '"refused":[0-9]*'
+tail -1 data23.metrics | grep -o '"refused":[0-9]*'
+
+# a server that answers in HTTP/1.0, closing every connection: fetches
+# in flight and threads fetching get every page alike
+./sitesrv -p 8054 -n 300 -o &
+sleep 1
+mkdir data24
+./crawler -H data16.hosts -d 0 -a 8 -F data24.metrics http://old-www.cs.dartmouth.edu:8054/bench/0.html data24 10
+mkdir data25
+./crawler -H data16.hosts -d 0 -j 4 -F data25.metrics http://old-www.cs.dartmouth.edu:8054/bench/0.html data25 10
+kill %1
+tail -1 data24.metrics | grep -o '"saved":[0-9]*'
+tail -1 data25.metrics | grep -o '"saved":[0-9]*'
+
+# a server that sends its pages chunked, on the port of one that did
+# not: fetched one at a time, in flight or by a thread, the pages saved
+# are the same
+./sitesrv -p 8055 -n 300 &
+sleep 1
+mkdir data26
+./crawler -H data16.hosts -d 0 -a 1 http://old-www.cs.dartmouth.edu:8055/bench/0.html data26 10
+kill %1
+wait
+./sitesrv -p 8055 -n 300 -c &
+sleep 1
+mkdir data27
+./crawler -H data16.hosts -d 0 -a 1 http://old-www.cs.dartmouth.edu:8055/bench/0.html data27 10
+mkdir data28
+./crawler -H data16.hosts -d 0 -j 1 http://old-www.cs.dartmouth.edu:8055/bench/0.html data28 10
+kill %1
+md5sum < data26/segment.0
+md5sum < data27/segment.0
+md5sum < data28/segment.0
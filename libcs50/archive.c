@@ -0,0 +1,453 @@
+/*
+ * archive.c - CS50 'archive' module
+ *
+ * see archive.h for more information.
+ *
+ * A record is built in memory and appended with one write() to a file
+ * opened O_APPEND, so records from several threads or processes never
+ * interleave.  To replay, we map the file and index it once, by URL,
+ * keeping the offset of every record for each; a record is parsed
+ * again only when it is served.
+ *
+ * Antony Guzman, 2020
+ */
+
+#define _GNU_SOURCE       // open_memstream
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "archive.h"
+#include "webpage.h"
+#include "http.h"
+#include "hashtable.h"
+#include "memory.h"
+
+/**************** file-local global variables ****************/
+#define MAXLINE 1024          // longest header line we read back
+
+/**************** local types ****************/
+typedef struct responses {
+  size_t *offsets;            // of each record for one URL, in order
+  int n, cap;
+  int next;                   // the one to serve next
+} responses_t;
+
+typedef struct record {
+  const char *url;            // not null-terminated
+  size_t urllen;
+  long connect, firstByte, fetch;
+  const char *head;           // status line and headers, or empty
+  size_t headlen;
+  const char *body;
+  size_t bodylen;
+  size_t end;                 // offset just past the record
+} record_t;
+
+/* All of the module's state, guarded by 'lock', but for the mode, which
+ * is set only before any fetch, and the mapped file, which is read-only.
+ * There is only ever one of these.
+ */
+static struct {
+  pthread_mutex_t lock;
+  archive_mode_t mode;
+  int fd;                     // recording: the file
+  char *data;                 // replaying: the file, mapped
+  size_t size;
+  hashtable_t *urls;          // replaying: URL -> responses_t
+  long recorded;              // records written
+  long replayed;              // fetches answered from the archive
+  long missed;                // ... and those whose URL was not there
+} archive = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .mode = ARCHIVE_OFF,
+  .fd = -1,
+};
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static void record_write(const webpage_t *page, const httpresponse_t *resp,
+                         const long elapsed);
+static bool record_parse(const size_t off, record_t *r);
+static bool archive_load(void);
+static void responses_delete(void *item);
+
+/**************** archive_start() ****************/
+/* see archive.h for description */
+bool
+archive_start(const char *path, const archive_mode_t mode)
+{
+  if (path == NULL || mode == ARCHIVE_OFF || archive.mode != ARCHIVE_OFF) {
+    return false;
+  }
+  if (mode == ARCHIVE_RECORD) {
+    archive.fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (archive.fd < 0) {
+      return false;
+    }
+  } else {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+      if (fd >= 0) close(fd);
+      return false;
+    }
+    archive.size = st.st_size;
+    archive.data = NULL;
+    if (archive.size > 0) {
+      archive.data = mmap(NULL, archive.size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (archive.data == MAP_FAILED) {
+        close(fd);
+        return false;
+      }
+    }
+    close(fd);
+    if (!archive_load()) {
+      if (archive.data != NULL) munmap(archive.data, archive.size);
+      return false;
+    }
+  }
+  archive.recorded = archive.replayed = archive.missed = 0;
+  archive.mode = mode;
+  return true;
+}
+
+/**************** archive_mode() ****************/
+/* see archive.h for description */
+archive_mode_t
+archive_mode(void)
+{
+  return archive.mode;
+}
+
+/**************** archive_put() ****************/
+/* see archive.h for description */
+void
+archive_put(const webpage_t *page, const httpresponse_t *resp)
+{
+  if (archive.mode == ARCHIVE_RECORD && page != NULL && resp != NULL) {
+    record_write(page, resp, -1);
+  }
+}
+
+/**************** archive_putFailure() ****************/
+/* see archive.h for description */
+void
+archive_putFailure(const webpage_t *page, const long elapsed)
+{
+  if (archive.mode == ARCHIVE_RECORD && page != NULL) {
+    record_write(page, NULL, elapsed);
+  }
+}
+
+/**************** archive_get() ****************/
+/* see archive.h for description */
+bool
+archive_get(webpage_t *page, long *delay)
+{
+  if (delay != NULL) {
+    *delay = 0;
+  }
+  if (archive.mode < ARCHIVE_REPLAY || page == NULL
+      || webpage_getURL(page) == NULL || webpage_getHTML(page) != NULL) {
+    return false;
+  }
+
+  // the URL's next record, if it has one
+  pthread_mutex_lock(&archive.lock);
+  responses_t *rs = hashtable_find(archive.urls, webpage_getURL(page));
+  size_t off = 0;
+  if (rs == NULL) {
+    archive.missed++;
+  } else {
+    off = rs->offsets[rs->next];
+    if (rs->next < rs->n - 1) {
+      rs->next++;
+    }
+    archive.replayed++;
+  }
+  pthread_mutex_unlock(&archive.lock);
+  record_t r;
+  if (rs == NULL || !record_parse(off, &r)) {
+    return false;
+  }
+
+  // the status line, then the headers
+  httpresponse_t resp;
+  memset(&resp, 0, sizeof(resp));
+  resp.contentLength = -1;
+  for (const char *line = r.head; line < r.head + r.headlen; ) {
+    const char *eol = memchr(line, '\n', r.head + r.headlen - line);
+    char buf[MAXLINE];
+    size_t len = eol - line < MAXLINE ? eol - line : MAXLINE - 1;
+    memcpy(buf, line, len);
+    buf[len] = '\0';
+    if (line == r.head) {
+      http_status(buf, &resp.status, NULL);
+    } else {
+      http_header(&resp, buf);
+    }
+    line = eol + 1;
+  }
+
+  // the page as the recorded fetch left it, but under today's limits
+  long maxBody;
+  http_getLimits(&maxBody, NULL);
+  if (!http_wanted(&resp)) {
+    resp.refused = true;
+    resp.avoided = resp.contentLength > 0 ? resp.contentLength : 0;
+  } else if (maxBody > 0 && r.bodylen > (size_t)maxBody) {
+    resp.refused = true;
+  }
+  bool fetched = false;
+  if (r.headlen > 0) {
+    webpage_setStatus(page, resp.status);
+    webpage_setTimes(page, r.connect, r.firstByte, r.fetch);
+    webpage_setRefused(page, resp.refused ? resp.avoided : -1);
+    if (resp.status == 200 && r.bodylen > 0 && !resp.refused) {
+      char *html = assertp(malloc(r.bodylen + 1), "archive html");
+      memcpy(html, r.body, r.bodylen);
+      html[r.bodylen] = '\0';
+      fetched = webpage_setHTML(page, html);
+      if (fetched) {
+        webpage_setValidators(page, resp.etag, resp.lastModified);
+      } else {
+        free(html);
+      }
+    }
+  }
+  if (delay != NULL && archive.mode == ARCHIVE_REPLAY && r.fetch > 0) {
+    *delay = r.fetch;
+  }
+  return fetched;
+}
+
+/**************** archive_fetch() ****************/
+/* see archive.h for description */
+bool
+archive_fetch(webpage_t *page)
+{
+  long delay;
+  bool fetched = archive_get(page, &delay);
+  if (delay > 0) {
+    struct timespec wait = { delay / 1000000, (delay % 1000000) * 1000 };
+    while (nanosleep(&wait, &wait) < 0 && errno == EINTR) {
+      ;
+    }
+  }
+  return fetched;
+}
+
+/**************** archive_report() ****************/
+/* see archive.h for description */
+void
+archive_report(FILE *fp, const char *message)
+{
+  if (fp == NULL || archive.mode == ARCHIVE_OFF) {
+    return;
+  }
+  pthread_mutex_lock(&archive.lock);
+  if (archive.mode == ARCHIVE_RECORD) {
+    fprintf(fp, "%s: %ld fetches recorded\n", message, archive.recorded);
+  } else {
+    fprintf(fp, "%s: %ld fetches replayed, %ld URLs not in the archive\n",
+            message, archive.replayed, archive.missed);
+  }
+  pthread_mutex_unlock(&archive.lock);
+}
+
+/**************** archive_stop() ****************/
+/* see archive.h for description */
+void
+archive_stop(void)
+{
+  pthread_mutex_lock(&archive.lock);
+  if (archive.fd >= 0) {
+    close(archive.fd);
+    archive.fd = -1;
+  }
+  if (archive.urls != NULL) {
+    hashtable_delete(archive.urls, responses_delete);
+    archive.urls = NULL;
+  }
+  if (archive.data != NULL) {
+    munmap(archive.data, archive.size);
+    archive.data = NULL;
+  }
+  archive.mode = ARCHIVE_OFF;
+  pthread_mutex_unlock(&archive.lock);
+}
+
+/**************** record_write ****************/
+/* Append a record of the page's fetch: of resp, or, if resp is NULL,
+ * of a fetch that got no response after 'elapsed' microseconds.
+ */
+static void
+record_write(const webpage_t *page, const httpresponse_t *resp,
+             const long elapsed)
+{
+  long connect = -1, firstByte = -1, fetch = elapsed;
+  if (resp != NULL) {
+    webpage_getTimes(page, &connect, &firstByte, &fetch);
+  }
+  size_t bodylen = (resp != NULL && resp->body != NULL) ? resp->bodylen : 0;
+
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *fp = open_memstream(&buf, &len);
+  if (fp == NULL) {
+    return;
+  }
+  fprintf(fp, "@ %ld %ld %ld %zu %s\n", connect, firstByte, fetch,
+          bodylen, webpage_getURL(page));
+  if (resp != NULL) {
+    fprintf(fp, "HTTP/1.1 %d\n", resp->status);
+    if (resp->etag[0] != '\0') {
+      fprintf(fp, "ETag: %s\n", resp->etag);
+    }
+    if (resp->lastModified[0] != '\0') {
+      fprintf(fp, "Last-Modified: %s\n", resp->lastModified);
+    }
+    if (resp->contentType[0] != '\0') {
+      fprintf(fp, "Content-Type: %s\n", resp->contentType);
+    }
+    if (resp->contentLength >= 0) {
+      fprintf(fp, "Content-Length: %ld\n", resp->contentLength);
+    }
+    if (resp->chunked) {
+      fprintf(fp, "Transfer-Encoding: chunked\n");   // the body is not
+    }
+    fprintf(fp, "Connection: %s\n", resp->keepalive ? "keep-alive" : "close");
+  }
+  fputc('\n', fp);
+  if (bodylen > 0) {
+    fwrite(resp->body, 1, bodylen, fp);
+  }
+  fputc('\n', fp);
+  if (fclose(fp) != 0) {
+    free(buf);
+    return;
+  }
+
+  // one write, so that records never interleave
+  pthread_mutex_lock(&archive.lock);
+  if (archive.fd >= 0 && write(archive.fd, buf, len) == (ssize_t)len) {
+    archive.recorded++;
+  }
+  pthread_mutex_unlock(&archive.lock);
+  free(buf);
+}
+
+/**************** record_parse ****************/
+/* Parse the record at offset off of the mapped archive into *r.
+ * Returns false if there is no whole record there.
+ */
+static bool
+record_parse(const size_t off, record_t *r)
+{
+  const char *data = archive.data;
+  const char *end = data + archive.size;
+  if (off >= archive.size) {
+    return false;
+  }
+  const char *line = data + off;
+  const char *eol = memchr(line, '\n', end - line);
+  if (eol == NULL) {
+    return false;
+  }
+
+  // "@ connect firstByte fetch bodyLength url"
+  char buf[128];
+  size_t len = eol - line < (long)sizeof(buf) ? eol - line : sizeof(buf) - 1;
+  memcpy(buf, line, len);
+  buf[len] = '\0';
+  int n = 0;
+  if (sscanf(buf, "@ %ld %ld %ld %zu %n", &r->connect, &r->firstByte,
+             &r->fetch, &r->bodylen, &n) != 4 || n == 0 || n >= len) {
+    return false;
+  }
+  r->url = line + n;
+  r->urllen = eol - r->url;
+
+  // the head runs up to a blank line
+  r->head = eol + 1;
+  const char *p = r->head;
+  while (p < end && *p != '\n') {
+    if ( (p = memchr(p, '\n', end - p)) == NULL) {
+      return false;
+    }
+    p++;
+  }
+  if (p >= end) {
+    return false;
+  }
+  r->headlen = p - r->head;
+  r->body = p + 1;
+  if (r->bodylen >= (size_t)(end - r->body)
+      || r->body[r->bodylen] != '\n') {
+    return false;
+  }
+  r->end = r->body + r->bodylen + 1 - data;
+  return true;
+}
+
+/**************** archive_load ****************/
+/* Index the mapped archive by URL.  Returns false if out of memory. */
+static bool
+archive_load(void)
+{
+  // count the records, to size the table
+  long records = 0;
+  record_t r;
+  for (size_t off = 0; record_parse(off, &r); off = r.end) {
+    records++;
+  }
+  archive.urls = hashtable_new(records + 1);
+  if (archive.urls == NULL) {
+    return false;
+  }
+
+  char *url = NULL;
+  size_t urlcap = 0;
+  for (size_t off = 0; record_parse(off, &r); off = r.end) {
+    if (r.urllen + 1 > urlcap) {
+      urlcap = 2 * (r.urllen + 1);
+      url = assertp(realloc(url, urlcap), "archive url");
+    }
+    memcpy(url, r.url, r.urllen);
+    url[r.urllen] = '\0';
+
+    responses_t *rs = hashtable_find(archive.urls, url);
+    if (rs == NULL) {
+      rs = assertp(count_calloc(1, sizeof(responses_t)), "archive responses");
+      hashtable_insert(archive.urls, url, rs);
+    }
+    if (rs->n == rs->cap) {
+      rs->cap = rs->cap == 0 ? 1 : 2 * rs->cap;
+      rs->offsets = assertp(realloc(rs->offsets, rs->cap * sizeof(size_t)),
+                            "archive offsets");
+    }
+    rs->offsets[rs->n++] = off;
+  }
+  free(url);
+  return true;
+}
+
+/**************** responses_delete ****************/
+/* for use by hashtable_delete */
+static void
+responses_delete(void *item)
+{
+  responses_t *rs = item;
+  if (rs != NULL) {
+    free(rs->offsets);
+    count_free(rs);
+  }
+}
@@ -0,0 +1,117 @@
+/*
+ * archive.h - header file for the 'archive' module
+ *
+ * The 'archive' keeps a record of fetches, process-wide, so that a crawl
+ * can later be repeated without a network.  While recording, every
+ * fetch -- by webpage_fetch, a connpool, or a fetchq -- appends to the
+ * archive file the page's URL, how long the fetch took, and the response:
+ * its status line, the headers we care about (see http.h), and its body;
+ * or that no response came.  While replaying, those fetches make no
+ * connection at all, but answer each URL from the archive instead,
+ * with the n-th fetch of a URL getting the n-th response recorded for
+ * it (and later ones the last); a URL not in the archive fails, as if
+ * its server were down.  Replayed bodies are subject to the limits of
+ * http_setLimits as fetched ones are, though one refused while recording
+ * is simply empty.  A replayed fetch takes as long as the
+ * recorded one did, or, with 'fast' replay, no time at all.
+ *
+ * The archive file is a series of records, each written at once, so
+ * that several threads, or processes, may record to one file:
+ *   @ connect firstByte fetch bodyLength url
+ *   HTTP/1.1 status
+ *   Header: value
+ *   ...
+ *   (a blank line)
+ *   body bytes, then a newline
+ * where the times are in microseconds, as webpage_getTimes gives them
+ * (-1 if unknown), and a fetch that got no response has no status line
+ * or headers.  A record cut short, by a crash say, ends the archive.
+ *
+ * All functions are safe to call from several threads at once.
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __ARCHIVE_H
+#define __ARCHIVE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "webpage.h"
+#include "http.h"
+
+/**************** global types ****************/
+typedef enum {
+  ARCHIVE_OFF,                // fetch from the network (the default)
+  ARCHIVE_RECORD,             // ... and record every fetch
+  ARCHIVE_REPLAY,             // fetch from the archive, taking the time
+                              //   each recorded fetch took
+  ARCHIVE_REPLAY_FAST         // fetch from the archive at once
+} archive_mode_t;
+
+/**************** functions ****************/
+
+/**************** archive_start ****************/
+/* Start recording to, or replaying from, the archive file at path.
+ *
+ * Caller provides:
+ *   the pathname, and a mode other than ARCHIVE_OFF.
+ * We return:
+ *   true on success; false if the file can't be opened for appending
+ *   (to record) or read (to replay), or an archive is already started.
+ * Caller is responsible for:
+ *   calling it before any fetch, and later calling archive_stop.
+ */
+bool archive_start(const char *path, const archive_mode_t mode);
+
+/**************** archive_mode ****************/
+/* Return the mode of the archive; ARCHIVE_OFF if none is started. */
+archive_mode_t archive_mode(void);
+
+/**************** archive_put ****************/
+/* If recording, append the response to the page's fetch: the page's
+ * URL and times (see webpage_setTimes), and resp's status, headers,
+ * and body (bodylen bytes, which need not be malloc'd).
+ */
+void archive_put(const webpage_t *page, const httpresponse_t *resp);
+
+/**************** archive_putFailure ****************/
+/* If recording, append that the page's fetch got no response, after
+ * trying for 'elapsed' microseconds.
+ */
+void archive_putFailure(const webpage_t *page, const long elapsed);
+
+/**************** archive_get ****************/
+/* If replaying, answer the page's fetch from the archive, at once.
+ *
+ * Caller provides:
+ *   a page with a URL and NULL html, as for webpage_fetch, and a
+ *   place to put how long the fetch should seem to take.
+ * We return:
+ *   true if the fetch succeeded: the recorded response was a 200 with
+ *   a body, not refused, which the page now has as its html; false
+ *   otherwise.
+ *   Either way the page's status, validators and times are as the
+ *   recorded fetch left them, and *delay is the microseconds it took
+ *   (0 with fast replay), which the caller should wait before using
+ *   the page, to replay the original timing.
+ */
+bool archive_get(webpage_t *page, long *delay);
+
+/**************** archive_fetch ****************/
+/* Like archive_get, but wait out the delay before returning. */
+bool archive_fetch(webpage_t *page);
+
+/**************** archive_report ****************/
+/* Print the fetches recorded, or those replayed and the URLs not found
+ * in the archive, to fp on one line, prefixed by message.
+ */
+void archive_report(FILE *fp, const char *message);
+
+/**************** archive_stop ****************/
+/* Close the archive file, and go back to fetching from the network
+ * without recording.  Call when no fetch is in progress.
+ */
+void archive_stop(void);
+
+#endif // __ARCHIVE_H
@@ -10,11 +10,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "bag.h"
 #include "memory.h"
 
 /**************** file-local global variables ****************/
-/* none */
+// nodes come from a slab (see memory.h), made on first use
+static slab_t *nodeSlab = NULL;
+static pthread_once_t nodeSlabOnce = PTHREAD_ONCE_INIT;
 
 /**************** local types ****************/
 typedef struct bagnode {
@@ -34,6 +37,7 @@ typedef struct bag {
 /**************** local functions ****************/
 /* not visible outside this file */
 static bagnode_t *bagnode_new(void *item);
+static void bagnode_slab(void);
 
 /**************** bag_new() ****************/
 /* see bag.h for description */
@@ -77,7 +81,8 @@ bag_insert(bag_t *bag, void *item)
 static bagnode_t * // not visible outside this file
 bagnode_new(void *item)
 {
-  bagnode_t *node = count_malloc(sizeof(bagnode_t));
+  pthread_once(&nodeSlabOnce, bagnode_slab);
+  bagnode_t *node = slab_alloc(nodeSlab);
 
   if (node == NULL) {
     // error allocating memory for node; return error
@@ -89,6 +94,14 @@ bagnode_new(void *item)
   }
 }
 
+/**************** bagnode_slab ****************/
+/* Make the slab for bagnodes */
+static void
+bagnode_slab(void)
+{
+  nodeSlab = slab_new("bagnode", sizeof(bagnode_t));
+}
+
 /**************** bag_extract() ****************/
 /* see bag.h for description */
 void *
@@ -102,7 +115,7 @@ bag_extract(bag_t *bag)
     bagnode_t *out = bag->head; // the node to take out
     void *item = out->item;     // the item to return
     bag->head = out->next;      // hop over the node to remove
-    count_free(out);
+    slab_free(nodeSlab, out);
     return item;
   }
 }
@@ -153,7 +166,7 @@ bag_delete(bag_t *bag, void (*itemdelete)(void *item) )
         (*itemdelete)(node->item);      // delete node's item
       }
       bagnode_t *next = node->next;     // remember what comes next
-      count_free(node);                 // free the node
+      slab_free(nodeSlab, node);        // free the node
       node = next;                      // and move on to next
     }
 
@@ -0,0 +1,373 @@
+/*
+ * connpool.c - CS50 'connpool' module
+ *
+ * see connpool.h for more information.
+ *
+ * The pool is a hashtable from "hostname:port" to a small stack of idle
+ * httpconn's.  A fetch takes a connection off the stack (or opens a new
+ * one), sends its requests, reads the responses in order, and pushes the
+ * connection back if the server is willing to keep it open.  Only the
+ * stacks and the counters are shared between threads; all socket I/O
+ * happens outside the lock, on a connection no other thread can see.
+ *
+ * Antony Guzman, 2020
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "connpool.h"
+#include "http.h"
+#include "hashtable.h"
+#include "webpage.h"
+#include "archive.h"
+#include "memory.h"
+
+/**************** file-local global variables ****************/
+static const int MAX_TRY = 3;         // new connections per batch, in a row
+static const int HOST_SLOTS = 31;     // hashtable slots for hosts
+
+/**************** local types ****************/
+typedef struct hostpool {
+  httpconn_t **idle;          // stack of idle connections
+  int nidle;                  // how many are on it
+} hostpool_t;
+
+/**************** global types ****************/
+typedef struct connpool {
+  pthread_mutex_t lock;       // guards everything below
+  hashtable_t *hosts;         // "hostname:port" -> hostpool_t
+  int maxIdle;                // capacity of each idle stack
+  int pipeline;               // most requests in flight per connection
+  long requests;              // requests sent
+  long connects;              // connections opened
+  long reused;                // requests sent on an already-used connection
+} connpool_t;
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static void fetch_batch(connpool_t *pool, const char *key,
+                        const char *hostname, const int port,
+                        webpage_t *pages[], char *requests[],
+                        const int m, bool fetched[]);
+static httpconn_t *pool_take(connpool_t *pool, const char *key);
+static void pool_put(connpool_t *pool, const char *key, httpconn_t *conn);
+static void hostpool_delete(void *item);
+
+/**************** connpool_new() ****************/
+/* see connpool.h for description */
+connpool_t *
+connpool_new(const int maxIdle, const int pipeline)
+{
+  if (maxIdle <= 0 || pipeline <= 0) {
+    return NULL;
+  }
+  connpool_t *pool = count_malloc(sizeof(connpool_t));
+  if (pool == NULL) {
+    return NULL;
+  }
+  pool->hosts = hashtable_new(HOST_SLOTS);
+  if (pool->hosts == NULL) {
+    count_free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pool->maxIdle = maxIdle;
+  pool->pipeline = pipeline;
+  pool->requests = pool->connects = pool->reused = 0;
+  return pool;
+}
+
+/**************** connpool_fetch() ****************/
+/* see connpool.h for description */
+int
+connpool_fetch(connpool_t *pool, webpage_t *pages[], const int n,
+               bool fetched[])
+{
+  if (pool == NULL || pages == NULL || fetched == NULL || n <= 0) {
+    return 0;
+  }
+
+  // replaying an archive, there are no connections to pool
+  if (archive_mode() >= ARCHIVE_REPLAY) {
+    int nfetched = 0;
+    for (int i = 0; i < n; i++) {
+      fetched[i] = archive_fetch(pages[i]);
+      nfetched += fetched[i] ? 1 : 0;
+    }
+    return nfetched;
+  }
+
+  // burst every URL; a page we can't burst is simply not fetched
+  char **hostnames = assertp(count_calloc(n, sizeof(char *)), "hostnames");
+  char **pathnames = assertp(count_calloc(n, sizeof(char *)), "pathnames");
+  int *ports = assertp(count_calloc(n, sizeof(int)), "ports");
+  for (int i = 0; i < n; i++) {
+    fetched[i] = false;
+    if (webpage_getURL(pages[i]) == NULL || webpage_getHTML(pages[i]) != NULL
+        || !BurstURL(webpage_getURL(pages[i]),
+                     &hostnames[i], &ports[i], &pathnames[i])) {
+      hostnames[i] = pathnames[i] = NULL;
+    }
+  }
+
+  // gather each page with later pages for the same host, up to 'pipeline'
+  webpage_t **batch = assertp(count_calloc(pool->pipeline,
+                                           sizeof(webpage_t *)), "batch");
+  char **requests = assertp(count_calloc(pool->pipeline,
+                                         sizeof(char *)), "requests");
+  bool *results = assertp(count_calloc(pool->pipeline, sizeof(bool)),
+                          "results");
+  int *which = assertp(count_calloc(pool->pipeline, sizeof(int)), "which");
+  int nfetched = 0;
+
+  for (int i = 0; i < n; i++) {
+    if (hostnames[i] == NULL) {
+      continue;     // bad URL, or already in an earlier batch
+    }
+    char *hostname = hostnames[i];
+    int port = ports[i];
+    int m = 0;
+    for (int j = i; j < n && m < pool->pipeline; j++) {
+      if (hostnames[j] != NULL && ports[j] == port
+          && strcmp(hostnames[j], hostname) == 0) {
+        which[m] = j;
+        batch[m] = pages[j];
+        requests[m] = assertp(http_request(hostname, pathnames[j],
+                                           webpage_getETag(pages[j]),
+                                           webpage_getLastModified(pages[j]),
+                                           false), "request");
+        m++;
+      }
+    }
+
+    char *key = assertp(count_malloc(strlen(hostname) + 12), "host key");
+    sprintf(key, "%s:%d", hostname, port);
+    fetch_batch(pool, key, hostname, port, batch, requests, m, results);
+    count_free(key);
+
+    for (int k = 0; k < m; k++) {
+      int j = which[k];
+      fetched[j] = results[k];
+      nfetched += results[k] ? 1 : 0;
+      count_free(requests[k]);
+      if (j != i) {
+        free(hostnames[j]);
+        hostnames[j] = NULL;    // mark it done
+      }
+    }
+    free(hostnames[i]);
+    hostnames[i] = NULL;
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (pathnames[i] != NULL) free(pathnames[i]);
+  }
+  count_free(hostnames);
+  count_free(pathnames);
+  count_free(ports);
+  count_free(batch);
+  count_free(requests);
+  count_free(results);
+  count_free(which);
+  return nfetched;
+}
+
+/**************** connpool_report() ****************/
+/* see connpool.h for description */
+void
+connpool_report(connpool_t *pool, FILE *fp, const char *message)
+{
+  if (pool == NULL || fp == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  fprintf(fp, "%s: %ld requests, %ld connections, %.1f%% reused\n",
+          message, pool->requests, pool->connects,
+          pool->requests > 0 ? 100.0 * pool->reused / pool->requests : 0.0);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/**************** connpool_delete() ****************/
+/* see connpool.h for description */
+void
+connpool_delete(connpool_t *pool)
+{
+  if (pool != NULL) {
+    hashtable_delete(pool->hosts, hostpool_delete);
+    pthread_mutex_destroy(&pool->lock);
+    count_free(pool);
+  }
+}
+
+/**************** fetch_batch ****************/
+/* Fetch m pages from one host, sending all outstanding requests on one
+ * connection before reading their responses.  If the connection dies or
+ * the server closes it part-way through, send the rest on another.
+ * A new connection on which the first response never comes (it timed
+ * out, say) fails that page alone.  Give up after MAX_TRY new
+ * connections in a row that yield nothing.
+ */
+static void
+fetch_batch(connpool_t *pool, const char *key,
+            const char *hostname, const int port,
+            webpage_t *pages[], char *requests[],
+            const int m, bool fetched[])
+{
+  int done = 0;       // responses read so far
+  int tries = 0;      // new connections that have yielded nothing
+  long long start = http_clock();
+
+  for (int k = 0; k < m; k++) {
+    fetched[k] = false;
+  }
+
+  while (done < m) {
+    // reuse an idle connection if there is one, else open one
+    bool fresh = false;
+    long long connecting = 0; // microseconds to open it, if we did
+    httpconn_t *conn = pool_take(pool, key);
+    if (conn == NULL) {
+      if (tries++ >= MAX_TRY) {
+        break;
+      }
+      long long connectStart = http_clock();
+      conn = httpconn_new(http_connect(hostname, port));
+      connecting = http_clock() - connectStart;
+      webpage_fetchPause();   // as webpage_fetch does, per connection
+      if (conn == NULL) {
+        continue;
+      }
+      fresh = true;
+    }
+
+    // send all the remaining requests; the first response must come
+    // by the fetch's deadline, counting the time spent connecting
+    long long sending = http_clock();
+    httpconn_setDeadline(conn, http_deadline(sending - connecting));
+    int sent = 0;
+    for (int k = done; k < m; k++) {
+      if (!httpconn_send(conn, requests[k], strlen(requests[k]))) {
+        break;
+      }
+      sent++;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->requests += sent;
+    pool->connects += fresh ? 1 : 0;
+    pool->reused += (fresh && sent > 0) ? sent - 1 : sent;
+    pthread_mutex_unlock(&pool->lock);
+
+    // read their responses, in order
+    int got = 0;
+    bool alive = (sent > 0);
+    while (got < sent) {
+      httpresponse_t resp;
+      if (!httpconn_read(conn, &resp)) {
+        alive = false;
+        break;
+      }
+      webpage_setStatus(pages[done], resp.status);
+      // the first response on a new connection waited for it to open
+      long waited = (fresh && got == 0) ? connecting : 0;
+      webpage_setTimes(pages[done], (fresh && got == 0) ? connecting : -1,
+                       waited + resp.firstByte - sending,
+                       waited + http_clock() - sending);
+      archive_put(pages[done], &resp);
+      webpage_setRefused(pages[done], resp.refused ? resp.avoided : -1);
+      if (resp.status == 200 && resp.bodylen > 0
+          && webpage_setHTML(pages[done], resp.body)) {
+        webpage_setValidators(pages[done], resp.etag, resp.lastModified);
+        fetched[done] = true;
+      } else {
+        free(resp.body);
+      }
+      done++;
+      got++;
+      // each later response has a deadline of its own
+      httpconn_setDeadline(conn, http_deadline(http_clock()));
+      if (!resp.keepalive) {
+        alive = false;
+        break;
+      }
+    }
+
+    if (alive) {
+      pool_put(pool, key, conn);
+    } else {
+      httpconn_delete(conn);
+    }
+    if (got > 0) {
+      tries = 0;    // progress; the server is there
+    } else if (fresh && sent > 0) {
+      // the server took the requests but never answered the first;
+      // give up on that page, not on those queued behind it
+      archive_putFailure(pages[done], http_clock() - start);
+      done++;
+    }
+  }
+
+  // the pages we gave up on
+  for (int k = done; k < m; k++) {
+    archive_putFailure(pages[k], http_clock() - start);
+  }
+}
+
+/**************** pool_take ****************/
+/* Pop an idle connection for the given host, or return NULL. */
+static httpconn_t *
+pool_take(connpool_t *pool, const char *key)
+{
+  httpconn_t *conn = NULL;
+  pthread_mutex_lock(&pool->lock);
+  hostpool_t *hp = hashtable_find(pool->hosts, key);
+  if (hp != NULL && hp->nidle > 0) {
+    conn = hp->idle[--hp->nidle];
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return conn;
+}
+
+/**************** pool_put ****************/
+/* Push an idle connection for the given host; close it if there is
+ * no room on the stack.
+ */
+static void
+pool_put(connpool_t *pool, const char *key, httpconn_t *conn)
+{
+  pthread_mutex_lock(&pool->lock);
+  hostpool_t *hp = hashtable_find(pool->hosts, key);
+  if (hp == NULL) {
+    hp = assertp(count_malloc(sizeof(hostpool_t)), "hostpool");
+    hp->idle = assertp(count_calloc(pool->maxIdle, sizeof(httpconn_t *)),
+                       "hostpool idle");
+    hp->nidle = 0;
+    hashtable_insert(pool->hosts, key, hp);
+  }
+  if (hp->nidle < pool->maxIdle) {
+    hp->idle[hp->nidle++] = conn;
+    conn = NULL;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  httpconn_delete(conn);    // ignores NULL
+}
+
+/**************** hostpool_delete ****************/
+/* Close a host's idle connections and free its stack;
+ * for use by hashtable_delete.
+ */
+static void
+hostpool_delete(void *item)
+{
+  hostpool_t *hp = item;
+  if (hp != NULL) {
+    for (int i = 0; i < hp->nidle; i++) {
+      httpconn_delete(hp->idle[i]);
+    }
+    count_free(hp->idle);
+    count_free(hp);
+  }
+}
@@ -0,0 +1,82 @@
+/*
+ * connpool.h - header file for the 'connpool' module
+ *
+ * A 'connpool' fetches web pages over persistent HTTP/1.1 connections,
+ * keeping idle connections open per host (host:port) so that later
+ * fetches from the same host skip the TCP handshake.  It can also
+ * pipeline: send several requests to one host before reading any of
+ * the responses.  The pool counts its requests and connections so the
+ * caller can see how often a connection was reused.
+ *
+ * A connpool may be shared by several threads.
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __CONNPOOL_H
+#define __CONNPOOL_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "webpage.h"
+
+/**************** global types ****************/
+typedef struct connpool connpool_t;  // opaque to users of the module
+
+/**************** functions ****************/
+
+/**************** connpool_new ****************/
+/* Create a new (empty) connpool.
+ *
+ * Caller provides:
+ *   the most idle connections to keep open per host (> 0), and
+ *   the most requests to pipeline on one connection (1 = no pipelining).
+ * We return:
+ *   pointer to a new connpool, or NULL if error.
+ * Caller is responsible for:
+ *   later calling connpool_delete.
+ */
+connpool_t *connpool_new(const int maxIdle, const int pipeline);
+
+/**************** connpool_fetch ****************/
+/* Fetch the html for each of n pages, as webpage_fetch would.
+ *
+ * Caller provides:
+ *   valid connpool; an array of n pages, each with a URL and NULL html;
+ *   and an array of n bools for the results.
+ * We do:
+ *   group the pages by host, sending up to 'pipeline' requests at a time
+ *   on one connection, reusing idle connections where we can;
+ *   set fetched[i] true if page i was fetched (it now has html);
+ *   like webpage_fetch, ask for a page with validators only if it has
+ *   changed, and note each page's response status.
+ * We return:
+ *   the number of pages fetched.
+ * Notes:
+ *   Like webpage_fetch, we pause after opening each new connection
+ *   (see webpage_setFetchDelay); reused ones are free.
+ *   Like webpage_fetch, we give up on a server after the timeouts set
+ *   by http_setTimeouts; a page's total deadline runs from when the
+ *   response before it on the connection, if any, was read.
+ *   Like webpage_fetch, we refuse bodies not HTML or too long (see
+ *   http_setLimits); the connection is then closed, and the pages
+ *   pipelined behind a refused one are sent again on another.
+ *   Like webpage_fetch, we record to an archive, or replay from one
+ *   (see archive.h); replaying, we open no connections, and fetch the
+ *   pages one after another, each taking as long as it was recorded to.
+ */
+int connpool_fetch(connpool_t *pool, webpage_t *pages[], const int n,
+                   bool fetched[]);
+
+/**************** connpool_report ****************/
+/* Print the pool's counters to fp on one line, prefixed by message:
+ * requests sent, connections opened, and the percentage of requests
+ * that were carried by an already-open connection.
+ */
+void connpool_report(connpool_t *pool, FILE *fp, const char *message);
+
+/**************** connpool_delete ****************/
+/* Close all idle connections and free the pool.  Ignores NULL. */
+void connpool_delete(connpool_t *pool);
+
+#endif // __CONNPOOL_H
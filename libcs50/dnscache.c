@@ -0,0 +1,386 @@
+/*
+ * dnscache.c - CS50 'dnscache' module
+ *
+ * see dnscache.h for more information.
+ *
+ * The cache is a hashtable from hostname to a dnsentry; the hashtable
+ * cannot remove items, so an expired entry stays where it is and is
+ * simply refreshed by the next lookup.  At most one thread resolves a
+ * given name at a time: it marks the entry 'resolving', drops the lock
+ * for the slow getaddrinfo call, and wakes any other thread waiting for
+ * that name when it is done.
+ *
+ * Antony Guzman, 2020
+ */
+
+#define _GNU_SOURCE       // strtok_r
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "dnscache.h"
+#include "hashtable.h"
+#include "file.h"
+#include "http.h"
+#include "memory.h"
+
+/**************** file-local global variables ****************/
+static const int HOST_SLOTS = 101;      // hashtable slots for names
+#define PREFETCH_SLOTS 256              // prefetch requests we will queue
+
+/**************** local types ****************/
+typedef struct dnsentry {
+  struct in_addr addr;        // the answer, if ok
+  bool ok;                    // did the name resolve?
+  bool fixed;                 // from a hosts file; never expires
+  bool resolving;             // a thread is asking the resolver now
+  long long expires;          // ms; when the answer goes stale
+} dnsentry_t;
+
+/* All of the module's state; everything but the thread is guarded by
+ * 'lock'.  There is only ever one of these.
+ */
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t resolved;    // some entry stopped resolving
+  pthread_cond_t work;        // prefetch queue grew, or stop was set
+  hashtable_t *names;         // hostname -> dnsentry_t, created on demand
+  int ttl, negttl;            // seconds to keep good and bad answers
+  char *queue[PREFETCH_SLOTS];  // hostnames waiting to be prefetched
+  int head, count;            // ring buffer of 'queue'
+  pthread_t thread;           // the prefetcher
+  bool running;               // is the prefetcher thread running?
+  bool stop;                  // should it stop?
+  long lookups;               // calls to dnscache_lookup
+  long hits;                  // ... answered from the cache
+  long neghits;               // ... of which negatively
+  long resolves;              // calls to the resolver
+  long prefetched;            // names resolved by the prefetcher
+} dns = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .resolved = PTHREAD_COND_INITIALIZER,
+  .work = PTHREAD_COND_INITIALIZER,
+  .ttl = 300,
+  .negttl = 30,
+};
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static bool cache_get(const char *hostname, struct in_addr *in, bool prefetch);
+static dnsentry_t *cache_entry(const char *hostname);
+static bool cache_fresh(dnsentry_t *e);
+static bool resolve(const char *hostname, struct in_addr *in);
+static void *prefetcher(void *arg);
+static void dnsentry_delete(void *item);
+
+/**************** dnscache_lookup() ****************/
+/* see dnscache.h for description */
+bool
+dnscache_lookup(const char *hostname, const int port, struct sockaddr_in *addr)
+{
+  if (hostname == NULL || addr == NULL) {
+    return false;
+  }
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons(port);
+  return cache_get(hostname, &addr->sin_addr, false);
+}
+
+/**************** dnscache_prefetch() ****************/
+/* see dnscache.h for description */
+void
+dnscache_prefetch(const char *hostname)
+{
+  if (hostname == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&dns.lock);
+  dnsentry_t *e = (dns.names == NULL) ? NULL
+    : hashtable_find(dns.names, hostname);
+  if ((e == NULL || (!e->resolving && !cache_fresh(e)))
+      && dns.count < PREFETCH_SLOTS) {
+    char *copy = count_malloc(strlen(hostname) + 1);
+    if (copy != NULL) {
+      strcpy(copy, hostname);
+      dns.queue[(dns.head + dns.count++) % PREFETCH_SLOTS] = copy;
+      if (!dns.running) {
+        dns.stop = false;
+        dns.running = (pthread_create(&dns.thread, NULL, prefetcher, NULL)
+                       == 0);
+      }
+      pthread_cond_signal(&dns.work);
+    }
+  }
+  pthread_mutex_unlock(&dns.lock);
+}
+
+/**************** dnscache_setTTL() ****************/
+/* see dnscache.h for description */
+void
+dnscache_setTTL(const int ttl, const int negttl)
+{
+  pthread_mutex_lock(&dns.lock);
+  if (ttl >= 0) {
+    dns.ttl = ttl;
+  }
+  if (negttl >= 0) {
+    dns.negttl = negttl;
+  }
+  pthread_mutex_unlock(&dns.lock);
+}
+
+/**************** dnscache_loadHosts() ****************/
+/* see dnscache.h for description */
+int
+dnscache_loadHosts(const char *filename)
+{
+  FILE *fp;
+  if (filename == NULL || (fp = fopen(filename, "r")) == NULL) {
+    return -1;
+  }
+
+  int loaded = 0;
+  char *line;
+  while ( (line = freadlinep(fp)) != NULL) {
+    char *comment = strchr(line, '#');
+    if (comment != NULL) {
+      *comment = '\0';
+    }
+    char *rest;
+    char *word = strtok_r(line, " \t", &rest);
+    struct in_addr in;
+    if (word != NULL && inet_pton(AF_INET, word, &in) == 1) {
+      pthread_mutex_lock(&dns.lock);
+      while ( (word = strtok_r(NULL, " \t", &rest)) != NULL) {
+        dnsentry_t *e = cache_entry(word);
+        if (e != NULL) {
+          e->addr = in;
+          e->ok = true;
+          e->fixed = true;
+          loaded++;
+        }
+      }
+      pthread_mutex_unlock(&dns.lock);
+    }
+    free(line);
+  }
+  fclose(fp);
+  return loaded;
+}
+
+/**************** dnscache_report() ****************/
+/* see dnscache.h for description */
+void
+dnscache_report(FILE *fp, const char *message)
+{
+  if (fp == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&dns.lock);
+  fprintf(fp, "%s: %ld lookups, %ld cached (%ld negative), "
+          "%ld resolved, %ld prefetched\n",
+          message, dns.lookups, dns.hits, dns.neghits,
+          dns.resolves, dns.prefetched);
+  pthread_mutex_unlock(&dns.lock);
+}
+
+/**************** dnscache_clear() ****************/
+/* see dnscache.h for description */
+void
+dnscache_clear(void)
+{
+  pthread_mutex_lock(&dns.lock);
+  if (dns.running) {
+    dns.stop = true;
+    pthread_cond_signal(&dns.work);
+    pthread_mutex_unlock(&dns.lock);
+    pthread_join(dns.thread, NULL);
+    pthread_mutex_lock(&dns.lock);
+    dns.running = false;
+  }
+  for (; dns.count > 0; dns.count--) {
+    count_free(dns.queue[dns.head]);
+    dns.head = (dns.head + 1) % PREFETCH_SLOTS;
+  }
+  hashtable_delete(dns.names, dnsentry_delete);
+  dns.names = NULL;
+  pthread_mutex_unlock(&dns.lock);
+}
+
+/**************** cache_get ****************/
+/* Look up hostname, in the cache or else with the resolver, and count
+ * the lookup as the caller's (or the prefetcher's, if 'prefetch').
+ */
+static bool
+cache_get(const char *hostname, struct in_addr *in, bool prefetch)
+{
+  pthread_mutex_lock(&dns.lock);
+  dnsentry_t *e = cache_entry(hostname);
+  if (e == NULL) {
+    pthread_mutex_unlock(&dns.lock);
+    return resolve(hostname, in);     // out of memory; just ask
+  }
+  if (!prefetch) {
+    dns.lookups++;
+  }
+  while (e->resolving) {
+    pthread_cond_wait(&dns.resolved, &dns.lock);
+  }
+
+  if (cache_fresh(e)) {
+    if (!prefetch) {
+      dns.hits++;
+      dns.neghits += e->ok ? 0 : 1;
+    }
+  } else {
+    // ask the resolver, without holding up lookups of other names
+    e->resolving = true;
+    dns.resolves++;
+    dns.prefetched += prefetch ? 1 : 0;
+    pthread_mutex_unlock(&dns.lock);
+    struct in_addr answer;
+    bool ok = resolve(hostname, &answer);
+    pthread_mutex_lock(&dns.lock);
+
+    e->ok = ok;
+    e->addr = answer;
+    e->expires = http_clock() / 1000 + 1000LL * (ok ? dns.ttl : dns.negttl);
+    e->resolving = false;
+    pthread_cond_broadcast(&dns.resolved);
+  }
+
+  bool ok = e->ok;
+  *in = e->addr;
+  pthread_mutex_unlock(&dns.lock);
+  return ok;
+}
+
+/**************** cache_entry ****************/
+/* Find the entry for hostname, adding a stale one if there is none.
+ * Caller holds the lock.  Returns NULL only if out of memory.
+ */
+static dnsentry_t *
+cache_entry(const char *hostname)
+{
+  if (dns.names == NULL && (dns.names = hashtable_new(HOST_SLOTS)) == NULL) {
+    return NULL;
+  }
+  dnsentry_t *e = hashtable_find(dns.names, hostname);
+  if (e == NULL) {
+    e = count_malloc(sizeof(dnsentry_t));
+    if (e == NULL) {
+      return NULL;
+    }
+    memset(e, 0, sizeof(*e));   // not ok, not fixed, expired
+    if (!hashtable_insert(dns.names, hostname, e)) {
+      count_free(e);
+      return NULL;
+    }
+  }
+  return e;
+}
+
+/**************** cache_fresh ****************/
+/* Is e's answer still good?  Caller holds the lock. */
+static bool
+cache_fresh(dnsentry_t *e)
+{
+  return e->fixed || e->expires > http_clock() / 1000;
+}
+
+/**************** resolve ****************/
+/* Ask the system resolver for hostname's first IPv4 address. */
+static bool
+resolve(const char *hostname, struct in_addr *in)
+{
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *server;
+  memset(in, 0, sizeof(*in));
+  if (getaddrinfo(hostname, NULL, &hints, &server) != 0) {
+    return false;
+  }
+  *in = ((struct sockaddr_in *)server->ai_addr)->sin_addr;
+  freeaddrinfo(server);
+  return true;
+}
+
+/**************** prefetcher ****************/
+/* The prefetcher thread: resolve queued names until told to stop. */
+static void *
+prefetcher(void *arg)
+{
+  pthread_mutex_lock(&dns.lock);
+  for (;;) {
+    while (dns.count == 0 && !dns.stop) {
+      pthread_cond_wait(&dns.work, &dns.lock);
+    }
+    if (dns.stop) {
+      break;
+    }
+    char *hostname = dns.queue[dns.head];
+    dns.head = (dns.head + 1) % PREFETCH_SLOTS;
+    dns.count--;
+    pthread_mutex_unlock(&dns.lock);
+
+    struct in_addr in;
+    cache_get(hostname, &in, true);
+    count_free(hostname);
+
+    pthread_mutex_lock(&dns.lock);
+  }
+  pthread_mutex_unlock(&dns.lock);
+  return NULL;
+}
+
+/**************** dnsentry_delete ****************/
+/* for use by hashtable_delete */
+static void
+dnsentry_delete(void *item)
+{
+  if (item != NULL) {
+    count_free(item);
+  }
+}
+
+/**************** unit test ****************/
+/* Build with -DQUICKTEST and run as
+ *   ./dnscache hostsfile name...
+ * to look each name up twice, after loading the hosts file.
+ */
+#ifdef QUICKTEST
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s hostsfile name...\n", argv[0]);
+    exit(1);
+  }
+  printf("loaded %d names from %s\n", dnscache_loadHosts(argv[1]), argv[1]);
+
+  for (int i = 2; i < argc; i++) {
+    dnscache_prefetch(argv[i]);
+  }
+  for (int pass = 1; pass <= 2; pass++) {
+    for (int i = 2; i < argc; i++) {
+      struct sockaddr_in addr;
+      char buf[INET_ADDRSTRLEN] = "-";
+      if (dnscache_lookup(argv[i], 80, &addr)) {
+        inet_ntop(AF_INET, &addr.sin_addr, buf, sizeof(buf));
+      }
+      printf("pass %d: %s -> %s\n", pass, argv[i], buf);
+    }
+  }
+  dnscache_report(stdout, "dnscache");
+  dnscache_clear();
+  return 0;
+}
+
+#endif // QUICKTEST
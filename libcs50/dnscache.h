@@ -0,0 +1,83 @@
+/*
+ * dnscache.h - header file for the 'dnscache' module
+ *
+ * The 'dnscache' resolves hostnames to IPv4 addresses and remembers the
+ * answers, process-wide, so that repeated fetches (and retries) from the
+ * same host do not each pay for a name lookup.  Successful lookups are
+ * kept for 'ttl' seconds and failed ones for 'negttl' seconds, so a host
+ * that does not exist fails fast.  getaddrinfo does not tell us the
+ * record's real TTL, hence the fixed ones.
+ *
+ * Names may also be taken from a file in /etc/hosts format, which is
+ * consulted before the system resolver and never expires; this lets
+ * tests run against a local server under a real-looking hostname.
+ *
+ * An optional prefetcher resolves hostnames in a background thread,
+ * so that by the time the fetch comes the answer is already cached.
+ *
+ * All functions are safe to call from several threads at once.
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __DNSCACHE_H
+#define __DNSCACHE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+/**************** functions ****************/
+
+/**************** dnscache_lookup ****************/
+/* Find the address of the given host, from the cache if we can.
+ *
+ * Caller provides:
+ *   hostname, port, and a place to put the address.
+ * We return:
+ *   true, with *addr filled in (family, address, and port), if the
+ *   host is known; false if it could not be resolved, now or recently.
+ * Notes:
+ *   If another thread is already resolving the same name, we wait for
+ *   its answer rather than asking again.
+ */
+bool dnscache_lookup(const char *hostname, const int port,
+                     struct sockaddr_in *addr);
+
+/**************** dnscache_prefetch ****************/
+/* Ask the background prefetcher to resolve hostname, if it is not
+ * already cached; returns at once.  The first call starts the
+ * prefetcher thread.  Requests are dropped if the prefetcher is
+ * far behind; prefetching is only ever a hint.
+ */
+void dnscache_prefetch(const char *hostname);
+
+/**************** dnscache_setTTL ****************/
+/* Keep successful lookups for ttl seconds, and failed ones for negttl
+ * seconds (both >= 0; defaults 300 and 30).  Applies to later lookups.
+ */
+void dnscache_setTTL(const int ttl, const int negttl);
+
+/**************** dnscache_loadHosts ****************/
+/* Read hostname-to-address entries from a file in /etc/hosts format:
+ * an IPv4 address, then one or more names, with '#' starting a comment.
+ * Lines that do not start with an IPv4 address are ignored.
+ * Returns the number of names loaded, or -1 if the file can't be read.
+ */
+int dnscache_loadHosts(const char *filename);
+
+/**************** dnscache_report ****************/
+/* Print the cache's counters to fp on one line, prefixed by message:
+ * lookups, answered from the cache, of those negatively, resolver
+ * calls, and names prefetched.
+ */
+void dnscache_report(FILE *fp, const char *message);
+
+/**************** dnscache_clear ****************/
+/* Stop the prefetcher, if running, and forget every cached name,
+ * including those loaded from a hosts file.  Unlike the others, this
+ * must not be called while another thread may be looking a name up.
+ */
+void dnscache_clear(void);
+
+#endif // __DNSCACHE_H
@@ -0,0 +1,239 @@
+/*
+ * fetchbench.c - microbenchmark for reading HTTP response bodies
+ *
+ * usage: fetchbench [megabytes [rounds]]
+ *
+ * A writer thread sends a response with a body of the given size
+ * (default 8MB) over a socketpair, framed by Content-Length, by chunked
+ * encoding, or by closing the connection; the main thread reads it
+ * back, either the way webpage_fetch used to (stdio, freadlinep for the
+ * headers and freadfilep for the body) or with httpconn_read, as
+ * webpage_fetch does now.  For each combination we print the best
+ * throughput, in MB/s, over the given number of rounds (default 5).
+ * No network or server is involved, so this measures only the cost
+ * of parsing and copying.
+ *
+ * Then, as a check, the writer declares a Content-Length of 1TB but
+ * sends only the body and closes: httpconn_read should read what comes,
+ * allocating as it arrives rather than all that was declared, and then
+ * fail, the body being short.  If it gives up without reading, we exit 4.
+ *
+ * Antony Guzman, 2020
+ */
+
+#define _GNU_SOURCE       // clock_gettime, MSG_NOSIGNAL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "http.h"
+#include "file.h"
+
+/**************** local types ****************/
+typedef enum { LENGTH, CHUNKED, CLOSE } framing_t;
+static const char *framingName[] = { "content-length", "chunked", "close" };
+
+typedef struct writer {
+  int fd;                     // our end of the socketpair
+  framing_t framing;          // how to frame the body
+  const char *body;           // the body to send
+  size_t len;                 // its length
+  size_t declared;            // Content-Length to claim, if not 0
+  bool sent;                  // was all of the response taken?
+} writer_t;
+
+/**************** local functions ****************/
+static void *writer(void *arg);
+static bool sendall(int fd, const char *data, size_t len);
+static size_t read_stdio(int fd);
+static size_t read_http(int fd);
+static double now_sec(void);
+
+/**************** main ****************/
+int
+main(int argc, char *argv[])
+{
+  int megabytes = 8, rounds = 5;
+  if (argc > 3
+      || (argc > 1 && sscanf(argv[1], "%d", &megabytes) != 1)
+      || (argc > 2 && sscanf(argv[2], "%d", &rounds) != 1)
+      || megabytes < 1 || rounds < 1) {
+    fprintf(stderr, "usage: %s [megabytes [rounds]]\n", argv[0]);
+    exit(1);
+  }
+
+  // a body of printable text, like a (very long) web page
+  size_t len = (size_t)megabytes << 20;
+  char *body = malloc(len);
+  if (body == NULL) {
+    fprintf(stderr, "%s: out of memory\n", argv[0]);
+    exit(2);
+  }
+  for (size_t i = 0; i < len; i++) {
+    body[i] = (i % 64 == 63) ? '\n' : 'a' + i % 26;
+  }
+
+  http_setLimits(0, false);   // read any body, however long
+
+  const char *readerName[] = { "stdio", "httpconn" };
+  size_t (*reader[])(int) = { read_stdio, read_http };
+
+  printf("%-8s %-15s %10s\n", "reader", "framing", "MB/s");
+  for (int r = 0; r < 2; r++) {
+    for (framing_t f = LENGTH; f <= CLOSE; f++) {
+      double best = 0;
+      for (int round = 0; round < rounds; round++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+          perror("socketpair");
+          exit(3);
+        }
+        writer_t w = { sv[1], f, body, len, 0, false };
+        pthread_t thread;
+        double start = now_sec();
+        pthread_create(&thread, NULL, writer, &w);
+        size_t got = reader[r](sv[0]);     // closes sv[0]
+        double elapsed = now_sec() - start;
+        pthread_join(thread, NULL);
+        if (got < len) {
+          fprintf(stderr, "%s/%s: read %zu of %zu bytes\n",
+                  readerName[r], framingName[f], got, len);
+        }
+        double rate = megabytes / elapsed;
+        best = rate > best ? rate : best;
+      }
+      printf("%-8s %-15s %10.1f\n", readerName[r], framingName[f], best);
+    }
+  }
+
+  // a body far shorter than declared: read, then refused as short
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+    perror("socketpair");
+    exit(3);
+  }
+  writer_t w = { sv[1], LENGTH, body, len, (size_t)1 << 40, false };
+  pthread_t thread;
+  pthread_create(&thread, NULL, writer, &w);
+  size_t got = read_http(sv[0]);
+  pthread_join(thread, NULL);
+  printf("httpconn declared 1TB, sent %dMB: %s\n", megabytes,
+         got == 0 && w.sent ? "read, then failed as short"
+                            : "not read as it arrived");
+
+  free(body);
+  return (got == 0 && w.sent) ? 0 : 4;
+}
+
+/**************** writer ****************/
+/* Send one response framed as asked, then close our end. */
+static void *
+writer(void *arg)
+{
+  writer_t *w = arg;
+  char header[128];
+  static const size_t CHUNK = 16384;
+
+  switch (w->framing) {
+  case LENGTH:
+    sprintf(header, "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n",
+            w->declared > 0 ? w->declared : w->len);
+    w->sent = sendall(w->fd, header, strlen(header))
+      && sendall(w->fd, w->body, w->len);
+    break;
+  case CHUNKED:
+    sprintf(header, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+    bool ok = sendall(w->fd, header, strlen(header));
+    for (size_t sent = 0; ok && sent < w->len; sent += CHUNK) {
+      size_t n = (w->len - sent < CHUNK) ? w->len - sent : CHUNK;
+      sprintf(header, "%zx\r\n", n);
+      ok = sendall(w->fd, header, strlen(header))
+        && sendall(w->fd, w->body + sent, n)
+        && sendall(w->fd, "\r\n", 2);
+    }
+    if (ok) {
+      sendall(w->fd, "0\r\n\r\n", 5);
+    }
+    break;
+  case CLOSE:
+    sprintf(header, "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n");
+    if (sendall(w->fd, header, strlen(header))) {
+      sendall(w->fd, w->body, w->len);
+    }
+    break;
+  }
+  close(w->fd);
+  return NULL;
+}
+
+/**************** sendall ****************/
+static bool
+sendall(int fd, const char *data, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+/**************** read_stdio ****************/
+/* Read a response as webpage_fetch used to: the status line and headers
+ * with freadlinep, then everything else with freadfilep.  This does not
+ * decode chunks; it returns the number of body bytes read, raw.
+ */
+static size_t
+read_stdio(int fd)
+{
+  FILE *fp = fdopen(fd, "r");
+  size_t got = 0;
+  char *line;
+  while ( (line = freadlinep(fp)) != NULL
+          && strcmp(line, "") != 0 && strcmp(line, "\r") != 0) {
+    free(line);
+  }
+  if (line != NULL) {
+    free(line);
+    char *body = freadfilep(fp);
+    if (body != NULL) {
+      got = strlen(body);
+      free(body);
+    }
+  }
+  fclose(fp);
+  return got;
+}
+
+/**************** read_http ****************/
+/* Read a response with httpconn_read; return the length of the body. */
+static size_t
+read_http(int fd)
+{
+  httpconn_t *conn = httpconn_new(fd);
+  httpresponse_t resp;
+  size_t got = 0;
+  if (httpconn_read(conn, &resp)) {
+    got = resp.bodylen;
+    free(resp.body);
+  }
+  httpconn_delete(conn);
+  return got;
+}
+
+/**************** now_sec ****************/
+static double
+now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,653 @@
+/*
+ * fetchq.c - CS50 'fetchq' module
+ *
+ * see fetchq.h for more information.
+ *
+ * Each fetch moves through three states: CONNECTING (waiting for a
+ * non-blocking connect to finish), SENDING (writing the request), and
+ * RECEIVING (reading the response until the server closes the
+ * connection, as we ask it to).  One epoll instance watches all the
+ * sockets; fetchq_next runs the event loop until some fetch finishes.
+ * Each fetch in flight also has a time by which it must make progress,
+ * set from the http module's timeouts whenever it does, and the event
+ * loop waits no longer than the earliest of those; a connect that times
+ * out is tried again, and any other wait that does ends the fetch.
+ *
+ * When replaying an archive, a fetch opens no socket: its response is
+ * taken from the archive when it is submitted, and the fetch finishes
+ * when the time the recorded one took has passed, which the event loop
+ * waits for as it would for a socket.
+ *
+ * Antony Guzman, 2020
+ */
+
+#define _GNU_SOURCE       // SOCK_NONBLOCK, strdup, memmem
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "fetchq.h"
+#include "webpage.h"
+#include "dnscache.h"
+#include "http.h"
+#include "archive.h"
+#include "memory.h"
+
+/**************** file-local global variables ****************/
+static const int MAX_TRY = 3;          // maximum attempts to connect
+static const size_t READ_CHUNK = 16384; // bytes to ask for per read()
+
+/**************** local types ****************/
+typedef enum { CONNECTING, SENDING, RECEIVING } fetchstate_t;
+
+typedef struct fetch {
+  webpage_t *page;            // the page being fetched
+  char *hostname;             // from BurstURL
+  int port;                   // from BurstURL
+  int fd;                     // socket, or -1
+  int tries;                  // connection attempts so far
+  fetchstate_t state;         // where we are in the exchange
+  char *request;              // the HTTP request
+  size_t reqlen;              // its length
+  size_t reqsent;             // how much of it has been sent
+  char *buf;                  // response received so far
+  size_t len;                 // bytes in buf
+  size_t cap;                 // bytes allocated for buf
+  httpresponse_t resp;        // its status and headers, once they are in,
+  size_t bodyStart;           //   and where in buf its body starts, or 0
+  bool fetched;               // result, once done
+  long long start;            // http_clock() when submitted,
+  long long connected;        //   when connected (or 0),
+  long long firstByte;        //   and when the response began (or 0)
+  long long due;              // if replayed, http_clock() when done, or 0
+  long long deadline;         // http_clock() when the whole fetch times out,
+  long long expires;          //   and when the current wait does, or 0
+  struct fetch *prev;         // links in the in-flight list, 
+  struct fetch *next;         //   and then in the completion queue
+} fetch_t;
+
+/**************** global types ****************/
+typedef struct fetchq {
+  int epfd;                   // epoll instance watching all sockets
+  int maxevents;              // size of events[]
+  struct epoll_event *events; // filled in by epoll_wait
+  int active;                 // fetches still in flight
+  fetch_t *inflight;          // ... and the list of them
+  fetch_t *donehead;          // completion queue: oldest first
+  fetch_t *donetail;          //   ... newest last
+  bool closing;               // fetches are being abandoned
+  int connectTimeout;         // ms for a connect, or 0 for no limit
+  int idleTimeout;            // ms for a send or read to progress, or 0
+} fetchq_t;
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static void fetch_connect(fetchq_t *fq, fetch_t *f);
+static void fetch_retry(fetchq_t *fq, fetch_t *f);
+static void fetch_event(fetchq_t *fq, fetch_t *f, uint32_t events);
+static void fetch_send(fetchq_t *fq, fetch_t *f);
+static void fetch_receive(fetchq_t *fq, fetch_t *f);
+static bool fetch_check(fetch_t *f, const size_t from);
+static void fetch_finish(fetchq_t *fq, fetch_t *f, bool received);
+static void fetch_done(fetchq_t *fq, fetch_t *f);
+static void fetch_arm(fetch_t *f, const int timeout);
+static int fetch_expire(fetchq_t *fq, const int timeout);
+static bool parse_response(char *buf, size_t len, httpresponse_t *resp);
+static void fetch_free(fetch_t *f);
+
+/**************** fetchq_new() ****************/
+/* see fetchq.h for description */
+fetchq_t *
+fetchq_new(const int maxInflight)
+{
+  if (maxInflight <= 0) {
+    return NULL;
+  }
+
+  fetchq_t *fq = count_malloc(sizeof(fetchq_t));
+  if (fq == NULL) {
+    return NULL;
+  }
+
+  fq->epfd = epoll_create1(0);
+  fq->maxevents = maxInflight < 256 ? maxInflight : 256;
+  fq->events = count_calloc(fq->maxevents, sizeof(struct epoll_event));
+  if (fq->epfd < 0 || fq->events == NULL) {
+    if (fq->epfd >= 0) close(fq->epfd);
+    if (fq->events != NULL) count_free(fq->events);
+    count_free(fq);
+    return NULL;
+  }
+  fq->active = 0;
+  fq->inflight = NULL;
+  fq->donehead = fq->donetail = NULL;
+  fq->closing = false;
+  http_getTimeouts(&fq->connectTimeout, &fq->idleTimeout, NULL);
+  return fq;
+}
+
+/**************** fetchq_submit() ****************/
+/* see fetchq.h for description */
+void
+fetchq_submit(fetchq_t *fq, webpage_t *page)
+{
+  if (fq == NULL || page == NULL) {
+    return;
+  }
+
+  fetch_t *f = assertp(count_calloc(1, sizeof(fetch_t)), "fetch_t");
+  f->page = page;
+  f->fd = -1;
+  f->start = http_clock();
+  fq->active++;
+  f->next = fq->inflight;
+  if (fq->inflight != NULL) {
+    fq->inflight->prev = f;
+  }
+  fq->inflight = f;
+
+  // same checks and request as webpage_fetch
+  char *pathname;
+  if (webpage_getURL(page) == NULL || webpage_getHTML(page) != NULL
+      || !BurstURL(webpage_getURL(page), &f->hostname, &f->port, &pathname)) {
+    fetch_finish(fq, f, false);
+    return;
+  }
+
+  // replaying, the response is at hand, but may not be due yet
+  if (archive_mode() >= ARCHIVE_REPLAY) {
+    long delay;
+    free(pathname);
+    f->fetched = archive_get(page, &delay);
+    if (delay > 0) {
+      f->due = f->start + delay;
+    } else {
+      fetch_done(fq, f);
+    }
+    return;
+  }
+
+  f->request = assertp(http_request(f->hostname, pathname, 
+                                    webpage_getETag(page),
+                                    webpage_getLastModified(page), true),
+                       "fetch request");
+  f->reqlen = strlen(f->request);
+  free(pathname);
+
+  f->deadline = http_deadline(f->start);
+  fetch_connect(fq, f);
+}
+
+/**************** fetchq_pending() ****************/
+/* see fetchq.h for description */
+int
+fetchq_pending(fetchq_t *fq)
+{
+  if (fq == NULL) {
+    return 0;
+  }
+  int pending = fq->active;
+  for (fetch_t *f = fq->donehead; f != NULL; f = f->next) {
+    pending++;
+  }
+  return pending;
+}
+
+/**************** fetchq_next() ****************/
+/* see fetchq.h for description */
+webpage_t *
+fetchq_next(fetchq_t *fq, bool *fetched, const int timeout)
+{
+  if (fq == NULL || fetched == NULL) {
+    return NULL;
+  }
+
+  // run the event loop until something completes, or time runs out
+  long long deadline = http_clock() / 1000 + timeout;
+  int remaining = timeout;
+  while (fq->donehead == NULL && fq->active > 0) {
+    int wait = fetch_expire(fq, remaining);
+    if (fq->donehead != NULL) {
+      break;
+    }
+    int n = epoll_wait(fq->epfd, fq->events, fq->maxevents, wait);
+    if (n < 0 && errno != EINTR) {
+      return NULL;
+    }
+    for (int i = 0; i < n; i++) {
+      fetch_event(fq, fq->events[i].data.ptr, fq->events[i].events);
+    }
+    if (timeout >= 0 && fq->donehead == NULL) {
+      if ( (remaining = deadline - http_clock() / 1000) <= 0) {
+        return NULL;
+      }
+    }
+  }
+
+  // pop the oldest completion
+  fetch_t *f = fq->donehead;
+  if (f == NULL) {
+    return NULL;
+  }
+  fq->donehead = f->next;
+  if (fq->donehead == NULL) {
+    fq->donetail = NULL;
+  }
+
+  webpage_t *page = f->page;
+  *fetched = f->fetched;
+  fetch_free(f);
+  return page;
+}
+
+/**************** fetchq_delete() ****************/
+/* see fetchq.h for description */
+void
+fetchq_delete(fetchq_t *fq, void (*pagedelete)(void *page))
+{
+  if (fq == NULL) {
+    return;
+  }
+
+  // abandon fetches still in flight, moving them to the completion queue
+  fq->closing = true;
+  while (fq->inflight != NULL) {
+    fetch_finish(fq, fq->inflight, false);
+  }
+
+  for (fetch_t *f = fq->donehead; f != NULL; ) {
+    fetch_t *next = f->next;
+    if (pagedelete != NULL) {
+      (*pagedelete)(f->page);
+    }
+    fetch_free(f);
+    f = next;
+  }
+
+  close(fq->epfd);
+  count_free(fq->events);
+  count_free(fq);
+}
+
+/**************** fetch_connect ****************/
+/* Start a non-blocking connect for f, and register it with epoll.
+ * On failure, retry or finish the fetch.
+ */
+static void
+fetch_connect(fetchq_t *fq, fetch_t *f)
+{
+  f->tries++;
+
+  struct sockaddr_in server;
+  if (!dnscache_lookup(f->hostname, f->port, &server)) {
+    fetch_retry(fq, f);
+    return;
+  }
+
+  f->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (f->fd < 0) {
+    fetch_retry(fq, f);
+    return;
+  }
+
+  int status = connect(f->fd, (struct sockaddr *)&server, sizeof(server));
+  if (status < 0 && errno != EINPROGRESS) {
+    fetch_retry(fq, f);
+    return;
+  }
+
+  // either way we learn of progress when the socket becomes writable
+  f->state = CONNECTING;
+  struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = f };
+  if (epoll_ctl(fq->epfd, EPOLL_CTL_ADD, f->fd, &ev) < 0) {
+    fetch_retry(fq, f);
+    return;
+  }
+  fetch_arm(f, fq->connectTimeout);
+}
+
+/**************** fetch_retry ****************/
+/* Abandon the current connection; try again if we may, and there is
+ * time, else give up.
+ */
+static void
+fetch_retry(fetchq_t *fq, fetch_t *f)
+{
+  if (f->fd >= 0) {
+    close(f->fd);   // also removes it from epoll
+    f->fd = -1;
+  }
+  if (f->tries < MAX_TRY
+      && (f->deadline == 0 || http_clock() < f->deadline)) {
+    fetch_connect(fq, f);
+  } else {
+    fetch_finish(fq, f, false);
+  }
+}
+
+/**************** fetch_event ****************/
+/* Advance f in response to the given epoll events. */
+static void
+fetch_event(fetchq_t *fq, fetch_t *f, uint32_t events)
+{
+  switch (f->state) {
+  case CONNECTING: {
+    int error = 0;
+    socklen_t errlen = sizeof(error);
+    if (getsockopt(f->fd, SOL_SOCKET, SO_ERROR, &error, &errlen) < 0
+        || error != 0) {
+      fetch_retry(fq, f);
+      return;
+    }
+    f->state = SENDING;
+    f->connected = http_clock();
+    fetch_arm(f, fq->idleTimeout);
+    fetch_send(fq, f);
+    break;
+  }
+  case SENDING:
+    fetch_send(fq, f);
+    break;
+  case RECEIVING:
+    fetch_receive(fq, f);
+    break;
+  }
+}
+
+/**************** fetch_send ****************/
+/* Send as much of the request as the socket will take. */
+static void
+fetch_send(fetchq_t *fq, fetch_t *f)
+{
+  while (f->reqsent < f->reqlen) {
+    ssize_t n = send(f->fd, f->request + f->reqsent, f->reqlen - f->reqsent,
+                     MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        fetch_finish(fq, f, false);
+      }
+      return;   // wait for EPOLLOUT again
+    }
+    f->reqsent += n;
+    fetch_arm(f, fq->idleTimeout);
+  }
+
+  // request is out; now wait for the response
+  f->state = RECEIVING;
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = f };
+  if (epoll_ctl(fq->epfd, EPOLL_CTL_MOD, f->fd, &ev) < 0) {
+    fetch_finish(fq, f, false);
+  }
+}
+
+/**************** fetch_receive ****************/
+/* Read whatever has arrived; finish the fetch at end of file.
+ * The buffer grows geometrically, so a large page costs linear copying.
+ */
+static void
+fetch_receive(fetchq_t *fq, fetch_t *f)
+{
+  for (;;) {
+    if (f->cap - f->len < READ_CHUNK + 1) {
+      size_t cap = f->cap == 0 ? 2 * READ_CHUNK : 2 * f->cap;
+      char *buf = realloc(f->buf, cap);
+      if (buf == NULL) {
+        fetch_finish(fq, f, false);
+        return;
+      }
+      f->buf = buf;
+      f->cap = cap;
+    }
+    ssize_t n = read(f->fd, f->buf + f->len, READ_CHUNK);
+    if (n > 0) {
+      if (f->len == 0) {
+        f->firstByte = http_clock();
+      }
+      f->len += n;
+      if (!fetch_check(f, f->len - n)) {
+        fetch_finish(fq, f, true);    // refused: the rest goes unread
+        return;
+      }
+      fetch_arm(f, fq->idleTimeout);
+    } else if (n == 0) {
+      fetch_finish(fq, f, true);      // server closed: response complete
+      return;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return;                         // wait for more
+    } else if (errno != EINTR) {
+      fetch_finish(fq, f, false);
+      return;
+    }
+  }
+}
+
+/**************** fetch_check ****************/
+/* Once the headers are in, read them, and decide whether the body is
+ * wanted (see http_wanted); then check that the body stays within the
+ * limit.  'from' is where in buf the latest bytes begin.
+ * Returns false if the body is refused.
+ */
+static bool
+fetch_check(fetch_t *f, const size_t from)
+{
+  if (f->bodyStart == 0) {
+    // look for the blank line, back far enough to catch one split
+    size_t back = from < 3 ? 0 : from - 3;
+    if (memmem(f->buf + back, f->len - back, "\r\n\r\n", 4) == NULL
+        && memmem(f->buf + back, f->len - back, "\n\n", 2) == NULL) {
+      return true;                    // not yet
+    }
+    if (!parse_response(f->buf, f->len, &f->resp)) {
+      return true;                    // leave it to fetch_finish
+    }
+    f->bodyStart = f->resp.body - f->buf;
+    if (!http_wanted(&f->resp)) {
+      f->resp.refused = true;
+      size_t got = f->len - f->bodyStart;
+      if (f->resp.contentLength > (long)got) {
+        f->resp.avoided = f->resp.contentLength - got;
+      }
+      return false;
+    }
+  }
+  long maxBody;
+  http_getLimits(&maxBody, NULL);
+  if (maxBody > 0 && f->len - f->bodyStart > (size_t)maxBody) {
+    f->resp.refused = true;           // how much more, we never learn
+    return false;
+  }
+  return true;
+}
+
+/**************** fetch_finish ****************/
+/* Close f's connection, decide whether the fetch succeeded,
+ * and move f to the completion queue.
+ */
+static void
+fetch_finish(fetchq_t *fq, fetch_t *f, bool received)
+{
+  if (f->fd >= 0) {
+    close(f->fd);
+    f->fd = -1;
+  }
+
+  f->fetched = false;
+  httpresponse_t resp;
+  bool parsed = false;
+  if (received) {
+    webpage_setTimes(f->page, f->connected - f->start,
+                     f->firstByte > 0 ? f->firstByte - f->start : -1,
+                     http_clock() - f->start);
+    if (f->bodyStart > 0) {
+      // the headers were read as they came; the body is what followed
+      resp = f->resp;
+      resp.body = f->buf + f->bodyStart;
+      resp.bodylen = resp.refused ? 0 : f->len - f->bodyStart;
+      resp.body[resp.bodylen] = '\0';
+      parsed = true;
+    } else {
+      parsed = parse_response(f->buf, f->len, &resp);
+    }
+    if (parsed && !resp.refused && !http_unframe(&resp)) {
+      parsed = false;                 // short, or its chunks bad
+      resp.status = 0;
+    }
+    if (resp.status != 0) {
+      webpage_setStatus(f->page, resp.status);
+    }
+  }
+  if (parsed) {
+    archive_put(f->page, &resp);
+    webpage_setRefused(f->page, resp.refused ? resp.avoided : -1);
+    if (resp.status == 200 && resp.bodylen > 0 && !resp.refused) {
+      // reuse the buffer for the html
+      webpage_setValidators(f->page, resp.etag, resp.lastModified);
+      memmove(f->buf, resp.body, resp.bodylen + 1);
+      char *html = f->buf;
+      f->buf = NULL;
+      f->fetched = webpage_setHTML(f->page, html);
+      if (!f->fetched) {
+        free(html);
+      }
+    }
+  } else if (!fq->closing && f->hostname != NULL) {
+    archive_putFailure(f->page, http_clock() - f->start);
+  }
+  fetch_done(fq, f);
+}
+
+/**************** fetch_done ****************/
+/* Move f, whose result is set, to the completion queue. */
+static void
+fetch_done(fetchq_t *fq, fetch_t *f)
+{
+  // unlink from the in-flight list
+  if (f->prev != NULL) {
+    f->prev->next = f->next;
+  } else {
+    fq->inflight = f->next;
+  }
+  if (f->next != NULL) {
+    f->next->prev = f->prev;
+  }
+  fq->active--;
+
+  // append to the completion queue
+  f->prev = NULL;
+  f->next = NULL;
+  if (fq->donetail == NULL) {
+    fq->donehead = f;
+  } else {
+    fq->donetail->next = f;
+  }
+  fq->donetail = f;
+}
+
+/**************** fetch_arm ****************/
+/* Give f until 'timeout' milliseconds from now (none if 0) to make
+ * progress, but no longer than its deadline.
+ */
+static void
+fetch_arm(fetch_t *f, const int timeout)
+{
+  f->expires = timeout > 0 ? http_clock() + timeout * 1000LL : 0;
+  if (f->deadline > 0 && (f->expires == 0 || f->deadline < f->expires)) {
+    f->expires = f->deadline;
+  }
+}
+
+/**************** fetch_expire ****************/
+/* Finish the replayed fetches that are due, and deal with those that
+ * have timed out: try a connect again, or give up.  Return the
+ * milliseconds to wait for events: timeout, or less if some fetch
+ * comes due or times out sooner.
+ */
+static int
+fetch_expire(fetchq_t *fq, const int timeout)
+{
+  long long now = http_clock();
+  long long next = 0;
+  for (fetch_t *f = fq->inflight; f != NULL; ) {
+    fetch_t *later = f->next;
+    long long when = f->due > 0 ? f->due : f->expires;
+    if (when > 0 && when <= now) {
+      if (f->due > 0) {
+        fetch_done(fq, f);
+      } else if (f->state == CONNECTING) {
+        fetch_retry(fq, f);         // which may connect again
+      } else {
+        fetch_finish(fq, f, false);
+      }
+      when = (f->fd >= 0) ? f->expires : 0;
+    }
+    if (when > 0 && (next == 0 || when < next)) {
+      next = when;
+    }
+    f = later;
+  }
+  if (next == 0) {
+    return timeout;
+  }
+  int wait = (next - now + 999) / 1000;
+  return (timeout < 0 || wait < timeout) ? wait : timeout;
+}
+
+/**************** parse_response ****************/
+/* Check the status line and read the headers of an HTTP response into
+ * *resp, with its body, which is null-terminated, still in buf.
+ * Returns false if the status line is not there, or the headers never
+ * end; resp->status is set if the status line is there.
+ */
+static bool
+parse_response(char *buf, size_t len, httpresponse_t *resp)
+{
+  memset(resp, 0, sizeof(*resp));
+  resp->contentLength = -1;
+  if (buf == NULL || len == 0) {
+    return false;
+  }
+  buf[len] = '\0';  // fetch_receive always leaves room
+
+  if (!http_status(buf, &resp->status, NULL)) {
+    return false;
+  }
+
+  // skip the status line, then note header lines up to a blank line
+  char *line = memchr(buf, '\n', len);
+  while (line != NULL) {
+    line++;
+    char *eol = memchr(line, '\n', len - (line - buf));
+    if (eol == NULL) {
+      return false;   // headers never ended
+    }
+    if (eol == line || (eol == line + 1 && *line == '\r')) {
+      // blank line: the body follows it
+      resp->body = eol + 1;
+      resp->bodylen = len - (resp->body - buf);
+      return true;
+    }
+    *eol = '\0';      // the line ends here, without any CR
+    if (eol[-1] == '\r') {
+      eol[-1] = '\0';
+    }
+    http_header(resp, line);
+    line = eol;
+  }
+  return false;
+}
+
+/**************** fetch_free ****************/
+/* Free f and its buffers (but not its page). */
+static void
+fetch_free(fetch_t *f)
+{
+  if (f->fd >= 0) close(f->fd);
+  if (f->hostname != NULL) free(f->hostname);
+  if (f->request != NULL) count_free(f->request);
+  if (f->buf != NULL) free(f->buf);
+  count_free(f);
+}
@@ -0,0 +1,91 @@
+/*
+ * fetchq.h - header file for the 'fetchq' module
+ *
+ * A 'fetchq' is an event-driven engine for fetching many web pages at
+ * once from a single thread.  The caller submits webpage_t objects that
+ * have a URL but no HTML; the fetchq opens a non-blocking connection for
+ * each, drives all of them with epoll, and hands back each page when its
+ * fetch completes (successfully or not) through a completion queue.
+ * Pages come back in the order their fetches complete, which is not
+ * necessarily the order in which they were submitted.
+ *
+ * The fetchq speaks the same HTTP as webpage_fetch, with the same
+ * limitations (see webpage.h), and likewise makes a conditional request
+ * for a page with validators, but does not sleep between fetches;
+ * any politeness policy is up to the caller.  It records fetches to an
+ * archive, or replays them from one, as webpage_fetch does (see
+ * archive.h); a replayed fetch completes when the recorded one did.
+ * It gives up on a server after the timeouts that were set by
+ * http_setTimeouts (see http.h) when the fetchq was created, and
+ * refuses bodies as http_setLimits says, deciding as soon as the
+ * headers arrive.
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __FETCHQ_H
+#define __FETCHQ_H
+
+#include <stdbool.h>
+#include "webpage.h"
+
+/**************** global types ****************/
+typedef struct fetchq fetchq_t;  // opaque to users of the module
+
+/**************** functions ****************/
+
+/**************** fetchq_new ****************/
+/* Create a new (empty) fetchq.
+ *
+ * Caller provides:
+ *   the number of fetches the caller intends to keep in flight (> 0);
+ *   this only sizes internal buffers, it is not enforced.
+ * We return:
+ *   pointer to a new fetchq, or NULL if error.
+ * Caller is responsible for:
+ *   later calling fetchq_delete.
+ */
+fetchq_t *fetchq_new(const int maxInflight);
+
+/**************** fetchq_submit ****************/
+/* Start fetching the given page.
+ *
+ * Caller provides:
+ *   valid fetchq, and a page with a URL and NULL html, as for webpage_fetch.
+ * We guarantee:
+ *   the page will later be returned by fetchq_next, exactly once,
+ *   even if the fetch could not be started.
+ * Caller is responsible for:
+ *   not touching the page until fetchq_next returns it.
+ */
+void fetchq_submit(fetchq_t *fq, webpage_t *page);
+
+/**************** fetchq_pending ****************/
+/* Return the number of pages submitted but not yet returned by fetchq_next. */
+int fetchq_pending(fetchq_t *fq);
+
+/**************** fetchq_next ****************/
+/* Return the next page whose fetch has completed, waiting if need be.
+ *
+ * Caller provides:
+ *   valid fetchq, a place to put the fetch result, and the most
+ *   milliseconds to wait (-1 to wait as long as it takes).
+ * We return:
+ *   a page previously submitted, with *fetched set as webpage_fetch
+ *   would have returned (if true, the page now has its html);
+ *   or NULL if nothing is pending, or nothing completed in time.
+ * Caller is responsible for:
+ *   the page, which is no longer in the fetchq.
+ */
+webpage_t *fetchq_next(fetchq_t *fq, bool *fetched, const int timeout);
+
+/**************** fetchq_delete ****************/
+/* Delete the fetchq, abandoning any fetches still in flight.
+ *
+ * Caller provides:
+ *   valid fetchq pointer, and a function to delete any page
+ *   still in the fetchq (may be NULL).
+ */
+void fetchq_delete(fetchq_t *fq, void (*pagedelete)(void *page));
+
+#endif // __FETCHQ_H
@@ -76,9 +76,10 @@ freaduntil(FILE *fp, int (*stopfunc)(int c))
   for (pos = 0; (c = fgetc(fp)) != EOF && !(*stopfunc)(c); pos++) {
     // We need to save buf[pos+1] for the terminating null
     // and buf[len-1] is the last usable slot, 
-    // so if pos+1 is past that slot, we need to grow the buffer.
+    // so if pos+1 is past that slot, we need to grow the buffer;
+    // doubling it keeps the total copying linear in the length read.
     if (pos+1 > len-1) {
-      char *newbuf = realloc(buf, ++len);
+      char *newbuf = realloc(buf, len *= 2);
       if (newbuf == NULL) {
         free(buf);
         return NULL;
@@ -0,0 +1,330 @@
+/*
+ * htmlscan.c - the 'htmlscan' module
+ *
+ * see htmlscan.h for more information.
+ *
+ * Outside tags, the text is classified a block of 64 bytes at a time,
+ * with SSE2 or AVX2: into a bit mask of the bytes that are letters and
+ * one of those that are '<'.  The words in the block, and the first
+ * tag, are then found from the masks alone, by finding the lowest bit
+ * set; only at a tag, or a word running into the next block, is the
+ * next block classified.  The last few bytes, fewer than a block, are
+ * looked at one by one.  Inside a tag, only the tag's name and
+ * attributes need looking at, and then only for <a ...> tags; the end of
+ * the tag is found with memchr, which the C library vectorizes itself.
+ *
+ * Antony Guzman, 2020
+ */
+
+#define _GNU_SOURCE       // strncasecmp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "htmlscan.h"
+
+#if defined(HTMLSCAN_SCALAR)
+#define VECTOR 0
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define VECTOR 32                         // bytes in a vector register
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VECTOR 16
+#else
+#define VECTOR 0
+#endif
+#define BLOCK 64                          // bytes classified at once
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static size_t scan_words(const char *html, size_t p, const size_t length,
+                         void *arg, void (*wordfunc)(void *arg,
+                                                     const char *word,
+                                                     const size_t length));
+static void scan_tag(const char *html, const size_t open, const size_t close,
+                     const size_t length, void *arg,
+                     void (*linkfunc)(void *arg, const char *link,
+                                      const size_t length));
+static inline int is_letter(const char c);
+#if VECTOR > 0
+static inline uint64_t classify(const char *block, uint64_t *open);
+#endif
+
+/**************** htmlscan() ****************/
+/* see htmlscan.h for description */
+void
+htmlscan(const char *html, const size_t length, void *arg,
+         void (*linkfunc)(void *arg, const char *link, const size_t length),
+         void (*wordfunc)(void *arg, const char *word, const size_t length))
+{
+  if (html == NULL || (linkfunc == NULL && wordfunc == NULL)) {
+    return;
+  }
+
+  size_t p = 0;
+  while (p < length) {
+    // words up to the next tag; if words are not wanted, skip to the tag
+    if (wordfunc != NULL) {
+      p = scan_words(html, p, length, arg, wordfunc);
+    } else {
+      const char *open = memchr(html + p, '<', length - p);
+      p = (open != NULL) ? open - html : length;
+    }
+    if (p >= length) {
+      break;
+    }
+
+    // html[p] is '<'
+    const char *close = memchr(html + p, '>', length - p);
+    size_t end = (close != NULL) ? close - html : length;
+    if (linkfunc != NULL) {
+      scan_tag(html, p, end, length, arg, linkfunc);
+    }
+    p = end + 1;              // past the tag; an unclosed tag ends the scan
+  }
+}
+
+/**************** scan_words ****************/
+/* Call wordfunc for each word in html from p up to the next '<'; return
+ * the position of that '<', or length if there is none.
+ */
+static size_t
+scan_words(const char *html, size_t p, const size_t length, void *arg,
+           void (*wordfunc)(void *arg, const char *word, const size_t length))
+{
+#if VECTOR > 0
+  while (p + BLOCK <= length) {
+    uint64_t open;
+    uint64_t letters = classify(html + p, &open);
+    uint64_t from = ~0ULL;    // the bits of the block still to look at
+    for (;;) {
+      uint64_t found = (letters | open) & from;
+      if (found == 0) {
+        p += BLOCK;           // nothing more in this block
+        break;
+      }
+      int i = __builtin_ctzll(found);
+      if ((open >> i) & 1) {
+        return p + i;         // a tag
+      }
+      uint64_t others = ~letters & (~0ULL << i);
+      if (others == 0) {
+        // the word runs into the next block; find its end, and carry on
+        // from there
+        size_t end = p + BLOCK;
+        while (end < length && is_letter(html[end])) {
+          end++;
+        }
+        (*wordfunc)(arg, html + p + i, end - (p + i));
+        p = end;
+        break;
+      }
+      int j = __builtin_ctzll(others);
+      (*wordfunc)(arg, html + p + i, j - i);
+      from = ~0ULL << j;      // j < 64, as others has bit j set
+    }
+  }
+#endif
+  // what is left, a byte at a time
+  while (p < length && html[p] != '<') {
+    if (is_letter(html[p])) {
+      size_t end = p + 1;
+      while (end < length && is_letter(html[end])) {
+        end++;
+      }
+      (*wordfunc)(arg, html + p, end - p);
+      p = end;
+    } else {
+      p++;
+    }
+  }
+  return p;
+}
+
+/**************** scan_tag ****************/
+/* The tag html[open] (the '<') to html[close] (its '>', or length) has
+ * been found; if it is an <a ...> tag with an href, call linkfunc with
+ * the href's value.  A quoted value may run past the tag's first '>'.
+ */
+static void
+scan_tag(const char *html, const size_t open, const size_t close,
+         const size_t length, void *arg,
+         void (*linkfunc)(void *arg, const char *link, const size_t length))
+{
+  // is the tag's name a..., perhaps after white space?
+  size_t p = open + 1;
+  while (p < close && isspace((unsigned char)html[p])) {
+    p++;
+  }
+  if (p >= close || (html[p] != 'a' && html[p] != 'A')) {
+    return;
+  }
+
+  // find "href", perhaps spaced, then '='
+  for (p++; p + 4 <= close; p++) {
+    if ((html[p] != 'h' && html[p] != 'H')
+        || strncasecmp(html + p, "href", 4) != 0) {
+      continue;
+    }
+    size_t q = p + 4;
+    while (q < close && isspace((unsigned char)html[q])) {
+      q++;
+    }
+    if (q >= close || html[q] != '=') {
+      continue;
+    }
+    for (q++; q < close && isspace((unsigned char)html[q]); q++) {
+    }
+
+    // the value is quoted, or runs to white space or the end of the tag
+    size_t start = q, end;
+    if (q < close && (html[q] == '"' || html[q] == '\'')) {
+      start = q + 1;
+      const char *quote = memchr(html + start, html[q], length - start);
+      if (quote == NULL) {
+        return;
+      }
+      end = quote - html;
+    } else {
+      for (end = start; end < close && !isspace((unsigned char)html[end]);
+           end++) {
+      }
+    }
+    (*linkfunc)(arg, html + start, end - start);
+    return;
+  }
+}
+
+/**************** is_letter ****************/
+/* Is c a letter, A-Z or a-z, as isalpha in the C locale? */
+static inline int
+is_letter(const char c)
+{
+  return (unsigned char)((c | 0x20) - 'a') < 26;
+}
+
+#if VECTOR > 0
+/**************** classify ****************/
+/* Return a mask with bit i set if block[i] is a letter, and set *open
+ * to one with bit i set if block[i] is '<'; the block is BLOCK bytes,
+ * loaded VECTOR bytes at a time.
+ *
+ * A byte is a letter if, with bit 0x20 set (which lowercases letters,
+ * and makes no other byte one), it is 'a' to 'z'.  There is no unsigned
+ * byte comparison, so the bytes are offset to put 'a' at -128 and then
+ * compared, signed, with -128 + 26.
+ */
+static inline uint64_t
+classify(const char *block, uint64_t *open)
+{
+  uint64_t letters = 0;
+  *open = 0;
+  for (int v = 0; v < BLOCK; v += VECTOR) {
+#if VECTOR == 32
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)(block + v));
+    __m256i lower = _mm256_or_si256(bytes, _mm256_set1_epi8(0x20));
+    __m256i offset = _mm256_add_epi8(lower, _mm256_set1_epi8(0x80 - 'a'));
+    __m256i isletter = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 26), offset);
+    __m256i isopen = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('<'));
+    letters |= (uint64_t)(uint32_t)_mm256_movemask_epi8(isletter) << v;
+    *open |= (uint64_t)(uint32_t)_mm256_movemask_epi8(isopen) << v;
+#else
+    __m128i bytes = _mm_loadu_si128((const __m128i *)(block + v));
+    __m128i lower = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+    __m128i offset = _mm_add_epi8(lower, _mm_set1_epi8(0x80 - 'a'));
+    __m128i isletter = _mm_cmpgt_epi8(_mm_set1_epi8(-128 + 26), offset);
+    __m128i isopen = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('<'));
+    letters |= (uint64_t)_mm_movemask_epi8(isletter) << v;
+    *open |= (uint64_t)_mm_movemask_epi8(isopen) << v;
+#endif
+  }
+  return letters;
+}
+#endif
+
+/**************** unit test ****************/
+/* Build with -DQUICKTEST (and again with -DHTMLSCAN_SCALAR, or -mavx2)
+ * and run as
+ *   ./htmlscan file...
+ * to scan each file, check that its words are those webpage_getNextWord
+ * finds, and print its links.
+ */
+#ifdef QUICKTEST
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "file.h"
+#include "webpage.h"
+
+typedef struct {
+  webpage_t *page;            // the same html, for webpage_getNextWord
+  int pos;                    // its position there
+  int words;                  // words found
+  bool same;                  // all as webpage_getNextWord found them?
+} check_t;
+
+static void
+check_word(void *arg, const char *word, const size_t length)
+{
+  check_t *check = arg;
+  char *expect = webpage_getNextWord(check->page, &check->pos);
+  if (expect == NULL || strlen(expect) != length
+      || strncmp(expect, word, length) != 0) {
+    if (check->same) {
+      fprintf(stderr, "word %d: '%.*s', expected '%s'\n", check->words,
+              (int)length, word, expect ? expect : "(none)");
+    }
+    check->same = false;
+  }
+  check->words++;
+  free(expect);
+}
+
+static void
+print_link(void *arg, const char *link, const size_t length)
+{
+  printf("  link '%.*s'\n", (int)length, link);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s file...\n", argv[0]);
+    exit(1);
+  }
+  int failures = 0;
+  for (int i = 1; i < argc; i++) {
+    FILE *fp = fopen(argv[i], "r");
+    char *html = (fp != NULL) ? freadfilep(fp) : NULL;
+    if (fp != NULL) {
+      fclose(fp);
+    }
+    if (html == NULL) {
+      fprintf(stderr, "%s: cannot read\n", argv[i]);
+      failures++;
+      continue;
+    }
+    check_t check = { webpage_new(strdup("http://x/"), 0, strdup(html)),
+                      0, 0, true };
+    printf("%s:\n", argv[i]);
+    htmlscan(html, strlen(html), NULL, print_link, NULL);
+    htmlscan(html, strlen(html), &check, NULL, check_word);
+    char *extra = webpage_getNextWord(check.page, &check.pos);
+    if (extra != NULL) {
+      fprintf(stderr, "missed word '%s'\n", extra);
+      check.same = false;
+      free(extra);
+    }
+    printf("  %d words, %s\n", check.words,
+           check.same ? "as webpage_getNextWord" : "NOT AS webpage_getNextWord");
+    failures += !check.same;
+    webpage_delete(check.page);
+    free(html);
+  }
+  return failures > 0;
+}
+
+#endif // QUICKTEST
@@ -0,0 +1,52 @@
+/*
+ * htmlscan.h - header file for the 'htmlscan' module
+ *
+ * A scanner that finds, in one pass over a page's HTML, both the links
+ * (the href of each <a ...> tag) and the words (runs of letters outside
+ * any <...> tag, as webpage_getNextWord finds them).  It hands each to
+ * the caller as a span of the HTML -- a pointer and a length -- so
+ * nothing is copied or allocated, and the HTML is left as it was.
+ *
+ * Runs of text are classified 16 bytes at a time with SSE2 (32 with
+ * AVX2, if compiled with -mavx2), and tags are skipped with memchr; on
+ * other machines, or if compiled with -DHTMLSCAN_SCALAR, a byte at a
+ * time.  The results are the same either way.
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __HTMLSCAN_H
+#define __HTMLSCAN_H
+
+#include <stddef.h>
+
+/**************** functions ****************/
+
+/**************** htmlscan ****************/
+/* Scan 'length' bytes of html, calling linkfunc for each link and
+ * wordfunc for each word, in the order they appear.
+ *
+ * Caller provides:
+ *   the html, which need not be null-terminated; an arbitrary argument
+ *   passed to both functions; and the functions, either of which may be
+ *   NULL if those spans are not wanted (the scan is then quicker).
+ * We call:
+ *   linkfunc(arg, link, length) with the value of the first href
+ *   attribute of each tag whose name starts with 'a' or 'A', without
+ *   its quotes, exactly as it is in the html (relative or absolute,
+ *   perhaps with a #fragment, or empty); an unquoted value ends at white
+ *   space or the end of the tag, and a quoted one that is never closed
+ *   is ignored.
+ *   wordfunc(arg, word, length) with each run of letters (A-Z, a-z)
+ *   outside any tag; a tag runs from '<' to the next '>', and a tag
+ *   that is never closed ends the scan.
+ * We guarantee:
+ *   the spans point into html, and are valid as long as it is.
+ */
+void htmlscan(const char *html, const size_t length, void *arg,
+              void (*linkfunc)(void *arg, const char *link,
+                               const size_t length),
+              void (*wordfunc)(void *arg, const char *word,
+                               const size_t length));
+
+#endif // __HTMLSCAN_H
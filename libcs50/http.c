@@ -0,0 +1,782 @@
+/*
+ * http.c - CS50 'http' module
+ *
+ * see http.h for more information.
+ *
+ * Antony Guzman, 2020
+ */
+
+#define _GNU_SOURCE       // strncasecmp, strcasestr, MSG_NOSIGNAL, SOCK_NONBLOCK
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "http.h"
+#include "dnscache.h"
+#include "memory.h"
+
+/**************** file-local global variables ****************/
+static const size_t BUFSIZE = 16384;       // initial read buffer size
+static const size_t MAX_LINE = 65536;      // longest header line we accept
+static const size_t MAX_PREALLOC = 1<<24;  // most body we allocate up front
+
+// deadlines for every fetch, in milliseconds; 0 for none
+static struct {
+  int connect;                // for a connection to open
+  int idle;                   // for the server to take or send more
+  int total;                  // for the whole fetch
+} timeouts = { 10000, 30000, 60000 };
+
+// which bodies of 200 responses we read
+static struct {
+  long maxBody;               // the most bytes, or 0 for no limit
+  bool htmlOnly;              // only HTML (or untyped) ones?
+} limits = { 1L<<24, true };
+
+/**************** global types ****************/
+typedef struct httpconn {
+  int fd;                     // the connected socket
+  char *buf;                  // read buffer
+  size_t cap;                 // bytes allocated for buf
+  size_t pos;                 // first unread byte in buf
+  size_t end;                 // one past the last byte read into buf
+  long long deadline;         // http_clock() when I/O fails, or 0
+} httpconn_t;
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static bool conn_wait(httpconn_t *conn, const short events);
+static ssize_t conn_recv(httpconn_t *conn, char *buf, const size_t len);
+static bool conn_fill(httpconn_t *conn);
+static char *conn_readline(httpconn_t *conn);
+static bool conn_readbody(httpconn_t *conn, httpresponse_t *resp,
+                          size_t *cap, size_t n);
+static bool conn_readchunks(httpconn_t *conn, httpresponse_t *resp,
+                            size_t *cap);
+static bool conn_readall(httpconn_t *conn, httpresponse_t *resp, size_t *cap);
+static bool body_reserve(httpresponse_t *resp, size_t *cap, size_t more);
+static bool body_toolong(httpresponse_t *resp, const size_t more);
+static bool body_dechunk(char *body, size_t *len);
+static bool header_is(const char *line, const char *name, const char **value);
+static void header_copy(char *dest, const char *value);
+
+/**************** http_setTimeouts() ****************/
+/* see http.h for description */
+void
+http_setTimeouts(const int connect, const int idle, const int total)
+{
+  timeouts.connect = connect > 0 ? connect : 0;
+  timeouts.idle = idle > 0 ? idle : 0;
+  timeouts.total = total > 0 ? total : 0;
+}
+
+/**************** http_getTimeouts() ****************/
+/* see http.h for description */
+void
+http_getTimeouts(int *connect, int *idle, int *total)
+{
+  if (connect != NULL) *connect = timeouts.connect;
+  if (idle != NULL) *idle = timeouts.idle;
+  if (total != NULL) *total = timeouts.total;
+}
+
+/**************** http_deadline() ****************/
+/* see http.h for description */
+long long
+http_deadline(const long long start)
+{
+  return timeouts.total > 0 ? start + timeouts.total * 1000LL : 0;
+}
+
+/**************** http_setLimits() ****************/
+/* see http.h for description */
+void
+http_setLimits(const long maxBody, const bool htmlOnly)
+{
+  limits.maxBody = maxBody > 0 ? maxBody : 0;
+  limits.htmlOnly = htmlOnly;
+}
+
+/**************** http_getLimits() ****************/
+/* see http.h for description */
+void
+http_getLimits(long *maxBody, bool *htmlOnly)
+{
+  if (maxBody != NULL) *maxBody = limits.maxBody;
+  if (htmlOnly != NULL) *htmlOnly = limits.htmlOnly;
+}
+
+/**************** http_wanted() ****************/
+/* see http.h for description */
+bool
+http_wanted(const httpresponse_t *resp)
+{
+  if (resp == NULL) {
+    return true;
+  }
+  if (resp->status == 200 && limits.htmlOnly && resp->contentType[0] != '\0'
+      && strcasestr(resp->contentType, "html") == NULL) {
+    return false;
+  }
+  return limits.maxBody == 0 || resp->contentLength <= limits.maxBody;
+}
+
+/**************** http_connect() ****************/
+/* see http.h for description */
+int
+http_connect(const char *hostname, const int port)
+{
+  if (hostname == NULL) {
+    return -1;
+  }
+
+  struct sockaddr_in server;   // address of the server
+  if (!dnscache_lookup(hostname, port, &server)) {
+    return -1;
+  }
+
+  // connect without blocking, then wait for it, but only so long
+  int comm_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (comm_sock < 0) {
+    return -1;
+  }
+  if (connect(comm_sock, (struct sockaddr *)&server, sizeof(server)) < 0) {
+    struct pollfd pfd = { .fd = comm_sock, .events = POLLOUT };
+    int error = 0;
+    socklen_t errlen = sizeof(error);
+    int n = -1;
+    if (errno == EINPROGRESS) {
+      do {
+        n = poll(&pfd, 1, timeouts.connect > 0 ? timeouts.connect : -1);
+      } while (n < 0 && errno == EINTR);
+    }
+    if (n <= 0
+        || getsockopt(comm_sock, SOL_SOCKET, SO_ERROR, &error, &errlen) < 0
+        || error != 0) {
+      close(comm_sock);
+      comm_sock = -1;
+    }
+  }
+  return comm_sock;
+}
+
+/**************** http_request() ****************/
+/* see http.h for description */
+char *
+http_request(const char *hostname, const char *pathname,
+             const char *etag, const char *lastModified, const bool close)
+{
+  if (hostname == NULL || pathname == NULL) {
+    return NULL;
+  }
+  bool hasEtag = (etag != NULL && *etag != '\0');
+  bool hasDate = (lastModified != NULL && *lastModified != '\0');
+  size_t len = strlen(pathname) + strlen(hostname) + 64
+    + (hasEtag ? strlen(etag) + 20 : 0)
+    + (hasDate ? strlen(lastModified) + 24 : 0);
+  char *request = count_malloc(len);
+  if (request == NULL) {
+    return NULL;
+  }
+  int n = sprintf(request, "GET %s HTTP/1.1\r\nHost: %s\r\n", 
+                  pathname, hostname);
+  if (hasEtag) {
+    n += sprintf(request + n, "If-None-Match: %s\r\n", etag);
+  }
+  if (hasDate) {
+    n += sprintf(request + n, "If-Modified-Since: %s\r\n", lastModified);
+  }
+  sprintf(request + n, "%s\r\n", close ? "Connection: close\r\n" : "");
+  return request;
+}
+
+/**************** http_status() ****************/
+/* see http.h for description */
+bool
+http_status(const char *line, int *status, int *minor)
+{
+  int x;
+  if (line == NULL || sscanf(line, "HTTP/1.%d %d", &x, status) != 2) {
+    return false;
+  }
+  if (minor != NULL) {
+    *minor = x;
+  }
+  return true;
+}
+
+/**************** http_unframe() ****************/
+/* see http.h for description */
+bool
+http_unframe(httpresponse_t *resp)
+{
+  if (resp == NULL || resp->body == NULL) {
+    return false;
+  }
+  if (resp->status == 204 || resp->status == 304) {
+    resp->bodylen = 0;
+  } else if (resp->chunked) {
+    if (!body_dechunk(resp->body, &resp->bodylen)) {
+      return false;
+    }
+  } else if (resp->contentLength >= 0) {
+    if (resp->bodylen < (size_t)resp->contentLength) {
+      return false;                       // connection ended early
+    }
+    resp->bodylen = resp->contentLength;
+  }
+  resp->body[resp->bodylen] = '\0';
+  return true;
+}
+
+/**************** http_header() ****************/
+/* see http.h for description */
+void
+http_header(httpresponse_t *resp, const char *line)
+{
+  if (resp == NULL || line == NULL) {
+    return;
+  }
+  const char *value;
+  if (header_is(line, "Content-Length", &value)) {
+    resp->contentLength = atol(value);
+  } else if (header_is(line, "Transfer-Encoding", &value)) {
+    resp->chunked = (strcasestr(value, "chunked") != NULL);
+  } else if (header_is(line, "Connection", &value)) {
+    if (strcasestr(value, "close") != NULL) {
+      resp->keepalive = false;
+    } else if (strcasestr(value, "keep-alive") != NULL) {
+      resp->keepalive = true;
+    }
+  } else if (header_is(line, "Content-Type", &value)) {
+    header_copy(resp->contentType, value);
+  } else if (header_is(line, "ETag", &value)) {
+    header_copy(resp->etag, value);
+  } else if (header_is(line, "Last-Modified", &value)) {
+    header_copy(resp->lastModified, value);
+  }
+}
+
+/**************** httpconn_new() ****************/
+/* see http.h for description */
+httpconn_t *
+httpconn_new(const int fd)
+{
+  if (fd < 0) {
+    return NULL;
+  }
+  httpconn_t *conn = count_malloc(sizeof(httpconn_t));
+  if (conn == NULL) {
+    return NULL;
+  }
+  conn->buf = count_malloc(BUFSIZE);
+  if (conn->buf == NULL) {
+    count_free(conn);
+    return NULL;
+  }
+  conn->fd = fd;
+  conn->cap = BUFSIZE;
+  conn->pos = conn->end = 0;
+  conn->deadline = 0;
+  return conn;
+}
+
+/**************** httpconn_setDeadline() ****************/
+/* see http.h for description */
+void
+httpconn_setDeadline(httpconn_t *conn, const long long deadline)
+{
+  if (conn != NULL) {
+    conn->deadline = deadline > 0 ? deadline : 0;
+  }
+}
+
+/**************** httpconn_send() ****************/
+/* see http.h for description */
+bool
+httpconn_send(httpconn_t *conn, const char *data, const size_t len)
+{
+  if (conn == NULL || data == NULL) {
+    return false;
+  }
+  for (size_t sent = 0; sent < len; ) {
+    ssize_t n = send(conn->fd, data + sent, len - sent,
+                     MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (!conn_wait(conn, POLLOUT)) {
+        return false;
+      }
+    } else if (n < 0 && errno != EINTR) {
+      return false;
+    }
+    if (n > 0) {
+      sent += n;
+    }
+  }
+  return true;
+}
+
+/**************** httpconn_read() ****************/
+/* see http.h for description */
+bool
+httpconn_read(httpconn_t *conn, httpresponse_t *resp)
+{
+  if (conn == NULL || resp == NULL) {
+    return false;
+  }
+  resp->status = 0;
+  resp->keepalive = false;
+  resp->contentLength = -1;
+  resp->chunked = false;
+  resp->body = NULL;
+  resp->bodylen = 0;
+  resp->etag[0] = resp->lastModified[0] = resp->contentType[0] = '\0';
+  resp->refused = false;
+  resp->avoided = 0;
+  resp->firstByte = 0;
+
+  // status line; skip any interim 1xx responses
+  char *line;
+  int minor;          // HTTP/1.<minor>
+  do {
+    if ( (line = conn_readline(conn)) == NULL
+         || !http_status(line, &resp->status, &minor)) {
+      return false;
+    }
+    if (resp->firstByte == 0) {
+      resp->firstByte = http_clock();
+    }
+    if (resp->status >= 100 && resp->status < 200) {
+      while ( (line = conn_readline(conn)) != NULL && *line != '\0') {
+        ;   // discard its headers
+      }
+      if (line == NULL) {
+        return false;
+      }
+    }
+  } while (resp->status >= 100 && resp->status < 200);
+
+  // HTTP/1.1 connections persist unless told otherwise; 1.0 the reverse
+  resp->keepalive = (minor >= 1);
+
+  // headers, up to a blank line
+  while ( (line = conn_readline(conn)) != NULL && *line != '\0') {
+    http_header(resp, line);
+  }
+  if (line == NULL) {
+    return false;
+  }
+
+  // body, if we want it; refusing one ends the connection, unread
+  size_t cap = 0;
+  bool ok;
+  if (resp->status == 204 || resp->status == 304) {
+    ok = body_reserve(resp, &cap, 0);            // never has a body
+  } else if (!http_wanted(resp)) {
+    resp->refused = true;
+    if (resp->contentLength > 0) {
+      size_t buffered = conn->end - conn->pos;
+      resp->avoided = resp->contentLength > (long)buffered
+                      ? resp->contentLength - buffered : 0;
+    }
+    ok = false;
+  } else if (resp->chunked) {
+    ok = conn_readchunks(conn, resp, &cap);
+  } else if (resp->contentLength >= 0) {
+    ok = conn_readbody(conn, resp, &cap, resp->contentLength);
+  } else {
+    resp->keepalive = false;                     // body ends at close
+    ok = conn_readall(conn, resp, &cap);
+  }
+
+  if (resp->refused) {
+    resp->keepalive = false;
+    resp->bodylen = 0;
+    ok = body_reserve(resp, &cap, 0);
+  }
+  if (!ok) {
+    free(resp->body);
+    resp->body = NULL;
+    resp->bodylen = 0;
+    return false;
+  }
+  resp->body[resp->bodylen] = '\0';
+  return true;
+}
+
+/**************** http_clock() ****************/
+/* see http.h for description */
+long long
+http_clock(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**************** httpconn_delete() ****************/
+/* see http.h for description */
+void
+httpconn_delete(httpconn_t *conn)
+{
+  if (conn != NULL) {
+    close(conn->fd);
+    count_free(conn->buf);
+    count_free(conn);
+  }
+}
+
+/**************** conn_wait ****************/
+/* Wait for the socket to be ready for the given poll events, but no
+ * longer than the idle timeout, nor past the connection's deadline.
+ * Returns false if time ran out (or poll failed).
+ */
+static bool
+conn_wait(httpconn_t *conn, const short events)
+{
+  int wait = timeouts.idle > 0 ? timeouts.idle : -1;
+  if (conn->deadline > 0) {
+    long long left = (conn->deadline - http_clock() + 999) / 1000;
+    if (left <= 0) {
+      return false;
+    }
+    if (wait < 0 || left < wait) {
+      wait = left;
+    }
+  }
+  struct pollfd pfd = { .fd = conn->fd, .events = events };
+  int n;
+  do {
+    n = poll(&pfd, 1, wait);
+  } while (n < 0 && errno == EINTR);
+  return n > 0;
+}
+
+/**************** conn_recv ****************/
+/* Read up to len bytes from the socket into buf, waiting for some to
+ * arrive as conn_wait does.  Returns the bytes read, 0 at end of file,
+ * or -1 on error or timeout; a server that keeps sending, however
+ * slowly, is cut off at the deadline all the same.
+ */
+static ssize_t
+conn_recv(httpconn_t *conn, char *buf, const size_t len)
+{
+  for (;;) {
+    if (conn->deadline > 0 && http_clock() >= conn->deadline) {
+      return -1;
+    }
+    ssize_t n = recv(conn->fd, buf, len, MSG_DONTWAIT);
+    if (n >= 0) {
+      return n;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      if (!conn_wait(conn, POLLIN)) {
+        return -1;
+      }
+    } else if (errno != EINTR) {
+      return -1;
+    }
+  }
+}
+
+/**************** conn_fill ****************/
+/* Read more bytes from the socket into the buffer, first sliding any
+ * unread bytes to the front, and growing the buffer if it is full.
+ * Returns false at end of file or on error.
+ */
+static bool
+conn_fill(httpconn_t *conn)
+{
+  if (conn->pos > 0) {
+    memmove(conn->buf, conn->buf + conn->pos, conn->end - conn->pos);
+    conn->end -= conn->pos;
+    conn->pos = 0;
+  }
+  if (conn->end == conn->cap) {
+    char *buf = realloc(conn->buf, 2 * conn->cap);
+    if (buf == NULL) {
+      return false;
+    }
+    conn->buf = buf;
+    conn->cap *= 2;
+  }
+
+  ssize_t n = conn_recv(conn, conn->buf + conn->end, conn->cap - conn->end);
+  if (n <= 0) {
+    return false;
+  }
+  conn->end += n;
+  return true;
+}
+
+/**************** conn_readline ****************/
+/* Return the next line, without its CRLF or LF, as a pointer into the
+ * read buffer; it is valid only until the next read from conn.
+ * Returns NULL if the connection ends first or the line is too long.
+ */
+static char *
+conn_readline(httpconn_t *conn)
+{
+  size_t scanned = 0;   // bytes past pos known not to hold a newline
+  for (;;) {
+    char *start = conn->buf + conn->pos;
+    char *nl = memchr(start + scanned, '\n', conn->end - conn->pos - scanned);
+    if (nl != NULL) {
+      *nl = '\0';
+      if (nl > start && nl[-1] == '\r') {
+        nl[-1] = '\0';
+      }
+      conn->pos = nl + 1 - conn->buf;
+      return start;
+    }
+    scanned = conn->end - conn->pos;
+    if (scanned > MAX_LINE || !conn_fill(conn)) {
+      return NULL;
+    }
+  }
+}
+
+/**************** conn_readbody ****************/
+/* Append exactly n more body bytes, first from the read buffer and then
+ * straight from the socket into the body.  Room for all n bytes is made
+ * up front (so a Content-Length body is allocated once, at its exact
+ * size), unless n is over MAX_PREALLOC, in which case the body grows
+ * as the bytes actually arrive; a server may declare more than it sends.
+ */
+static bool
+conn_readbody(httpconn_t *conn, httpresponse_t *resp, size_t *cap, size_t n)
+{
+  if (body_toolong(resp, n)) {
+    resp->avoided = n;      // a chunk, say, we need not read at all
+    return false;
+  }
+  if (!body_reserve(resp, cap, n < MAX_PREALLOC ? n : MAX_PREALLOC)) {
+    return false;
+  }
+
+  size_t buffered = conn->end - conn->pos;
+  size_t take = buffered < n ? buffered : n;
+  memcpy(resp->body + resp->bodylen, conn->buf + conn->pos, take);
+  conn->pos += take;
+  resp->bodylen += take;
+  n -= take;
+
+  while (n > 0) {
+    size_t room = *cap - resp->bodylen - 1;
+    if (room == 0) {
+      if (!body_reserve(resp, cap, n < MAX_PREALLOC ? n : MAX_PREALLOC)) {
+        return false;
+      }
+      room = *cap - resp->bodylen - 1;
+    }
+    ssize_t got = conn_recv(conn, resp->body + resp->bodylen,
+                            room < n ? room : n);
+    if (got <= 0) {
+      return false;   // connection ended early
+    }
+    resp->bodylen += got;
+    n -= got;
+  }
+  return true;
+}
+
+/**************** conn_readchunks ****************/
+/* Read a chunked body: hex size lines, each followed by that many bytes
+ * and a CRLF, ending with a zero-size chunk and optional trailers.
+ */
+static bool
+conn_readchunks(httpconn_t *conn, httpresponse_t *resp, size_t *cap)
+{
+  if (!body_reserve(resp, cap, 0)) {
+    return false;
+  }
+  for (;;) {
+    char *line = conn_readline(conn);
+    char *end;
+    if (line == NULL) {
+      return false;
+    }
+    long size = strtol(line, &end, 16);   // ignores any ;extensions
+    if (end == line || size < 0) {
+      return false;
+    }
+    if (size == 0) {
+      break;
+    }
+    if (!conn_readbody(conn, resp, cap, size)
+        || (line = conn_readline(conn)) == NULL || *line != '\0') {
+      return false;
+    }
+  }
+
+  // skip trailers, up to the final blank line
+  char *line;
+  while ( (line = conn_readline(conn)) != NULL && *line != '\0') {
+    ;
+  }
+  return line != NULL;
+}
+
+/**************** conn_readall ****************/
+/* Read the body up to end of file. */
+static bool
+conn_readall(httpconn_t *conn, httpresponse_t *resp, size_t *cap)
+{
+  // whatever is already buffered, then the rest from the socket
+  if (!conn_readbody(conn, resp, cap, conn->end - conn->pos)) {
+    return false;
+  }
+  for (;;) {
+    if (!body_reserve(resp, cap, BUFSIZE)) {
+      return false;
+    }
+    // fill whatever room the body has; it doubles when it runs out
+    ssize_t got = conn_recv(conn, resp->body + resp->bodylen,
+                            *cap - resp->bodylen - 1);
+    if (got < 0) {
+      return false;
+    }
+    if (got == 0) {
+      return true;
+    }
+    resp->bodylen += got;
+    if (body_toolong(resp, 0)) {
+      return false;         // how much more there was, we never learn
+    }
+  }
+}
+
+/**************** body_reserve ****************/
+/* Make sure the body has room for 'more' bytes plus a null,
+ * growing it geometrically so a large body costs linear copying.
+ * The first allocation is exactly what is asked for (if more than
+ * 1KB), so a body of known length is allocated once, without waste.
+ */
+static bool
+body_reserve(httpresponse_t *resp, size_t *cap, size_t more)
+{
+  size_t need = resp->bodylen + more + 1;
+  if (resp->body != NULL && need <= *cap) {
+    return true;
+  }
+  size_t newcap = *cap > 0 ? 2 * *cap : 1024;
+  if (newcap < need) {
+    newcap = need;
+  }
+  char *body = realloc(resp->body, newcap);
+  if (body == NULL) {
+    return false;
+  }
+  resp->body = body;
+  *cap = newcap;
+  return true;
+}
+
+/**************** body_dechunk ****************/
+/* Decode the chunked body of *len bytes at body, null-terminated, in
+ * place, as conn_readchunks reads one from a connection; set *len to
+ * its decoded length.  Return false if it is malformed or never ends.
+ */
+static bool
+body_dechunk(char *body, size_t *len)
+{
+  const char *in = body, *stop = body + *len;
+  char *out = body;
+  for (;;) {
+    const char *eol = memchr(in, '\n', stop - in);
+    char *end;
+    if (eol == NULL) {
+      return false;
+    }
+    long size = strtol(in, &end, 16);     // ignores any ;extensions
+    if (end == in || end > eol || size < 0) {
+      return false;
+    }
+    in = eol + 1;
+    if (size == 0) {
+      break;
+    }
+    if (stop - in < size + 1) {
+      return false;
+    }
+    memmove(out, in, size);
+    out += size;
+    in += size;
+    if (*in == '\r') {
+      in++;
+    }
+    if (in >= stop || *in != '\n') {
+      return false;
+    }
+    in++;
+  }
+
+  // skip trailers, up to the final blank line
+  for (;;) {
+    const char *eol = memchr(in, '\n', stop - in);
+    if (eol == NULL) {
+      return false;
+    }
+    if (eol == in || (eol == in + 1 && *in == '\r')) {
+      break;
+    }
+    in = eol + 1;
+  }
+  *len = out - body;
+  return true;
+}
+
+/**************** body_toolong ****************/
+/* Would 'more' bytes make the body longer than the limit?  If so, it
+ * is refused, whatever the status.
+ */
+static bool
+body_toolong(httpresponse_t *resp, const size_t more)
+{
+  if (limits.maxBody > 0
+      && resp->bodylen + more > (size_t)limits.maxBody) {
+    resp->refused = true;
+    return true;
+  }
+  return false;
+}
+
+/**************** header_is ****************/
+/* Is this header line "name: value"?  If so, point *value at the value. */
+static bool
+header_is(const char *line, const char *name, const char **value)
+{
+  size_t len = strlen(name);
+  if (strncasecmp(line, name, len) != 0 || line[len] != ':') {
+    return false;
+  }
+  for (*value = line + len + 1; **value == ' ' || **value == '\t'; (*value)++) {
+    ;
+  }
+  return true;
+}
+
+/**************** header_copy ****************/
+/* Copy a header value into a validator field, without any trailing
+ * blanks; one too long to fit is dropped, as if the header were absent.
+ */
+static void
+header_copy(char *dest, const char *value)
+{
+  size_t len = strlen(value);
+  while (len > 0 && (value[len-1] == ' ' || value[len-1] == '\t')) {
+    len--;
+  }
+  if (len < HTTP_VALIDATOR) {
+    memcpy(dest, value, len);
+    dest[len] = '\0';
+  } else {
+    dest[0] = '\0';
+  }
+}
@@ -0,0 +1,206 @@
+/*
+ * http.h - header file for the 'http' module
+ *
+ * An 'httpconn' wraps a connected socket with a read buffer, and knows
+ * how to read one complete HTTP/1.1 response from it: the status line,
+ * the headers we care about, and a body framed by Content-Length, by
+ * Transfer-Encoding: chunked, or by the server closing the connection.
+ * Because it reads exactly one response, the connection can then be
+ * used for the next request if the server allows it (keep-alive),
+ * and several requests may be sent before reading their responses
+ * (pipelining).
+ *
+ * No fetch waits forever on a server: connecting, sending and reading
+ * all give up after deadlines set, process-wide, by http_setTimeouts.
+ * Nor does one download a body nobody wants: the headers of a page are
+ * checked first, and a body that is not HTML, or too long, is refused
+ * (see http_setLimits).
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __HTTP_H
+#define __HTTP_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**************** global constants ****************/
+#define HTTP_VALIDATOR 128    // room for an ETag or Last-Modified value
+
+/**************** global types ****************/
+typedef struct httpconn httpconn_t;  // opaque to users of the module
+
+/* What we learned from one response.
+ * The body is malloc'd and null-terminated (possibly empty) when the
+ * response was read successfully; the caller must later free it.
+ * A refused body is left empty.
+ */
+typedef struct httpresponse {
+  int status;                 // e.g., 200
+  bool keepalive;             // may the connection carry another request?
+  long contentLength;         // from the header, or -1 if none
+  bool chunked;               // was the body sent chunked?
+  char *body;                 // the (de-chunked) body
+  size_t bodylen;             // its length, not counting the null
+  char etag[HTTP_VALIDATOR];  // the ETag header, or "" if none (or too long)
+  char lastModified[HTTP_VALIDATOR];  // Last-Modified, likewise
+  char contentType[HTTP_VALIDATOR];   // Content-Type, likewise
+  bool refused;               // was the body refused (see http_setLimits)?
+  long avoided;               // if so, its bytes not read, if known, else 0
+  long long firstByte;        // http_clock() when the status line was read
+} httpresponse_t;
+
+/**************** functions ****************/
+
+/**************** http_setTimeouts ****************/
+/* Set the deadlines, in milliseconds (0 for none), for every fetch from
+ * now on, by any of the fetching modules:
+ *   connect, for each attempt to open a connection;
+ *   idle, for the server to take more of a request, or send more of a
+ *     response, before we give up on it;
+ *   total, for a whole fetch, from opening its connection to reading
+ *     the end of its response.
+ * The defaults are 10000, 30000 and 60000.  Call before any fetch.
+ */
+void http_setTimeouts(const int connect, const int idle, const int total);
+
+/**************** http_getTimeouts ****************/
+/* Fill in the deadlines set by http_setTimeouts; any pointer may be NULL. */
+void http_getTimeouts(int *connect, int *idle, int *total);
+
+/**************** http_deadline ****************/
+/* Return the http_clock() time by which a fetch begun at 'start' must
+ * be over, or 0 if there is no total deadline.
+ */
+long long http_deadline(const long long start);
+
+/**************** http_setLimits ****************/
+/* Set which bodies are read, by every fetch from now on: if maxBody > 0,
+ * only those of at most maxBody bytes, whatever the status (the body of
+ * a 404 is no more use for being long); and, with htmlOnly, of 200
+ * responses only those whose Content-Type, if any, is HTML (text/html,
+ * or application/xhtml+xml).  Any other is refused: not read at all,
+ * if the headers give it away, or read no further once it grows too
+ * long.  The default is HTML only, up to 16MB.  Call before any fetch.
+ */
+void http_setLimits(const long maxBody, const bool htmlOnly);
+
+/**************** http_getLimits ****************/
+/* Fill in the limits set by http_setLimits; either pointer may be NULL. */
+void http_getLimits(long *maxBody, bool *htmlOnly);
+
+/**************** http_wanted ****************/
+/* Given a response whose status line and headers have been read,
+ * return true if, by the limits above, its body should be read.
+ */
+bool http_wanted(const httpresponse_t *resp);
+
+/**************** http_connect ****************/
+/* Open a TCP connection to the given host and port, waiting no longer
+ * than the connect timeout.
+ * Returns the connected socket, which is non-blocking, or -1 on failure.
+ * Safe to call from several threads at once.
+ */
+int http_connect(const char *hostname, const int port);
+
+/**************** http_request ****************/
+/* Build a GET request for pathname from hostname.
+ *
+ * Caller provides:
+ *   hostname and pathname, as from BurstURL; the validators of a copy
+ *   of the page we already have, etag and lastModified, either of which
+ *   may be NULL or empty; and whether to ask the server to close the
+ *   connection after its response.
+ * We return:
+ *   a new null-terminated request, or NULL if out of memory; with
+ *   validators it is conditional (If-None-Match, If-Modified-Since),
+ *   so the server may answer 304 Not Modified instead of the page.
+ * Caller is responsible for:
+ *   later calling count_free on it.
+ */
+char *http_request(const char *hostname, const char *pathname,
+                   const char *etag, const char *lastModified,
+                   const bool close);
+
+/**************** http_status ****************/
+/* Read a status line, "HTTP/1.x NNN ...": return true, with *status the
+ * status and, if minor is not NULL, *minor the x, if line is one; false
+ * otherwise.  httpconn_read reads every status line this way; it is
+ * here for those who read responses some other way.
+ */
+bool http_status(const char *line, int *status, int *minor);
+
+/**************** http_header ****************/
+/* Note one header line (without its line ending) in resp, if it is
+ * one of those we care about.  httpconn_read calls this for every
+ * header; it is here for those who read responses some other way.
+ */
+void http_header(httpresponse_t *resp, const char *line);
+
+/**************** http_unframe ****************/
+/* Make the raw body of a response read to the end of its connection
+ * into the body its framing says, as httpconn_read would have it: a
+ * chunked body is decoded, in place, and one longer than its
+ * Content-Length cut to it; a 204 or 304 has none.
+ *
+ * Caller provides:
+ *   a response whose status and headers are noted (see http_header),
+ *   with the raw body, writable and null-terminated, at resp->body,
+ *   resp->bodylen bytes long.
+ * We return:
+ *   true, with the body null-terminated at its new resp->bodylen;
+ *   false if it is shorter than its Content-Length, or its chunks are
+ *   malformed or never end, as httpconn_read would fail it.
+ */
+bool http_unframe(httpresponse_t *resp);
+
+/**************** http_clock ****************/
+/* Return the time in microseconds on a clock that never goes backward;
+ * only differences between its values mean anything.
+ */
+long long http_clock(void);
+
+/**************** httpconn_new ****************/
+/* Wrap the connected socket fd in a new httpconn.
+ * We return:
+ *   pointer to a new httpconn, or NULL if error.
+ * The httpconn owns fd from now on; httpconn_delete closes it.
+ */
+httpconn_t *httpconn_new(const int fd);
+
+/**************** httpconn_setDeadline ****************/
+/* Make sends and reads on the connection fail once http_clock() passes
+ * deadline, as from http_deadline; 0, the default, for no deadline.
+ * Either way each waits no longer than the idle timeout for the server.
+ */
+void httpconn_setDeadline(httpconn_t *conn, const long long deadline);
+
+/**************** httpconn_send ****************/
+/* Write all len bytes of data to the connection.
+ * Returns true on success, false if the connection failed or timed out.
+ */
+bool httpconn_send(httpconn_t *conn, const char *data, const size_t len);
+
+/**************** httpconn_read ****************/
+/* Read one complete response from the connection into *resp.
+ *
+ * Caller provides:
+ *   valid httpconn, and a response struct to fill in.
+ * We return:
+ *   true if a whole response was read, or all of it but a refused
+ *   body, in which case resp->body is malloc'd (and empty, if refused)
+ *   and the caller is responsible for freeing it, and the connection
+ *   can carry another request if resp->keepalive (never if refused);
+ *   false if the connection failed or timed out, or the response was
+ *   malformed, in which case resp->body is NULL and the connection is
+ *   unusable.
+ */
+bool httpconn_read(httpconn_t *conn, httpresponse_t *resp);
+
+/**************** httpconn_delete ****************/
+/* Close the connection and free the httpconn. Ignores NULL. */
+void httpconn_delete(httpconn_t *conn);
+
+#endif // __HTTP_H
@@ -0,0 +1,276 @@
+/*
+ * lz.c - the 'lz' compression module
+ *
+ * see lz.h for more information.
+ *
+ * A sequence is:
+ *   a token byte, whose high four bits are the number of literals (15
+ *   meaning 15 or more) and low four bits the match length less 4 (15
+ *   meaning 19 or more);
+ *   if the literals are 15 or more, further bytes adding to the count,
+ *   each 255 meaning another follows;
+ *   the literals;
+ *   the distance back to the match, 1 to 65535, low byte first;
+ *   if the match length is 19 or more, further bytes as for literals.
+ * The last sequence has only a token and literals, and ends the data.
+ *
+ * The compressor looks for matches through a hash table of the last
+ * position at which each 4-byte string was seen, and skips ahead
+ * faster the longer it goes without finding one.
+ *
+ * Antony Guzman, 2020
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "lz.h"
+
+/**************** file-local global variables ****************/
+static const size_t MINMATCH = 4;         // shortest match encoded
+static const size_t MAXDISTANCE = 65535;  // farthest back a match may be
+#define HASH_BITS 14                      // log2 of the hash table size
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static uint32_t read32(const uint8_t *p);
+static bool put_length(uint8_t *dst, size_t *op, const size_t capacity,
+                       size_t length);
+static bool get_length(const uint8_t *src, size_t *ip, const size_t length,
+                       size_t *value);
+
+/**************** lz_bound() ****************/
+/* see lz.h for description */
+size_t
+lz_bound(const size_t length)
+{
+  return length + length / 255 + 16;
+}
+
+/**************** lz_compress() ****************/
+/* see lz.h for description */
+size_t
+lz_compress(const char *src, const size_t length,
+            char *dst, const size_t capacity)
+{
+  const uint8_t *in = (const uint8_t *)src;
+  uint8_t *out = (uint8_t *)dst;
+  uint32_t table[1 << HASH_BITS];
+  memset(table, 0, sizeof(table));
+
+  size_t ip = 0, anchor = 0, op = 0;
+  while (length >= MINMATCH && ip <= length - MINMATCH) {
+    uint32_t seq = read32(in + ip);
+    uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+    size_t candidate = table[h];
+    table[h] = ip;
+    if (candidate >= ip || ip - candidate > MAXDISTANCE
+        || read32(in + candidate) != seq) {
+      ip += 1 + ((ip - anchor) >> 6);
+      continue;
+    }
+
+    // a match; extend it, and emit the literals before it and it
+    size_t match = MINMATCH;
+    while (ip + match < length && in[candidate + match] == in[ip + match]) {
+      match++;
+    }
+    size_t literals = ip - anchor;
+    if (op + 1 + literals + 2 > capacity) {
+      return 0;
+    }
+    size_t token = op++;
+    out[token] = (literals < 15 ? literals : 15) << 4;
+    if (literals >= 15 && !put_length(out, &op, capacity, literals - 15)) {
+      return 0;
+    }
+    if (op + literals + 2 > capacity) {
+      return 0;
+    }
+    memcpy(out + op, in + anchor, literals);
+    op += literals;
+    out[op++] = (ip - candidate) & 0xff;
+    out[op++] = (ip - candidate) >> 8;
+    size_t extra = match - MINMATCH;
+    out[token] |= extra < 15 ? extra : 15;
+    if (extra >= 15 && !put_length(out, &op, capacity, extra - 15)) {
+      return 0;
+    }
+
+    ip += match;
+    anchor = ip;
+  }
+
+  // the rest are literals
+  size_t literals = length - anchor;
+  if (op + 1 > capacity) {
+    return 0;
+  }
+  out[op++] = (literals < 15 ? literals : 15) << 4;
+  if (literals >= 15 && !put_length(out, &op, capacity, literals - 15)) {
+    return 0;
+  }
+  if (op + literals > capacity) {
+    return 0;
+  }
+  memcpy(out + op, in + anchor, literals);
+  return op + literals;
+}
+
+/**************** lz_decompress() ****************/
+/* see lz.h for description */
+bool
+lz_decompress(const char *src, const size_t length,
+              char *dst, const size_t rawLength)
+{
+  const uint8_t *in = (const uint8_t *)src;
+  uint8_t *out = (uint8_t *)dst;
+  size_t ip = 0, op = 0;
+
+  while (ip < length) {
+    size_t token = in[ip++];
+    size_t literals = token >> 4;
+    if (literals == 15 && !get_length(in, &ip, length, &literals)) {
+      return false;
+    }
+    if (literals > length - ip || literals > rawLength - op) {
+      return false;
+    }
+    memcpy(out + op, in + ip, literals);
+    ip += literals;
+    op += literals;
+    if (ip == length) {
+      break;                  // the last sequence
+    }
+
+    if (length - ip < 2) {
+      return false;
+    }
+    size_t distance = in[ip] | (in[ip + 1] << 8);
+    ip += 2;
+    size_t match = token & 15;
+    if (match == 15 && !get_length(in, &ip, length, &match)) {
+      return false;
+    }
+    match += MINMATCH;
+    if (distance == 0 || distance > op || match > rawLength - op) {
+      return false;
+    }
+    // a match may overlap what it copies, so copy at most 'distance'
+    // bytes at a time
+    while (match > 0) {
+      size_t chunk = match < distance ? match : distance;
+      memcpy(out + op, out + op - distance, chunk);
+      op += chunk;
+      match -= chunk;
+    }
+  }
+  return op == rawLength;
+}
+
+/**************** read32 ****************/
+/* Return the four bytes at p as an integer, in this machine's order. */
+static uint32_t
+read32(const uint8_t *p)
+{
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+/**************** put_length ****************/
+/* Write the part of a count beyond 15, as a run of 255s and a last byte
+ * less than 255, at out[*op]; advance *op.  False if out is full.
+ */
+static bool
+put_length(uint8_t *out, size_t *op, const size_t capacity, size_t length)
+{
+  while (length >= 255) {
+    if (*op >= capacity) {
+      return false;
+    }
+    out[(*op)++] = 255;
+    length -= 255;
+  }
+  if (*op >= capacity) {
+    return false;
+  }
+  out[(*op)++] = length;
+  return true;
+}
+
+/**************** get_length ****************/
+/* Read the part of a count beyond 15, as written by put_length, from
+ * in[*ip], and add it to *value; advance *ip.  False if in ends first.
+ */
+static bool
+get_length(const uint8_t *in, size_t *ip, const size_t length, size_t *value)
+{
+  size_t byte;
+  do {
+    if (*ip >= length) {
+      return false;
+    }
+    byte = in[(*ip)++];
+    *value += byte;
+  } while (byte == 255);
+  return true;
+}
+
+/**************** unit test ****************/
+/* Build with -DQUICKTEST and run as
+ *   ./lz file...
+ * to compress each file, check that it decompresses to the same bytes,
+ * and that every truncation of it is refused (or, if it cuts off only
+ * an empty last sequence, still decompresses to them), and print the
+ * ratio.
+ */
+#ifdef QUICKTEST
+
+#include <stdlib.h>
+#include "file.h"
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s file...\n", argv[0]);
+    exit(1);
+  }
+  int failures = 0;
+  for (int i = 1; i < argc; i++) {
+    FILE *fp = fopen(argv[i], "r");
+    char *text = (fp != NULL) ? freadfilep(fp) : NULL;
+    if (fp != NULL) {
+      fclose(fp);
+    }
+    if (text == NULL) {
+      fprintf(stderr, "%s: cannot read\n", argv[i]);
+      failures++;
+      continue;
+    }
+    size_t length = strlen(text);
+    char *packed = malloc(lz_bound(length));
+    char *unpacked = malloc(length + 1);
+    size_t n = lz_compress(text, length, packed, lz_bound(length));
+    bool same = lz_decompress(packed, n, unpacked, length)
+      && memcmp(text, unpacked, length) == 0;
+    bool refused = true;
+    for (size_t cut = 0; cut < n; cut++) {
+      refused = refused && (!lz_decompress(packed, cut, unpacked, length)
+                            || memcmp(text, unpacked, length) == 0);
+    }
+    bool small = (length == 0 || lz_compress(text, length, packed, n - 1) == 0);
+    printf("%s: %zu -> %zu bytes (%.1f%%), %s, truncations %s, %s\n",
+           argv[i], length, n, length > 0 ? 100.0 * n / length : 0.0,
+           same ? "round trip ok" : "ROUND TRIP FAILED",
+           refused ? "refused" : "NOT REFUSED",
+           small ? "short buffer refused" : "SHORT BUFFER NOT REFUSED");
+    failures += !same || !refused || !small;
+    free(text);
+    free(packed);
+    free(unpacked);
+  }
+  return failures > 0;
+}
+
+#endif // QUICKTEST
@@ -0,0 +1,52 @@
+/*
+ * lz.h - header file for the 'lz' compression module
+ *
+ * A small, fast LZ77 codec in the style of LZ4: the compressed data is
+ * a series of sequences, each a token byte (the number of literal bytes
+ * that follow, and the length of a match after them), the literals, and
+ * a two-byte distance back to where the match is to be copied from.
+ * It compresses text such as HTML to between a half and a quarter of
+ * its size, and decompresses it at memory speed.  The compressed data
+ * does not record its own length, nor that of the original; the caller
+ * keeps both.
+ *
+ * Antony Guzman, 2020
+ */
+
+#ifndef __LZ_H
+#define __LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**************** functions ****************/
+
+/**************** lz_bound ****************/
+/* Return the most bytes lz_compress can produce from 'length' bytes. */
+size_t lz_bound(const size_t length);
+
+/**************** lz_compress ****************/
+/* Compress 'length' bytes from src into dst.
+ *
+ * Caller provides:
+ *   the data to compress, and a buffer of 'capacity' bytes for the
+ *   result; a capacity of lz_bound(length) is always enough.
+ * We return:
+ *   the number of bytes written to dst, or 0 if they would not fit
+ *   (and length is not 0).
+ */
+size_t lz_compress(const char *src, const size_t length,
+                   char *dst, const size_t capacity);
+
+/**************** lz_decompress ****************/
+/* Decompress 'length' bytes from src, the output of lz_compress, into
+ * dst, which must hold the original 'rawLength' bytes.
+ * We return:
+ *   true if src decompressed to exactly rawLength bytes; false if it is
+ *   not valid compressed data of that length, in which case dst holds
+ *   garbage.  We never read or write beyond the given lengths.
+ */
+bool lz_decompress(const char *src, const size_t length,
+                   char *dst, const size_t rawLength);
+
+#endif // __LZ_H
@@ -8,19 +8,78 @@
  * 2. Variants that 'assert' the result is non-NULL;
  *    if NULL occurs, kick out an error and die.
  *
+ * 3. Slabs of small objects, with a cache of free objects per thread.
+ *
  * David Kotz, April 2016, 2017, 2019
  * Updated by Temi Prioleau, January 2020
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include "memory.h"
 
 /**************** file-local global variables ****************/
-// track malloc and free across *all* calls within this program.
-static int nmalloc = 0;    // number of successful malloc calls
-static int nfree = 0;    // number of free calls
-static int nfreenull = 0;  // number of free(NULL) calls
+// track malloc and free across *all* calls within this program,
+// from whichever thread makes them.
+static atomic_long nmalloc = 0;    // number of successful malloc calls
+static atomic_long nfree = 0;      // number of free calls
+static atomic_long nfreenull = 0;  // number of free(NULL) calls
+
+// slabs
+#define MAXSLABS 32               // slabs in the program, at most
+#define CHUNK (64 * 1024)         // bytes carved into objects at a time
+#define BATCH 32                  // objects moved to or from a thread
+#define CACHE (2 * BATCH)         // free objects a thread keeps, at most
+#define ALIGN 16                  // object sizes are multiples of this
+
+static slab_t *slabs[MAXSLABS];   // every slab, by index
+static int nslabs = 0;
+static pthread_mutex_t slabsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// the sizes served by slab_allocSize, and their slabs, once made
+static const size_t classSizes[] = { 16, 32, 48, 64, 96, 128, 192,
+                                     256, 384, 512 };
+#define NCLASSES (sizeof(classSizes) / sizeof(classSizes[0]))
+static slab_t *classes[NCLASSES];
+static pthread_once_t classesOnce = PTHREAD_ONCE_INIT;
+
+// each thread's free objects of each slab; given back when it exits
+typedef struct cache {
+  void *head;                     // free objects, linked through
+  int count;                      //   their first word
+} cache_t;
+static _Thread_local cache_t caches[MAXSLABS];
+static _Thread_local bool cachesKeyed = false;
+static pthread_key_t cachesKey;
+static pthread_once_t cachesOnce = PTHREAD_ONCE_INIT;
+
+/**************** local types ****************/
+typedef struct slab {
+  char name[32];                  // for count_report
+  size_t size;                    // of each object, rounded up to ALIGN
+  int index;                      // in slabs[] and caches[]
+  pthread_mutex_t lock;           // protects the rest
+  void *free;                     // free objects given back by threads
+  char *chunk;                    // the part of the last chunk not yet
+  size_t chunkLeft;               //   carved into objects
+  long chunks;                    // chunks allocated
+  atomic_long nalloc;             // objects allocated and freed
+  atomic_long nfree;
+} slab_t;
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static void slab_refill(slab_t *slab, cache_t *cache);
+static void slab_flush(slab_t *slab, cache_t *cache, int count);
+static void caches_key(void);
+static void caches_exit(void *arg);
+static void classes_new(void);
+static slab_t *class_find(const size_t size);
+static long slabs_net(void);
 
 
 /**************** assertp ****************/
@@ -41,7 +100,7 @@ void *
 count_malloc_assert(const size_t size, const char *message)
 {
   void *ptr = assertp(malloc(size), message);
-  nmalloc++;
+  atomic_fetch_add_explicit(&nmalloc, 1, memory_order_relaxed);
   return ptr;
 }
 
@@ -53,7 +112,7 @@ count_malloc(const size_t size)
 {
   void *ptr = malloc(size);
   if (ptr != NULL) {
-    nmalloc++;
+    atomic_fetch_add_explicit(&nmalloc, 1, memory_order_relaxed);
   }
   return ptr;
 }
@@ -64,7 +123,7 @@ void *
 count_calloc_assert(const size_t nmemb, const size_t size, const char *message)
 {
   void *ptr = assertp(calloc(nmemb, size), message);
-  nmalloc++;
+  atomic_fetch_add_explicit(&nmalloc, 1, memory_order_relaxed);
   return ptr;
 }
 
@@ -75,7 +134,7 @@ count_calloc(const size_t nmemb, const size_t size)
 {
   void *ptr = calloc(nmemb, size);
   if (ptr != NULL) {
-    nmalloc++;
+    atomic_fetch_add_explicit(&nmalloc, 1, memory_order_relaxed);
   }
   return ptr;
 }
@@ -87,10 +146,10 @@ count_free(void *ptr)
 {
   if (ptr != NULL) {
     free(ptr);
-    nfree++;
+    atomic_fetch_add_explicit(&nfree, 1, memory_order_relaxed);
   } else {
     // it's an error to call free(NULL)!
-    nfreenull++;
+    atomic_fetch_add_explicit(&nfreenull, 1, memory_order_relaxed);
   }
 }
 
@@ -99,8 +158,27 @@ count_free(void *ptr)
 void 
 count_report(FILE *fp, const char *message)
 {
-  fprintf(fp, "%s: %d malloc, %d free, %d free(NULL), %d net\n", 
-          message, nmalloc, nfree, nfreenull, nmalloc - nfree - nfreenull);
+  long mallocs = atomic_load(&nmalloc);
+  long frees = atomic_load(&nfree);
+  long freenulls = atomic_load(&nfreenull);
+  fprintf(fp, "%s: %ld malloc, %ld free, %ld free(NULL), %ld net\n", 
+          message, mallocs, frees, freenulls, mallocs - frees - freenulls);
+
+  // and a line for each slab that has been used
+  pthread_mutex_lock(&slabsLock);
+  for (int i = 0; i < nslabs; i++) {
+    slab_t *slab = slabs[i];
+    long nalloc = atomic_load(&slab->nalloc);
+    long nfreed = atomic_load(&slab->nfree);
+    if (nalloc > 0) {
+      pthread_mutex_lock(&slab->lock);
+      long kb = slab->chunks * CHUNK / 1024;
+      pthread_mutex_unlock(&slab->lock);
+      fprintf(fp, "%s: slab %s: %ld alloc, %ld free, %ld net, %ld KB\n",
+              message, slab->name, nalloc, nfreed, nalloc - nfreed, kb);
+    }
+  }
+  pthread_mutex_unlock(&slabsLock);
 }
 
 /**************** count_net() ****************/
@@ -108,5 +186,328 @@ count_report(FILE *fp, const char *message)
 int
 count_net(void)
 {
-  return nmalloc - nfree - nfreenull;
+  return atomic_load(&nmalloc) - atomic_load(&nfree)
+    - atomic_load(&nfreenull) + slabs_net();
+}
+
+/**************** slab_new() ****************/
+/* see memory.h for description */
+slab_t *
+slab_new(const char *name, const size_t size)
+{
+  if (name == NULL || size == 0 || size > CHUNK) {
+    return NULL;
+  }
+  slab_t *slab = malloc(sizeof(slab_t));
+  if (slab == NULL) {
+    return NULL;
+  }
+  snprintf(slab->name, sizeof(slab->name), "%s", name);
+  // big enough to link, and keeping every object aligned
+  slab->size = (size + ALIGN - 1) / ALIGN * ALIGN;
+  pthread_mutex_init(&slab->lock, NULL);
+  slab->free = NULL;
+  slab->chunk = NULL;
+  slab->chunkLeft = 0;
+  slab->chunks = 0;
+  atomic_init(&slab->nalloc, 0);
+  atomic_init(&slab->nfree, 0);
+
+  pthread_mutex_lock(&slabsLock);
+  if (nslabs == MAXSLABS) {
+    pthread_mutex_unlock(&slabsLock);
+    pthread_mutex_destroy(&slab->lock);
+    free(slab);
+    return NULL;
+  }
+  slab->index = nslabs;
+  slabs[nslabs++] = slab;
+  pthread_mutex_unlock(&slabsLock);
+  return slab;
+}
+
+/**************** slab_alloc() ****************/
+/* see memory.h for description */
+void *
+slab_alloc(slab_t *slab)
+{
+  if (slab == NULL) {
+    return NULL;
+  }
+  cache_t *cache = &caches[slab->index];
+  if (cache->head == NULL) {
+    slab_refill(slab, cache);
+    if (cache->head == NULL) {
+      return NULL;
+    }
+  }
+  void *ptr = cache->head;
+  cache->head = *(void **)ptr;
+  cache->count--;
+  atomic_fetch_add_explicit(&slab->nalloc, 1, memory_order_relaxed);
+  return ptr;
+}
+
+/**************** slab_free() ****************/
+/* see memory.h for description */
+void
+slab_free(slab_t *slab, void *ptr)
+{
+  if (slab == NULL || ptr == NULL) {
+    return;
+  }
+  cache_t *cache = &caches[slab->index];
+  *(void **)ptr = cache->head;
+  cache->head = ptr;
+  cache->count++;
+  atomic_fetch_add_explicit(&slab->nfree, 1, memory_order_relaxed);
+  if (cache->count > CACHE) {
+    slab_flush(slab, cache, BATCH);
+  }
+}
+
+/**************** slab_allocSize() ****************/
+/* see memory.h for description */
+void *
+slab_allocSize(const size_t size)
+{
+  slab_t *slab = class_find(size);
+  return slab != NULL ? slab_alloc(slab) : count_malloc(size);
+}
+
+/**************** slab_freeSize() ****************/
+/* see memory.h for description */
+void
+slab_freeSize(void *ptr, const size_t size)
+{
+  if (ptr != NULL) {
+    slab_t *slab = class_find(size);
+    if (slab != NULL) {
+      slab_free(slab, ptr);
+    } else {
+      count_free(ptr);
+    }
+  }
+}
+
+/**************** slab_refill ****************/
+/* Give this thread's (empty) cache a batch of free objects: those
+ * other threads gave back, if any, or else new ones, from the chunk.
+ * The cache is left empty if there is no memory.
+ */
+static void
+slab_refill(slab_t *slab, cache_t *cache)
+{
+  if (!cachesKeyed) {
+    // so that the cache is given back when this thread exits
+    pthread_once(&cachesOnce, caches_key);
+    pthread_setspecific(cachesKey, caches);
+    cachesKeyed = true;
+  }
+
+  pthread_mutex_lock(&slab->lock);
+  while (cache->count < BATCH && slab->free != NULL) {
+    void *ptr = slab->free;
+    slab->free = *(void **)ptr;
+    *(void **)ptr = cache->head;
+    cache->head = ptr;
+    cache->count++;
+  }
+  while (cache->count < BATCH) {
+    if (slab->chunkLeft < slab->size) {
+      // the rest of the old chunk, if any, is lost
+      if ( (slab->chunk = malloc(CHUNK)) == NULL) {
+        slab->chunkLeft = 0;
+        break;
+      }
+      slab->chunkLeft = CHUNK;
+      slab->chunks++;
+    }
+    void *ptr = slab->chunk;
+    slab->chunk += slab->size;
+    slab->chunkLeft -= slab->size;
+    *(void **)ptr = cache->head;
+    cache->head = ptr;
+    cache->count++;
+  }
+  pthread_mutex_unlock(&slab->lock);
+}
+
+/**************** slab_flush ****************/
+/* Give count of the objects in this thread's cache back to the slab. */
+static void
+slab_flush(slab_t *slab, cache_t *cache, int count)
+{
+  pthread_mutex_lock(&slab->lock);
+  while (count-- > 0 && cache->head != NULL) {
+    void *ptr = cache->head;
+    cache->head = *(void **)ptr;
+    cache->count--;
+    *(void **)ptr = slab->free;
+    slab->free = ptr;
+  }
+  pthread_mutex_unlock(&slab->lock);
+}
+
+/**************** caches_key ****************/
+/* Make the key whose destructor gives back an exiting thread's caches. */
+static void
+caches_key(void)
+{
+  pthread_key_create(&cachesKey, caches_exit);
+}
+
+/**************** caches_exit ****************/
+/* Give all of an exiting thread's free objects back to their slabs. */
+static void
+caches_exit(void *arg)
+{
+  cache_t *mine = arg;
+  pthread_mutex_lock(&slabsLock);
+  int n = nslabs;
+  pthread_mutex_unlock(&slabsLock);
+  for (int i = 0; i < n; i++) {
+    if (mine[i].count > 0) {
+      slab_flush(slabs[i], &mine[i], mine[i].count);
+    }
+  }
+}
+
+/**************** classes_new ****************/
+/* Make the slabs for slab_allocSize. */
+static void
+classes_new(void)
+{
+  for (int i = 0; i < NCLASSES; i++) {
+    char name[16];
+    sprintf(name, "%zu bytes", classSizes[i]);
+    classes[i] = slab_new(name, classSizes[i]);
+  }
+}
+
+/**************** class_find ****************/
+/* Return the slab for objects of the given size, or NULL if there is
+ * none (for a large size, or if the slab could not be made).
+ */
+static slab_t *
+class_find(const size_t size)
+{
+  pthread_once(&classesOnce, classes_new);
+  for (int i = 0; i < NCLASSES; i++) {
+    if (size <= classSizes[i]) {
+      return classes[i];
+    }
+  }
+  return NULL;
+}
+
+/**************** slabs_net ****************/
+/* Return the objects allocated from all slabs and not yet freed. */
+static long
+slabs_net(void)
+{
+  long net = 0;
+  pthread_mutex_lock(&slabsLock);
+  for (int i = 0; i < nslabs; i++) {
+    net += atomic_load(&slabs[i]->nalloc) - atomic_load(&slabs[i]->nfree);
+  }
+  pthread_mutex_unlock(&slabsLock);
+  return net;
+}
+
+/**************** unit test ****************/
+/* Build with -DQUICKTEST and run as
+ *   ./memory
+ * to have several threads allocate objects from a slab, and strings of
+ * many sizes, and fill each with its own bytes; then each thread checks
+ * and frees another thread's objects, and the counts must balance.
+ */
+#ifdef QUICKTEST
+
+#define THREADS 4
+#define OBJECTS 20000
+#define OBJSIZE 40
+
+static slab_t *testSlab;
+static struct {
+  int id;
+  unsigned char *objects[OBJECTS];
+  unsigned char *strings[OBJECTS];
+  int failures;
+} tests[THREADS];
+
+/* the size of string i */
+static size_t
+test_size(const int i)
+{
+  return 1 + (i * 7) % 700;           // some too big for any slab
+}
+
+/* allocate and fill this thread's objects and strings */
+static void *
+test_alloc(void *arg)
+{
+  int t = *(int *)arg;
+  for (int i = 0; i < OBJECTS; i++) {
+    tests[t].objects[i] = assertp(slab_alloc(testSlab), "test object");
+    memset(tests[t].objects[i], t * 31 + i, OBJSIZE);
+    tests[t].strings[i] = assertp(slab_allocSize(test_size(i)), "test string");
+    memset(tests[t].strings[i], t * 17 + i, test_size(i));
+    if (i % 3 == 0) {
+      // and free some at once, to be used again
+      slab_free(testSlab, assertp(slab_alloc(testSlab), "test object"));
+    }
+  }
+  return NULL;
+}
+
+/* check and free the objects and strings of the next thread */
+static void *
+test_free(void *arg)
+{
+  int t = (*(int *)arg + 1) % THREADS;
+  int failures = 0;
+  for (int i = 0; i < OBJECTS; i++) {
+    for (int j = 0; j < OBJSIZE; j++) {
+      failures += tests[t].objects[i][j] != (unsigned char)(t * 31 + i);
+    }
+    for (size_t j = 0; j < test_size(i); j++) {
+      failures += tests[t].strings[i][j] != (unsigned char)(t * 17 + i);
+    }
+    slab_free(testSlab, tests[t].objects[i]);
+    slab_freeSize(tests[t].strings[i], test_size(i));
+  }
+  tests[t].failures = failures;
+  return NULL;
+}
+
+int main(void)
+{
+  testSlab = assertp(slab_new("test", OBJSIZE), "test slab");
+  pthread_t threads[THREADS];
+  for (int round = 0; round < 2; round++) {
+    for (int t = 0; t < THREADS; t++) {
+      tests[t].id = t;
+      pthread_create(&threads[t], NULL, test_alloc, &tests[t].id);
+    }
+    for (int t = 0; t < THREADS; t++) {
+      pthread_join(threads[t], NULL);
+    }
+    for (int t = 0; t < THREADS; t++) {
+      pthread_create(&threads[t], NULL, test_free, &tests[t].id);
+    }
+    for (int t = 0; t < THREADS; t++) {
+      pthread_join(threads[t], NULL);
+    }
+  }
+
+  int failures = 0;
+  for (int t = 0; t < THREADS; t++) {
+    failures += tests[t].failures;
+  }
+  count_report(stdout, "memory");
+  printf("%d bytes overwritten, %d net\n", failures, count_net());
+  return failures > 0 || count_net() != 0;
 }
+
+#endif // QUICKTEST
@@ -8,6 +8,14 @@
  * 2. Variants that 'assert' the result is non-NULL;
  *    if NULL occurs, kick out an error and die.
  *
+ * 3. Slabs: pools of small objects of one size, for things made and
+ *    freed by the thousand, like pages and the nodes that hold them.
+ *    Each thread keeps a few free objects of each slab to itself, so
+ *    most allocations take no lock, and objects are carved from large
+ *    chunks, which the program keeps (reusing the objects) until it
+ *    exits, so they do not fragment the heap.  Slabs count their
+ *    objects too, and count_report includes them.
+ *
  * David Kotz, April 2016, 2017, 2019
  * Updated by Temi Prioleau, January 2020
  */
@@ -100,7 +108,52 @@ void count_report(FILE *fp, const char *message);
  *   returns positive if there are unfreed allocations,
  *   returns negative if there were more free's than alloc's (!),
  *   returns zero if they balance.
+ * Objects still allocated from slabs count as unfreed allocations.
  */
 int count_net(void);
 
+/**************** global types ****************/
+typedef struct slab slab_t;  // opaque to users of the module
+
+/**************** slab_new() ****************/
+/* Make a slab of objects of the given size, for any thread to use.
+ * Caller provides:
+ *   a name for the objects, for count_report, and their size (> 0).
+ * We return:
+ *   the new slab, or NULL if there are too many slabs already (there
+ *   may be 32) or no memory.
+ * A slab, and the memory of its objects, lasts until the program
+ * exits; make each slab once (with pthread_once, say) and keep it.
+ */
+slab_t *slab_new(const char *name, const size_t size);
+
+/**************** slab_alloc() ****************/
+/* Allocate an object, uninitialized, from the slab.
+ * We return:
+ *   a pointer to the object, aligned for any type; NULL if slab is
+ *   NULL or there is no memory.
+ * Caller is responsible for:
+ *   later calling slab_free(slab, object), in any thread.
+ */
+void *slab_alloc(slab_t *slab);
+
+/**************** slab_free() ****************/
+/* Return an object to the slab it came from.  Ignores a NULL object. */
+void slab_free(slab_t *slab, void *ptr);
+
+/**************** slab_allocSize() ****************/
+/* Allocate size bytes, like count_malloc, but from a slab shared by
+ * all objects of about that size, if size is small (at most 512 bytes;
+ * anything larger comes from malloc).  Good for short strings.
+ * We return:
+ *   a pointer to the space, or NULL if there is no memory.
+ * Caller is responsible for:
+ *   later calling slab_freeSize(ptr, size), with the same size.
+ */
+void *slab_allocSize(const size_t size);
+
+/**************** slab_freeSize() ****************/
+/* Free space from slab_allocSize(size).  Ignores NULL. */
+void slab_freeSize(void *ptr, const size_t size);
+
 #endif // __MEMORY_H
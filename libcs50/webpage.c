@@ -17,24 +17,42 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <unistd.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
-#include <netdb.h>
-#include "file.h"
+#include <time.h>
+#include <pthread.h>
 #include "webpage.h"
+#include "htmlscan.h"
 #include "memory.h"
+#include "http.h"
+#include "archive.h"
 
 /* ***************************************** */
 /* Private types */
+/* A URL is parsed into spans of the string it is in, so that nothing
+ * need be allocated; each part's 'start' is NULL if it is absent.
+ */
+struct span {
+  const char *start;          // first character of this part
+  size_t len;                 // number of characters in it
+};
+
 struct URL {
-  char* scheme;               // http://
-  char* user;                 // username:password@
-  char* host;                 // www.example.com
-  char* path;                 // /path/to/file.html
-  char* query;                // ?name1=val1&name2=val2
-  char* fragment;             // #top
+  struct span scheme;         // http://
+  struct span user;           // username:password@
+  struct span host;           // www.example.com
+  struct span path;           // /path/to/file.html
+  struct span query;          // ?name1=val1&name2=val2
+  struct span fragment;       // #top
+};
+
+/* what webpage_scan passes through htmlscan to ScanLink and ScanWord */
+struct scan {
+  webpage_t *page;            // the page being scanned
+  void *arg;                  // the caller's argument
+  void (*linkfunc)(void *arg, char *url);     // the caller's functions
+  void (*wordfunc)(void *arg, const char *word, const size_t len);
 };
 
 /* webpage_t: structure to represent a web page, and its contents.
@@ -42,26 +60,38 @@ struct URL {
  */
 typedef struct webpage {
   char *url;                               // url of the page
+  size_t urlSize;                          // its slab size, or 0 if malloc'd
   char *html;                              // html code of the page
   size_t html_len;                         // length of html code
   int depth;                               // depth of crawl
+  char *etag;                              // validators of the html,
+  char *lastModified;                      //   or NULL if unknown
+  int status;                              // HTTP status of the last fetch
+  long connectTime;                        // microseconds the last fetch
+  long firstByteTime;                      //   took to connect, to get the
+  long fetchTime;                          //   first byte, in all; or -1
+  long avoided;                            // bytes of a refused body not
+                                           //   read; or -1 if not refused
 } webpage_t;
 
 /* *********************************************************************** */
 /* Private function prototypes */
 
-static FILE *ConnectToHost(const char *hostname, const int port);
-static inline bool isBlankLine(const char *line);
-static char *RemoveDotSegments(char *input);
+static size_t RemoveDotSegments(const char *input, size_t len, char *out);
 static void RemoveWhitespace(char* str);
-static char *FixupRelativeURL(char *base, char *rel, size_t len);
-static bool ParseURL(char* str, struct URL* url);
-static void FreeURL(struct URL url);
-static bool BurstURL(const char *url, char **hostname, 
-                     int *port, char **pathname);
+static size_t FixupRelativeURL(const char *base, const char *rel, size_t len,
+                               char *out, size_t size);
+static bool NextLink(webpage_t *page, int *pos, char **link, size_t *len,
+                     bool *relative);
+static void ScanLink(void *arg, const char *href, const size_t len);
+static void ScanWord(void *arg, const char *word, const size_t len);
+static bool ParseURL(const char* str, size_t len, struct URL* url);
+static const char *FindAny(const char *str, const char *end, const char *set);
 #ifdef DEBUG
 static void PrintURL(struct URL url);
 #endif // DEBUG
+static webpage_t *PageAlloc(void);
+static void PagesNew(void);
 
 /* *********************************************************************** */
 /* Private global variables */
@@ -69,6 +99,16 @@ static void PrintURL(struct URL url);
 static const int MAX_TRY = 3;    // maximum attempts to fetch
 static const int HTTP_PORT = 80; // default web server port
 
+#ifndef NOSLEEP // CS50 students: please don't turn off the sleep!
+static int fetchDelay = 1000;    // ms to pause after each connect attempt
+#else
+static int fetchDelay = 0;
+#endif
+
+// pages, and the URLs copied by webpage_newCopy, come from slabs
+static slab_t *pageSlab = NULL;
+static pthread_once_t pageSlabOnce = PTHREAD_ONCE_INIT;
+
 static const char* EXTS[] = {  // valid extensions
   "html",
   "htm",     // added by DFK
@@ -102,13 +142,35 @@ webpage_new(char *url, const int depth, char *html)
     return NULL;
   }
 
-  webpage_t *page = assertp(malloc(sizeof(webpage_t)), "webpage_t");
+  webpage_t *page = PageAlloc();
 
   page->url = url;
+  page->urlSize = 0;
   page->depth = depth;
   page->html = html;
   page->html_len = html ? strlen(html) : 0;
+  page->etag = NULL;
+  page->lastModified = NULL;
+  page->status = 0;
+  page->connectTime = page->firstByteTime = page->fetchTime = -1;
+  page->avoided = -1;
+
+  return page;
+}
 
+/**************** webpage_newCopy ****************/
+/* see webpage.h for documentation */
+webpage_t *
+webpage_newCopy(const char *url, const int depth)
+{
+  if (url == NULL || depth < 0) {
+    return NULL;
+  }
+  size_t size = strlen(url) + 1;
+  char *copy = assertp(slab_allocSize(size), "webpage url");
+  memcpy(copy, url, size);
+  webpage_t *page = webpage_new(copy, depth, NULL);
+  page->urlSize = size;
   return page;
 }
 
@@ -119,9 +181,15 @@ webpage_delete(void *data)
 {
   webpage_t *page = data;
   if (page != NULL) {
-    if (page->url != NULL) free(page->url);
+    if (page->urlSize > 0) {
+      slab_freeSize(page->url, page->urlSize);
+    } else if (page->url != NULL) {
+      free(page->url);
+    }
     if (page->html != NULL) free(page->html);
-    free(page);
+    if (page->etag != NULL) free(page->etag);
+    if (page->lastModified != NULL) free(page->lastModified);
+    slab_free(pageSlab, page);
   }
 }
 
@@ -137,10 +205,13 @@ webpage_delete(void *data)
  * Pseudocode:
  *     1. check for valid page 
  *     2. parse url into hostname, port, and filename
- *     3. open a connection to the given host
- *     4. send http request
- *     5. fetch html response
- *     6. cleanup
+ *     3. if replaying an archive, take the response from it instead
+ *     4. open a connection to the given host, each try with a timeout
+ *     5. send http request, conditional if we have the page's validators,
+ *        giving the connection the fetch's deadline
+ *     6. read the response, record it if recording an archive, and keep
+ *        its body and validators if the status is 200
+ *     7. cleanup
  */
 bool 
 webpage_fetch(webpage_t *page)
@@ -159,72 +230,207 @@ webpage_fetch(webpage_t *page)
     return false;
   }
 
-  // attempt to connect to server 
-  FILE *http_fp = NULL; 
-  for (int try = 0;  http_fp == NULL && try < MAX_TRY; try++) {
+  // no network at all when replaying
+  if (archive_mode() >= ARCHIVE_REPLAY) {
+    free(hostname);
+    free(pathname);
+    bool fetched = archive_fetch(page);
+    webpage_fetchPause();
+    return fetched;
+  }
+
+  // attempt to connect to server; time the attempts, but not the pauses
+  httpconn_t *conn = NULL; 
+  long long connecting = 0;
+  for (int try = 0;  conn == NULL && try < MAX_TRY; try++) {
     // open connection - exit on error
-    http_fp = ConnectToHost(hostname, port);
+    long long start = http_clock();
+    conn = httpconn_new(http_connect(hostname, port));
+    connecting += http_clock() - start;
 
-#ifndef NOSLEEP // CS50 students: please don't turn off the sleep!
-    sleep(1);   // sleep one second between fetches, to lighten load on server
-#endif
+    // pause between fetches, to lighten load on server
+    webpage_fetchPause();
   }
 
   // failed to connect?
-  if (http_fp == NULL) {
+  if (conn == NULL) {
+    free(hostname);
+    free(pathname);
+    archive_putFailure(page, connecting);
     return false;
   }
 
-  // prepare and send HTTP request; receive response
-  char *httpResponse = NULL;
-  const char *httpFormat =
-    "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n";
-  if (fprintf(http_fp, httpFormat, pathname, hostname) >= 0) {
-    // ensure stdio buffer is flushed to socket
-    fflush(http_fp);
-    // read the server's response
-    httpResponse = freadlinep(http_fp);
+  // prepare and send HTTP request; the time spent connecting counts
+  // toward the fetch's deadline
+  long long sending = http_clock();
+  httpconn_setDeadline(conn, http_deadline(sending - connecting));
+  char *request = http_request(hostname, pathname, 
+                               page->etag, page->lastModified, true);
+  bool sent = false;
+  if (request != NULL) {
+    sent = httpconn_send(conn, request, strlen(request));
+    count_free(request);
   }
 
   free(hostname);
   free(pathname);
 
-  // did we succeed? check the response
+  // did we succeed? read and check the response; the http module
+  // reads the body in bulk, sized by Content-Length or de-chunked
   bool success = false;
-
-  if (httpResponse != NULL) {
-    // check response code to see whether we succeeded
-    int httpResponseCode = 0;
-    if (sscanf(httpResponse, "HTTP/1.1 %d", &httpResponseCode) == 1
-        && httpResponseCode == 200) {
-      // success! ignore the rest of the header, then grab the page
-      // read lines until we read a blank line or fail to read a line
-      char *line = freadlinep(http_fp);
-      while (line != NULL && !isBlankLine(line)) {
-        free(line);
-        line = freadlinep(http_fp);
-      }
-      // did we exit the loop because we read an empty line?
-      if (line != NULL) {
-        free(line); // the blank line
-
-        // then grab everything else - that should be the page content
-        char *html = freadfilep(http_fp);
-        if (html != NULL) {
-          page->html = html;
-          success = true;
-        } 
-      }
+  httpresponse_t resp;
+  if (sent && httpconn_read(conn, &resp)) {
+    page->status = resp.status;
+    webpage_setTimes(page, connecting, connecting + resp.firstByte - sending,
+                     connecting + http_clock() - sending);
+    archive_put(page, &resp);
+    webpage_setRefused(page, resp.refused ? resp.avoided : -1);
+    if (resp.status == 200 && !resp.refused
+        && webpage_setHTML(page, resp.body)) {
+      webpage_setValidators(page, resp.etag, resp.lastModified);
+      success = true;
+    } else {
+      free(resp.body);
     }
-    free(httpResponse);
+  } else {
+    archive_putFailure(page, connecting + http_clock() - sending);
   }
 
   // clean up
-  fclose(http_fp);
+  httpconn_delete(conn);
 
   return success;
 }
 
+/**************** webpage_setFetchDelay ****************/
+/* see webpage.h for documentation */
+void
+webpage_setFetchDelay(const int ms)
+{
+  fetchDelay = ms > 0 ? ms : 0;
+}
+
+/**************** webpage_fetchPause ****************/
+/* see webpage.h for documentation */
+void
+webpage_fetchPause(void)
+{
+  if (fetchDelay > 0) {
+    struct timespec delay = { fetchDelay / 1000, (fetchDelay % 1000) * 1000000L };
+    while (nanosleep(&delay, &delay) != 0) {
+      ;   // interrupted; sleep for the remainder
+    }
+  }
+}
+
+/**************** webpage_setValidators ****************/
+/* see webpage.h for documentation */
+bool
+webpage_setValidators(webpage_t *page, const char *etag, 
+                      const char *lastModified)
+{
+  if (page == NULL) {
+    return false;
+  }
+  char *newEtag = (etag != NULL && *etag != '\0') ? strdup(etag) : NULL;
+  char *newDate = (lastModified != NULL && *lastModified != '\0') 
+    ? strdup(lastModified) : NULL;
+  if ((etag != NULL && *etag != '\0' && newEtag == NULL)
+      || (lastModified != NULL && *lastModified != '\0' && newDate == NULL)) {
+    if (newEtag != NULL) free(newEtag);
+    if (newDate != NULL) free(newDate);
+    return false;
+  }
+  if (page->etag != NULL) free(page->etag);
+  if (page->lastModified != NULL) free(page->lastModified);
+  page->etag = newEtag;
+  page->lastModified = newDate;
+  return true;
+}
+
+/* see webpage.h for documentation */
+const char *webpage_getETag(const webpage_t *page) {
+  return page ? page->etag : NULL;
+}
+const char *webpage_getLastModified(const webpage_t *page) {
+  return page ? page->lastModified : NULL;
+}
+
+/**************** webpage_setStatus ****************/
+/* see webpage.h for documentation */
+void
+webpage_setStatus(webpage_t *page, const int status)
+{
+  if (page != NULL) {
+    page->status = status;
+  }
+}
+
+/* see webpage.h for documentation */
+int webpage_getStatus(const webpage_t *page) {
+  return page ? page->status : 0;
+}
+
+/**************** webpage_setTimes ****************/
+/* see webpage.h for documentation */
+void
+webpage_setTimes(webpage_t *page, const long connect, const long firstByte,
+                 const long total)
+{
+  if (page != NULL) {
+    page->connectTime = connect;
+    page->firstByteTime = firstByte;
+    page->fetchTime = total;
+  }
+}
+
+/* see webpage.h for documentation */
+void
+webpage_getTimes(const webpage_t *page, long *connect, long *firstByte,
+                 long *total)
+{
+  if (connect != NULL) *connect = page ? page->connectTime : -1;
+  if (firstByte != NULL) *firstByte = page ? page->firstByteTime : -1;
+  if (total != NULL) *total = page ? page->fetchTime : -1;
+}
+
+/**************** webpage_setRefused ****************/
+/* see webpage.h for documentation */
+void
+webpage_setRefused(webpage_t *page, const long avoided)
+{
+  if (page != NULL) {
+    page->avoided = avoided < 0 ? -1 : avoided;
+  }
+}
+
+/* see webpage.h for documentation */
+bool
+webpage_getRefused(const webpage_t *page, long *avoided)
+{
+  bool refused = page != NULL && page->avoided >= 0;
+  if (avoided != NULL) *avoided = refused ? page->avoided : 0;
+  return refused;
+}
+
+/* see webpage.h for documentation */
+size_t webpage_getHTMLLength(const webpage_t *page) {
+  return (page && page->html) ? page->html_len : 0;
+}
+
+/**************** webpage_setHTML ****************/
+/* see webpage.h for documentation */
+bool
+webpage_setHTML(webpage_t *page, char *html)
+{
+  if (page == NULL || html == NULL || page->html != NULL) {
+    return false;
+  }
+  page->html = html;
+  page->html_len = strlen(html);
+  return true;
+}
+
 /**************** webpage_getNextWord ****************/
 /* see webpage.h for usage documentation.
  *
@@ -315,16 +521,9 @@ webpage_getNextWord(webpage_t *page, int *pos)
  *
  * Pseudocode:
  *     1. check arguments
- *     2. if *pos = 0 (first call for this page): remove whitespace from html
- *     3. find hyperlink starting tags "<a" or "<A"
- *     4. find next href attribute "href="
- *     5. find next end tag ">"
- *     6. check that href comes before end tag
- *     7. deal with quoted and unquoted urls
- *     8. determine if url is absolute
- *     9. fixup relative links
- *    10. update *pos to position after the URL
- *    11. create new character buffer for result and return it
+ *     2. find the next link
+ *     3. create new character buffer for result
+ *     4. fixup relative links, or copy absolute links, into it
  */
 char *
 webpage_getNextURL(webpage_t *page, int *pos)
@@ -334,10 +533,248 @@ webpage_getNextURL(webpage_t *page, int *pos)
     return NULL;
   }
 
+  char *href;                              // the link, within the html
+  size_t len;                              // its length
+  bool relative;                           // is this link relative?
+  if (!NextLink(page, pos, &href, &len, &relative)) {
+    return NULL;
+  }
+
+  // create new buffer, big enough for the link when made absolute
+  size_t size = (relative ? strlen(page->url) : 0) + len + 2;
+  char *result = calloc(size, sizeof(char));
+  if (result == NULL) {
+    // out of memory
+    return NULL;
+  }
+
+  // have a good link now
+  if (relative) {                           // need to fixup relative links
+    if (FixupRelativeURL(page->url, href, len, result, size) == 0) {
+      free(result);
+      return NULL;                          // Fixup failed
+    }
+  } else {
+    // copy over absolute url
+    memcpy(result, href, len);
+  }
+  return result;
+}
+
+/**************** webpage_nextURL ****************/
+/* See "webpage.h" for full documentation.
+ *
+ * As webpage_getNextURL, but writing into the caller's buffer, and
+ * skipping any link that cannot be made absolute within it.
+ */
+bool
+webpage_nextURL(webpage_t *page, int *pos, char *url, const size_t size)
+{
+  // make sure we have text and base url, and valid args
+  if (page == NULL || page->html == NULL || page->url == NULL || pos == NULL
+      || url == NULL || size == 0) {
+    return false;
+  }
+
+  char *href;                              // the link, within the html
+  size_t len;                              // its length
+  bool relative;                           // is this link relative?
+  while (NextLink(page, pos, &href, &len, &relative)) {
+    if (relative) {
+      if (FixupRelativeURL(page->url, href, len, url, size) > 0) {
+        return true;
+      }
+    } else if (len < size) {
+      memcpy(url, href, len);
+      url[len] = '\0';
+      return true;
+    }
+  }
+  return false;
+}
+
+/**************** webpage_scan ****************/
+/* See "webpage.h" for full documentation.
+ *
+ * htmlscan finds the links and words in one pass; ScanLink makes each
+ * link absolute, and ScanWord passes each word on.  If only words are
+ * wanted, they go straight to the caller.
+ */
+void
+webpage_scan(webpage_t *page, void *arg,
+             void (*linkfunc)(void *arg, char *url),
+             void (*wordfunc)(void *arg, const char *word, const size_t len))
+{
+  if (page == NULL || page->html == NULL
+      || (linkfunc != NULL && page->url == NULL)) {
+    return;
+  }
+
+  if (linkfunc == NULL) {
+    htmlscan(page->html, strlen(page->html), arg, NULL, wordfunc);
+  } else {
+    struct scan scan = { page, arg, linkfunc, wordfunc };
+    htmlscan(page->html, strlen(page->html), &scan,
+             ScanLink, wordfunc != NULL ? ScanWord : NULL);
+  }
+}
+
+/******************** NormalizeURL *******************************/
+/* Normalize the url according to RFC 3986 chapter 3.
+ * see webpage.h for documentation.
+ *
+ * Assumptions:
+ *     1. url is an absolute url
+ *
+ * Pseudocode:
+ *     1. check arguments
+ *     2. try to parse url
+ *     3. check any file extensions
+ *     4. lowercase scheme and host, where they are
+ *     5. remove dot segments from the path, and move the query and
+ *        fragment down after it
+ *
+ * The url is rewritten in place: each part is written no later in the
+ * string than where it was read from, so no part is overwritten before
+ * it has been read, and nothing need be allocated.
+ */
+bool
+NormalizeURL(char *url)
+{
+  struct URL tmp;                        // url parts, within url
+
+  // test url
+  if (!url) { return false; }
+
+  // try to parse the url
+  if (!ParseURL(url, strlen(url), &tmp)) {
+    return false;
+  }
+
+  // check file extension
+  if (tmp.path.len > 0) {                 // have a path
+    const char *end = tmp.path.start + tmp.path.len;
+    const char *dot = NULL;
+    const char *slash = NULL;
+    for (const char *ptr = tmp.path.start; ptr < end; ptr++) {
+      if (*ptr == '.') {
+        dot = ptr;
+      } else if (*ptr == '/') {
+        slash = ptr;
+      }
+    }
+
+    if (dot && slash && dot > slash) {    // /path/to/file.ext
+      dot++;                              // consume '.'
+
+      if (dot < end) {
+        // check all valid extensions
+        bool valid_ext = false;
+        for (int i = 0; EXTS[i] != NULL; i++) {
+          size_t ext_len = strlen(EXTS[i]);
+          if ((size_t)(end - dot) >= ext_len
+              && !strncasecmp(dot, EXTS[i], ext_len)) {
+            valid_ext = true; break;
+          }
+        }
+
+        // bad extension
+        if (!valid_ext) {
+          return false;
+        }
+      }
+    }
+  }
+
+  // put normalized url back together; scheme, user, and host stay put
+  for (size_t i = 0; i < tmp.scheme.len; i++) {             // scheme
+    url[i] = tolower(url[i]);
+  }
+  char *host = url + (tmp.host.start - url);                // host
+  for (size_t i = 0; i < tmp.host.len; i++) {
+    host[i] = tolower(host[i]);
+  }
+  char *out = host + tmp.host.len;
+
+  // path, with . and .. segments removed
+  out += RemoveDotSegments(tmp.path.start, tmp.path.len, out);
+
+  if (tmp.query.start) {                                    // query
+    memmove(out, tmp.query.start, tmp.query.len);
+    out += tmp.query.len;
+  }
+  if (tmp.fragment.start) {                                 // fragment
+    memmove(out, tmp.fragment.start, tmp.fragment.len);
+    out += tmp.fragment.len;
+  }
+  *out = '\0';
+
+#ifdef REMOVE_SLASH
+  // Remove trailing slash [DFK 2017].
+  // This code allows crawler to realize that
+  //    http://www.cs.dartmouth.edu == http://www.cs.dartmouth.edu/
+  // but doing so actually prevents the crawler from following the
+  // server's implicit redirect to http://www.cs.dartmouth.edu/index.html
+  // So, I've decided not to include it.
+  if (*url != '\0') {
+    char *last = url + strlen(url) - 1;
+    if (*last == '/'){
+      *last = '\0';
+    }
+  }
+#endif // REMOVE_SLASH
+
+  return true;
+}
+
+/***********************************************************************
+ * IsInternalURL - see webpage.h for interface description.
+ */
+bool
+IsInternalURL(char *url)
+{
+  if (NormalizeURL(url)) {
+    if (strncmp(url, INTERNAL_URL_PREFIX, strlen(INTERNAL_URL_PREFIX)) == 0) {
+      return true;
+    } else {
+      return false;
+    }
+  } else {
+    return false;
+  }
+}
+
+
+/***********************************************************************
+ * INTERNAL FUNCTIONS
+ ***********************************************************************/
+
+/***********************************************************************
+ * NextLink - find the next link in the page's html, from html[*pos]
+ * @page: page with html to search
+ * @pos: position in html; updated to the first position after the link
+ * @link: set to the start of the link, within the html
+ * @len: set to the length of the link
+ * @relative: set to whether the link is relative
+ *
+ * Returns false if there are no more links.  The link is not copied;
+ * it is followed in the html by its closing quote or other delimiter.
+ *
+ * Pseudocode:
+ *     1. if *pos = 0 (first call for this page): remove whitespace from html
+ *     2. find hyperlink starting tags "<a" or "<A"
+ *     3. find next href attribute "href="
+ *     4. find next end tag ">"
+ *     5. check that href comes before end tag
+ *     6. deal with quoted and unquoted urls
+ *     7. determine if url is absolute
+ *     8. update *pos to position after the URL
+ */
+static bool
+NextLink(webpage_t *page, int *pos, char **link, size_t *len, bool *relative)
+{
   char *html = page->html;                 // the html document
-  char *base_url = page->url;              // the base URL for this html
   int bad_link;                            // is this link ill formatted?
-  int relative;                            // is this link relative?
   char delim;                              // url delimiter: ' ', ''', '"'
   char *lnk;                               // hyperlink tags
   char *href;                              // href in a tag
@@ -352,20 +789,20 @@ webpage_getNextURL(webpage_t *page, int *pos)
 
   // parse for hyperlinks
   do {
-    relative = 0;                        // assume absolute link
+    *relative = false;                   // assume absolute link
     bad_link = 0;                        // assume valid link
 
     // find tag "<a" or "<A""
     lnk = strcasestr(&html[*pos], "<a");
 
     // no more links on this page
-    if (!lnk) { return NULL; }
+    if (!lnk) { return false; }
 
     // find next href after hyperlink tag
     href = strcasestr(lnk, "href=");
 
     // no more links on this page
-    if (!href) { return NULL; }
+    if (!href) { return false; }
 
     // find end of hyperlink tag
     end = strchr(lnk, '>');
@@ -410,8 +847,8 @@ webpage_getNextURL(webpage_t *page, int *pos)
 
     // is the url absolute, i.e, ':' must precede any '/', '?', or '#'
     ptr = strpbrk(href, ":/?#");
-    if (!ptr || *ptr != ':') { 
-      relative = 1; 
+    if (!ptr || *ptr != ':') {
+      *relative = true;
     } else if (strncasecmp(href, "http", 4)) { // absolute, but not http(s)
       bad_link = 1; (*pos) += 2; continue;
     }
@@ -420,174 +857,80 @@ webpage_getNextURL(webpage_t *page, int *pos)
   // update position after the end of the url
   *pos = end - html;
 
-  // have a good link now
-  if (relative) {                           // need to fixup relative links
-    char *result = FixupRelativeURL(base_url, href, end - href);
-    return result; // may be NULL if Fixup failed.
-  } else {
-    // create new buffer
-    char *result = calloc(end-href+1, sizeof(char));
-    if (result == NULL) {
-      // out of memory
-      return NULL;
-    } else {
-      // copy over absolute url
-      strncpy(result, href, end - href);
-      return result;
-    }
-  }
+  *link = href;
+  *len = end - href;
+  return true;
 }
 
-/******************** NormalizeURL *******************************/
-/* Normalize the url according to RFC 3986 chapter 3.
- * see webpage.h for documentation.
- *
- * Assumptions:
- *     1. url has been allocated
- *     2. url is an absolute url
+/***********************************************************************
+ * ScanLink - make a link found by htmlscan absolute, and pass it on
+ * @arg: the struct scan
+ * @href: the link, as it is in the html
+ * @len: its length
  *
- * Pseudocode:
- *     1. check arguments
- *     2. try to parse url
- *     3. check any file extensions
- *     4. clear the url
- *     5. remove dot segments and lowercase scheme and host
- *     6. put the url back together
+ * Much as NextLink would: any white space left in the link (only a
+ * quoted one can have any) is removed, and any #fragment; a link to a
+ * fragment of this page, or not http, is ignored; a relative link is
+ * resolved against the page's url.  Links too long for the buffers are
+ * ignored too.  Unlike NextLink, which removed all white space first,
+ * an unquoted href ends at white space (see htmlscan.h), so
+ * <a href=x.html name=y> links to x.html, not x.htmlname=y.
  */
-bool 
-NormalizeURL(char *url) 
+static void
+ScanLink(void *arg, const char *href, const size_t len)
 {
-  bool status = true;
-  int valid_ext;
-  struct URL tmp;                        // url struct for parsing
-  char *dot;
-  char *slash;
-
-  // test url
-  if (!url) { return 0; }
-
-  // try to parse the url
-  if (!ParseURL(url, &tmp)) {
-    status = false;
-    goto cleanup;                         // sorry Dijkstra
-  }
-
-  // check file extension
-  if (tmp.path) {                         // have a path
-    dot = strrchr(tmp.path, '.');
-    slash = strrchr(tmp.path, '/');
-
-    if (dot && slash && dot > slash) {    // /path/to/file.ext
-      dot++;                              // consume '.'
-
-      if (strlen(dot) > 0) {
-        // check all valid extensions
-        valid_ext = 0;
-        for (int i = 0; EXTS[i] != NULL; i++) {
-          if (!strncasecmp(dot, EXTS[i], strlen(EXTS[i]))) {
-            valid_ext = 1; break;
-          }
-        }
-
-        // bad extension
-        if (!valid_ext) {
-          status = false;
-          goto cleanup;            // sorry Dijkstra
-        }
+  struct scan *scan = arg;
+  char link[WEBPAGE_URLSIZE];              // the link, condensed
+  char url[WEBPAGE_URLSIZE];               // the link, made absolute
+  size_t i, n = 0;
+
+  // copy the link, without white space, up to any '#'
+  for (i = 0; i < len && href[i] != '#'; i++) {
+    if (!isspace((unsigned char)href[i])) {
+      if (n + 1 >= sizeof(link)) {
+        return;                            // too long
       }
+      link[n++] = href[i];
     }
   }
+  link[n] = '\0';
 
-  // clear url
-  memset(url, '\0', strlen(url)-1);
-
-  // put normalized url back together
-  if (tmp.scheme) {                         // scheme
-    strcat(url, tmp.scheme);
-  }
-
-  if (tmp.user) {                           // user
-    strcat(url, tmp.user);
-  }
-
-  if (tmp.host) {                           // host
-    strcat(url, tmp.host);
+  // have a link now
+  if (n == 0 && i < len) {                 // internal reference
+    return;
   }
 
-  if (tmp.path) {                           // path
-    // remove . and .. segments
-    char *p = RemoveDotSegments(tmp.path);
-
-    if (p) {
-      strcat(url, p);
-
-      free(p);
+  // is the url absolute, i.e, ':' must precede any '/', '?', or '#'
+  char *ptr = strpbrk(link, ":/?#");
+  if (!ptr || *ptr != ':') {               // relative: fix it up
+    if (FixupRelativeURL(scan->page->url, link, n, url, sizeof(url)) > 0) {
+      (*scan->linkfunc)(scan->arg, url);
     }
+  } else if (!strncasecmp(link, "http", 4)) {
+    (*scan->linkfunc)(scan->arg, link);
   }
-
-  if (tmp.query) {                          // query
-    strcat(url, tmp.query);
-  }
-
-  if (tmp.fragment) {                       // fragment
-    strcat(url, tmp.fragment);
-  }
-
-#ifdef REMOVE_SLASH
-  // Remove trailing slash [DFK 2017].
-  // This code allows crawler to realize that
-  //    http://www.cs.dartmouth.edu == http://www.cs.dartmouth.edu/
-  // but doing so actually prevents the crawler from following the 
-  // server's implicit redirect to http://www.cs.dartmouth.edu/index.html
-  // So, I've decided not to include it.
-  if (*url != '\0') {
-    char *last = url + strlen(url) - 1;
-    if (*last == '/'){
-      *last = '\0';
-    }
-  }
-#endif // REMOVE_SLASH
-
- cleanup:                                     // cleanup memory
-  if (tmp.scheme) { free(tmp.scheme); }
-  if (tmp.user) { free(tmp.user); }
-  if (tmp.host) { free(tmp.host); }
-  if (tmp.path) { free(tmp.path); }
-  if (tmp.query) { free(tmp.query); }
-  if (tmp.fragment) { free(tmp.fragment); }
-
-  return status;
+  // else absolute, but not http(s)
 }
 
 /***********************************************************************
- * IsInternalURL - see webpage.h for interface description.
+ * ScanWord - pass a word found by htmlscan on to the caller of
+ * webpage_scan, with the caller's argument
  */
-bool
-IsInternalURL(char *url)
+static void
+ScanWord(void *arg, const char *word, const size_t len)
 {
-  if (NormalizeURL(url)) {
-    if (strncmp(url, INTERNAL_URL_PREFIX, strlen(INTERNAL_URL_PREFIX)) == 0) {
-      return true;
-    } else {
-      return false;
-    }
-  } else {
-    return false;
-  }
+  struct scan *scan = arg;
+  (*scan->wordfunc)(scan->arg, word, len);
 }
 
-
-/***********************************************************************
- * INTERNAL FUNCTIONS
- ***********************************************************************/
-
 /***********************************************************************
  * ParseURL - attempts to parse str into a URL struct
  * @str: absolute url to parse
- * @url: pointer to a struct containing parts of a url; 
+ * @len: length of str, which need not be null-terminated
+ * @url: pointer to a struct containing parts of a url;
  *       inbound, its members are assumed uninitialized
- *       outbound, its members are initialized to NULL or malloc'd memory.
- *       Caller is later responsible for calling FreeURL(url) to free that space.
+ *       outbound, its members are spans of str, or empty spans.
+ *       Nothing is allocated, so there is nothing to free.
  *
  * Expects str to be an absolute url. Returns false if str cannot be
  * successfully parsed; otherwise, returns true.
@@ -607,17 +950,15 @@ IsInternalURL(char *url)
  * Should have no use outside of this file, thus declared static.
  */
 static bool
-ParseURL(char* str, struct URL* url)
+ParseURL(const char* str, size_t len, struct URL* url)
 {
-  int host_len;                            // length of host segment
-  char *scheme_end;                        // scheme end point, : or :/ or ://
-  char *user_end;                          // end of user info, @
-  char *host_beg;                          // beginning of host, : or @
-  char *host_end;                          // end of host, scheme:host/
-  char *host_e;                            // end of host, / or end of url
-  char *path_end;                          // end of path, ? or # or end of url
-  char *query_beg;                         // end of query, # or end of url
-  char *frag_beg;                          // end of fragment, end of url
+  const char *str_end = str + len;         // end of url
+  const char *scheme_end;                  // scheme end point, : or :/ or ://
+  const char *user_end;                    // end of user info, @
+  const char *host_beg;                    // beginning of host
+  const char *host_end;                    // end of host, / ? # or end of url
+  const char *path_end;                    // end of path, ? or # or end of url
+  const char *frag_beg;                    // beginning of fragment, #
 
   // make sure we have a str and url struct
   if (!str || !url) {
@@ -625,15 +966,10 @@ ParseURL(char* str, struct URL* url)
   }
 
   // initialize the structure
-  url->scheme = NULL;
-  url->user = NULL;
-  url->host = NULL;
-  url->path = NULL;
-  url->query = NULL;
-  url->fragment = NULL;
-  
+  memset(url, 0, sizeof(*url));
+
   // make sure absolute url, i.e., ':' must preceede any '/', '?', or '#'
-  scheme_end = strpbrk(str, ":/?#");
+  scheme_end = FindAny(str, str_end, ":/?#");
   if (!scheme_end || *scheme_end != ':') {
     return false;
   }
@@ -641,138 +977,83 @@ ParseURL(char* str, struct URL* url)
   scheme_end++;                            // consume ':'
 
   // do we have scheme:<path> or scheme:<host><path>
-  if (!strncmp(scheme_end, "//", 2)) {     // have host
+  if (str_end - scheme_end >= 2 && !strncmp(scheme_end, "//", 2)) {
     scheme_end += 2;                       // consume "//"
   }
+  url->scheme = (struct span){ str, scheme_end - str };
 
-  // allocate url scheme
-  url->scheme = calloc(scheme_end - str + 1, sizeof(char));
-  if (!url->scheme) {
-    return false;
-  }
-
-  // lowercase it
-  for (char *ptr = str; ptr < scheme_end; ptr++) {
-    url->scheme[ptr - str] = tolower(*ptr);
+  // the host (with any user information) runs to the path
+  host_end = FindAny(scheme_end, str_end, "/?#");
+  if (!host_end) {                         // scheme:host
+    host_end = str_end;
   }
 
-
   // get user information, anything between scheme and first '@'
-  user_end = strpbrk(scheme_end, "@/");
-  if (user_end && *user_end == '/') {    // no user info
-    user_end = NULL;
-  }
-
-  if (user_end) {                        // have user info
-    user_end++;                          // consume '@'
-
-    // allocate user
-    url->user = calloc(user_end - scheme_end + 1, sizeof(char));
-    if (!url->user) {
-      return false;
-    }
-
-    // copy user info
-    strncpy(url->user, scheme_end, user_end - scheme_end);
-  }
-
-  // get host information
-  host_end = strchr(scheme_end, '/');
-
-  if (!host_end && !user_end) {             // scheme:host
-    host_len = strlen(str) - (scheme_end - str);
-    host_beg = scheme_end;
-    host_e = &str[strlen(str)];
-  } else if (!host_end && user_end) {       // scheme:user@host
-    host_len = strlen(str) - (user_end - str);
+  user_end = FindAny(scheme_end, host_end, "@");
+  if (user_end) {                          // have user info
+    user_end++;                            // consume '@'
+    url->user = (struct span){ scheme_end, user_end - scheme_end };
     host_beg = user_end;
-    host_e = &str[strlen(str)];
-  } else if (host_end && !user_end) {       // scheme:host/path...
-    host_len = host_end - scheme_end + 1;
+  } else {
     host_beg = scheme_end;
-    host_e = host_end;
-  } else {                                 // scheme:user@host/path...
-    host_len = host_end - user_end + 1;
-    host_beg = user_end;
-    host_e = host_end;
-  }
-
-  // allocate host
-  url->host = calloc(host_len + 1 , sizeof(char));
-  if (!url->host) {
-    return false;
-  }
-
-  // lowercase it
-  for (char *ptr = host_beg; ptr < host_e; ptr++) {
-    url->host[ptr - host_beg] = tolower(*ptr);
   }
+  url->host = (struct span){ host_beg, host_end - host_beg };
 
   // get path part, between host and query and/or fragment
-  path_end = strpbrk(scheme_end, "?#");
-
-  if (path_end) {                           // .../path? or .../path#
-    url->path = calloc(path_end - host_e + 1, sizeof(char));
-    if (!url->path) {
-      return false;
-    }
-
-    strncpy(url->path, host_e, path_end - host_e);
-  } else {                                 // .../path
-    url->path = calloc(&str[strlen(str)] - host_e + 1, sizeof(char));
-    if (!url->path) {
-      return false;
-    }
-
-    strcpy(url->path, host_e);
+  path_end = FindAny(host_end, str_end, "?#");
+  if (!path_end) {                         // .../path
+    path_end = str_end;
   }
+  url->path = (struct span){ host_end, path_end - host_end };
 
   // get fragment, anything after first '#'
-  frag_beg = strchr(scheme_end, '#');
-
-  if (frag_beg) {                           // have fragment
-    url->fragment = calloc(&str[strlen(str)] - frag_beg + 1, sizeof(char));
-    if (!url->fragment) {
-      return false;
-    }
-
-    strcpy(url->fragment, frag_beg);
+  frag_beg = FindAny(path_end, str_end, "#");
+  if (frag_beg) {                          // have fragment
+    url->fragment = (struct span){ frag_beg, str_end - frag_beg };
+  } else {
+    frag_beg = str_end;
   }
 
   // get query, anything after first '?' before any '#'
-  query_beg = strchr(scheme_end, '?');
+  if (path_end < frag_beg) {               // ...?name=value
+    url->query = (struct span){ path_end, frag_beg - path_end };
+  }
 
-  if (query_beg && !frag_beg) {             // ...?name=value
-    url->query = calloc(&str[strlen(str)] - query_beg + 1, sizeof(char));
-    if (!url->query) {
-      return false;
-    }
+  return true;                                // if we got this far, good
+}
 
-    strcpy(url->query, query_beg);
-  } else if (query_beg && frag_beg && query_beg < frag_beg) { // ...?name=value#top
-    url->query = calloc(frag_beg - query_beg + 1, sizeof(char));
-    if (!url->query) {
-      return false;
+/* ****************** FindAny ***************************** */
+/* Return the first character in str, before end, that is in set;
+ * or NULL if there is none.  Like strpbrk, but bounded by end.
+ */
+static const char *
+FindAny(const char *str, const char *end, const char *set)
+{
+  for (const char *ptr = str; ptr < end; ptr++) {
+    if (*ptr != '\0' && strchr(set, *ptr) != NULL) {
+      return ptr;
     }
-
-    strncpy(url->query, query_beg, frag_beg - query_beg);
   }
+  return NULL;
+}
 
-  return true;                                // if we got this far, good
+/* ****************** PageAlloc ***************************** */
+/* Allocate a webpage_t from the pages' slab; die if out of memory.
+ */
+static webpage_t *
+PageAlloc(void)
+{
+  pthread_once(&pageSlabOnce, PagesNew);
+  return assertp(slab_alloc(pageSlab), "webpage_t");
 }
 
-/* ****************** FreeURL ***************************** */
-/* free the members of the URL struct - but not the struct itself.
+/* ****************** PagesNew ***************************** */
+/* Make the pages' slab, once.
  */
-static void 
-FreeURL(struct URL url)
+static void
+PagesNew(void)
 {
-  if (url.scheme) { free(url.scheme); }
-  if (url.user)   { free(url.user); }
-  if (url.host)   { free(url.host); }
-  if (url.path)   { free(url.path); }
-  if (url.query)  { free(url.query); }
-  if (url.fragment) { free(url.fragment); }
+  pageSlab = slab_new("webpage", sizeof(webpage_t));
 }
 
 
@@ -780,22 +1061,24 @@ FreeURL(struct URL url)
 /* ****************** PrintURL ***************************** */
 /* Print members of the URL struct - for debugging.
  */
-static void 
+static void
 PrintURL(struct URL url)
 {
   printf("URL ");
-  printf("scheme '%s'; ", url.scheme);
-  printf("user '%s'; ", url.user);
-  printf("host '%s'; ", url.host);
-  printf("path '%s'; ", url.path);
-  printf("query '%s'; ", url.query);
-  printf("fragment '%s'; ", url.fragment);
+  printf("scheme '%.*s'; ", (int)url.scheme.len, url.scheme.start);
+  printf("user '%.*s'; ", (int)url.user.len, url.user.start);
+  printf("host '%.*s'; ", (int)url.host.len, url.host.start);
+  printf("path '%.*s'; ", (int)url.path.len, url.path.start);
+  printf("query '%.*s'; ", (int)url.query.len, url.query.start);
+  printf("fragment '%.*s'; ", (int)url.fragment.len, url.fragment.start);
   printf("\n");
 }
 #endif // DEBUG
 
 /* ****************** BurstURL ********************* */
-/* Burst the URL into components (hostname, port, pathname).
+/* see webpage.h for usage documentation.
+ *
+ * Burst the URL into components (hostname, port, pathname).
  *
  * Input: URL, assumed non-NULL and already normalized.
  * 
@@ -814,7 +1097,7 @@ PrintURL(struct URL url)
  * webpage_fetch because it can't handle anything other than simple
  * http://hostname[:port][/path] forms of URL anyway.
  */
-static bool
+bool
 BurstURL(const char *url, char **hostname, int *port, char **pathname)
 {
   // make plenty of space for the resulting strings
@@ -857,54 +1140,18 @@ BurstURL(const char *url, char **hostname, int *port, char **pathname)
 }
 
 
-/* ********************* ConnectToHost ************************** */
-/* Connect to the given hostname and port, 
- * returning an open FILE* for the socket,
- * or NULL on failure.
- */
-static FILE *
-ConnectToHost(const char *hostname, const int port)
-{
-  // Look up the hostname specified on command line
-  struct hostent *hostp = gethostbyname(hostname);
-  if (hostp == NULL) {
-    return NULL;
-  }
-
-  // Initialize fields of the server address
-  struct sockaddr_in server;  // address of the server
-  server.sin_family = AF_INET;
-  bcopy(hostp->h_addr_list[0], &server.sin_addr, hostp->h_length);
-  server.sin_port = htons(port);
-
-  // Create socket (a file descriptor)
-  int comm_sock = socket(AF_INET, SOCK_STREAM, 0);
-  if (comm_sock < 0) {
-    return NULL;
-  }
-
-  // And connect that socket to that server   
-  if (connect(comm_sock, (struct sockaddr *) &server, sizeof(server)) < 0) {
-    return NULL;
-  }
-
-  // to make it easier to work with, switch to stdio
-  FILE *http_fp = fdopen(comm_sock, "r+");
-  if (http_fp == NULL) {
-    return NULL;
-  }
-
-  return http_fp;
-}
-
-
 /* ***************************************************************** */
 /*
  * RemoveDotSegments - removes . and .. segments from url paths
- * @input: the character buffer to cleanse
+ * @input: the path to cleanse
+ * @len: its length
+ * @out: buffer for the result, of at least len characters
  *
- * Returns a newly allocated character buffer with . and .. segments removed
- * according to the algorithm in RFC 3986 section 5.2.4 "Remove Dot Segments".
+ * Writes the path to out with . and .. segments removed according to
+ * the algorithm in RFC 3986 section 5.2.4 "Remove Dot Segments", and
+ * returns its length; out is not null-terminated.  The result is never
+ * longer than the input, and is written no further along than what is
+ * still to be read, so out may be input.
  * See: http://www.ietf.org/rfc/rfc1738.txt
  *
  * Should have no use outside of this file, thus declared static.
@@ -931,58 +1178,35 @@ ConnectToHost(const char *hostname, const int port)
  * be used in advertising or otherwise to promote the sale, use or other dealings
  * in this Software without prior written authorization of the copyright holder.
  */
-static char *
-RemoveDotSegments(char *input)
+static size_t
+RemoveDotSegments(const char *input, size_t len, char *out)
 {
-  size_t in_len;                           // input length
-  size_t copy_len;                         // copy length
-  char *copy;                              // copy of input that is modified
-  char *copyptr;                           // handle for free'ing copy'
-  char *out;                               // output buffer
-  char *outptr;                            // pointer to current write point
-
-  if (!input || strlen(input) < 1)
-    return NULL;
-
-  // save lengths
-  in_len = copy_len = strlen(input);
-
-  // create output buffer
-  out = outptr = calloc(in_len + 1, sizeof(char));
-  if (!out)
-    return NULL; /* out of memory */
-
-  // copy the input buffer
-  copy = copyptr = strdup(input);
-  if (!copy) {
-    free(out);
-    return NULL;
-  }
+  size_t in = 0;                           // next character to read
+  size_t outlen = 0;                       // characters written
 
   // 2.  While the input buffer is not empty, loop as follows:
-  do {
+  while (in < len) {
+    const char *copy = input + in;         // what is left of the input
+    size_t copy_len = len - in;
+
     // A. If the input buffer begins with a prefix of "../" or "./",
     //    then remove that prefix from the input buffer; otherwise,
-    if (!strncmp("./", copy, 2)) {
-      copy += 2;
-      copy_len -= 2;
+    if (copy_len >= 2 && !strncmp("./", copy, 2)) {
+      in += 2;
     }
-    else if (!strncmp("../", copy, 3)) {
-      copy += 3;
-      copy_len -= 3;
+    else if (copy_len >= 3 && !strncmp("../", copy, 3)) {
+      in += 3;
     }
 
     // B. if the input buffer begins with a prefix of "/./" or "/.",
     //    where "." is a complete path segment, then replace that
     //    prefix with "/" in the input buffer; otherwise,
-    else if (!strncmp("/./", copy, 3)) {
-      copy += 2;
-      copy_len -= 2;
+    else if (copy_len >= 3 && !strncmp("/./", copy, 3)) {
+      in += 2;
     }
-    else if (!strcmp("/.", copy)) {
-      copy[1] = '/';
-      copy++;
-      copy_len -= 1;
+    else if (copy_len == 2 && !strncmp("/.", copy, 2)) {
+      in += 2;
+      out[outlen++] = '/';                 // that "/" is all that is left
     }
 
     // C. if the input buffer begins with a prefix of "/../" or "/..",
@@ -990,36 +1214,33 @@ RemoveDotSegments(char *input)
     //    prefix with "/" in the input buffer and remove the last
     //    segment and its preceding "/" (if any) from the output
     //    buffer; otherwise,
-    else if (!strncmp("/../", copy, 4)) {
-      copy += 3;
-      copy_len -= 3;
+    else if (copy_len >= 4 && !strncmp("/../", copy, 4)) {
+      in += 3;
 
       // remove the last segment
-      while (outptr > out) {
-        outptr--;
-        if (*outptr == '/')
+      while (outlen > 0) {
+        outlen--;
+        if (out[outlen] == '/')
           break;
       }
-      *outptr = 0;
     }
-    else if (!strcmp("/..", copy)) {
-      copy[2] = '/';
-      copy += 2;
-      copy_len -= 2;
+    else if (copy_len == 3 && !strncmp("/..", copy, 3)) {
+      in += 3;
 
       // remove the last segment
-      while (outptr > out) {
-        outptr--;
-        if (*outptr == '/')
+      while (outlen > 0) {
+        outlen--;
+        if (out[outlen] == '/')
           break;
       }
-      *outptr = 0;
+      out[outlen++] = '/';                 // that "/" is all that is left
     }
 
     // D. if the input buffer consists only of "." or "..", then remove
     //    that from the input buffer; otherwise, */
-    else if (!strcmp(".", copy) || !strcmp("..", copy)) {
-      *copy = 0;
+    else if ((copy_len == 1 && *copy == '.')
+             || (copy_len == 2 && !strncmp("..", copy, 2))) {
+      in = len;
     }
 
     // E. move the first path segment in the input buffer to the end of
@@ -1028,17 +1249,12 @@ RemoveDotSegments(char *input)
     //    the next "/" character or the end of the input buffer. */
     else {
       do {
-        *outptr++ = *copy++;
-        copy_len--;
-      } while (*copy && (*copy != '/'));
-      *outptr = '\0';
+        out[outlen++] = input[in++];
+      } while (in < len && input[in] != '/');
     }
-  } while (*copy != '\0');    // keep going
-
-  // cleanup copy
-  free(copyptr);
+  }    // keep going
 
-  return out;
+  return outlen;
 }
 
 /* ***************************************************************** */
@@ -1047,88 +1263,73 @@ RemoveDotSegments(char *input)
  * @base: base url to resolve from
  * @rel: relative url to resolve
  * @len: length of the relative url
+ * @out: buffer for the absolute url
+ * @size: size of that buffer
  *
- * Returns a newly allocated character buffer that represents the
- * absolute url from the base and relative urls. Returns NULL if
- * an absolute url cannot be established.
+ * Writes the absolute url from the base and relative urls into out,
+ * and returns its length.  Returns 0 if an absolute url cannot be
+ * established, or it would not fit in size bytes with its null.
  *
  * This is a quick attempt at RFC 3986 section 5.2.
  *
  * Should have no use outside of this file, thus declared static.
  */
 
-static char *
-FixupRelativeURL(char *base, char *rel, size_t len)
+static size_t
+FixupRelativeURL(const char *base, const char *rel, size_t len,
+                 char *out, size_t size)
 {
-  char *abs_url;                           // absolute url to build
-  char *slash;                             // right-most '/' in a path
   struct URL tmp;                          // parsed url
+  size_t base_len = 0;                     // how much of the base path to keep
+  size_t abs_len;                          // length of the absolute url
 
-  // we need a base url to work with
-  if (!base) {
-    return NULL;
-  }
-
-  // allocate new absolute url
-  abs_url = calloc(strlen(base) + len + 2, sizeof(char));
-  if (!abs_url) {
-    return NULL;
-  }
-
-  // attempt to parse the base url
-  if (!ParseURL(base, &tmp)) {
-    free(abs_url);                       // cleanup the absolute url
-
-    abs_url = NULL;                      // going to return NULL
-    goto cleanup;                        // sorry Dijkstra
+  // we need a base url to work with, and to parse it
+  if (!base || !rel || !ParseURL(base, strlen(base), &tmp)) {
+    return 0;
   }
 
-  // put absolute url back together
-  if (tmp.scheme) {                         // scheme
-    strcat(abs_url, tmp.scheme);
+  // is the relative URL relative to domain root, or relative to base?
+  if (len == 0 || rel[0] != '/') {
+    // relative to base_url: keep the base path up to the right-most '/'
+    for (size_t i = tmp.path.len; i > 1; i--) {
+      if (tmp.path.start[i - 1] == '/') {
+        base_len = i - 1;
+        break;
+      }
+    }
   }
 
-  if (tmp.user) {                           // user
-    strcat(abs_url, tmp.user);
+  // will it fit?
+  abs_len = tmp.host.start + tmp.host.len - base + len;
+  if (len == 0 || rel[0] != '/') {
+    abs_len += base_len + 1;               // base path, and separating '/'
   }
-
-  if (tmp.host) {                           // host
-    strcat(abs_url, tmp.host);              // always ends in slash
+  if (abs_len >= size) {
+    return 0;
   }
 
-  // do we have a relative url?
-  if (rel) { // yes, add it to the abs_url
-    // is the relative URL relative to domain root, or relative to base?
-    if (rel[0] == '/') {
-      // relative to domain root
-      strncat(abs_url, rel, len);      // add relative url
+  // put absolute url back together: scheme, user, and host...
+  char *ptr = out;
+  for (const char *c = base; c < tmp.host.start + tmp.host.len; c++) {
+    if (c < tmp.scheme.start + tmp.scheme.len || c >= tmp.host.start) {
+      *ptr++ = tolower(*c);               // scheme and host are lowercased
     } else {
-      // relative to base_url
-      // add the base path up to the right-most '/'
-      if (tmp.path
-          && (slash = strrchr(tmp.path, '/'))
-          && (slash != tmp.path)) {
-        strncat(abs_url, tmp.path, slash - tmp.path);
-      }
-      strcat(abs_url, "/");            // separate base and relative path
-      strncat(abs_url, rel, len);      // add relative url
-    }
-  } else { // no relative url; finish the abs_url
-    // DFK: not sure this case occurs, or if it does, what action to take.
-    // add the base path up to the right-most '/'
-    if (tmp.path
-        && (slash = strrchr(tmp.path, '/'))
-        && (slash != tmp.path)) {
-      strncat(abs_url, tmp.path, slash - tmp.path);
+      *ptr++ = *c;                        // user is not
     }
   }
 
-  // we can ignore the base query and fragment, they shouldn't apply
-
- cleanup:                                     // cleanup memory
-  FreeURL(tmp);
+  // ... and the base path, if relative to it, and then the relative url
+  if (len == 0 || rel[0] != '/') {
+    memcpy(ptr, tmp.path.start, base_len);
+    ptr += base_len;
+    *ptr++ = '/';                          // separate base and relative path
+  }
+  memcpy(ptr, rel, len);                   // add relative url
+  ptr += len;
+  *ptr = '\0';
 
-  return abs_url;
+  // we can ignore the base query and fragment, they shouldn't apply
+  return ptr - out;
 }
 
 
@@ -1157,17 +1358,3 @@ RemoveWhitespace(char* str)
   } while ((*prev++ = *cur++));            // condense to front of str
 }
 
-/* **************** isBlankLine ******************/
-/* Input: line, a non-NULL pointer to a string.
- * Return true if the string is pointing to a blank line, that is, 
- * an empty string, or
- * with only newline (LF), only carriage return (CR), or only CRLF.
- */
-static inline bool
-isBlankLine(const char *line)
-{
-  return (   (line[0] == '\0')
-             || (strcmp(line, "\n") == 0) 
-             || (strcmp(line, "\r") == 0) 
-             || (strcmp(line, "\r\n") == 0));
-}
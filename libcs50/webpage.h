@@ -24,6 +24,7 @@ typedef struct webpage webpage_t;
 int   webpage_getDepth(const webpage_t *page);
 char *webpage_getURL(const webpage_t *page);
 char *webpage_getHTML(const webpage_t *page);
+size_t webpage_getHTMLLength(const webpage_t *page);   // 0 if no html
 
 /**************** webpage_new ****************/
 /* Allocate and initialize a new webpage_t structure.
@@ -40,8 +41,18 @@ char *webpage_getHTML(const webpage_t *page);
  */
 webpage_t *webpage_new(char *url, const int depth, char *html);
 
+/**************** webpage_newCopy ****************/
+/* Like webpage_new(url, depth, NULL), but for a copy of url, which the
+ * caller keeps; the copy comes from a slab (see memory.h), which is
+ * cheaper for the many short-lived pages a crawler makes for its links.
+ * 
+ * Returns NULL on any error.
+ */
+webpage_t *webpage_newCopy(const char *url, const int depth);
+
 /**************** webpage_delete ****************/
-/* Delete a webpage_t structure created by webpage_new().
+/* Delete a webpage_t structure created by webpage_new() or
+ * webpage_newCopy().
  * This function may be called from something like bag_delete().
  * This function calls free() on both the url and the html, if not NULL.
  */
@@ -76,6 +87,30 @@ void webpage_delete(void *data);
  *     True: success; caller must later free html via webpage_delete(page).
  *     False: some error fetching page.
  * 
+ * Conditional fetch:
+ *   If the page has validators (see webpage_setValidators), the request
+ *   asks for the page only if it has changed since.  If the server says
+ *   it has not (304 Not Modified), we return false and leave html NULL,
+ *   and webpage_getStatus(page) returns 304.  After a successful fetch
+ *   the page's validators are those the server sent with the html.
+ *
+ * Timeouts:
+ *   Each attempt to connect, and each wait for the server to take the
+ *   request or send more of the response, gives up after the timeouts
+ *   set by http_setTimeouts (see http.h), and the whole fetch, the
+ *   attempts to connect included (but not the pauses between them), is
+ *   cut off at its total deadline; we then return false.
+ *
+ * Limits:
+ *   A body that is not HTML, or is too long (see http_setLimits), is
+ *   refused, unread or read no further than the limit; we then return
+ *   false, and webpage_getRefused says so.
+ *
+ * Archive:
+ *   While an archive is recording (see archive.h), every fetch is
+ *   recorded; while one is replaying, the response comes from it, and
+ *   no connection is made.
+ *
  * Limitations:
  *   * can only handle http (not https or other schemes)
  *   * can only handle URLs of form http://host[:port][/pathname]
@@ -83,6 +118,83 @@ void webpage_delete(void *data);
  */
 bool webpage_fetch(webpage_t *page);
 
+/**************** webpage_setFetchDelay ****************/
+/* Set how long webpage_fetch pauses after each attempt to connect,
+ * to lighten the load on the server; connpool uses the same pause.
+ * @ms: milliseconds; 0 means don't pause.
+ *
+ * The default is one second (0 if compiled with -DNOSLEEP).  A caller
+ * that schedules its own fetches so as not to overload any one host,
+ * as the crawler does, may set it to 0.  Not meant to be changed while
+ * fetches are under way.
+ */
+void webpage_setFetchDelay(const int ms);
+
+/**************** webpage_fetchPause ****************/
+/* Pause for the delay set by webpage_setFetchDelay. */
+void webpage_fetchPause(void);
+
+/**************** webpage_setValidators ****************/
+/* Set the page's validators: the ETag and Last-Modified values the
+ * server sent with a copy of its html, either of which may be NULL
+ * (or empty) if it sent none.  Fetching the page again then asks for
+ * it only if it has changed.  The strings are copied.
+ *
+ * Returns false, leaving the page's validators as they were, if page is
+ * NULL or we run out of memory.
+ */
+bool webpage_setValidators(webpage_t *page, const char *etag, 
+                           const char *lastModified);
+const char *webpage_getETag(const webpage_t *page);
+const char *webpage_getLastModified(const webpage_t *page);
+
+/**************** webpage_setStatus ****************/
+/* Note the HTTP status of the response to the last request for this
+ * page; for those who fetch pages by means other than webpage_fetch.
+ * webpage_getStatus returns it, or 0 if the page was never fetched or
+ * no response came.
+ */
+void webpage_setStatus(webpage_t *page, const int status);
+int webpage_getStatus(const webpage_t *page);
+
+/**************** webpage_setTimes ****************/
+/* Note how long the last fetch of this page took, in microseconds:
+ * to connect, to the first byte of the response, and in all, each
+ * counted from the start of the fetch; -1 for any not known.  A page
+ * fetched on a connection opened for an earlier page has a connect
+ * time of -1.  webpage_fetch, connpool and fetchq set them after every
+ * response; pauses between attempts (webpage_setFetchDelay) are not
+ * counted.  webpage_getTimes returns them, each -1 if the page was
+ * never fetched; any pointer may be NULL.
+ */
+void webpage_setTimes(webpage_t *page, const long connect,
+                      const long firstByte, const long total);
+void webpage_getTimes(const webpage_t *page, long *connect,
+                      long *firstByte, long *total);
+
+/**************** webpage_setRefused ****************/
+/* Note that the body of the response to the last fetch of this page was
+ * refused, unread, for not being HTML or being too long (see
+ * http_setLimits), and how many of its bytes were not read, as far as
+ * known; a negative 'avoided' notes that it was not refused.
+ * webpage_fetch, connpool and fetchq set it after every response.
+ * webpage_getRefused returns whether it was refused, with *avoided (if
+ * not NULL) the bytes not read, or 0.  A refused fetch fails.
+ */
+void webpage_setRefused(webpage_t *page, const long avoided);
+bool webpage_getRefused(const webpage_t *page, long *avoided);
+
+/**************** webpage_setHTML ****************/
+/* Give the page html that was fetched by some means other than
+ * webpage_fetch (for example, by the fetchq module).
+ * @html: must point to malloc'd memory, null-terminated; may not be NULL.
+ *
+ * Returns true on success; the page now owns html, to be freed by 
+ * webpage_delete.  Returns false, and leaves html untouched, if page
+ * is NULL, html is NULL, or the page already has html.
+ */
+bool webpage_setHTML(webpage_t *page, char *html);
+
 
 /**************** webpage_getNextWord ***********************************/
 /* return the next word from html[pos]
@@ -149,6 +261,65 @@ char *webpage_getNextWord(webpage_t *page, int *pos);
 
 char *webpage_getNextURL(webpage_t *page, int *pos);
 
+/****************** webpage_nextURL ***********************************/
+/* copy the next url from html[pos] into the caller's buffer
+ * @page: pointer to the webpage info
+ * @pos: current position in html buffer; updated to first pos after the URL.
+ * @url: buffer for the URL
+ * @size: size of that buffer
+ *
+ * As webpage_getNextURL, but allocates nothing: the next URL, made
+ * absolute as by webpage_getNextURL, is written with its null into url.
+ * Returns true if there was one; false if there are no more URLs.  Any
+ * URL too long for the buffer, or that can't be made absolute, is
+ * skipped.  Together with IsInternalURL, which normalizes in place, this
+ * lets a caller scan a page's links without allocating.
+ *
+ * Usage example: (retrieve all urls in a page)
+ * int pos = 0;
+ * char url[WEBPAGE_URLSIZE];
+ *
+ * while (webpage_nextURL(page, &pos, url, sizeof(url))) {
+ *     printf("Found url: %s\n", url);
+ * }
+ */
+bool webpage_nextURL(webpage_t *page, int *pos, char *url, const size_t size);
+
+// A size of buffer for webpage_nextURL big enough for any reasonable URL
+#define WEBPAGE_URLSIZE 8192
+
+/****************** webpage_scan ***********************************/
+/* find all the links and words in the page, in one pass over its html
+ * @page: pointer to the webpage info
+ * @arg: passed to linkfunc and wordfunc
+ * @linkfunc: called with each link, or NULL if links are not wanted
+ * @wordfunc: called with each word, or NULL if words are not wanted
+ *
+ * Calls linkfunc(arg, url) for each URL webpage_getNextURL would return,
+ * in turn, with the URL in a buffer of WEBPAGE_URLSIZE bytes that
+ * linkfunc may change (say, with IsInternalURL) but not keep.  Calls
+ * wordfunc(arg, word, len) for each word webpage_getNextWord would
+ * return, in turn, with the word as a span of the page's html, not
+ * null-terminated.  Links and words come in the order they are in the
+ * html.  Nothing is allocated, and the html is not changed.
+ *
+ * The links are found as the html is, rather than with its white space
+ * removed, so in a few odd cases they differ from webpage_getNextURL's:
+ * an unquoted href ends at white space, and the <a must start a tag.
+ * See htmlscan.h.
+ *
+ * Usage example: (count the words in a page)
+ * static void count(void *arg, const char *word, const size_t len) {
+ *     (*(int *)arg)++;
+ * }
+ * int words = 0;
+ * webpage_scan(page, &words, NULL, count);
+ */
+void webpage_scan(webpage_t *page, void *arg,
+                  void (*linkfunc)(void *arg, char *url),
+                  void (*wordfunc)(void *arg, const char *word,
+                                   const size_t len));
+
 /***********************************************************************
  * NormalizeURL - attempts to normalize the url
  * @url: absolute url to normalize
@@ -156,6 +327,8 @@ char *webpage_getNextURL(webpage_t *page, int *pos);
  * Returns true on success; 
  * returns false if the url can't be parsed or normalized.
  * returns false if the url refers to a file unlikely to contain html.
+ * The url is normalized in place (it never grows), allocating nothing;
+ * if we return false it is left as it was.
  * 
  * Usage example:
  * char* url = calloc(100, sizeof(char));
@@ -181,6 +354,17 @@ bool NormalizeURL(char *url);
  */
 bool IsInternalURL(char *url);
 
+/***********************************************************************
+ * BurstURL - split a normalized URL into hostname, port, and pathname
+ * @url: URL of the form http://host[:port][/pathname]
+ *
+ * Returns true on success, in which case *hostname and *pathname point
+ * to new strings that the caller must later free, and *port is the 
+ * port (80 if none given).  Returns false if the URL can't be burst.
+ * This is the parsing webpage_fetch does before connecting.
+ */
+bool BurstURL(const char *url, char **hostname, int *port, char **pathname);
+
 // All URLs beginning with this prefix are considered "internal"
 static const
 char INTERNAL_URL_PREFIX[] = "http://old-www.cs.dartmouth.edu";
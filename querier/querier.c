@@ -246,22 +246,15 @@ void printMatches(document_t *array, int numCounters, char* pageDirectory)
   // Print ranked results
   printf("Matches %d documents (ranked):\n", numCounters);
   for (int i = 0; i < numCounters; i++) {
-    // Make filename to get URL
+    // get URL from the saved page
     int docID = array[i].docID;
-    char filename[100];
-    sprintf(filename, "%s/%d", pageDirectory, docID); 
-
-    // get URL from file 
-    FILE *fp = fopen(filename, "r");
-    char *url = freadlinep(fp); // 
-
+    char *url = page_loadURL(pageDirectory, docID);
 
     printf("Score: %3d docID: %3d | %s\n", array[i].score,
-    array[i].docID, url);
+    array[i].docID, url == NULL ? "(missing)" : url);
 
     // clean up
-    fclose(fp);
-    count_free(url);
+    free(url);
   }
 
 }
@@ -542,23 +535,8 @@ int checkFormat(char* input)
  */
 int docCount(char *pageDirectory)
 {
-  // goes into the directory and gets the number of documents
-	FILE *fp;
-
-  // get the name of the crawler files
-	char crawlerFile[100];
-	int docID = 1;
-	sprintf(crawlerFile, "%s/%d", pageDirectory, docID);
-
-  // open and check the if they exist, increaming the count
-	fp = fopen(crawlerFile, "r");
-	while (fp != NULL) {
-		fclose(fp);
-		docID++;
-		sprintf(crawlerFile, "%s/%d", pageDirectory, docID);
-		fp = fopen(crawlerFile, "r");
-	}
-	return docID - 1;
+  // count the pages saved, in whichever format
+	return pagedir_count(pageDirectory);
 
 }
 